@@ -0,0 +1,198 @@
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include "allocation.hpp"
+
+#ifndef ZO_NO_ALLOCATION_HOOKS
+
+namespace {
+    std::atomic<std::uint64_t> sAllocations {0};
+    std::atomic<std::uint64_t> sBytes {0};
+    std::atomic<std::uint64_t> sFrees {0};
+
+    // Constant initialised, so it's safe to touch from inside
+    // operator new on any thread at any time
+    thread_local AllocationStats tThreadStats {};
+
+    void countAllocation(std::size_t size) {
+        sAllocations.fetch_add(1, std::memory_order_relaxed);
+        sBytes.fetch_add(size, std::memory_order_relaxed);
+        ++tThreadStats.mAllocations;
+        tThreadStats.mBytes += size;
+    }
+
+    void countFree() {
+        sFrees.fetch_add(1, std::memory_order_relaxed);
+        ++tThreadStats.mFrees;
+    }
+
+    void* allocate(std::size_t size) {
+        void* memory { std::malloc(size? size: 1) };
+        if(memory) countAllocation(size);
+        return memory;
+    }
+
+    void* allocateAligned(std::size_t size, std::align_val_t alignment) {
+        std::size_t align { static_cast<std::size_t>(alignment) };
+        // aligned_alloc wants a whole number of alignments
+        std::size_t rounded { (std::max<std::size_t>(size, 1) + align - 1) / align * align };
+#ifdef _WIN32
+        void* memory { _aligned_malloc(rounded, align) };
+#else
+        void* memory { std::aligned_alloc(align, rounded) };
+#endif
+        if(memory) countAllocation(size);
+        return memory;
+    }
+
+    void release(void* memory) {
+        if(!memory) return;
+        countFree();
+        std::free(memory);
+    }
+
+    void releaseAligned(void* memory) {
+        if(!memory) return;
+        countFree();
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+}
+
+void* operator new(std::size_t size) {
+    void* memory { allocate(size) };
+    if(!memory) throw std::bad_alloc {};
+    return memory;
+}
+void* operator new[](std::size_t size) {
+    void* memory { allocate(size) };
+    if(!memory) throw std::bad_alloc {};
+    return memory;
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    void* memory { allocateAligned(size, alignment) };
+    if(!memory) throw std::bad_alloc {};
+    return memory;
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    void* memory { allocateAligned(size, alignment) };
+    if(!memory) throw std::bad_alloc {};
+    return memory;
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, alignment);
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* memory) noexcept { release(memory); }
+void operator delete[](void* memory) noexcept { release(memory); }
+void operator delete(void* memory, std::size_t) noexcept { release(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { release(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { release(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { release(memory); }
+
+void operator delete(void* memory, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { releaseAligned(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { releaseAligned(memory); }
+
+AllocationStats getAllocationStats() {
+    return AllocationStats {
+        .mAllocations { sAllocations.load(std::memory_order_relaxed) },
+        .mBytes { sBytes.load(std::memory_order_relaxed) },
+        .mFrees { sFrees.load(std::memory_order_relaxed) }
+    };
+}
+
+AllocationStats getThreadAllocationStats() {
+    return tThreadStats;
+}
+
+#else
+
+AllocationStats getAllocationStats() { return AllocationStats {}; }
+AllocationStats getThreadAllocationStats() { return AllocationStats {}; }
+
+#endif
+
+AllocationScope::AllocationScope(const char* name):
+    mName {name},
+    mStart { getThreadAllocationStats() }
+{}
+
+AllocationScope::~AllocationScope() {
+    if(!mName) return;
+    AllocationStats stats { getStats() };
+    if(stats.mAllocations)
+        std::cout << mName << ": " << stats.mAllocations << " allocations, " << stats.mBytes << " bytes" << std::endl;
+}
+
+FrameArena::FrameArena(std::size_t blockSize):
+    mBlockSize { std::max<std::size_t>(blockSize, alignof(std::max_align_t)) }
+{
+    addBlock(mBlockSize);
+}
+
+void* FrameArena::allocate(std::size_t size, std::size_t alignment) {
+    for(;;) {
+        Block& block { mBlocks[mBlock] };
+        std::uintptr_t base { reinterpret_cast<std::uintptr_t>(block.mData.get()) };
+        std::uintptr_t start { (base + mHead + alignment - 1) / alignment * alignment };
+        if(start + size <= base + block.mSize) {
+            mHead = start + size - base;
+            return reinterpret_cast<void*>(start);
+        }
+
+        // Move on to the next block, adding one big enough if there
+        // isn't one
+        if(mBlock + 1 == mBlocks.size()) addBlock(size + alignment);
+        ++mBlock;
+        mHead = 0;
+    }
+}
+
+void FrameArena::reset() {
+    mPeak = std::max(mPeak, getUsed());
+    if(mBlocks.size() > 1) {
+        // This frame overflowed; next time it all fits in one block
+        std::size_t capacity { getCapacity() };
+        mBlocks.clear();
+        addBlock(capacity);
+    }
+    mBlock = 0;
+    mHead = 0;
+}
+
+std::size_t FrameArena::getUsed() const {
+    std::size_t used {mHead};
+    for(std::size_t i {0}; i < mBlock; ++i) used += mBlocks[i].mSize;
+    return used;
+}
+
+std::size_t FrameArena::getCapacity() const {
+    std::size_t capacity {0};
+    for(const Block& block: mBlocks) capacity += block.mSize;
+    return capacity;
+}
+
+void FrameArena::addBlock(std::size_t minSize) {
+    std::size_t size { std::max(mBlockSize, minSize) };
+    mBlocks.push_back(Block {
+        .mData { std::make_unique_for_overwrite<std::byte[]>(size) },
+        .mSize { size }
+    });
+}
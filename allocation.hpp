@@ -0,0 +1,193 @@
+#ifndef ZOALLOCATION_H
+#define ZOALLOCATION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+/*
+Heap allocation counting. The global operator new and delete are
+replaced (in allocation.cpp) with ones that count every allocation
+and the bytes asked for, both process-wide and per thread, so that a
+frame, or any stretch of code, can be checked for allocating at all.
+The steady-state frame is meant not to: per-frame scratch memory comes
+from the frame arena below, and anything else is kept between frames.
+
+Build with ZO_NO_ALLOCATION_HOOKS to leave the standard operators in
+place; everything then reads zero
+*/
+struct AllocationStats {
+    std::uint64_t mAllocations {0};
+    std::uint64_t mBytes {0};
+    std::uint64_t mFrees {0};
+};
+
+inline AllocationStats operator-(const AllocationStats& a, const AllocationStats& b) {
+    return AllocationStats {
+        .mAllocations { a.mAllocations - b.mAllocations },
+        .mBytes { a.mBytes - b.mBytes },
+        .mFrees { a.mFrees - b.mFrees }
+    };
+}
+
+// Totals since startup, over every thread
+AllocationStats getAllocationStats();
+// Totals since startup, for the calling thread
+AllocationStats getThreadAllocationStats();
+
+// Counts what the calling thread allocates while it's alive. Given a
+// name, it prints what it counted when it ends, if anything
+class AllocationScope {
+public:
+    explicit AllocationScope(const char* name=nullptr);
+    ~AllocationScope();
+
+    AllocationScope(const AllocationScope& other) = delete;
+    AllocationScope& operator=(const AllocationScope& other) = delete;
+
+    AllocationStats getStats() const { return getThreadAllocationStats() - mStart; }
+
+private:
+    const char* mName;
+    AllocationStats mStart;
+};
+
+/*
+Bump allocator for memory that only has to last until the end of the
+frame. Allocating is a pointer increment, nothing is freed on its own,
+and reset() hands everything back at once.
+
+If a frame needs more than a block holds, more blocks are added; the
+next reset() merges them into one block big enough for the whole
+frame, so after a few frames it stops touching the heap entirely.
+Only for trivially destructible types, since nothing is destroyed,
+and only for one thread at a time
+*/
+class FrameArena {
+public:
+    explicit FrameArena(std::size_t blockSize=1 << 20);
+
+    FrameArena(const FrameArena& other) = delete;
+    FrameArena& operator=(const FrameArena& other) = delete;
+
+    void* allocate(std::size_t size, std::size_t alignment=alignof(std::max_align_t));
+
+    // Uninitialised room for count Ts
+    template<typename T>
+    T* allocate(std::size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena memory is never destroyed");
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // Forget everything allocated since the last reset
+    void reset();
+
+    std::size_t getUsed() const;
+    // Most used in any one frame so far
+    std::size_t getPeak() const { return mPeak; }
+    std::size_t getCapacity() const;
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> mData;
+        std::size_t mSize;
+    };
+
+    void addBlock(std::size_t minSize);
+
+    std::size_t mBlockSize;
+    std::vector<Block> mBlocks;
+    std::size_t mBlock {0}; // block being allocated from
+    std::size_t mHead {0};  // next free byte in it
+    std::size_t mPeak {0};
+};
+
+// Standard allocator over a frame arena, for containers that are
+// built and thrown away within a frame
+template<typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(FrameArena& arena): mArena {&arena} {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other): mArena {other.mArena} {}
+
+    T* allocate(std::size_t count) { return mArena->allocate<T>(count); }
+    void deallocate(T*, std::size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return mArena == other.mArena; }
+
+private:
+    FrameArena* mArena;
+
+    template<typename U> friend class ArenaAllocator;
+};
+
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+/*
+Fixed-size slots for one type of object, carved out of blocks of
+blockCapacity at a time. Freed slots go on a free list and are handed
+out again before any new block is allocated, so objects that come and
+go keep reusing the same memory. Objects still alive when the pool
+goes are not destroyed
+*/
+template<typename T>
+class ObjectPool {
+public:
+    explicit ObjectPool(std::size_t blockCapacity=64): mBlockCapacity {blockCapacity? blockCapacity: 1} {}
+
+    ObjectPool(const ObjectPool& other) = delete;
+    ObjectPool& operator=(const ObjectPool& other) = delete;
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        if(!mFree) addBlock();
+        Slot* slot { mFree };
+        mFree = slot->mNext;
+        T* object { new (slot->mStorage) T(std::forward<Args>(args)...) };
+        ++mLive;
+        return object;
+    }
+
+    void destroy(T* object) {
+        if(!object) return;
+        object->~T();
+        Slot* slot { reinterpret_cast<Slot*>(object) };
+        slot->mNext = mFree;
+        mFree = slot;
+        --mLive;
+    }
+
+    std::size_t getLiveCount() const { return mLive; }
+    std::size_t getCapacity() const { return mBlocks.size() * mBlockCapacity; }
+
+private:
+    union Slot {
+        Slot* mNext;
+        alignas(T) std::byte mStorage[sizeof(T)];
+    };
+
+    void addBlock() {
+        mBlocks.push_back(std::make_unique<Slot[]>(mBlockCapacity));
+        Slot* block { mBlocks.back().get() };
+        for(std::size_t i {mBlockCapacity}; i-- > 0;) {
+            block[i].mNext = mFree;
+            mFree = &block[i];
+        }
+    }
+
+    std::size_t mBlockCapacity;
+    std::vector<std::unique_ptr<Slot[]>> mBlocks;
+    Slot* mFree {nullptr};
+    std::size_t mLive {0};
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "jobsystem.hpp"
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "animation.hpp"
+
+namespace {
+    // Texels to a bone: the top three rows of its matrix
+    constexpr GLint TEXELS_PER_BONE {3};
+    // Room for a few hundred characters' bones a frame before the
+    // palette has to grow
+    constexpr GLsizeiptr PALETTE_REGION_SIZE {1 << 20};
+}
+
+AnimationSystem::AnimationSystem():
+    mPalette {GL_TEXTURE_BUFFER, PALETTE_REGION_SIZE}
+{}
+
+CharacterHandle AnimationSystem::addCharacter(ModelHandle model, const glm::mat4& transform) {
+    return mCharacters.add(Character { .mModel {model}, .mTransform {transform} });
+}
+
+void AnimationSystem::removeCharacter(CharacterHandle character) {
+    // Its draws stop with the next update()
+    if(Character* removed { mCharacters.get(character) }) {
+        std::size_t posed { static_cast<std::size_t>(std::find(mPosed.begin(), mPosed.end(), removed) - mPosed.begin()) };
+        if(posed < mPosed.size()) {
+            mPosed.erase(mPosed.begin() + posed);
+            mSkeletons.erase(mSkeletons.begin() + posed);
+        }
+        mCharacters.remove(character);
+    }
+}
+
+void AnimationSystem::setTransform(CharacterHandle character, const glm::mat4& transform) {
+    if(Character* found { mCharacters.get(character) }) found->mTransform = transform;
+}
+
+void AnimationSystem::play(CharacterHandle character, int clip, float fadeSeconds, float speed, bool loop) {
+    Character* found { mCharacters.get(character) };
+    if(!found) return;
+
+    found->mPrevious = found->mCurrent;
+    found->mCurrent = Layer { .mClip {clip}, .mTime {0.f}, .mSpeed {speed}, .mLoop {loop} };
+    found->mFadeSeconds = fadeSeconds;
+    found->mFade = fadeSeconds > 0.f? 0.f: 1.f;
+}
+
+void AnimationSystem::advance(Layer& layer, const Skeleton& skeleton, float deltaSeconds) {
+    if(layer.mClip < 0 || static_cast<std::size_t>(layer.mClip) >= skeleton.mClips.size()) return;
+    float duration { skeleton.mClips[layer.mClip].getDuration() };
+    layer.mTime += deltaSeconds * layer.mSpeed;
+    layer.mTime = layer.mLoop? layer.mTime - duration * std::floor(layer.mTime / duration): std::clamp(layer.mTime, 0.f, duration);
+}
+
+void AnimationSystem::sample(const Layer& layer, const Skeleton& skeleton, std::vector<JointPose>& pose) {
+    // Joints a clip leaves alone stay at rest
+    skeleton.getRestPose(pose);
+    if(layer.mClip < 0 || static_cast<std::size_t>(layer.mClip) >= skeleton.mClips.size()) return;
+    skeleton.mClips[layer.mClip].sample(layer.mTime, pose);
+}
+
+void AnimationSystem::pose(Character& character, const Skeleton& skeleton, float deltaSeconds, glm::vec4* palette) const {
+    advance(character.mCurrent, skeleton, deltaSeconds);
+    sample(character.mCurrent, skeleton, character.mPose);
+
+    if(character.mFade < 1.f) {
+        character.mFade = std::min(1.f, character.mFade + deltaSeconds / character.mFadeSeconds);
+        advance(character.mPrevious, skeleton, deltaSeconds);
+        sample(character.mPrevious, skeleton, character.mBlendPose);
+        for(std::size_t i {0}; i < character.mPose.size(); ++i)
+            character.mPose[i] = blend(character.mBlendPose[i], character.mPose[i], character.mFade);
+    }
+
+    skeleton.getGlobalPose(character.mPose, character.mGlobalPose);
+    for(const Bone& bone: skeleton.mBones) {
+        glm::mat4 matrix { character.mGlobalPose[bone.mJoint] * bone.mInverseBind };
+        for(int row {0}; row < TEXELS_PER_BONE; ++row)
+            *palette++ = glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]);
+    }
+}
+
+void AnimationSystem::update(float deltaSeconds, const ModelCache& models, JobSystem& jobs) {
+    PROFILE_ZONE("AnimationSystem::update");
+    // Last frame's draws have all been issued by now
+    mPalette.endFrame();
+    mPalette.beginFrame();
+
+    // Where each character's bones go. Those whose models aren't in
+    // yet, or have no bones, get none and are drawn unposed
+    mPosed.clear();
+    mSkeletons.clear();
+    GLint nTexels {0};
+    mCharacters.forEach([&](CharacterHandle, Character& character) {
+        const Model* model { models.getModel(character.mModel) };
+        const Skeleton* skeleton { model && !model->getSkeleton().empty()? &model->getSkeleton(): nullptr };
+        character.mFirstTexel = nTexels;
+        character.mBoneCount = skeleton? static_cast<GLint>(skeleton->mBones.size()): 0;
+        nTexels += character.mBoneCount * TEXELS_PER_BONE;
+        mPosed.push_back(&character);
+        mSkeletons.push_back(skeleton);
+    });
+    mBoneCount = nTexels / TEXELS_PER_BONE;
+
+    // Left bound for every pass after, whatever shader it draws with
+    glActiveTexture(GL_TEXTURE0 + BONE_PALETTE_UNIT);
+    counted::bindTexture(GL_TEXTURE_BUFFER, mPalette.getTextureID());
+    glActiveTexture(GL_TEXTURE0);
+    if(nTexels == 0) return;
+
+    GLintptr offset {0};
+    glm::vec4* palette { static_cast<glm::vec4*>(mPalette.map(nTexels * sizeof(glm::vec4), sizeof(glm::vec4), offset)) };
+    if(!palette) {
+        for(Character* character: mPosed) character->mBoneCount = 0;
+        return;
+    }
+    GLint baseTexel { static_cast<GLint>(offset / static_cast<GLintptr>(sizeof(glm::vec4))) };
+
+    jobs.parallelFor(mPosed.size(), 4, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            if(!mSkeletons[i]) continue;
+            Character& character { *mPosed[i] };
+            pose(character, *mSkeletons[i], deltaSeconds, palette + character.mFirstTexel);
+            character.mFirstTexel += baseTexel;
+        }
+    });
+    mPalette.unmap();
+}
+
+void AnimationSystem::record(CommandQueue& commands, const ModelCache& models) const {
+    commands.record(mPosed.size(), [&](CommandBuffer& buffer, std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            const Character& character { *mPosed[i] };
+            models.record(character.mModel, buffer, character.mTransform, character.mFirstTexel, character.mBoneCount);
+        }
+    });
+}
+
+void AnimationSystem::bind(const Shader& shader) const {
+    shader.setInt("bonePalette", BONE_PALETTE_UNIT);
+}
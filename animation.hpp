@@ -0,0 +1,109 @@
+#ifndef ZOANIMATION_H
+#define ZOANIMATION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "handle.hpp"
+#include "shader.hpp"
+#include "skeleton.hpp"
+#include "streambuffer.hpp"
+#include "modelcache.hpp"
+#include "commandbuffer.hpp"
+
+class JobSystem;
+
+struct CharacterTag;
+using CharacterHandle = Handle<CharacterTag>;
+
+// Texture unit the bone palette is bound to
+const GLint BONE_PALETTE_UNIT {11};
+
+/*
+Skinned characters: copies of skinned models, each playing clips from
+its model's skeleton. Every frame each character's clips are sampled,
+crossfaded if it's between two, and its bones' matrices (bone from
+model space, as 3 rows of a 3x4 matrix) written straight into that
+frame's part of the bone palette, a texture buffer of RGBA32F texels,
+one character to a job.
+
+Characters are drawn with shaders built with SKINNING defined, which
+read their bones from the palette by the offset and count in their
+draw data. The palette has its own stream buffer so that nothing
+else in the frame can grow it out from under the draws reading it
+*/
+class AnimationSystem {
+public:
+    AnimationSystem();
+
+    AnimationSystem(const AnimationSystem& other) = delete;
+    AnimationSystem& operator=(const AnimationSystem& other) = delete;
+
+    // A copy of model placed by transform, holding its rest pose
+    // until it's told to play something
+    CharacterHandle addCharacter(ModelHandle model, const glm::mat4& transform);
+    void removeCharacter(CharacterHandle character);
+    void setTransform(CharacterHandle character, const glm::mat4& transform);
+
+    // Crossfade from whatever character is playing to clip (an index
+    // into its model's skeleton's clips) over fadeSeconds. Clips the
+    // model doesn't have play as the rest pose
+    void play(CharacterHandle character, int clip, float fadeSeconds=.2f, float speed=1.f, bool loop=true);
+
+    // Move every character on by deltaSeconds and write this frame's
+    // bone palette, leaving it bound to BONE_PALETTE_UNIT. On the GL
+    // thread, once a frame, before recording
+    void update(float deltaSeconds, const ModelCache& models, JobSystem& jobs);
+
+    // Record every character's draws, posed as of the last update()
+    void record(CommandQueue& commands, const ModelCache& models) const;
+
+    // Point shader, which must be in use, at the palette
+    void bind(const Shader& shader) const;
+
+    std::size_t getCharacterCount() const { return mCharacters.size(); }
+    // Bones posed by the last update()
+    std::size_t getBoneCount() const { return mBoneCount; }
+
+private:
+    struct Layer {
+        int mClip {-1};
+        float mTime {0.f};
+        float mSpeed {1.f};
+        bool mLoop {true};
+    };
+
+    struct Character {
+        ModelHandle mModel;
+        glm::mat4 mTransform;
+        Layer mCurrent;
+        Layer mPrevious;   // faded out of, if mFade < 1
+        float mFade {1.f}; // of mCurrent in
+        float mFadeSeconds {0.f};
+        GLint mFirstTexel {0};
+        GLint mBoneCount {0}; // 0 while the model isn't loaded
+        // Kept between frames for their storage
+        std::vector<JointPose> mPose;
+        std::vector<JointPose> mBlendPose;
+        std::vector<glm::mat4> mGlobalPose;
+    };
+
+    static void advance(Layer& layer, const Skeleton& skeleton, float deltaSeconds);
+    static void sample(const Layer& layer, const Skeleton& skeleton, std::vector<JointPose>& pose);
+    void pose(Character& character, const Skeleton& skeleton, float deltaSeconds, glm::vec4* palette) const;
+
+    HandlePool<Character, CharacterTag> mCharacters;
+    // Every character as of the last update(), with its skeleton if
+    // it has one to pose
+    std::vector<Character*> mPosed;
+    std::vector<const Skeleton*> mSkeletons;
+    std::size_t mBoneCount {0};
+
+    StreamBuffer mPalette;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include <string>
+#include <memory>
+#include <fstream>
+#include <iterator>
+
+#include "shared_globals.hpp"
+#include "profiler.hpp"
+#include "assetfilesystem.hpp"
+
+bool AssetFileSystem::mount(const std::string& packPath) {
+    std::unique_ptr<AssetPack> pack { std::make_unique<AssetPack>() };
+    if(!pack->open(packPath)) return false;
+    mPacks.push_back(std::move(pack));
+    return true;
+}
+
+bool AssetFileSystem::exists(const std::string& path) const {
+    std::string normalized { normalizeAssetPath(path) };
+    for(auto pack { mPacks.rbegin() }; pack != mPacks.rend(); ++pack) {
+        if((*pack)->contains(normalized)) return true;
+    }
+    return std::ifstream {path}.good();
+}
+
+bool AssetFileSystem::read(const std::string& path, AssetData& data) const {
+    std::string normalized { normalizeAssetPath(path) };
+    for(auto pack { mPacks.rbegin() }; pack != mPacks.rend(); ++pack) {
+        if((*pack)->read(normalized, data)) return true;
+    }
+
+    PROFILE_ZONE("AssetFileSystem::readFile");
+    std::ifstream file {path, std::ios::binary | std::ios::ate};
+    if(!file) return false;
+    std::streamsize size { file.tellg() };
+    if(size < 0) return false;
+    file.seekg(0);
+    return static_cast<bool>(
+        file.read(reinterpret_cast<char*>(data.setOwned(static_cast<std::size_t>(size))), size)
+    );
+}
+
+bool readAsset(const std::string& path, AssetData& data) {
+    if(gAssets) return gAssets->read(path, data);
+    return AssetFileSystem {}.read(path, data);
+}
+
+bool assetExists(const std::string& path) {
+    if(gAssets) return gAssets->exists(path);
+    return AssetFileSystem {}.exists(path);
+}
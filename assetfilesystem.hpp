@@ -0,0 +1,36 @@
+#ifndef ZOASSETFILESYSTEM_H
+#define ZOASSETFILESYSTEM_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "assetpack.hpp"
+
+/*
+Where assets are read from. Packs are mapped into memory and mounted
+at startup; after that an asset is looked up in the mounted packs,
+newest first, by the same relative path it has on disk
+("shaders/vertex.vs"), and read from disk only if no pack has it.
+Assets from a pack usually come back as a view straight into the
+mapping, with no copy
+*/
+class AssetFileSystem {
+public:
+    // False, having said why, if the pack couldn't be opened. Mount
+    // everything before any other thread starts reading
+    bool mount(const std::string& packPath);
+
+    bool exists(const std::string& path) const;
+    bool read(const std::string& path, AssetData& data) const;
+
+private:
+    std::vector<std::unique_ptr<AssetPack>> mPacks;
+};
+
+// Read the asset at path through gAssets, or straight from disk if
+// there's no file system set up. Safe on any thread
+bool readAsset(const std::string& path, AssetData& data);
+bool assetExists(const std::string& path);
+
+#endif
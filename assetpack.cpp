@@ -0,0 +1,245 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef ZO_PACK_LZ4
+#include <lz4.h>
+#endif
+#ifdef ZO_PACK_ZSTD
+#include <zstd.h>
+#endif
+
+#include "assetpack.hpp"
+
+using namespace AssetPackFormat;
+
+std::string normalizeAssetPath(const std::string& path) {
+    std::vector<std::string> parts {};
+    std::size_t start {0};
+    while(start <= path.size()) {
+        std::size_t end { path.find_first_of("/\\", start) };
+        if(end == std::string::npos) end = path.size();
+        std::string part { path.substr(start, end - start) };
+        if(part == "..") {
+            if(!parts.empty() && parts.back() != "..") parts.pop_back();
+            else parts.push_back(part);
+        } else if(!part.empty() && part != ".") parts.push_back(part);
+        start = end + 1;
+    }
+
+    std::string normalized {};
+    for(const std::string& part: parts) {
+        if(!normalized.empty()) normalized += '/';
+        normalized += part;
+    }
+    return normalized;
+}
+
+std::uint64_t hashAssetPath(const std::string& normalizedPath) {
+    // 64-bit FNV-1a
+    std::uint64_t hash {14695981039346656037ull};
+    for(char c: normalizedPath) {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool compressAsset(Compression compression, const std::uint8_t* data, std::size_t size, std::vector<std::uint8_t>& compressed) {
+    std::size_t compressedSize {0};
+    switch(compression) {
+#ifdef ZO_PACK_LZ4
+        case lz4: {
+            if(size > static_cast<std::size_t>(LZ4_MAX_INPUT_SIZE)) return false;
+            compressed.resize(LZ4_compressBound(static_cast<int>(size)));
+            int result {
+                LZ4_compress_default(
+                    reinterpret_cast<const char*>(data), reinterpret_cast<char*>(compressed.data()),
+                    static_cast<int>(size), static_cast<int>(compressed.size())
+                )
+            };
+            if(result <= 0) return false;
+            compressedSize = static_cast<std::size_t>(result);
+        } break;
+#endif
+#ifdef ZO_PACK_ZSTD
+        case zstd: {
+            compressed.resize(ZSTD_compressBound(size));
+            std::size_t result { ZSTD_compress(compressed.data(), compressed.size(), data, size, 19) };
+            if(ZSTD_isError(result)) return false;
+            compressedSize = result;
+        } break;
+#endif
+        default:
+            return false;
+    }
+    // Not worth decompressing for less than an eighth off (images
+    // mostly come compressed already)
+    if(compressedSize > size - size / 8) return false;
+    compressed.resize(compressedSize);
+    return true;
+}
+
+static bool decompressAsset(const Entry& entry, const std::uint8_t* bytes, std::uint8_t* data) {
+    switch(entry.mCompression) {
+#ifdef ZO_PACK_LZ4
+        case lz4:
+            return LZ4_decompress_safe(
+                reinterpret_cast<const char*>(bytes), reinterpret_cast<char*>(data),
+                static_cast<int>(entry.mStoredSize), static_cast<int>(entry.mSize)
+            ) == static_cast<int>(entry.mSize);
+#endif
+#ifdef ZO_PACK_ZSTD
+        case zstd:
+            return ZSTD_decompress(data, entry.mSize, bytes, entry.mStoredSize) == entry.mSize;
+#endif
+        default:
+            std::cout << "ERROR::ASSETPACK::UNSUPPORTED_COMPRESSION " << entry.mCompression << std::endl;
+            return false;
+    }
+}
+
+void AssetData::setView(const std::uint8_t* data, std::size_t size) {
+    mOwned.clear();
+    mData = data;
+    mSize = size;
+}
+
+std::uint8_t* AssetData::setOwned(std::size_t size) {
+    mOwned.resize(size);
+    mData = mOwned.data();
+    mSize = size;
+    return mOwned.data();
+}
+
+AssetPack::~AssetPack() {
+    close();
+}
+
+bool AssetPack::open(const std::string& path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file { CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+    if(file == INVALID_HANDLE_VALUE) {
+        std::cout << "ERROR::ASSETPACK::OPEN_FAILED " << path << std::endl;
+        return false;
+    }
+    mFile = file;
+    LARGE_INTEGER fileSize {};
+    GetFileSizeEx(file, &fileSize);
+    mFileSize = static_cast<std::size_t>(fileSize.QuadPart);
+    if(mFileSize >= sizeof(Header)) {
+        mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mMapping) mBase = static_cast<const std::uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    int file { ::open(path.c_str(), O_RDONLY) };
+    if(file < 0) {
+        std::cout << "ERROR::ASSETPACK::OPEN_FAILED " << path << std::endl;
+        return false;
+    }
+    struct stat status {};
+    if(fstat(file, &status) == 0) mFileSize = static_cast<std::size_t>(status.st_size);
+    if(mFileSize >= sizeof(Header)) {
+        void* mapped { mmap(nullptr, mFileSize, PROT_READ, MAP_PRIVATE, file, 0) };
+        if(mapped != MAP_FAILED) mBase = static_cast<const std::uint8_t*>(mapped);
+    }
+    // The mapping keeps the file open
+    ::close(file);
+#endif
+    if(!mBase) {
+        std::cout << "ERROR::ASSETPACK::MAP_FAILED " << path << std::endl;
+        close();
+        return false;
+    }
+
+    // Check everything the index points at is inside the file, so
+    // lookups needn't
+    Header header {};
+    std::memcpy(&header, mBase, sizeof(header));
+    bool valid {
+        std::memcmp(header.mMagic, MAGIC, sizeof(MAGIC)) == 0
+        && header.mVersion == VERSION
+        && header.mIndexOffset % alignof(Entry) == 0
+        && header.mIndexOffset <= mFileSize
+        && header.mEntryCount <= (mFileSize - header.mIndexOffset) / sizeof(Entry)
+        && header.mNamesOffset <= mFileSize
+    };
+    if(valid) {
+        mEntries = reinterpret_cast<const Entry*>(mBase + header.mIndexOffset);
+        mEntryCount = header.mEntryCount;
+        mNames = reinterpret_cast<const char*>(mBase + header.mNamesOffset);
+        std::size_t namesSize { mFileSize - header.mNamesOffset };
+        for(std::size_t i {0}; valid && i < mEntryCount; ++i) {
+            const Entry& entry { mEntries[i] };
+            valid = entry.mOffset <= mFileSize && entry.mStoredSize <= mFileSize - entry.mOffset
+                && entry.mNameOffset <= namesSize && entry.mNameLength <= namesSize - entry.mNameOffset
+                && (i == 0 || mEntries[i - 1].mHash <= entry.mHash);
+        }
+    }
+    if(!valid) {
+        std::cout << "ERROR::ASSETPACK::INVALID_PACK " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void AssetPack::close() {
+#ifdef _WIN32
+    if(mBase) UnmapViewOfFile(mBase);
+    if(mMapping) CloseHandle(mMapping);
+    if(mFile) CloseHandle(mFile);
+    mMapping = nullptr;
+    mFile = nullptr;
+#else
+    if(mBase) munmap(const_cast<std::uint8_t*>(mBase), mFileSize);
+#endif
+    mBase = nullptr;
+    mFileSize = 0;
+    mEntries = nullptr;
+    mEntryCount = 0;
+    mNames = nullptr;
+}
+
+const Entry* AssetPack::find(const std::string& normalizedPath) const {
+    // Paths sharing a hash sit together; tell them apart by name
+    std::uint64_t hash { hashAssetPath(normalizedPath) };
+    const Entry* end { mEntries + mEntryCount };
+    const Entry* entry {
+        std::lower_bound(mEntries, end, hash, [](const Entry& entry, std::uint64_t hash) { return entry.mHash < hash; })
+    };
+    for(; entry != end && entry->mHash == hash; ++entry) {
+        if(
+            entry->mNameLength == normalizedPath.size()
+            && std::memcmp(mNames + entry->mNameOffset, normalizedPath.data(), normalizedPath.size()) == 0
+        ) return entry;
+    }
+    return nullptr;
+}
+
+bool AssetPack::read(const std::string& normalizedPath, AssetData& data) const {
+    const Entry* entry { find(normalizedPath) };
+    if(!entry) return false;
+
+    const std::uint8_t* bytes { mBase + entry->mOffset };
+    if(entry->mCompression == AssetPackFormat::stored) {
+        data.setView(bytes, static_cast<std::size_t>(entry->mStoredSize));
+        return true;
+    }
+    return decompressAsset(*entry, bytes, data.setOwned(static_cast<std::size_t>(entry->mSize)));
+}
@@ -0,0 +1,115 @@
+#ifndef ZOASSETPACK_H
+#define ZOASSETPACK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+Assets packed into one file, so loading doesn't pay for an open, stat
+and read per small file. A pack is a header, each asset's bytes
+(aligned, so they can be used straight from the mapping), an index
+sorted by the hash of each asset's path, and the paths themselves.
+Assets can be stored LZ4 or Zstd compressed, when the build has those
+libraries (ZO_PACK_LZ4, ZO_PACK_ZSTD); compressed ones are the only
+ones copied when read.
+
+Packs are built with tools/packassets.cpp (make pack) and read at
+run time through AssetFileSystem (see assetfilesystem.hpp)
+*/
+
+namespace AssetPackFormat {
+    constexpr char MAGIC[4] {'Z', 'O', 'P', 'K'};
+    constexpr std::uint32_t VERSION {1};
+
+    enum Compression : std::uint32_t {
+        stored=0,
+        lz4=1,
+        zstd=2
+    };
+
+    // Everything is little endian, at the offsets these lay out
+    struct Header {
+        char mMagic[4];
+        std::uint32_t mVersion;
+        std::uint32_t mEntryCount;
+        std::uint32_t mAlignment;   // of every asset's offset
+        std::uint64_t mIndexOffset; // mEntryCount Entries, by mHash
+        std::uint64_t mNamesOffset; // the paths, back to back
+    };
+
+    struct Entry {
+        std::uint64_t mHash;
+        std::uint64_t mOffset;
+        std::uint64_t mStoredSize;
+        std::uint64_t mSize;        // once decompressed
+        std::uint32_t mNameOffset;  // from mNamesOffset
+        std::uint32_t mNameLength;
+        std::uint32_t mCompression;
+        std::uint32_t mPadding;
+    };
+
+    static_assert(sizeof(Header) == 32 && sizeof(Entry) == 48);
+}
+
+// Paths as stored in packs: forward slashes, no "." or empty parts,
+// and ".." folded into its parent, so "media/../shaders\\x.vs" and
+// "shaders/x.vs" are the same asset
+std::string normalizeAssetPath(const std::string& path);
+std::uint64_t hashAssetPath(const std::string& normalizedPath);
+
+// Compress data with compression, if the build supports it. False
+// if it doesn't, or the result wouldn't be any smaller
+bool compressAsset(AssetPackFormat::Compression compression, const std::uint8_t* data, std::size_t size, std::vector<std::uint8_t>& compressed);
+
+// An asset's bytes: either a view into a mapped pack, good for as
+// long as the pack stays mounted, or a copy owned by this
+class AssetData {
+public:
+    const std::uint8_t* data() const { return mData; }
+    std::size_t size() const { return mSize; }
+
+    void setView(const std::uint8_t* data, std::size_t size);
+    std::uint8_t* setOwned(std::size_t size);
+
+private:
+    const std::uint8_t* mData {nullptr};
+    std::size_t mSize {0};
+    std::vector<std::uint8_t> mOwned;
+};
+
+// One pack file, memory mapped
+class AssetPack {
+public:
+    AssetPack() = default;
+    ~AssetPack();
+
+    AssetPack(const AssetPack& other) = delete;
+    AssetPack& operator=(const AssetPack& other) = delete;
+
+    // False, having said why, if path isn't a pack this can read
+    bool open(const std::string& path);
+    void close();
+
+    bool contains(const std::string& normalizedPath) const { return find(normalizedPath) != nullptr; }
+    // False if the pack hasn't got it, or it couldn't be decompressed
+    bool read(const std::string& normalizedPath, AssetData& data) const;
+
+    std::size_t size() const { return mEntryCount; }
+
+private:
+    const AssetPackFormat::Entry* find(const std::string& normalizedPath) const;
+
+    const std::uint8_t* mBase {nullptr};
+    std::size_t mFileSize {0};
+    const AssetPackFormat::Entry* mEntries {nullptr};
+    std::size_t mEntryCount {0};
+    const char* mNames {nullptr};
+#ifdef _WIN32
+    void* mFile {nullptr};
+    void* mMapping {nullptr};
+#endif
+};
+
+#endif
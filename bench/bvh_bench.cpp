@@ -0,0 +1,157 @@
+// Benchmark for mesh BVHs on a generated million triangle mesh: a
+// sphere with bumps pushed out of it. Times the build on one thread
+// and on the job system, then picking rays cast from all around it
+// and short segments like a camera's steps, checking a sample of
+// each against testing every triangle
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "../jobsystem.hpp"
+#include "../meshbvh.hpp"
+
+const int SPHERE_SEGMENTS {1024}; // around; half as many rings, 2 triangles each
+const int RAYS {100000};
+const int SEGMENTS {100000};
+const float SEGMENT_LENGTH {.05f};
+const int CHECKED {500};          // of each, against brute force
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void makeBumpySphere(std::vector<glm::vec3>& positions, std::vector<GLuint>& indices) {
+    const float pi {3.14159265f};
+    int rings {SPHERE_SEGMENTS / 2};
+    for(int ring {0}; ring <= rings; ++ring) {
+        float polar {pi * ring / rings};
+        for(int segment {0}; segment <= SPHERE_SEGMENTS; ++segment) {
+            float azimuth {2.f * pi * segment / SPHERE_SEGMENTS};
+            glm::vec3 direction {std::sin(polar) * std::cos(azimuth), std::cos(polar), std::sin(polar) * std::sin(azimuth)};
+            float bumps {1.f + .05f * std::sin(17.f * azimuth) * std::sin(11.f * polar) + .02f * std::sin(91.f * polar)};
+            positions.push_back(direction * bumps);
+        }
+    }
+    GLuint stride {static_cast<GLuint>(SPHERE_SEGMENTS + 1)};
+    for(GLuint ring {0}; ring < static_cast<GLuint>(rings); ++ring) {
+        for(GLuint segment {0}; segment < static_cast<GLuint>(SPHERE_SEGMENTS); ++segment) {
+            GLuint a {ring * stride + segment}, b {a + 1}, c {a + stride}, d {c + 1};
+            indices.insert(indices.end(), {a, c, b, b, c, d});
+        }
+    }
+}
+
+// The nearest hit, the slow way
+bool bruteForce(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, const Ray& ray, float& distance) {
+    distance = ray.mMaxDistance;
+    bool found {false};
+    for(std::size_t i {0}; i + 2 < indices.size(); i += 3) {
+        glm::vec3 a {positions[indices[i]]};
+        glm::vec3 edge1 {positions[indices[i + 1]] - a}, edge2 {positions[indices[i + 2]] - a};
+        glm::vec3 p {glm::cross(ray.mDirection, edge2)};
+        float determinant {glm::dot(edge1, p)};
+        if(determinant == 0.f) continue;
+        glm::vec3 s {ray.mOrigin - a};
+        float u {glm::dot(s, p) / determinant};
+        glm::vec3 q {glm::cross(s, edge1)};
+        float v {glm::dot(ray.mDirection, q) / determinant};
+        float t {glm::dot(edge2, q) / determinant};
+        if(u < 0.f || v < 0.f || u + v > 1.f || !(t >= 0.f && t < distance)) continue;
+        distance = t;
+        found = true;
+    }
+    return found;
+}
+
+struct Timings {
+    double mTotalMs {0.0};
+    double mMaxMs {0.0};
+    int mHits {0};
+    int mMismatches {0};
+};
+
+template<typename Query>
+Timings run(const std::vector<Ray>& rays, Query&& query) {
+    Timings timings {};
+    for(const Ray& ray: rays) {
+        Clock::time_point start {Clock::now()};
+        timings.mHits += query(ray);
+        double ms {elapsedMs(start)};
+        timings.mTotalMs += ms;
+        timings.mMaxMs = std::max(timings.mMaxMs, ms);
+    }
+    return timings;
+}
+
+int main() {
+    std::vector<glm::vec3> positions {};
+    std::vector<GLuint> indices {};
+    makeBumpySphere(positions, indices);
+    std::size_t nTriangles {indices.size() / 3};
+
+    MeshBVH serial {};
+    Clock::time_point start {Clock::now()};
+    serial.build(positions, indices);
+    double serialMs {elapsedMs(start)};
+
+    JobSystem jobs {};
+    MeshBVH bvh {};
+    start = Clock::now();
+    bvh.build(positions, indices, &jobs);
+    double parallelMs {elapsedMs(start)};
+
+    std::cout << std::fixed << std::setprecision(2)
+        << nTriangles << " triangles: " << bvh.getNodeCount() << " nodes, "
+        << bvh.getMemorySize() / (1024.0 * 1024.0) << " MB\n"
+        << "build: " << serialMs << " ms on 1 thread, " << parallelMs << " ms on " << jobs.getWorkerCount() << "\n";
+
+    // Picking rays from a shell around the sphere at points roughly
+    // towards it; segments short steps from near its surface
+    std::mt19937 random {1234};
+    std::uniform_real_distribution<float> unit {-1.f, 1.f};
+    auto randomDirection = [&]() {
+        glm::vec3 direction {};
+        do direction = glm::vec3(unit(random), unit(random), unit(random));
+        while(glm::dot(direction, direction) > 1.f || glm::dot(direction, direction) < 1e-4f);
+        return glm::normalize(direction);
+    };
+    std::vector<Ray> rays {}, segments {};
+    for(int i {0}; i < RAYS; ++i) {
+        glm::vec3 origin {randomDirection() * 3.f};
+        glm::vec3 target {randomDirection() * .8f};
+        rays.push_back(Ray { .mOrigin {origin}, .mDirection {glm::normalize(target - origin)} });
+    }
+    for(int i {0}; i < SEGMENTS; ++i) {
+        glm::vec3 origin {randomDirection() * (1.f + .08f * unit(random))};
+        segments.push_back(Ray { .mOrigin {origin}, .mDirection {randomDirection()}, .mMaxDistance {SEGMENT_LENGTH} });
+    }
+
+    RayHit hit {};
+    Timings picking {run(rays, [&](const Ray& ray) { return bvh.intersect(ray, hit); })};
+    Timings stepping {run(segments, [&](const Ray& ray) { return bvh.occluded(ray); })};
+
+    for(int i {0}; i < CHECKED; ++i) {
+        float expected {0.f};
+        bool expectedHit {bruteForce(positions, indices, rays[i], expected)};
+        bool found {bvh.intersect(rays[i], hit)};
+        if(found != expectedHit || (found && std::abs(hit.mDistance - expected) > 1e-4f)) ++picking.mMismatches;
+        expectedHit = bruteForce(positions, indices, segments[i], expected);
+        if(bvh.occluded(segments[i]) != expectedHit) ++stepping.mMismatches;
+    }
+
+    std::cout << std::setprecision(4)
+        << "picking rays: " << picking.mTotalMs * 1000.0 / RAYS << " us mean, " << picking.mMaxMs * 1000.0 << " us max, "
+        << picking.mHits << " of " << RAYS << " hit, " << picking.mMismatches << " of " << CHECKED << " wrong\n"
+        << "segments:     " << stepping.mTotalMs * 1000.0 / SEGMENTS << " us mean, " << stepping.mMaxMs * 1000.0 << " us max, "
+        << stepping.mHits << " of " << SEGMENTS << " hit, " << stepping.mMismatches << " of " << CHECKED << " wrong" << std::endl;
+    return picking.mMismatches + stepping.mMismatches > 0? 1: 0;
+}
@@ -0,0 +1,83 @@
+// Microbenchmark for the job system: per-job scheduling overhead, and
+// how a parallel-for over a compute-bound kernel scales with workers.
+// Worker counts above the machine's core count are still run, but
+// are oversubscribed and reported as such
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "../jobsystem.hpp"
+
+const std::size_t N_EMPTY_JOBS {1000000};
+const std::size_t N_KERNEL_ITEMS {1 << 22};
+const std::size_t MAX_WORKERS {64};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedNs(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Queue empty jobs from the calling thread and wait on them all
+double measureJobOverhead(JobSystem& jobs) {
+    std::atomic<std::size_t> ran {0};
+    JobCounter counter {};
+
+    Clock::time_point start { Clock::now() };
+    for(std::size_t i {0}; i < N_EMPTY_JOBS; ++i) {
+        jobs.run([&ran]() { ran.fetch_add(1, std::memory_order_relaxed); }, &counter);
+    }
+    jobs.wait(counter);
+    return elapsedNs(start) / N_EMPTY_JOBS;
+}
+
+// Run a fixed amount of arithmetic split across the workers
+double measureKernel(JobSystem& jobs, std::vector<float>& output) {
+    Clock::time_point start { Clock::now() };
+    jobs.parallelFor(N_KERNEL_ITEMS, 1024, [&output](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            float x { static_cast<float>(i) };
+            for(int j {0}; j < 32; ++j) x = std::sqrt(x * 1.0001f + 1.f);
+            output[i] = x;
+        }
+    });
+    return elapsedNs(start) / 1e6;
+}
+
+int main() {
+    std::size_t nCores { std::max(1u, std::thread::hardware_concurrency()) };
+    std::vector<float> output (N_KERNEL_ITEMS);
+
+    std::cout << "Hardware threads: " << nCores << "\n\n"
+        << std::setw(8) << "workers"
+        << std::setw(14) << "ns/job"
+        << std::setw(14) << "kernel ms"
+        << std::setw(10) << "speedup"
+        << '\n';
+
+    double baseline {0.0};
+    for(std::size_t nWorkers {1}; nWorkers <= MAX_WORKERS; nWorkers *= 2) {
+        JobSystem jobs { nWorkers };
+
+        // Warm up once so thread start-up isn't counted
+        measureKernel(jobs, output);
+
+        double overhead { measureJobOverhead(jobs) };
+        double kernel { measureKernel(jobs, output) };
+        if(nWorkers == 1) baseline = kernel;
+
+        std::cout << std::setw(8) << nWorkers
+            << std::setw(14) << std::fixed << std::setprecision(1) << overhead
+            << std::setw(14) << std::setprecision(2) << kernel
+            << std::setw(10) << std::setprecision(2) << baseline / kernel
+            << (nWorkers > nCores? "  (oversubscribed)": "")
+            << '\n';
+    }
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+// Benchmark for the software occlusion culler on a generated city:
+// blocks of box buildings, with props scattered in the streets and
+// on the roofs. The buildings are the occluders, and everything is
+// an occludee. Each view flies the camera along a path, and reports
+// how much of what was in view was culled as hidden, and what
+// rasterising the occluders and testing every box cost a frame
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../jobsystem.hpp"
+#include "../occlusionculler.hpp"
+
+const int CITY_BLOCKS {32};          // along each side
+const float BLOCK_SIZE {24.f};
+const float STREET_WIDTH {8.f};
+const int PROPS_PER_BLOCK {24};
+const float OCCLUDER_DISTANCE {200.f};
+const int FRAMES {240};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Box {
+    glm::vec3 mMin;
+    glm::vec3 mMax;
+};
+
+struct View {
+    const char* mName;
+    glm::vec3 mStart;
+    glm::vec3 mEnd;
+    glm::vec3 mLook; // direction looked in, all the way
+};
+
+// Unit cube from (0, 0, 0) to (1, 1, 1), faces wound anticlockwise
+// seen from outside
+const std::vector<glm::vec3> BOX_VERTICES {
+    {0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {1.f, 1.f, 0.f}, {0.f, 1.f, 0.f},
+    {0.f, 0.f, 1.f}, {1.f, 0.f, 1.f}, {1.f, 1.f, 1.f}, {0.f, 1.f, 1.f}
+};
+const std::vector<GLuint> BOX_INDICES {
+    4, 5, 6, 4, 6, 7, // +z
+    1, 0, 3, 1, 3, 2, // -z
+    5, 1, 2, 5, 2, 6, // +x
+    0, 4, 7, 0, 7, 3, // -x
+    3, 7, 6, 3, 6, 2, // +y
+    0, 1, 5, 0, 5, 4  // -y
+};
+
+glm::mat4 boxTransform(const Box& box) {
+    return glm::scale(glm::translate(glm::mat4(1.f), box.mMin), box.mMax - box.mMin);
+}
+
+// Buildings first, then props
+std::vector<Box> makeCity(std::size_t& nBuildings) {
+    std::mt19937 random {1234};
+    std::uniform_real_distribution<float> unit {0.f, 1.f};
+    std::vector<Box> boxes {};
+
+    float lot {BLOCK_SIZE - STREET_WIDTH};
+    for(int blockZ {0}; blockZ < CITY_BLOCKS; ++blockZ) {
+        for(int blockX {0}; blockX < CITY_BLOCKS; ++blockX) {
+            glm::vec3 corner {blockX * BLOCK_SIZE, 0.f, blockZ * BLOCK_SIZE};
+            float height {8.f + 52.f * unit(random) * unit(random)};
+            boxes.push_back(Box {corner, corner + glm::vec3(lot, height, lot)});
+        }
+    }
+    nBuildings = boxes.size();
+
+    for(std::size_t building {0}; building < nBuildings; ++building) {
+        Box block {boxes[building]};
+        for(int i {0}; i < PROPS_PER_BLOCK; ++i) {
+            glm::vec3 size {.5f + 2.f * unit(random), .5f + 1.5f * unit(random), .5f + 2.f * unit(random)};
+            glm::vec3 position {};
+            if(i % 3 == 0) {
+                // On the roof
+                position = glm::vec3(
+                    block.mMin.x + (lot - size.x) * unit(random), block.mMax.y,
+                    block.mMin.z + (lot - size.z) * unit(random)
+                );
+            } else {
+                // In the street along one side of the block
+                float along {(BLOCK_SIZE - size.x) * unit(random)};
+                float across {(STREET_WIDTH - size.z) * unit(random)};
+                position = i % 2?
+                    glm::vec3(block.mMin.x + along, 0.f, block.mMin.z + lot + across):
+                    glm::vec3(block.mMin.x + lot + across, 0.f, block.mMin.z + along);
+            }
+            boxes.push_back(Box {position, position + size});
+        }
+    }
+    return boxes;
+}
+
+int main() {
+    std::size_t nBuildings {0};
+    std::vector<Box> boxes { makeCity(nBuildings) };
+    std::vector<glm::mat4> transforms {};
+    for(const Box& box: boxes) transforms.push_back(boxTransform(box));
+
+    float cityEnd {CITY_BLOCKS * BLOCK_SIZE};
+    float street {BLOCK_SIZE * 10.f - STREET_WIDTH * .5f}; // down the middle of a street
+    const View views[] {
+        {"street", {street, 1.8f, 4.f}, {street, 1.8f, cityEnd - 4.f}, {0.f, -.02f, 1.f}},
+        {"crossing", {street, 1.8f, cityEnd * .5f}, {street, 1.8f, cityEnd * .5f}, {1.f, 0.f, .3f}},
+        {"rooftops", {-20.f, 70.f, -20.f}, {cityEnd * .5f, 70.f, -20.f}, {.3f, -.25f, 1.f}},
+        {"overhead", {cityEnd * .5f, 400.f, 0.f}, {cityEnd * .5f, 400.f, cityEnd}, {0.f, -1.f, .2f}}
+    };
+    glm::mat4 projection {glm::perspective(glm::radians(60.f), 16.f / 9.f, .1f, 1000.f)};
+
+    JobSystem jobs {};
+    OcclusionCuller culler {};
+    OcclusionCuller frustum {}; // no occluders, so it only culls what's out of view
+
+    std::cout << "Hardware threads: " << std::max(1u, std::thread::hardware_concurrency())
+        << ", AVX2: " << (culler.usesAVX2()? "yes": "no")
+        << ", depth buffer " << culler.getWidth() << "x" << culler.getHeight() << '\n'
+        << boxes.size() << " boxes, " << nBuildings << " of them buildings\n\n"
+        << std::setw(10) << "view"
+        << std::setw(12) << "triangles"
+        << std::setw(10) << "in view"
+        << std::setw(10) << "hidden"
+        << std::setw(10) << "culled"
+        << std::setw(12) << "raster ms"
+        << std::setw(10) << "test ms"
+        << std::setw(11) << "total ms"
+        << '\n';
+
+    for(const View& view: views) {
+        double rasterMs {0.0}, testMs {0.0};
+        std::size_t triangles {0}, inView {0}, visible {0};
+        for(int frame {-1}; frame < FRAMES; ++frame) {
+            // The first frame warms up, uncounted
+            float t {frame < 0? 0.f: static_cast<float>(frame) / (FRAMES - 1)};
+            glm::vec3 eye {view.mStart + t * (view.mEnd - view.mStart)};
+            glm::vec3 up {std::abs(view.mLook.y) > .9f? glm::vec3(0.f, 0.f, 1.f): glm::vec3(0.f, 1.f, 0.f)};
+            glm::mat4 viewProjection {projection * glm::lookAt(eye, eye + view.mLook, up)};
+
+            Clock::time_point start {Clock::now()};
+            culler.beginFrame(viewProjection);
+            for(std::size_t i {0}; i < nBuildings; ++i) {
+                glm::vec3 centre {.5f * (boxes[i].mMin + boxes[i].mMax)};
+                if(glm::length(centre - eye) < OCCLUDER_DISTANCE)
+                    culler.addOccluder(BOX_VERTICES, BOX_INDICES, transforms[i]);
+            }
+            culler.rasterize(jobs);
+            double raster {elapsedMs(start)};
+
+            start = Clock::now();
+            std::atomic<std::size_t> frameVisible {0};
+            jobs.parallelFor(boxes.size(), 256, [&](std::size_t begin, std::size_t end) {
+                std::size_t count {0};
+                for(std::size_t i {begin}; i < end; ++i) {
+                    if(culler.isVisible(boxes[i].mMin, boxes[i].mMax)) ++count;
+                }
+                frameVisible.fetch_add(count, std::memory_order_relaxed);
+            });
+            double test {elapsedMs(start)};
+            if(frame < 0) continue;
+
+            frustum.beginFrame(viewProjection);
+            frustum.rasterize(jobs);
+            for(const Box& box: boxes) {
+                if(frustum.isVisible(box.mMin, box.mMax)) ++inView;
+            }
+            rasterMs += raster;
+            testMs += test;
+            triangles += culler.getTriangleCount();
+            visible += frameVisible.load();
+        }
+
+        double hidden {inView? 100.0 * (inView - visible) / inView: 0.0};
+        double culled {100.0 * (static_cast<double>(FRAMES) * boxes.size() - visible) / (static_cast<double>(FRAMES) * boxes.size())};
+        std::cout << std::setw(10) << view.mName
+            << std::setw(12) << triangles / FRAMES
+            << std::setw(9) << std::fixed << std::setprecision(1) << 100.0 * inView / (static_cast<double>(FRAMES) * boxes.size()) << '%'
+            << std::setw(9) << hidden << '%'
+            << std::setw(9) << culled << '%'
+            << std::setw(12) << std::setprecision(3) << rasterMs / FRAMES
+            << std::setw(10) << testMs / FRAMES
+            << std::setw(11) << (rasterMs + testMs) / FRAMES
+            << '\n';
+    }
+    std::cout << "\nin view: boxes inside the view frustum; hidden: of those, the share culled as occluded;\n"
+        << "culled: every box culled, out of view or hidden\n";
+
+    return 0;
+}
@@ -0,0 +1,487 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "light.hpp"
+#include "clusteredlighting.hpp"
+#include "glcallcounts.hpp"
+#include "benchmark.hpp"
+
+// Distance between neighbouring vegetation quads
+const float INSTANCE_SPACING {1.f};
+
+// Distance between neighbouring copies of the model
+const float MODEL_SPACING {4.f};
+
+// Distance between neighbouring animated characters
+const float CHARACTER_SPACING {2.f};
+
+// Frames the camera takes to go once around the grid
+const std::size_t ORBIT_FRAMES {600};
+
+// The orbit is kept inside the camera's far plane
+const float MIN_ORBIT_RADIUS {4.f};
+const float MAX_ORBIT_RADIUS {30.f};
+
+// Resolution of each generated texture
+const int BENCHMARK_TEXTURE_SIZE {64};
+
+static bool parseCount(const std::string& value, std::size_t& count) {
+    char* end {nullptr};
+    unsigned long long parsed { std::strtoull(value.c_str(), &end, 10) };
+    if(value.empty() || *end != '\0') return false;
+    count = static_cast<std::size_t>(parsed);
+    return true;
+}
+
+static bool parseSize(const std::string& value, int& size) {
+    std::size_t parsed {0};
+    if(!parseCount(value, parsed) || parsed == 0 || parsed > 16384) return false;
+    size = static_cast<int>(parsed);
+    return true;
+}
+
+static bool parseDistance(const std::string& value, float& distance) {
+    char* end {nullptr};
+    float parsed { std::strtof(value.c_str(), &end) };
+    if(value.empty() || *end != '\0' || !(parsed >= 0.f)) return false;
+    distance = parsed;
+    return true;
+}
+
+static bool loadSceneFile(const std::string& path, BenchmarkConfig& config);
+
+// Apply one option; value is empty for switches. Sets takesValue
+// for options that consume one
+static bool setOption(BenchmarkConfig& config, const std::string& name, const std::string& value, bool& takesValue) {
+    takesValue = false;
+    if(name == "benchmark") config.mEnabled = true;
+    else if(name == "windowed") config.mWindowed = true;
+    else if(name == "deferred") config.mDeferred = true;
+    else if(name == "forward") config.mDeferred = false;
+    else if(name == "no-prepass") config.mDepthPrepass = false;
+    else if(name == "no-occlusion-culling") config.mOcclusionCulling = false;
+    else if(name == "dynamic-resolution") config.mDynamicResolution = true;
+    else {
+        takesValue = true;
+        if(name == "scene") return loadSceneFile(value, config);
+        if(name == "output") { config.mOutputPath = value; return !value.empty(); }
+        if(name == "capture-prefix") { config.mCapturePrefix = value; return !value.empty(); }
+        if(name == "width") return parseSize(value, config.mWidth);
+        if(name == "height") return parseSize(value, config.mHeight);
+        if(name == "instances") return parseCount(value, config.mInstances);
+        if(name == "lights") return parseCount(value, config.mLights);
+        if(name == "textures") return parseCount(value, config.mTextures) && config.mTextures > 0;
+        if(name == "warmup") return parseCount(value, config.mWarmupFrames);
+        if(name == "frames") return parseCount(value, config.mFrames) && config.mFrames > 0;
+        if(name == "capture-every") return parseCount(value, config.mCaptureInterval);
+        if(name == "capture-video") { config.mCaptureVideoPath = value; return !value.empty(); }
+        if(name == "max-allocations") { config.mLimitAllocations = true; return parseCount(value, config.mMaxAllocations); }
+        if(name == "replay") { config.mReplayPath = value; return !value.empty(); }
+        if(name == "pack") { config.mPackPath = value; return !value.empty(); }
+        if(name == "virtual-texture") { config.mVirtualTexturePath = value; return !value.empty(); }
+        if(name == "model") { config.mModelPath = value; return !value.empty(); }
+        if(name == "model-copies") return parseCount(value, config.mModelCopies) && config.mModelCopies > 0;
+        if(name == "impostor-distance") return parseDistance(value, config.mImpostorDistance);
+        if(name == "min-render-scale") return parseDistance(value, config.mMinRenderScale) && config.mMinRenderScale > 0.f && config.mMinRenderScale <= 2.f;
+        if(name == "max-render-scale") return parseDistance(value, config.mMaxRenderScale) && config.mMaxRenderScale > 0.f && config.mMaxRenderScale <= 2.f;
+        if(name == "frame-budget-ms") return parseDistance(value, config.mFrameBudgetMs) && config.mFrameBudgetMs > 0.f;
+        if(name == "character") { config.mCharacterPath = value; return !value.empty(); }
+        if(name == "characters") return parseCount(value, config.mCharacters);
+        if(name == "replay-steps-per-frame") return parseCount(value, config.mReplayStepsPerFrame) && config.mReplayStepsPerFrame > 0;
+        std::cout << "ERROR::BENCHMARK::UNKNOWN_OPTION " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool loadSceneFile(const std::string& path, BenchmarkConfig& config) {
+    std::ifstream file {path};
+    if(!file) {
+        std::cout << "ERROR::BENCHMARK::SCENE_NOT_FOUND " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for(int lineNumber {1}; std::getline(file, line); ++lineNumber) {
+        std::size_t comment { line.find('#') };
+        if(comment != std::string::npos) line.erase(comment);
+        std::istringstream words {line};
+        std::string name, value, extra;
+        if(!(words >> name)) continue;
+        words >> value >> extra;
+
+        bool takesValue {false};
+        if(!setOption(config, name, value, takesValue) || (!takesValue && !value.empty()) || !extra.empty()) {
+            std::cout << "ERROR::BENCHMARK::BAD_SCENE_LINE " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseBenchmarkArgs(int argc, char* argv[], BenchmarkConfig& config) {
+    for(int i {1}; i < argc; ++i) {
+        std::string arg {argv[i]};
+        if(arg.rfind("--", 0) != 0) {
+            std::cout << "ERROR::BENCHMARK::UNKNOWN_OPTION " << arg << std::endl;
+            return false;
+        }
+        std::string value { i + 1 < argc? argv[i + 1]: "" };
+        bool takesValue {false};
+        if(!setOption(config, arg.substr(2), value, takesValue)) {
+            if(takesValue) std::cout << "ERROR::BENCHMARK::BAD_VALUE " << arg << " " << value << std::endl;
+            return false;
+        }
+        if(takesValue) ++i;
+    }
+    return true;
+}
+
+std::vector<glm::vec3> makeBenchmarkInstances(const BenchmarkConfig& config) {
+    std::size_t side { static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(config.mInstances)))) };
+    float offset { .5f * (side - 1) * INSTANCE_SPACING };
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(config.mInstances);
+    for(std::size_t i {0}; i < config.mInstances; ++i) {
+        std::size_t row { i / side };
+        std::size_t column { i % side };
+        // Stagger alternate rows so quads don't line up into walls
+        float stagger { row % 2? .5f * INSTANCE_SPACING: 0.f };
+        positions.push_back(glm::vec3 {
+            column * INSTANCE_SPACING + stagger - offset,
+            0.f,
+            row * INSTANCE_SPACING - offset
+        });
+    }
+    return positions;
+}
+
+std::vector<glm::vec3> makeModelPlacements(const BenchmarkConfig& config) {
+    // A square grid centred on the origin, so a single copy sits
+    // right at it
+    std::size_t side { static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(config.mModelCopies)))) };
+    float offset { .5f * (side - 1) * MODEL_SPACING };
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(config.mModelCopies);
+    for(std::size_t i {0}; i < config.mModelCopies; ++i) {
+        positions.push_back(glm::vec3 {
+            (i % side) * MODEL_SPACING - offset,
+            0.f,
+            (i / side) * MODEL_SPACING - offset
+        });
+    }
+    return positions;
+}
+
+std::vector<glm::vec3> makeCharacterPlacements(const BenchmarkConfig& config) {
+    // A square grid like the model's, but set half a step off it so
+    // a character never stands right inside a copy of the model
+    std::size_t side { static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(config.mCharacters)))) };
+    float offset { .5f * (side - 1) * CHARACTER_SPACING };
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(config.mCharacters);
+    for(std::size_t i {0}; i < config.mCharacters; ++i) {
+        positions.push_back(glm::vec3 {
+            (i % side) * CHARACTER_SPACING - offset + .5f * CHARACTER_SPACING,
+            0.f,
+            (i / side) * CHARACTER_SPACING - offset + .5f * CHARACTER_SPACING
+        });
+    }
+    return positions;
+}
+
+void addBenchmarkLights(const BenchmarkConfig& config, LightClusters& lights) {
+    std::size_t side { static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(config.mInstances)))) };
+    float radius { std::max(.5f * side * INSTANCE_SPACING, 2.f) };
+
+    // Spread lights evenly over the grid on a sunflower spiral, each
+    // a different hue
+    const float goldenAngle {2.39996323f};
+    for(std::size_t i {0}; i < config.mLights; ++i) {
+        float t { (i + .5f) / config.mLights };
+        float distance { radius * std::sqrt(t) };
+        float angle { goldenAngle * i };
+        glm::vec3 position { distance * std::cos(angle), 1.f, distance * std::sin(angle) };
+
+        float hue { 6.f * std::fmod(i * .618034f, 1.f) };
+        glm::vec3 colour {
+            glm::clamp(glm::vec3 {
+                std::abs(hue - 3.f) - 1.f,
+                2.f - std::abs(hue - 2.f),
+                2.f - std::abs(hue - 4.f)
+            }, 0.f, 1.f)
+        };
+        lights.addLight(makePointLight(position, colour, colour, glm::vec3 {0.f}, .35f, .44f));
+    }
+}
+
+std::vector<GLuint> makeBenchmarkTextures(const BenchmarkConfig& config) {
+    // A blade of grass, cut out with alpha, tinted differently for
+    // each texture
+    std::vector<GLubyte> pixels(BENCHMARK_TEXTURE_SIZE * BENCHMARK_TEXTURE_SIZE * 4);
+    std::vector<GLuint> textures(config.mTextures);
+    glGenTextures(static_cast<GLsizei>(textures.size()), &textures[0]);
+    for(std::size_t t {0}; t < textures.size(); ++t) {
+        float tint { static_cast<float>(t) / textures.size() };
+        for(int y {0}; y < BENCHMARK_TEXTURE_SIZE; ++y) {
+            for(int x {0}; x < BENCHMARK_TEXTURE_SIZE; ++x) {
+                float u { (x + .5f) / BENCHMARK_TEXTURE_SIZE };
+                float v { (y + .5f) / BENCHMARK_TEXTURE_SIZE };
+                bool inside { std::abs(u - .5f) < .45f * (1.f - v) };
+                GLubyte* pixel { &pixels[(y * BENCHMARK_TEXTURE_SIZE + x) * 4] };
+                pixel[0] = static_cast<GLubyte>(255.f * (.2f + .6f * tint) * (.5f + .5f * v));
+                pixel[1] = static_cast<GLubyte>(255.f * (.5f + .5f * v));
+                pixel[2] = static_cast<GLubyte>(255.f * (.6f - .5f * tint) * (.5f + .5f * v));
+                pixel[3] = inside? 255: 0;
+            }
+        }
+        counted::bindTexture(GL_TEXTURE_2D, textures[t]);
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_RGBA8, BENCHMARK_TEXTURE_SIZE, BENCHMARK_TEXTURE_SIZE,
+            0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]
+        );
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+    return textures;
+}
+
+void getBenchmarkCameraPose(const BenchmarkConfig& config, std::size_t frame, glm::vec3& position, float& yaw, float& pitch) {
+    std::size_t side { static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(config.mInstances)))) };
+    float radius { glm::clamp(.6f * side * INSTANCE_SPACING, MIN_ORBIT_RADIUS, MAX_ORBIT_RADIUS) };
+    float angle { 6.2831853f * (frame % ORBIT_FRAMES) / ORBIT_FRAMES };
+
+    position = glm::vec3 { radius * std::sin(angle), 1.5f + .4f * radius, radius * std::cos(angle) };
+    glm::vec3 direction { glm::normalize(glm::vec3 {0.f, .5f, 0.f} - position) };
+    yaw = glm::degrees(std::atan2(direction.x, -direction.z));
+    pitch = glm::degrees(std::asin(direction.y));
+}
+
+BenchmarkRun::BenchmarkRun(const BenchmarkConfig& config):
+    mConfig {config},
+    mFrequency { static_cast<double>(SDL_GetPerformanceFrequency()) }
+{
+    mFrameTimes.reserve(mConfig.mFrames);
+    mCPUTimes.reserve(mConfig.mFrames);
+    mDrawCounts.reserve(mConfig.mFrames);
+    mAllocations.reserve(mConfig.mFrames);
+    mAllocatedBytes.reserve(mConfig.mFrames);
+}
+
+void BenchmarkRun::setFrameCount(std::size_t frames) {
+    mConfig.mFrames = frames;
+    // Reserved up front so recording results never allocates
+    // during a frame
+    mFrameTimes.reserve(frames);
+    mCPUTimes.reserve(frames);
+    mDrawCounts.reserve(frames);
+    mAllocations.reserve(frames);
+    mAllocatedBytes.reserve(frames);
+}
+
+void BenchmarkRun::beginFrame() {
+    ++mFrame;
+    mAllocationStart = getAllocationStats();
+    mFrameStart = SDL_GetPerformanceCounter();
+}
+
+bool BenchmarkRun::endFrame(std::size_t drawCount, int width, int height) {
+    std::uint64_t submitted { SDL_GetPerformanceCounter() };
+    AllocationStats allocated { getAllocationStats() - mAllocationStart };
+    glFinish();
+    std::uint64_t finished { SDL_GetPerformanceCounter() };
+
+    if(mFrame > mConfig.mWarmupFrames) {
+        std::size_t measured { mFrameTimes.size() };
+        mFrameTimes.push_back(1000.0 * (finished - mFrameStart) / mFrequency);
+        mCPUTimes.push_back(1000.0 * (submitted - mFrameStart) / mFrequency);
+        mDrawCounts.push_back(drawCount);
+        mAllocations.push_back(allocated.mAllocations);
+        mAllocatedBytes.push_back(allocated.mBytes);
+
+        // Captured after timing, so the readback isn't measured
+        if(mConfig.mCaptureInterval > 0 && measured % mConfig.mCaptureInterval == 0)
+            captureFrame(width, height);
+    }
+    return mFrameTimes.size() < mConfig.mFrames;
+}
+
+bool BenchmarkRun::captureFrame(int width, int height) {
+    std::size_t rowSize { static_cast<std::size_t>(width) * 4 };
+    std::vector<GLubyte> pixels(rowSize * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // GL's rows run bottom up, PNG's top down
+    std::vector<GLubyte> row(rowSize);
+    for(int top {0}, bottom {height - 1}; top < bottom; ++top, --bottom) {
+        std::memcpy(&row[0], &pixels[top * rowSize], rowSize);
+        std::memcpy(&pixels[top * rowSize], &pixels[bottom * rowSize], rowSize);
+        std::memcpy(&pixels[bottom * rowSize], &row[0], rowSize);
+    }
+
+    std::ostringstream path;
+    path << mConfig.mCapturePrefix << "_" << std::setw(5) << std::setfill('0') << mFrameTimes.size() - 1 << ".png";
+    SDL_Surface* surface {
+        SDL_CreateRGBSurfaceWithFormatFrom(&pixels[0], width, height, 32, static_cast<int>(rowSize), SDL_PIXELFORMAT_RGBA32)
+    };
+    bool saved { surface && IMG_SavePNG(surface, path.str().c_str()) == 0 };
+    SDL_FreeSurface(surface);
+    if(!saved) {
+        std::cout << "ERROR::BENCHMARK::CAPTURE_NOT_SAVED " << path.str() << std::endl;
+        return false;
+    }
+    mCaptures.push_back(path.str());
+    return true;
+}
+
+static std::string escapeJSON(const std::string& text) {
+    std::string escaped;
+    for(char c: text) {
+        if(c == '"' || c == '\\') escaped += '\\';
+        if(static_cast<unsigned char>(c) >= 0x20) escaped += c;
+    }
+    return escaped;
+}
+
+// Mean and nearest-rank percentiles of a set of timings
+static void writeTimings(std::ostream& out, std::vector<double> times) {
+    std::sort(times.begin(), times.end());
+    double sum {0.0};
+    for(double time: times) sum += time;
+    auto percentile = [&](double p) {
+        std::size_t rank { static_cast<std::size_t>(std::ceil(p / 100.0 * times.size())) };
+        return times[std::clamp<std::size_t>(rank, 1, times.size()) - 1];
+    };
+    out << "{\"mean\": " << sum / times.size()
+        << ", \"min\": " << times.front()
+        << ", \"p50\": " << percentile(50.0)
+        << ", \"p90\": " << percentile(90.0)
+        << ", \"p95\": " << percentile(95.0)
+        << ", \"p99\": " << percentile(99.0)
+        << ", \"max\": " << times.back() << "}";
+}
+
+static void writeCounts(std::ostream& out, const std::vector<std::uint64_t>& counts) {
+    std::uint64_t sum {0};
+    std::uint64_t max {0};
+    for(std::uint64_t count: counts) {
+        sum += count;
+        max = std::max(max, count);
+    }
+    out << "{\"mean\": " << static_cast<double>(sum) / counts.size() << ", \"max\": " << max << "}";
+}
+
+bool BenchmarkRun::writeReport() const {
+    if(mFrameTimes.empty()) {
+        std::cout << "ERROR::BENCHMARK::NO_FRAMES_MEASURED" << std::endl;
+        return false;
+    }
+    std::ofstream report {mConfig.mOutputPath};
+    if(!report) {
+        std::cout << "ERROR::BENCHMARK::REPORT_NOT_WRITTEN " << mConfig.mOutputPath << std::endl;
+        return false;
+    }
+
+    std::size_t drawSum {0};
+    std::size_t drawMax {0};
+    for(std::size_t draws: mDrawCounts) {
+        drawSum += draws;
+        drawMax = std::max(drawMax, draws);
+    }
+
+    const char* renderer { reinterpret_cast<const char*>(glGetString(GL_RENDERER)) };
+    const char* version { reinterpret_cast<const char*>(glGetString(GL_VERSION)) };
+    report << std::fixed << std::setprecision(4);
+    report << "{\n";
+    report << "  \"renderer\": \"" << escapeJSON(renderer? renderer: "") << "\",\n";
+    report << "  \"version\": \"" << escapeJSON(version? version: "") << "\",\n";
+    report << "  \"config\": {"
+        << "\"width\": " << mConfig.mWidth
+        << ", \"height\": " << mConfig.mHeight
+        << ", \"instances\": " << mConfig.mInstances
+        << ", \"lights\": " << mConfig.mLights
+        << ", \"textures\": " << mConfig.mTextures
+        << ", \"warmupFrames\": " << mConfig.mWarmupFrames
+        << ", \"frames\": " << mConfig.mFrames
+        << ", \"path\": \"" << (mConfig.mDeferred? "deferred": "forward") << "\""
+        << ", \"depthPrepass\": " << (mConfig.mDepthPrepass? "true": "false")
+        << ", \"occlusionCulling\": " << (mConfig.mOcclusionCulling? "true": "false")
+        << ", \"dynamicResolution\": " << (mConfig.mDynamicResolution? "true": "false")
+        << ", \"minRenderScale\": " << mConfig.mMinRenderScale
+        << ", \"maxRenderScale\": " << mConfig.mMaxRenderScale
+        << ", \"frameBudgetMs\": " << mConfig.mFrameBudgetMs
+        << ", \"headless\": " << (mConfig.mWindowed? "false": "true")
+        << ", \"replay\": \"" << escapeJSON(mConfig.mReplayPath) << "\""
+        << ", \"captureVideo\": \"" << escapeJSON(mConfig.mCaptureVideoPath) << "\""
+        << ", \"pack\": \"" << escapeJSON(mConfig.mPackPath) << "\""
+        << ", \"model\": \"" << escapeJSON(mConfig.mModelPath) << "\""
+        << ", \"modelCopies\": " << mConfig.mModelCopies
+        << ", \"impostorDistance\": " << mConfig.mImpostorDistance
+        << ", \"character\": \"" << escapeJSON(mConfig.mCharacterPath) << "\""
+        << ", \"characters\": " << (mConfig.mCharacterPath.empty()? 0: mConfig.mCharacters)
+        << ", \"virtualTexture\": \"" << escapeJSON(mConfig.mVirtualTexturePath) << "\"},\n";
+    report << "  \"frameTimeMs\": ";
+    writeTimings(report, mFrameTimes);
+    report << ",\n  \"cpuTimeMs\": ";
+    writeTimings(report, mCPUTimes);
+    report << ",\n  \"drawsPerFrame\": {\"mean\": " << static_cast<double>(drawSum) / mDrawCounts.size()
+        << ", \"max\": " << drawMax << "},\n";
+    // Any steady-state frame allocating at all is worth looking into
+    std::size_t framesAllocating {0};
+    for(std::uint64_t allocations: mAllocations) framesAllocating += allocations > 0;
+    report << "  \"allocationsPerFrame\": ";
+    writeCounts(report, mAllocations);
+    report << ",\n  \"allocatedBytesPerFrame\": ";
+    writeCounts(report, mAllocatedBytes);
+    report << ",\n  \"framesAllocating\": " << framesAllocating << ",\n";
+    // Frame by frame, so runs of the same recording on different
+    // builds can be lined up against each other
+    report << "  \"frameTimesMs\": [";
+    for(std::size_t i {0}; i < mFrameTimes.size(); ++i)
+        report << (i? ", ": "") << mFrameTimes[i];
+    report << "],\n";
+    report << "  \"captures\": [";
+    for(std::size_t i {0}; i < mCaptures.size(); ++i)
+        report << (i? ", ": "") << "\"" << escapeJSON(mCaptures[i]) << "\"";
+    report << "]\n}\n";
+
+    std::cout << "Benchmark: " << mFrameTimes.size() << " frames written to " << mConfig.mOutputPath << std::endl;
+    return static_cast<bool>(report);
+}
+
+bool BenchmarkRun::checkAllocations() const {
+    if(!mConfig.mLimitAllocations) return true;
+    std::size_t failed {0};
+    for(std::size_t i {0}; i < mAllocations.size(); ++i) {
+        if(mAllocations[i] <= mConfig.mMaxAllocations) continue;
+        if(failed++ < 10)
+            std::cout << "ERROR::BENCHMARK::FRAME_ALLOCATED frame " << i << ": "
+                << mAllocations[i] << " allocations, " << mAllocatedBytes[i] << " bytes" << std::endl;
+    }
+    if(failed)
+        std::cout << "ERROR::BENCHMARK::ALLOCATION_LIMIT_EXCEEDED in " << failed << " of "
+            << mAllocations.size() << " frames (limit " << mConfig.mMaxAllocations << ")" << std::endl;
+    return failed == 0;
+}
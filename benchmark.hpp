@@ -0,0 +1,149 @@
+#ifndef ZOBENCHMARK_H
+#define ZOBENCHMARK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "clusteredlighting.hpp"
+#include "allocation.hpp"
+
+// What to render and for how long. Set from the command line
+// (--instances 5000) or from a scene file holding the same options
+// one per line, without the dashes (instances 5000)
+struct BenchmarkConfig {
+    bool mEnabled {false};
+    bool mWindowed {false};     // draw into a window instead of headless
+    std::string mOutputPath {"benchmark.json"};
+    std::string mCapturePrefix {"benchmark_frame"};
+
+    int mWidth {1280};
+    int mHeight {720};
+
+    std::size_t mInstances {1000}; // vegetation quads, on a square grid
+    std::size_t mLights {32};      // point lights, on top of the spot and directional light
+    std::size_t mTextures {8};     // distinct materials, assigned round robin
+
+    std::size_t mWarmupFrames {30};
+    std::size_t mFrames {300};
+    std::size_t mCaptureInterval {0}; // save every nth measured frame as PNG; 0 for none
+
+    // Stream every frame here as it's drawn (see framecapture.hpp):
+    // a .y4m or .rgba file, or else numbered PNGs with this prefix.
+    // Unlike the captures above this is part of the frame's time
+    std::string mCaptureVideoPath {};
+
+    // Fail the run if any measured frame allocates from the heap more
+    // than this many times
+    bool mLimitAllocations {false};
+    std::size_t mMaxAllocations {0};
+
+    bool mDeferred {false};
+    bool mDepthPrepass {true};
+    // Skip draws hidden behind the model's copies (see
+    // occlusionculler.hpp)
+    bool mOcclusionCulling {true};
+    // Scale the scene's resolution to hold its GPU time to a budget
+    // (see dynamicresolution.hpp). Off unless asked for, so a run
+    // measures the same work every frame
+    bool mDynamicResolution {false};
+    float mMinRenderScale {.5f};
+    float mMaxRenderScale {1.f};
+    float mFrameBudgetMs {1000.f / 60.f};
+
+    // Drive the camera from an input recording instead (see
+    // inputrecording.hpp), this many simulation steps per frame.
+    // Benchmarks then run to the end of the recording
+    std::string mReplayPath {};
+    std::size_t mReplayStepsPerFrame {2};
+
+    // Asset pack to read from (see assetfilesystem.hpp); assets.pack
+    // is used when it's there if none is given
+    std::string mPackPath {};
+
+    // An image to texture a ground plane with, through virtual
+    // texturing (see virtualtexture.hpp)
+    std::string mVirtualTexturePath {};
+
+    // A model to load in the background and draw at the origin
+    // (see modelcache.hpp), or this many copies of it on a grid
+    // around the origin
+    std::string mModelPath {};
+    std::size_t mModelCopies {1};
+    // Copies of the model further away than this are drawn as
+    // impostors (see impostor.hpp); 0 never does
+    float mImpostorDistance {20.f};
+
+    // A skinned model to load and draw this many animated copies of
+    // (see animation.hpp), on a grid in front of the model's
+    std::string mCharacterPath {};
+    std::size_t mCharacters {100};
+};
+
+// Fill config from argv. Returns false, having printed why, on an
+// unknown option or an unreadable scene file
+bool parseBenchmarkArgs(int argc, char* argv[], BenchmarkConfig& config);
+
+// Scene generation. Everything is derived from the config alone, so
+// a given config always renders the same frames
+std::vector<glm::vec3> makeBenchmarkInstances(const BenchmarkConfig& config);
+std::vector<glm::vec3> makeModelPlacements(const BenchmarkConfig& config);
+std::vector<glm::vec3> makeCharacterPlacements(const BenchmarkConfig& config);
+void addBenchmarkLights(const BenchmarkConfig& config, LightClusters& lights);
+std::vector<GLuint> makeBenchmarkTextures(const BenchmarkConfig& config);
+
+// Camera pose for a frame, when there's no recording to replay: a
+// slow orbit around the grid, looking at its centre
+void getBenchmarkCameraPose(const BenchmarkConfig& config, std::size_t frame, glm::vec3& position, float& yaw, float& pitch);
+
+/*
+Times a fixed number of frames after a warm-up, and reports frame
+time percentiles and draw counts as JSON. Each frame is waited out
+with glFinish(), so a frame's time covers its GPU work too and the
+results don't depend on how far the driver lets the CPU run ahead
+*/
+class BenchmarkRun {
+public:
+    explicit BenchmarkRun(const BenchmarkConfig& config);
+
+    // Measure this many frames after the warm-up instead
+    void setFrameCount(std::size_t frames);
+
+    void beginFrame();
+
+    // Finish the frame drawn into the bound framebuffer (width x
+    // height), record its timings and draw count, and capture it if
+    // it's due. False once every frame has been measured
+    bool endFrame(std::size_t drawCount, int width, int height);
+
+    // Frames begun so far, warm-up included
+    std::size_t getFrame() const { return mFrame; }
+
+    bool writeReport() const;
+
+    // False, saying which frames, if the allocation limit was broken
+    bool checkAllocations() const;
+
+private:
+    bool captureFrame(int width, int height);
+
+    BenchmarkConfig mConfig;
+    std::size_t mFrame {0};
+    std::uint64_t mFrameStart {0};
+    double mFrequency;
+
+    // Per measured frame, in milliseconds
+    std::vector<double> mFrameTimes;
+    std::vector<double> mCPUTimes;
+    std::vector<std::size_t> mDrawCounts;
+    std::vector<std::uint64_t> mAllocations;
+    std::vector<std::uint64_t> mAllocatedBytes;
+    AllocationStats mAllocationStart {};
+    std::vector<std::string> mCaptures;
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shared_globals.hpp"
+#include "jobsystem.hpp"
+#include "light.hpp"
+#include "shader.hpp"
+#include "profiler.hpp"
+#include "allocation.hpp"
+#include "glcallcounts.hpp"
+#include "clusteredlighting.hpp"
+
+// Each light takes up this many RGBA32F texels in the light buffer
+const std::size_t TEXELS_PER_LIGHT {6};
+
+LightClusters::LightClusters():
+    mClusterMin (CLUSTER_COUNT),
+    mClusterMax (CLUSTER_COUNT),
+    mSlices (CLUSTERS_Z)
+{
+    glGenBuffers(1, &mLightDataBuffer);
+    glGenBuffers(1, &mGridBuffer);
+    glGenBuffers(1, &mIndexBuffer);
+    glGenTextures(1, &mLightDataTexture);
+    glGenTextures(1, &mGridTexture);
+    glGenTextures(1, &mIndexTexture);
+}
+
+LightClusters::~LightClusters() {
+    glDeleteTextures(1, &mLightDataTexture);
+    glDeleteTextures(1, &mGridTexture);
+    glDeleteTextures(1, &mIndexTexture);
+    glDeleteBuffers(1, &mLightDataBuffer);
+    glDeleteBuffers(1, &mGridBuffer);
+    glDeleteBuffers(1, &mIndexBuffer);
+}
+
+std::size_t LightClusters::addLight(const Light& light) {
+    if(mLights.size() >= MAX_CLUSTERED_LIGHTS) return MAX_CLUSTERED_LIGHTS;
+    mLights.push_back(light);
+    mRanges.push_back(::getLightRange(light));
+    mShadowSlots.push_back(-1);
+    mLightsChanged = true;
+    return mLights.size() - 1;
+}
+
+void LightClusters::setLight(std::size_t index, const Light& light) {
+    mLights[index] = light;
+    mRanges[index] = ::getLightRange(light);
+    mLightsChanged = true;
+}
+
+void LightClusters::clearLights() {
+    mLights.clear();
+    mRanges.clear();
+    mShadowSlots.clear();
+    mLightsChanged = true;
+}
+
+void LightClusters::setShadowSlot(std::size_t index, int slot) {
+    if(mShadowSlots[index] == slot) return;
+    mShadowSlots[index] = slot;
+    mLightsChanged = true;
+}
+
+void LightClusters::update(const glm::mat4& view, const glm::mat4& projection, float nearDepth, float farDepth) {
+    PROFILE_ZONE("LightClusters::update");
+    // Cluster bounds only depend on the projection
+    if(projection != mBoundsProjection || nearDepth != mNearDepth || farDepth != mFarDepth) {
+        mNearDepth = nearDepth;
+        mFarDepth = farDepth;
+        buildClusterBounds(projection);
+        mBoundsProjection = projection;
+    }
+
+    // Bring point and spot lights into view space
+    mDirectionalLights.clear();
+    mLocalLights.clear();
+    mViewX.clear(); mViewY.clear(); mViewZ.clear(); mViewRadius.clear();
+    mViewDirections.clear();
+    for(std::size_t i {0}; i < mLights.size(); ++i) {
+        if(std::isinf(mRanges[i])) {
+            mDirectionalLights.push_back(i);
+            continue;
+        }
+        glm::vec4 position { view * glm::vec4(mLights[i].mPosition, 1.f) };
+        mLocalLights.push_back(i);
+        mViewX.push_back(position.x);
+        mViewY.push_back(position.y);
+        mViewZ.push_back(position.z);
+        mViewRadius.push_back(mRanges[i]);
+        mViewDirections.push_back(
+            mLights[i].mType == Light::spot?
+            glm::normalize(glm::vec3(view * glm::vec4(mLights[i].mDirection, 0.f))):
+            glm::vec3(0.f)
+        );
+    }
+
+    // Every depth slice is assigned independently
+    gJobSystem->parallelFor(CLUSTERS_Z, 1, [this](std::size_t begin, std::size_t end) {
+        for(std::size_t slice {begin}; slice < end; ++slice) assignSlice(slice);
+    });
+
+    // Join slices in order. Directional lights go first in the index
+    // list, so cluster offsets start after them
+    mGridIndices.assign(mDirectionalLights.begin(), mDirectionalLights.end());
+    mGrid.clear();
+    for(const ClusterSlice& slice: mSlices) {
+        std::uint32_t sliceOffset { static_cast<std::uint32_t>(mGridIndices.size()) };
+        for(const glm::uvec2& cluster: slice.mGrid) {
+            mGrid.push_back(glm::uvec2(cluster.x + sliceOffset, cluster.y));
+        }
+        mGridIndices.insert(mGridIndices.end(), slice.mIndices.begin(), slice.mIndices.end());
+    }
+
+    upload();
+}
+
+void LightClusters::buildClusterBounds(const glm::mat4& projection) {
+    glm::mat4 inverseProjection { glm::inverse(projection) };
+
+    // View-space point on the near plane for a given NDC x and y
+    auto unproject = [&inverseProjection](float x, float y) {
+        glm::vec4 point { inverseProjection * glm::vec4(x, y, -1.f, 1.f) };
+        return glm::vec3(point) / point.w;
+    };
+
+    for(std::size_t z {0}; z < CLUSTERS_Z; ++z) {
+        // Slices are spaced exponentially, so that clusters stay
+        // roughly cube shaped with distance
+        float sliceNear { mNearDepth * std::pow(mFarDepth / mNearDepth, static_cast<float>(z) / CLUSTERS_Z) };
+        float sliceFar { mNearDepth * std::pow(mFarDepth / mNearDepth, static_cast<float>(z + 1) / CLUSTERS_Z) };
+
+        for(std::size_t y {0}; y < CLUSTERS_Y; ++y) {
+            for(std::size_t x {0}; x < CLUSTERS_X; ++x) {
+                float ndcLeft { -1.f + 2.f * x / CLUSTERS_X };
+                float ndcRight { -1.f + 2.f * (x + 1) / CLUSTERS_X };
+                float ndcBottom { -1.f + 2.f * y / CLUSTERS_Y };
+                float ndcTop { -1.f + 2.f * (y + 1) / CLUSTERS_Y };
+                const glm::vec3 corners[4] {
+                    unproject(ndcLeft, ndcBottom), unproject(ndcRight, ndcBottom),
+                    unproject(ndcLeft, ndcTop), unproject(ndcRight, ndcTop)
+                };
+
+                glm::vec3 boundsMin { std::numeric_limits<float>::max() };
+                glm::vec3 boundsMax { -std::numeric_limits<float>::max() };
+                for(const glm::vec3& corner: corners) {
+                    for(float depth: {sliceNear, sliceFar}) {
+                        glm::vec3 point { corner * (depth / -corner.z) };
+                        boundsMin = glm::min(boundsMin, point);
+                        boundsMax = glm::max(boundsMax, point);
+                    }
+                }
+
+                std::size_t cluster { x + CLUSTERS_X * (y + CLUSTERS_Y * z) };
+                mClusterMin[cluster] = boundsMin;
+                mClusterMax[cluster] = boundsMax;
+            }
+        }
+    }
+}
+
+void LightClusters::assignSlice(std::size_t z) {
+    ClusterSlice& slice { mSlices[z] };
+    slice.mIndices.clear();
+    slice.mGrid.clear();
+    slice.mCandidates.clear();
+    slice.mX.clear(); slice.mY.clear(); slice.mZ.clear(); slice.mRadiusSq.clear();
+
+    // Narrow lights down to those overlapping this slice's depth range
+    float sliceNear { -mClusterMax[CLUSTERS_X * CLUSTERS_Y * z].z };
+    float sliceFar { -mClusterMin[CLUSTERS_X * CLUSTERS_Y * z].z };
+    for(std::size_t i {0}; i < mLocalLights.size(); ++i) {
+        float depth { -mViewZ[i] };
+        if(depth + mViewRadius[i] < sliceNear || depth - mViewRadius[i] > sliceFar) continue;
+        slice.mCandidates.push_back(i);
+        slice.mX.push_back(mViewX[i]);
+        slice.mY.push_back(mViewY[i]);
+        slice.mZ.push_back(mViewZ[i]);
+        slice.mRadiusSq.push_back(mViewRadius[i] * mViewRadius[i]);
+    }
+
+    // Pad candidates to a multiple of four with lights that can
+    // never touch a cluster
+    while(slice.mX.size() % 4) {
+        slice.mX.push_back(1e30f);
+        slice.mY.push_back(1e30f);
+        slice.mZ.push_back(1e30f);
+        slice.mRadiusSq.push_back(0.f);
+    }
+
+    for(std::size_t cluster { CLUSTERS_X * CLUSTERS_Y * z }; cluster < CLUSTERS_X * CLUSTERS_Y * (z + 1); ++cluster) {
+        const glm::vec3& boundsMin { mClusterMin[cluster] };
+        const glm::vec3& boundsMax { mClusterMax[cluster] };
+        std::uint32_t offset { static_cast<std::uint32_t>(slice.mIndices.size()) };
+
+        // Bounding sphere of the cluster, for spot light cone tests
+        glm::vec3 centre { .5f * (boundsMin + boundsMax) };
+        float clusterRadius { glm::length(boundsMax - centre) };
+
+        for(std::size_t i {0}; i < slice.mX.size(); i += 4) {
+            // Squared distance from each light to the cluster's AABB,
+            // four lights at a time
+            int hits {0};
+#if defined(__SSE2__)
+            __m128 zero { _mm_setzero_ps() };
+            __m128 x { _mm_loadu_ps(&slice.mX[i]) };
+            __m128 y { _mm_loadu_ps(&slice.mY[i]) };
+            __m128 zs { _mm_loadu_ps(&slice.mZ[i]) };
+            __m128 dx { _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_set1_ps(boundsMin.x), x), _mm_sub_ps(x, _mm_set1_ps(boundsMax.x)))) };
+            __m128 dy { _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_set1_ps(boundsMin.y), y), _mm_sub_ps(y, _mm_set1_ps(boundsMax.y)))) };
+            __m128 dz { _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_set1_ps(boundsMin.z), zs), _mm_sub_ps(zs, _mm_set1_ps(boundsMax.z)))) };
+            __m128 distanceSq { _mm_add_ps(_mm_mul_ps(dx, dx), _mm_add_ps(_mm_mul_ps(dy, dy), _mm_mul_ps(dz, dz))) };
+            hits = _mm_movemask_ps(_mm_cmple_ps(distanceSq, _mm_loadu_ps(&slice.mRadiusSq[i])));
+#else
+            for(std::size_t lane {0}; lane < 4; ++lane) {
+                glm::vec3 position { slice.mX[i + lane], slice.mY[i + lane], slice.mZ[i + lane] };
+                glm::vec3 delta { glm::max(glm::vec3(0.f), glm::max(boundsMin - position, position - boundsMax)) };
+                if(glm::dot(delta, delta) <= slice.mRadiusSq[i + lane]) hits |= (1 << lane);
+            }
+#endif
+            while(hits) {
+                std::size_t lane { static_cast<std::size_t>(__builtin_ctz(hits)) };
+                hits &= hits - 1;
+                std::uint16_t local { slice.mCandidates[i + lane] };
+                std::uint16_t lightIndex { mLocalLights[local] };
+
+                // Spot lights must also have the cluster inside their
+                // cone, not just their range
+                const Light& light { mLights[lightIndex] };
+                if(light.mType == Light::spot) {
+                    glm::vec3 toCluster { centre - glm::vec3(mViewX[local], mViewY[local], mViewZ[local]) };
+                    float lengthSq { glm::dot(toCluster, toCluster) };
+                    float along { glm::dot(toCluster, mViewDirections[local]) };
+                    float cosAngle { light.mCosCutoffOuter };
+                    float sinAngle { glm::sqrt(glm::max(0.f, 1.f - cosAngle * cosAngle)) };
+                    float closest { cosAngle * glm::sqrt(glm::max(0.f, lengthSq - along * along)) - along * sinAngle };
+                    if(closest > clusterRadius || along > clusterRadius + mViewRadius[local] || along < -clusterRadius)
+                        continue;
+                }
+                slice.mIndices.push_back(lightIndex);
+            }
+        }
+
+        slice.mGrid.push_back(glm::uvec2(
+            offset, static_cast<std::uint32_t>(slice.mIndices.size()) - offset
+        ));
+    }
+}
+
+void LightClusters::upload() {
+    // Light properties; only re-sent when a light has changed
+    if(mLightsChanged) {
+        FrameVector<glm::vec4> lightData { ArenaAllocator<glm::vec4> {*gFrameArena} };
+        lightData.reserve(std::max<std::size_t>(1, mLights.size()) * TEXELS_PER_LIGHT);
+        for(std::size_t i {0}; i < mLights.size(); ++i) {
+            const Light& light { mLights[i] };
+            lightData.push_back(glm::vec4(light.mPosition, static_cast<float>(light.mType)));
+            lightData.push_back(glm::vec4(light.mDirection, 0.f));
+            lightData.push_back(glm::vec4(light.mDiffuse, light.mConstant));
+            lightData.push_back(glm::vec4(light.mSpecular, light.mLinear));
+            lightData.push_back(glm::vec4(light.mAmbient, light.mQuadratic));
+            lightData.push_back(glm::vec4(
+                light.mCosCutoffInner, light.mCosCutoffOuter, static_cast<float>(mShadowSlots[i]), 0.f
+            ));
+        }
+        if(lightData.empty()) lightData.resize(TEXELS_PER_LIGHT, glm::vec4(0.f));
+
+        glBindBuffer(GL_TEXTURE_BUFFER, mLightDataBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), &lightData[0], GL_DYNAMIC_DRAW);
+        counted::bindTexture(GL_TEXTURE_BUFFER, mLightDataTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mLightDataBuffer);
+        mLightsChanged = false;
+    }
+
+    // Cluster grid and index list change every frame; orphan the
+    // old storage rather than waiting on the GPU to finish with it
+    glBindBuffer(GL_TEXTURE_BUFFER, mGridBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, mGrid.size() * sizeof(glm::uvec2), &mGrid[0], GL_STREAM_DRAW);
+    counted::bindTexture(GL_TEXTURE_BUFFER, mGridTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, mGridBuffer);
+
+    // Buffer textures can't be empty, so upload a dummy index when
+    // no light reaches any cluster
+    const std::uint16_t noIndices[1] {0};
+    glBindBuffer(GL_TEXTURE_BUFFER, mIndexBuffer);
+    glBufferData(
+        GL_TEXTURE_BUFFER,
+        std::max<std::size_t>(1, mGridIndices.size()) * sizeof(std::uint16_t),
+        mGridIndices.empty()? noIndices: &mGridIndices[0],
+        GL_STREAM_DRAW
+    );
+    counted::bindTexture(GL_TEXTURE_BUFFER, mIndexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, mIndexBuffer);
+
+    counted::bindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bindLightData(const Shader& shader) const {
+    glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_UNIT);
+    counted::bindTexture(GL_TEXTURE_BUFFER, mLightDataTexture);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_INDEX_UNIT);
+    counted::bindTexture(GL_TEXTURE_BUFFER, mIndexTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setInt("lightData", LIGHT_DATA_UNIT);
+    shader.setInt("lightIndices", LIGHT_INDEX_UNIT);
+    shader.setInt("nDirectionalLights", static_cast<int>(mDirectionalLights.size()));
+}
+
+void LightClusters::bind(const Shader& shader, int viewportWidth, int viewportHeight) const {
+    bindLightData(shader);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_GRID_UNIT);
+    counted::bindTexture(GL_TEXTURE_BUFFER, mGridTexture);
+    glActiveTexture(GL_TEXTURE0);
+    shader.setInt("lightGrid", LIGHT_GRID_UNIT);
+
+    // Lets the shader go from a fragment's view depth to its slice:
+    // slice = log(depth) * scale - bias
+    float logDepthRatio { std::log(mFarDepth / mNearDepth) };
+    shader.setFloat("clusterScale", CLUSTERS_Z / logDepthRatio);
+    shader.setFloat("clusterBias", CLUSTERS_Z * std::log(mNearDepth) / logDepthRatio);
+    shader.setVec2("clusterTileSize", glm::vec2(
+        static_cast<float>(viewportWidth) / CLUSTERS_X,
+        static_cast<float>(viewportHeight) / CLUSTERS_Y
+    ));
+}
@@ -0,0 +1,118 @@
+#ifndef ZOCLUSTEREDLIGHTING_H
+#define ZOCLUSTEREDLIGHTING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "light.hpp"
+#include "shader.hpp"
+
+// Dimensions of the view-space froxel grid
+const std::size_t CLUSTERS_X {16};
+const std::size_t CLUSTERS_Y {9};
+const std::size_t CLUSTERS_Z {24};
+const std::size_t CLUSTER_COUNT { CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z };
+
+// Light indices are stored as 16-bit values on the GPU
+const std::size_t MAX_CLUSTERED_LIGHTS {65535};
+
+// Texture units the light buffers are bound to
+const GLint LIGHT_DATA_UNIT {4};
+const GLint LIGHT_GRID_UNIT {5};
+const GLint LIGHT_INDEX_UNIT {6};
+
+/*
+Clustered forward lighting. The view frustum is split into a grid of
+clusters (tiles in screen space, exponential slices in depth), each
+point and spot light is assigned to the clusters its range overlaps,
+and the fragment shader only evaluates the lights listed for its own
+cluster. Directional lights reach everything and are evaluated for
+every fragment
+*/
+class LightClusters {
+public:
+    LightClusters();
+    ~LightClusters();
+
+    LightClusters(const LightClusters& other) = delete;
+    LightClusters& operator=(const LightClusters& other) = delete;
+
+    // Light management; indices stay valid until clearLights()
+    std::size_t addLight(const Light& light);
+    void setLight(std::size_t index, const Light& light);
+    const Light& getLight(std::size_t index) const { return mLights[index]; }
+    std::size_t getLightCount() const { return mLights.size(); }
+    float getLightRange(std::size_t index) const { return mRanges[index]; }
+    void clearLights();
+
+    // Which shadow map a light samples, as handed out by
+    // ShadowMaps; -1 (the default) for none
+    void setShadowSlot(std::size_t index, int slot);
+    int getShadowSlot(std::size_t index) const { return mShadowSlots[index]; }
+
+    // Assign lights to clusters for this view and upload the result
+    void update(const glm::mat4& view, const glm::mat4& projection, float nearDepth, float farDepth);
+
+    // Bind light buffers and set the uniforms the object shader
+    // needs to find its cluster. Shader must be in use
+    void bind(const Shader& shader, int viewportWidth, int viewportHeight) const;
+
+    // Bind just the light data and index buffers, for shaders that
+    // look lights up by index rather than by cluster
+    void bindLightData(const Shader& shader) const;
+
+    // Directional lights occupy the start of the index buffer
+    std::size_t getDirectionalLightCount() const { return mDirectionalLights.size(); }
+
+    // Total number of light references across all clusters, as of
+    // the last update
+    std::size_t getAssignmentCount() const { return mGridIndices.size(); }
+
+private:
+    void buildClusterBounds(const glm::mat4& projection);
+    void assignSlice(std::size_t slice);
+    void upload();
+
+    std::vector<Light> mLights;
+    std::vector<float> mRanges;
+    std::vector<int> mShadowSlots;
+    bool mLightsChanged {true};
+
+    // Point and spot lights in view space, as structure-of-arrays so
+    // four can be tested against a cluster at once
+    std::vector<float> mViewX, mViewY, mViewZ, mViewRadius;
+    std::vector<glm::vec3> mViewDirections;
+    std::vector<std::uint16_t> mLocalLights; // index into mLights
+    std::vector<std::uint16_t> mDirectionalLights;
+
+    // View-space bounds of each cluster
+    std::vector<glm::vec3> mClusterMin;
+    std::vector<glm::vec3> mClusterMax;
+    glm::mat4 mBoundsProjection {0.f};
+    float mNearDepth {1.f};
+    float mFarDepth {50.f};
+
+    // Scratch space and results for one depth slice; each slice is
+    // assigned by its own job, and the results joined afterwards
+    struct ClusterSlice {
+        std::vector<float> mX, mY, mZ, mRadiusSq;
+        std::vector<std::uint16_t> mCandidates;
+        std::vector<std::uint16_t> mIndices;
+        std::vector<glm::uvec2> mGrid;
+    };
+    std::vector<ClusterSlice> mSlices;
+
+    std::vector<std::uint16_t> mGridIndices;
+    std::vector<glm::uvec2> mGrid;
+
+    // Texture buffers backing the shader's light lookups
+    GLuint mLightDataBuffer {0}, mLightDataTexture {0};
+    GLuint mGridBuffer {0}, mGridTexture {0};
+    GLuint mIndexBuffer {0}, mIndexTexture {0};
+};
+
+#endif
@@ -0,0 +1,332 @@
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shared_globals.hpp"
+#include "jobsystem.hpp"
+#include "shader.hpp"
+#include "streambuffer.hpp"
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "commandbuffer.hpp"
+
+// Ranges smaller than this aren't worth handing to another thread
+const std::size_t MIN_ITEMS_PER_BUFFER {512};
+
+// Marks a sorted draw with no material or draw data before it
+const std::uint32_t NO_COMMAND {0xFFFFFFFF};
+
+// Replay helpers shared by ordered and sorted submission
+static void replayMaterial(const RenderCommand& command) {
+    glActiveTexture(GL_TEXTURE1);
+    counted::bindTexture(GL_TEXTURE_2D, command.mMaterial.mSpecular);
+    glActiveTexture(GL_TEXTURE0);
+    counted::bindTexture(GL_TEXTURE_2D, command.mMaterial.mDiffuse);
+}
+
+static void replayDrawData(GLintptr offset) {
+    glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, gStreamBuffer->getBufferID(), offset, sizeof(DrawData));
+}
+
+static void replayDraw(const RenderCommand& command, GLuint& boundVAO) {
+    if(command.mDraw.mVAO != boundVAO) {
+        counted::bindVertexArray(command.mDraw.mVAO);
+        boundVAO = command.mDraw.mVAO;
+    }
+    void* first { reinterpret_cast<void*>(command.mDraw.mFirst * sizeof(GLuint)) };
+    if(command.mDraw.mInstances > 1)
+        counted::drawElementsInstanced(GL_TRIANGLES, command.mDraw.mCount, GL_UNSIGNED_INT, first, command.mDraw.mInstances);
+    else counted::drawElements(GL_TRIANGLES, command.mDraw.mCount, GL_UNSIGNED_INT, first);
+}
+
+void CommandBuffer::clear() {
+    mCommands.clear();
+    mDrawData.clear();
+    mHasMaterial = false;
+}
+
+void CommandBuffer::bindMaterial(GLuint diffuse, GLuint specular) {
+    // Skip binds that wouldn't change anything
+    if(mHasMaterial && diffuse == mLastDiffuse && specular == mLastSpecular)
+        return;
+
+    RenderCommand command {};
+    command.mType = RenderCommand::bindMaterial;
+    command.mMaterial.mDiffuse = diffuse;
+    command.mMaterial.mSpecular = specular;
+    mCommands.push_back(command);
+
+    mLastDiffuse = diffuse;
+    mLastSpecular = specular;
+    mHasMaterial = true;
+}
+
+void CommandBuffer::setDrawData(const glm::mat4& model) {
+    // The normal matrix is computed here rather than at submission,
+    // so that its cost is spread across the recording threads
+    setDrawData(model, glm::transpose(glm::inverse(model)));
+}
+
+void CommandBuffer::setDrawData(const glm::mat4& model, const glm::mat4& normalMat) {
+    mDrawData.push_back(DrawData {
+        .mModel { model },
+        .mNormalMat { normalMat },
+        .mSkin { glm::ivec4(0) }
+    });
+
+    RenderCommand command {};
+    command.mType = RenderCommand::setDrawData;
+    command.mDrawData.mIndex = static_cast<std::uint32_t>(mDrawData.size() - 1);
+    mCommands.push_back(command);
+}
+
+void CommandBuffer::setSkinnedDrawData(const glm::mat4& model, GLint firstTexel, GLint boneCount) {
+    setDrawData(model);
+    mDrawData.back().mSkin = glm::ivec4(firstTexel, boneCount, 0, 0);
+}
+
+void CommandBuffer::addInstanceData(const glm::mat4& model) {
+    mDrawData.push_back(DrawData {
+        .mModel { model },
+        .mNormalMat { glm::transpose(glm::inverse(model)) },
+        .mSkin { glm::ivec4(0) }
+    });
+}
+
+void CommandBuffer::drawElements(GLuint vao, GLsizei count, std::uint32_t first) {
+    drawElementsInstanced(vao, count, 1, first);
+}
+
+void CommandBuffer::drawElementsInstanced(GLuint vao, GLsizei count, GLsizei instances, std::uint32_t first) {
+    RenderCommand command {};
+    command.mType = RenderCommand::drawElements;
+    command.mDraw.mVAO = vao;
+    command.mDraw.mCount = count;
+    command.mDraw.mFirst = first;
+    command.mDraw.mInstances = instances;
+    mCommands.push_back(command);
+}
+
+void CommandQueue::record(std::size_t nItems, const RecordFunction& recordRange) {
+    PROFILE_ZONE("CommandQueue::record");
+    std::size_t nBuffers {
+        std::max<std::size_t>(1, std::min(
+            gJobSystem->getWorkerCount(),
+            (nItems + MIN_ITEMS_PER_BUFFER - 1) / MIN_ITEMS_PER_BUFFER
+        ))
+    };
+
+    mSorted = false;
+    mUploaded = false;
+
+    // Buffers are kept around between frames so that their storage
+    // is reused
+    if(mBuffers.size() < nBuffers) mBuffers.resize(nBuffers);
+    for(CommandBuffer& buffer: mBuffers) buffer.clear();
+
+    std::size_t itemsPerBuffer { (nItems + nBuffers - 1) / nBuffers };
+    auto recordBuffer = [&](std::size_t i) {
+        std::size_t begin { std::min(nItems, i * itemsPerBuffer) };
+        std::size_t end { std::min(nItems, begin + itemsPerBuffer) };
+        if(begin < end) recordRange(mBuffers[i], begin, end);
+    };
+
+    // The calling thread records the first range itself
+    JobCounter recorded {};
+    for(std::size_t i {1}; i < nBuffers; ++i) {
+        gJobSystem->run([&recordBuffer, i]() { recordBuffer(i); }, &recorded);
+    }
+    recordBuffer(0);
+    gJobSystem->wait(recorded);
+}
+
+void CommandQueue::sortFrontToBack(const glm::vec3& eyePos) {
+    // Flatten the buffers into independent draws, each carrying the
+    // state it was recorded with
+    mSortedDraws.clear();
+    for(std::size_t b {0}; b < mBuffers.size(); ++b) {
+        const CommandBuffer& buffer { mBuffers[b] };
+        std::uint32_t material { NO_COMMAND };
+        std::uint32_t drawData { NO_COMMAND };
+        for(std::size_t c {0}; c < buffer.mCommands.size(); ++c) {
+            const RenderCommand& command { buffer.mCommands[c] };
+            switch(command.mType) {
+                case RenderCommand::bindMaterial:
+                    material = static_cast<std::uint32_t>(c);
+                break;
+
+                case RenderCommand::setDrawData:
+                    drawData = command.mDrawData.mIndex;
+                break;
+
+                case RenderCommand::drawElements: {
+                    glm::vec3 offset {
+                        drawData == NO_COMMAND?
+                        -eyePos: glm::vec3(buffer.mDrawData[drawData].mModel[3]) - eyePos
+                    };
+                    mSortedDraws.push_back(SortedDraw {
+                        .mDistanceSq { glm::dot(offset, offset) },
+                        .mBuffer { static_cast<std::uint32_t>(b) },
+                        .mMaterial { material },
+                        .mDrawData { drawData },
+                        .mDraw { static_cast<std::uint32_t>(c) }
+                    });
+                }
+                break;
+            }
+        }
+    }
+
+    // Equally distant draws keep their recorded order. Ties are broken
+    // by position rather than with stable_sort, which allocates a
+    // scratch buffer every call
+    std::sort(mSortedDraws.begin(), mSortedDraws.end(),
+        [](const SortedDraw& a, const SortedDraw& b) {
+            if(a.mDistanceSq != b.mDistanceSq) return a.mDistanceSq < b.mDistanceSq;
+            if(a.mBuffer != b.mBuffer) return a.mBuffer < b.mBuffer;
+            return a.mDraw < b.mDraw;
+        }
+    );
+    mSorted = true;
+}
+
+void CommandQueue::uploadDrawData() const {
+    PROFILE_ZONE("CommandQueue::uploadDrawData");
+    // Each draw's data has to start on a boundary the driver accepts
+    // for uniform buffer ranges, and on a whole texel for instanced
+    // draws to read it as texels
+    static GLint alignment {0};
+    if(!alignment) {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        alignment = std::max<GLint>(alignment, sizeof(glm::vec4));
+    }
+    mDrawDataStride = (static_cast<GLsizeiptr>(sizeof(DrawData)) + alignment - 1) / alignment * alignment;
+
+    std::size_t nDrawData {0};
+    for(const CommandBuffer& buffer: mBuffers) nDrawData += buffer.mDrawData.size();
+
+    mDrawDataOffsets.resize(mBuffers.size());
+    mUploaded = true;
+    if(nDrawData == 0) {
+        mUploadFrame = gStreamBuffer->getFrame();
+        return;
+    }
+
+    GLintptr offset {0};
+    char* data {
+        static_cast<char*>(gStreamBuffer->map(nDrawData * mDrawDataStride, alignment, offset))
+    };
+    mUploadFrame = gStreamBuffer->getFrame();
+    if(!data) {
+        std::cout << "ERROR::COMMANDQUEUE::DRAW_DATA_NOT_MAPPED" << std::endl;
+        return;
+    }
+    GLint texelStride { static_cast<GLint>(mDrawDataStride / sizeof(glm::vec4)) };
+    for(std::size_t b {0}; b < mBuffers.size(); ++b) {
+        mDrawDataOffsets[b] = offset;
+        for(DrawData drawData: mBuffers[b].mDrawData) {
+            drawData.mSkin.z = static_cast<GLint>(offset / sizeof(glm::vec4));
+            drawData.mSkin.w = texelStride;
+            std::memcpy(data, &drawData, sizeof(DrawData));
+            data += mDrawDataStride;
+            offset += mDrawDataStride;
+        }
+    }
+    gStreamBuffer->unmap();
+}
+
+void CommandQueue::submit(const Shader& shader) const {
+    PROFILE_ZONE("CommandQueue::submit");
+    // Whatever was streamed in an earlier frame may have been
+    // overwritten by now
+    if(!mUploaded || mUploadFrame != gStreamBuffer->getFrame()) uploadDrawData();
+
+    // Instanced draws read their later instances' data from here
+    glActiveTexture(GL_TEXTURE0 + DRAW_DATA_UNIT);
+    counted::bindTexture(GL_TEXTURE_BUFFER, gStreamBuffer->getTextureID());
+    glActiveTexture(GL_TEXTURE0);
+
+    if(mSorted) {
+        submitSorted();
+        return;
+    }
+
+    GLuint boundVAO {0};
+    for(std::size_t b {0}; b < mBuffers.size(); ++b) {
+        for(const RenderCommand& command: mBuffers[b].mCommands) {
+            switch(command.mType) {
+                case RenderCommand::bindMaterial:
+                    replayMaterial(command);
+                break;
+
+                case RenderCommand::setDrawData:
+                    replayDrawData(mDrawDataOffsets[b] + command.mDrawData.mIndex * mDrawDataStride);
+                break;
+
+                case RenderCommand::drawElements:
+                    replayDraw(command, boundVAO);
+                break;
+            }
+        }
+    }
+    counted::bindVertexArray(0);
+}
+
+void CommandQueue::submitSorted() const {
+    // Neighbouring draws no longer share state by construction, so
+    // binds are only issued when the state actually changes
+    GLuint boundVAO {0};
+    GLuint boundDiffuse {0}, boundSpecular {0};
+    bool materialBound {false};
+    GLintptr boundData {-1};
+    for(const SortedDraw& draw: mSortedDraws) {
+        const CommandBuffer& buffer { mBuffers[draw.mBuffer] };
+
+        if(draw.mMaterial != NO_COMMAND) {
+            const RenderCommand& material { buffer.mCommands[draw.mMaterial] };
+            if(
+                !materialBound
+                || material.mMaterial.mDiffuse != boundDiffuse
+                || material.mMaterial.mSpecular != boundSpecular
+            ) {
+                replayMaterial(material);
+                boundDiffuse = material.mMaterial.mDiffuse;
+                boundSpecular = material.mMaterial.mSpecular;
+                materialBound = true;
+            }
+        }
+
+        if(draw.mDrawData != NO_COMMAND) {
+            GLintptr data { mDrawDataOffsets[draw.mBuffer] + draw.mDrawData * mDrawDataStride };
+            if(data != boundData) {
+                replayDrawData(data);
+                boundData = data;
+            }
+        }
+
+        replayDraw(buffer.mCommands[draw.mDraw], boundVAO);
+    }
+    counted::bindVertexArray(0);
+}
+
+std::size_t CommandQueue::getCommandCount() const {
+    std::size_t count {0};
+    for(const CommandBuffer& buffer: mBuffers) count += buffer.size();
+    return count;
+}
+
+std::size_t CommandQueue::getDrawCount() const {
+    if(mSorted) return mSortedDraws.size();
+    std::size_t count {0};
+    for(const CommandBuffer& buffer: mBuffers) {
+        for(const RenderCommand& command: buffer.mCommands)
+            count += command.mType == RenderCommand::drawElements;
+    }
+    return count;
+}
@@ -0,0 +1,167 @@
+#ifndef ZOCOMMANDBUFFER_H
+#define ZOCOMMANDBUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+
+// Per-draw data referenced by a setDrawData command; laid out as the
+// shaders' std140 DrawBlock
+struct DrawData {
+    glm::mat4 mModel;
+    glm::mat4 mNormalMat;
+    // Skinned draws' first texel in the bone palette and bone count
+    // (see animation.hpp); no bones for anything else. The last two
+    // are filled in as it's streamed: its first texel in the stream
+    // buffer, and the texels from one instance's data to the next
+    glm::ivec4 mSkin;
+};
+
+// A single compact, trivially copyable render command. Commands
+// never touch GL when recorded, so they can be built on any thread
+struct RenderCommand {
+    enum CommandType : std::uint8_t {
+        bindMaterial=0,
+        setDrawData=1,
+        drawElements=2
+    };
+
+    CommandType mType;
+    union {
+        // Textures bound to units 0 (diffuse) and 1 (specular)
+        struct {
+            GLuint mDiffuse;
+            GLuint mSpecular;
+        } mMaterial;
+
+        // Index into the recording buffer's draw data array
+        struct {
+            std::uint32_t mIndex;
+        } mDrawData;
+
+        // Indexed draw of mCount elements starting at mFirst, mInstances
+        // times over
+        struct {
+            GLuint mVAO;
+            GLsizei mCount;
+            std::uint32_t mFirst;
+            GLsizei mInstances;
+        } mDraw;
+    };
+};
+
+class CommandBuffer {
+public:
+    // Forget all recorded commands, keeping allocated storage
+    void clear();
+
+    // Recording functions; these are safe to call from worker threads
+    void bindMaterial(GLuint diffuse, GLuint specular);
+    void setDrawData(const glm::mat4& model);
+    void setDrawData(const glm::mat4& model, const glm::mat4& normalMat);
+    void setSkinnedDrawData(const glm::mat4& model, GLint firstTexel, GLint boneCount);
+    // Draw data for the next instance of an instanced draw, following
+    // the setDrawData() for its first
+    void addInstanceData(const glm::mat4& model);
+    void drawElements(GLuint vao, GLsizei count, std::uint32_t first=0);
+    // Once per instance recorded since the last setDrawData()
+    void drawElementsInstanced(GLuint vao, GLsizei count, GLsizei instances, std::uint32_t first=0);
+
+    std::size_t size() const { return mCommands.size(); }
+
+private:
+    std::vector<RenderCommand> mCommands;
+    std::vector<DrawData> mDrawData;
+
+    // last material recorded into this buffer, used to drop
+    // redundant binds
+    GLuint mLastDiffuse {0};
+    GLuint mLastSpecular {0};
+    bool mHasMaterial {false};
+
+    friend class CommandQueue;
+};
+
+// A set of command buffers, recorded in parallel and replayed on
+// the GL thread in slot order, so the result never depends on which
+// worker finished first
+class CommandQueue {
+public:
+    // Refers to anything callable as recordRange(commands, begin,
+    // end) for the length of a record() call. Unlike std::function it
+    // never copies the callable, so recording never allocates however
+    // much the callable captures
+    class RecordFunction {
+    public:
+        template<typename Function>
+            requires (!std::is_same_v<std::remove_cvref_t<Function>, RecordFunction>)
+        RecordFunction(Function&& function):
+            mFunction { const_cast<void*>(static_cast<const void*>(&function)) },
+            mInvoke { [](void* function, CommandBuffer& commands, std::size_t begin, std::size_t end) {
+                (*static_cast<std::remove_reference_t<Function>*>(function))(commands, begin, end);
+            } }
+        {}
+
+        void operator()(CommandBuffer& commands, std::size_t begin, std::size_t end) const {
+            mInvoke(mFunction, commands, begin, end);
+        }
+
+    private:
+        void* mFunction;
+        void (*mInvoke)(void* function, CommandBuffer& commands, std::size_t begin, std::size_t end);
+    };
+
+    // Split nItems into contiguous ranges and record each range into
+    // its own buffer, on as many threads as are useful
+    void record(std::size_t nItems, const RecordFunction& recordRange);
+
+    // Reorder the recorded draws nearest first, going by the distance
+    // from eyePos to each draw's model origin (its first instance's,
+    // if instanced), so that early depth testing rejects as much
+    // hidden geometry as possible. Lasts until the next record()
+    void sortFrontToBack(const glm::vec3& eyePos);
+
+    // Replay every recorded buffer in order (or sorted order, if
+    // sorted). Must be called on the thread that owns the GL
+    // context, with shader in use. The first submission each frame
+    // streams all the queue's draw data to the GPU in one write, and
+    // every submission after it in the frame reuses it
+    void submit(const Shader& shader) const;
+
+    std::size_t getCommandCount() const;
+    // Draw calls a submit() issues
+    std::size_t getDrawCount() const;
+
+private:
+    // A draw along with the material and draw data in effect for it;
+    // indices are into mBuffers[mBuffer]'s commands and draw data
+    struct SortedDraw {
+        float mDistanceSq;
+        std::uint32_t mBuffer;
+        std::uint32_t mMaterial;
+        std::uint32_t mDrawData;
+        std::uint32_t mDraw;
+    };
+
+    void uploadDrawData() const;
+    void submitSorted() const;
+
+    std::vector<CommandBuffer> mBuffers;
+    std::vector<SortedDraw> mSortedDraws;
+    bool mSorted {false};
+
+    // Where each buffer's draw data starts in the stream buffer, and
+    // the stream buffer frame it was written in
+    mutable std::vector<GLintptr> mDrawDataOffsets;
+    mutable GLsizeiptr mDrawDataStride {0};
+    mutable std::uint64_t mUploadFrame {0};
+    mutable bool mUploaded {false};
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shader.hpp"
+#include "clusteredlighting.hpp"
+#include "shadowmaps.hpp"
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "deferredrenderer.hpp"
+
+// Resolution of the light volume sphere
+const int VOLUME_RINGS {8};
+const int VOLUME_SEGMENTS {12};
+
+// G-buffer texture units used by the lighting pass
+const GLint ALBEDO_SPECULAR_UNIT {0};
+const GLint NORMAL_UNIT {1};
+const GLint DEPTH_UNIT {2};
+
+DeferredRenderer::DeferredRenderer(int width, int height):
+    mGeometryShader {"shaders/vertex.vs", "shaders/gbuffer_fragment.fs"},
+    mVirtualGeometryShader {"shaders/vertex.vs", "shaders/gbuffer_fragment.fs", "#define VIRTUAL_TEXTURING"},
+    mImpostorGeometryShader {"shaders/impostor.vs", "shaders/gbuffer_fragment.fs", "#define IMPOSTOR"},
+    mSkinnedGeometryShader {"shaders/vertex.vs", "shaders/gbuffer_fragment.fs", "#define SKINNING"},
+    mDirectionalShader {"shaders/deferred_fullscreen.vs", "shaders/deferred_lighting.fs"},
+    mVolumeShader {"shaders/deferred_volume.vs", "shaders/deferred_lighting.fs"}
+{
+    glGenFramebuffers(1, &mFBO);
+    resize(width, height);
+
+    glGenVertexArrays(1, &mFullscreenVAO);
+    buildLightVolume();
+}
+
+DeferredRenderer::~DeferredRenderer() {
+    freeTargets();
+    glDeleteFramebuffers(1, &mFBO);
+    glDeleteVertexArrays(1, &mFullscreenVAO);
+    glDeleteVertexArrays(1, &mVolumeVAO);
+    glDeleteBuffers(1, &mVolumeVBO);
+    glDeleteBuffers(1, &mVolumeEBO);
+    glDeleteBuffers(1, &mInstanceVBO);
+}
+
+bool DeferredRenderer::getBuildSuccess() {
+    return (
+        mGeometryShader.getBuildSuccess()
+        && mVirtualGeometryShader.getBuildSuccess()
+        && mImpostorGeometryShader.getBuildSuccess()
+        && mSkinnedGeometryShader.getBuildSuccess()
+        && mDirectionalShader.getBuildSuccess()
+        && mVolumeShader.getBuildSuccess()
+    );
+}
+
+void DeferredRenderer::freeTargets() {
+    if(mAlbedoSpecular) glDeleteTextures(1, &mAlbedoSpecular);
+    if(mNormal) glDeleteTextures(1, &mNormal);
+    if(mDepthStencil) glDeleteTextures(1, &mDepthStencil);
+    mAlbedoSpecular = mNormal = mDepthStencil = 0;
+}
+
+void DeferredRenderer::resize(int width, int height) {
+    freeTargets();
+    mWidth = width;
+    mHeight = height;
+
+    // Every G-buffer target is read back with exact texel lookups
+    auto makeTarget = [width, height](GLenum internalFormat, GLenum format, GLenum type) {
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        counted::bindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    };
+    mAlbedoSpecular = makeTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    mNormal = makeTarget(GL_RG16F, GL_RG, GL_FLOAT);
+    mDepthStencil = makeTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mAlbedoSpecular, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mNormal, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mDepthStencil, 0);
+    const GLenum drawBuffers[2] { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::DEFERRED::GBUFFER_INCOMPLETE" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, mOutputFBO);
+}
+
+void DeferredRenderer::buildLightVolume() {
+    // A UV sphere, pushed out just enough that its flat faces
+    // enclose the unit sphere rather than cutting into it
+    const float pi { glm::pi<float>() };
+    float inflate {
+        1.f / (std::cos(pi / VOLUME_SEGMENTS) * std::cos(pi / (2 * VOLUME_RINGS)))
+    };
+    std::vector<glm::vec3> positions {};
+    for(int ring {0}; ring <= VOLUME_RINGS; ++ring) {
+        float theta { pi * ring / VOLUME_RINGS };
+        for(int segment {0}; segment < VOLUME_SEGMENTS; ++segment) {
+            float phi { 2.f * pi * segment / VOLUME_SEGMENTS };
+            positions.push_back(inflate * glm::vec3(
+                std::sin(theta) * std::cos(phi),
+                std::cos(theta),
+                std::sin(theta) * std::sin(phi)
+            ));
+        }
+    }
+    std::vector<GLuint> indices {};
+    for(int ring {0}; ring < VOLUME_RINGS; ++ring) {
+        for(int segment {0}; segment < VOLUME_SEGMENTS; ++segment) {
+            GLuint current { static_cast<GLuint>(ring * VOLUME_SEGMENTS + segment) };
+            GLuint next { static_cast<GLuint>(ring * VOLUME_SEGMENTS + (segment + 1) % VOLUME_SEGMENTS) };
+            GLuint below { current + VOLUME_SEGMENTS };
+            GLuint belowNext { next + VOLUME_SEGMENTS };
+            // Wound counter-clockwise as seen from outside
+            indices.insert(indices.end(), {current, next, below, next, belowNext, below});
+        }
+    }
+    mVolumeIndexCount = indices.size();
+
+    glGenVertexArrays(1, &mVolumeVAO);
+    glGenBuffers(1, &mVolumeVBO);
+    glGenBuffers(1, &mVolumeEBO);
+    glGenBuffers(1, &mInstanceVBO);
+
+    counted::bindVertexArray(mVolumeVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, mVolumeVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVolumeEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+
+        // Per-light attributes advance once per instance
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceVBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(VolumeInstance),
+            reinterpret_cast<void*>(offsetof(VolumeInstance, mPositionRange)));
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(VolumeInstance),
+            reinterpret_cast<void*>(offsetof(VolumeInstance, mLightIndex)));
+        glVertexAttribDivisor(2, 1);
+    counted::bindVertexArray(0);
+}
+
+const Shader& DeferredRenderer::beginGeometryPass(const glm::mat4& view, const glm::mat4& projection) {
+    PROFILE_ZONE("DeferredRenderer::beginGeometryPass");
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glViewport(0, 0, mWidth, mHeight);
+    const GLfloat zero[4] {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, zero);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    // Blending would mix encoded normals together
+    glDisable(GL_BLEND);
+
+    mGeometryShader.use();
+    mGeometryShader.setMat4("view", view);
+    mGeometryShader.setMat4("projection", projection);
+    mGeometryShader.setInt("material.texture_diffuse1", 0);
+    mGeometryShader.setInt("material.texture_specular1", 1);
+    return mGeometryShader;
+}
+
+const Shader& DeferredRenderer::useVirtualGeometryShader(const glm::mat4& view, const glm::mat4& projection) {
+    mVirtualGeometryShader.use();
+    mVirtualGeometryShader.setMat4("view", view);
+    mVirtualGeometryShader.setMat4("projection", projection);
+    mVirtualGeometryShader.setInt("material.texture_diffuse1", 0);
+    mVirtualGeometryShader.setInt("material.texture_specular1", 1);
+    return mVirtualGeometryShader;
+}
+
+const Shader& DeferredRenderer::useImpostorGeometryShader(const glm::mat4& view, const glm::mat4& projection) {
+    mImpostorGeometryShader.use();
+    mImpostorGeometryShader.setMat4("view", view);
+    mImpostorGeometryShader.setMat4("projection", projection);
+    mImpostorGeometryShader.setInt("material.texture_diffuse1", 0);
+    mImpostorGeometryShader.setInt("material.texture_specular1", 1);
+    return mImpostorGeometryShader;
+}
+
+const Shader& DeferredRenderer::useSkinnedGeometryShader(const glm::mat4& view, const glm::mat4& projection) {
+    mSkinnedGeometryShader.use();
+    mSkinnedGeometryShader.setMat4("view", view);
+    mSkinnedGeometryShader.setMat4("projection", projection);
+    mSkinnedGeometryShader.setInt("material.texture_diffuse1", 0);
+    mSkinnedGeometryShader.setInt("material.texture_specular1", 1);
+    return mSkinnedGeometryShader;
+}
+
+void DeferredRenderer::lightingPass(const LightClusters& lights, const ShadowMaps& shadows, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eyePos) {
+    PROFILE_ZONE("DeferredRenderer::lightingPass");
+    PROFILE_GPU_ZONE("Deferred lighting");
+    // Copy scene depth over so light volumes are depth tested
+    // against it
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mFBO);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mOutputFBO);
+    glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, mOutputFBO);
+
+    glActiveTexture(GL_TEXTURE0 + ALBEDO_SPECULAR_UNIT);
+    counted::bindTexture(GL_TEXTURE_2D, mAlbedoSpecular);
+    glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+    counted::bindTexture(GL_TEXTURE_2D, mNormal);
+    glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+    counted::bindTexture(GL_TEXTURE_2D, mDepthStencil);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Every light adds its contribution on top of the others
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDepthMask(GL_FALSE);
+
+    glm::mat4 inverseViewProjection { glm::inverse(projection * view) };
+    auto setCommonUniforms = [&](Shader& shader) {
+        shader.use();
+        shader.setInt("gAlbedoSpecular", ALBEDO_SPECULAR_UNIT);
+        shader.setInt("gNormal", NORMAL_UNIT);
+        shader.setInt("gDepth", DEPTH_UNIT);
+        shader.setMat4("view", view);
+        shader.setMat4("inverseViewProjection", inverseViewProjection);
+        shader.setVec2("screenSize", glm::vec2(mWidth, mHeight));
+        shader.setVec3("eyePos", eyePos);
+        lights.bindLightData(shader);
+        shadows.bind(shader);
+    };
+
+    // Directional lights light every pixel
+    glDisable(GL_DEPTH_TEST);
+    setCommonUniforms(mDirectionalShader);
+    counted::bindVertexArray(mFullscreenVAO);
+    counted::drawArraysInstanced(GL_TRIANGLES, 0, 3, lights.getDirectionalLightCount());
+
+    // Point and spot lights light only what's inside their volume.
+    // Drawing back faces with GEQUAL keeps this correct when the
+    // camera is inside a volume, and depth clamping keeps back faces
+    // past the far plane from being clipped away
+    mInstances.clear();
+    for(std::size_t i {0}; i < lights.getLightCount(); ++i) {
+        float range { lights.getLightRange(i) };
+        if(std::isinf(range)) continue;
+        mInstances.push_back(VolumeInstance {
+            .mPositionRange { glm::vec4(lights.getLight(i).mPosition, range) },
+            .mLightIndex { static_cast<GLuint>(i) }
+        });
+    }
+    if(!mInstances.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, mInstances.size() * sizeof(VolumeInstance), &mInstances[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_GEQUAL);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glEnable(GL_DEPTH_CLAMP);
+        setCommonUniforms(mVolumeShader);
+        mVolumeShader.setMat4("projection", projection);
+        counted::bindVertexArray(mVolumeVAO);
+        counted::drawElementsInstanced(GL_TRIANGLES, mVolumeIndexCount, GL_UNSIGNED_INT, nullptr, mInstances.size());
+        glDisable(GL_DEPTH_CLAMP);
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+    }
+    counted::bindVertexArray(0);
+
+    // Put back the state the forward path expects
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
@@ -0,0 +1,98 @@
+#ifndef ZODEFERREDRENDERER_H
+#define ZODEFERREDRENDERER_H
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "clusteredlighting.hpp"
+#include "shadowmaps.hpp"
+
+/*
+Deferred shading path. The geometry pass writes a compact G-buffer:
+
+    0: RGBA8   albedo (rgb), specular intensity (a)
+    1: RG16F   octahedral-encoded world normal
+    depth:     24-bit depth, 8-bit stencil; positions are rebuilt
+               from it in the lighting pass
+
+The lighting pass then draws one full-screen triangle per directional
+light and one sphere volume per point or spot light, both instanced
+and blended additively, so lighting cost follows the pixels each
+light actually covers rather than scene overdraw
+*/
+class DeferredRenderer {
+public:
+    DeferredRenderer(int width, int height);
+    ~DeferredRenderer();
+
+    DeferredRenderer(const DeferredRenderer& other) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer& other) = delete;
+
+    bool getBuildSuccess();
+
+    // (Re)create G-buffer attachments at the given size
+    void resize(int width, int height);
+
+    // Bind and clear the G-buffer and put the geometry pass shader
+    // into use, with view and projection set. Scene draws go
+    // through the shader returned
+    const Shader& beginGeometryPass(const glm::mat4& view, const glm::mat4& projection);
+    // Switch the geometry pass to the shader for virtual-textured
+    // draws (see virtualtexture.hpp), which still need its atlas bound
+    const Shader& useVirtualGeometryShader(const glm::mat4& view, const glm::mat4& projection);
+    // Or to the one impostors (see impostor.hpp) are drawn with
+    const Shader& useImpostorGeometryShader(const glm::mat4& view, const glm::mat4& projection);
+    // Or to the one skinned characters (see animation.hpp) are drawn
+    // with, which still needs the bone palette bound
+    const Shader& useSkinnedGeometryShader(const glm::mat4& view, const glm::mat4& projection);
+
+    // Where the lighting pass draws to; the default framebuffer
+    // unless set. Must be the same size as the G-buffer
+    void setOutputFramebuffer(GLuint framebuffer) { mOutputFBO = framebuffer; }
+
+    // Light the G-buffer into the output framebuffer, whose depth
+    // is replaced by the scene's
+    void lightingPass(const LightClusters& lights, const ShadowMaps& shadows, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eyePos);
+
+private:
+    void freeTargets();
+    void buildLightVolume();
+
+    int mWidth {0};
+    int mHeight {0};
+
+    GLuint mOutputFBO {0};
+    GLuint mFBO {0};
+    GLuint mAlbedoSpecular {0};
+    GLuint mNormal {0};
+    GLuint mDepthStencil {0};
+
+    Shader mGeometryShader;
+    Shader mVirtualGeometryShader;
+    Shader mImpostorGeometryShader;
+    Shader mSkinnedGeometryShader;
+    Shader mDirectionalShader;
+    Shader mVolumeShader;
+
+    // Empty VAO for the full-screen triangle, whose vertices are
+    // generated in the vertex shader
+    GLuint mFullscreenVAO {0};
+
+    // Sphere mesh plus per-instance light data for light volumes
+    GLuint mVolumeVAO {0};
+    GLuint mVolumeVBO {0};
+    GLuint mVolumeEBO {0};
+    GLuint mInstanceVBO {0};
+    GLsizei mVolumeIndexCount {0};
+
+    struct VolumeInstance {
+        glm::vec4 mPositionRange;
+        GLuint mLightIndex;
+    };
+    std::vector<VolumeInstance> mInstances;
+};
+
+#endif
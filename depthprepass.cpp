@@ -0,0 +1,43 @@
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "commandbuffer.hpp"
+#include "profiler.hpp"
+#include "depthprepass.hpp"
+
+DepthPrepass::DepthPrepass():
+    mOpaqueShader {"shaders/depth.vs", "shaders/depth.fs"},
+    mAlphaTestedShader {"shaders/depth.vs", "shaders/depth.fs", "#define ALPHA_TEST"}
+{}
+
+bool DepthPrepass::getBuildSuccess() {
+    return mOpaqueShader.getBuildSuccess() && mAlphaTestedShader.getBuildSuccess();
+}
+
+void DepthPrepass::render(const CommandQueue& commands, const glm::mat4& view, const glm::mat4& projection, bool alphaTested) {
+    PROFILE_ZONE("DepthPrepass::render");
+    PROFILE_GPU_ZONE("Depth pre-pass");
+    Shader& shader { alphaTested? mAlphaTestedShader: mOpaqueShader };
+    shader.use();
+    shader.setMat4("view", view);
+    shader.setMat4("projection", projection);
+    if(alphaTested) shader.setInt("material.texture_diffuse1", 0);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    commands.submit(shader);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void DepthPrepass::beginShadingPass() {
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+void DepthPrepass::endShadingPass() {
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
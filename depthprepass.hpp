@@ -0,0 +1,39 @@
+#ifndef ZODEPTHPREPASS_H
+#define ZODEPTHPREPASS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "commandbuffer.hpp"
+
+/*
+Depth-only pre-pass. Scene depth is laid down first with a minimal
+shader, after which the shading pass tests for an exact depth match
+with depth writes off, so every pixel runs the lighting shader at
+most once. Shading pass shaders should be built with
+DEPTH_EQUAL_PASS defined, so that they skip their own alpha test
+and keep early depth rejection
+*/
+class DepthPrepass {
+public:
+    DepthPrepass();
+
+    bool getBuildSuccess();
+
+    // Write depth (and nothing else) for every draw in commands.
+    // Alpha tested draws cut out transparent texels, at the cost of
+    // a texture read and losing early depth rejection themselves
+    void render(const CommandQueue& commands, const glm::mat4& view, const glm::mat4& projection, bool alphaTested);
+
+    // Depth state for the shading pass that follows, and the default
+    // state to go back to afterwards
+    void beginShadingPass();
+    void endShadingPass();
+
+private:
+    Shader mOpaqueShader;
+    Shader mAlphaTestedShader;
+};
+
+#endif
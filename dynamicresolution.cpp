@@ -0,0 +1,208 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "dynamicresolution.hpp"
+
+namespace {
+    // Timings in flight; results are read this many frames late
+    constexpr std::size_t QUERY_COUNT {4};
+    // Scales are multiples of this
+    constexpr float SCALE_STEP {.05f};
+    // Frames to wait after a change, for timings at the new scale
+    // to come back and settle, before the next
+    constexpr std::uint64_t FRAMES_BETWEEN_CHANGES {15};
+    // Weight of each new timing in the smoothed average
+    constexpr float SMOOTHING {.1f};
+    // Share of the budget a change aims for, leaving room for noise.
+    // Between it and the whole budget the scale is left alone
+    constexpr float TARGET_SHARE {.9f};
+    // Largest drop, and rise, in scale a single change makes
+    constexpr float MAX_DROP {.75f};
+    constexpr float MAX_RISE {1.1f};
+}
+
+DynamicResolution::DynamicResolution(const Settings& settings):
+    mSettings {settings},
+    mUpscaleShader {"shaders/upscale.vs", "shaders/upscale.fs"},
+    mQueries(QUERY_COUNT)
+{
+    mSettings.mMinScale = std::clamp(mSettings.mMinScale, SCALE_STEP, 2.f);
+    mSettings.mMaxScale = std::clamp(mSettings.mMaxScale, mSettings.mMinScale, 2.f);
+    mScale = std::clamp(1.f, mSettings.mMinScale, mSettings.mMaxScale);
+
+    glGenFramebuffers(1, &mFBO);
+    glGenVertexArrays(1, &mFullscreenVAO);
+    for(TimerQuery& query: mQueries) glGenQueries(1, &query.mQuery);
+}
+
+DynamicResolution::~DynamicResolution() {
+    for(TimerQuery& query: mQueries) glDeleteQueries(1, &query.mQuery);
+    glDeleteVertexArrays(1, &mFullscreenVAO);
+    glDeleteFramebuffers(1, &mFBO);
+    if(mColor) glDeleteTextures(1, &mColor);
+    if(mDepthStencil) glDeleteRenderbuffers(1, &mDepthStencil);
+}
+
+bool DynamicResolution::getBuildSuccess() {
+    return mUpscaleShader.getBuildSuccess();
+}
+
+void DynamicResolution::resize(int width, int height) {
+    mOutputWidth = std::max(1, width);
+    mOutputHeight = std::max(1, height);
+    resizeTarget();
+}
+
+void DynamicResolution::setEnabled(bool enabled) {
+    mEnabled = enabled;
+    mFramesSinceChange = 0;
+}
+
+void DynamicResolution::resizeTarget() {
+    getRenderSize(mRenderWidth, mRenderHeight);
+
+    if(mColor) glDeleteTextures(1, &mColor);
+    if(mDepthStencil) glDeleteRenderbuffers(1, &mDepthStencil);
+
+    // Filtered, since the upscale samples between texels
+    glGenTextures(1, &mColor);
+    counted::bindTexture(GL_TEXTURE_2D, mColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, mRenderWidth, mRenderHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &mDepthStencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, mDepthStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, mRenderWidth, mRenderHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLint framebuffer {0};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, mDepthStencil);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::DYNAMICRESOLUTION::TARGET_INCOMPLETE" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+bool DynamicResolution::update() {
+    // Oldest first; once one isn't back, none after it are either
+    for(std::size_t i {0}; i < mQueries.size(); ++i) {
+        TimerQuery& query { mQueries[(mNextQuery + i) % mQueries.size()] };
+        if(!query.mPending) continue;
+        GLint available {0};
+        glGetQueryObjectiv(query.mQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) break;
+        GLuint64 elapsed {0};
+        glGetQueryObjectui64v(query.mQuery, GL_QUERY_RESULT, &elapsed);
+        query.mPending = false;
+
+        float ms { static_cast<float>(elapsed) * 1e-6f };
+        mSmoothedMs = mHasTiming? mSmoothedMs + (ms - mSmoothedMs) * SMOOTHING: ms;
+        mHasTiming = true;
+    }
+
+    if(mEnabled && mHasTiming && ++mFramesSinceChange >= FRAMES_BETWEEN_CHANGES) {
+        // Most of the scene's cost goes with its pixel count, so the
+        // scale goes with the square root of the time
+        float wanted { mScale * std::sqrt(mSettings.mBudgetMs * TARGET_SHARE / std::max(mSmoothedMs, 1e-3f)) };
+        wanted = std::clamp(wanted, mScale * MAX_DROP, mScale * MAX_RISE);
+        float stepped { std::floor(wanted / SCALE_STEP + 1e-3f) * SCALE_STEP };
+        float scale {mScale};
+        if(mSmoothedMs > mSettings.mBudgetMs) scale = std::min(stepped, mScale - SCALE_STEP);
+        else if(stepped >= mScale + SCALE_STEP - 1e-3f) scale = stepped;
+        scale = std::clamp(scale, mSettings.mMinScale, mSettings.mMaxScale);
+
+        if(std::abs(scale - mScale) > 1e-3f) {
+            // Until timings at the new scale come back, expect them to
+            // have changed with the pixel count
+            mSmoothedMs *= (scale * scale) / (mScale * mScale);
+            mScale = scale;
+            mFramesSinceChange = 0;
+        }
+    }
+
+    int width {mRenderWidth}, height {mRenderHeight};
+    getRenderSize(width, height);
+    if(width == mRenderWidth && height == mRenderHeight) return false;
+    resizeTarget();
+    return true;
+}
+
+void DynamicResolution::getRenderSize(int& width, int& height) const {
+    float scale { mEnabled? mScale: 1.f };
+    width = std::max(1, static_cast<int>(std::lround(mOutputWidth * scale)));
+    height = std::max(1, static_cast<int>(std::lround(mOutputHeight * scale)));
+}
+
+void DynamicResolution::beginScene() {
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glViewport(0, 0, mRenderWidth, mRenderHeight);
+
+    // Skip timing this frame rather than wait, if every query's
+    // still in flight
+    TimerQuery& query { mQueries[mNextQuery] };
+    if(query.mPending) return;
+    glBeginQuery(GL_TIME_ELAPSED, query.mQuery);
+    query.mPending = true;
+}
+
+void DynamicResolution::endScene() {
+    TimerQuery& query { mQueries[mNextQuery] };
+    if(!query.mPending) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    mNextQuery = (mNextQuery + 1) % mQueries.size();
+}
+
+void DynamicResolution::present(GLuint framebuffer) {
+    PROFILE_GPU_ZONE("Upscale");
+    if(mRenderWidth == mOutputWidth && mRenderHeight == mOutputHeight) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, mFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glBlitFramebuffer(
+            0, 0, mRenderWidth, mRenderHeight, 0, 0, mOutputWidth, mOutputHeight,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST
+        );
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, mOutputWidth, mOutputHeight);
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, mOutputWidth, mOutputHeight);
+    // Whatever the scene was drawn with, this covers every pixel
+    GLboolean depthTest { glIsEnabled(GL_DEPTH_TEST) };
+    GLboolean blend { glIsEnabled(GL_BLEND) };
+    GLint polygonMode[2] {GL_FILL, GL_FILL};
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    mUpscaleShader.use();
+    mUpscaleShader.setInt("scene", 0);
+    mUpscaleShader.setVec2("sourceTexelSize", glm::vec2(1.f / mRenderWidth, 1.f / mRenderHeight));
+    // Sharpening only makes up for what's lost upscaling
+    mUpscaleShader.setFloat("sharpness", mScale < 1.f? mSettings.mSharpness: 0.f);
+    glActiveTexture(GL_TEXTURE0);
+    counted::bindTexture(GL_TEXTURE_2D, mColor);
+    counted::bindVertexArray(mFullscreenVAO);
+    counted::drawArrays(GL_TRIANGLES, 0, 3);
+    counted::bindVertexArray(0);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+
+    if(depthTest) glEnable(GL_DEPTH_TEST);
+    if(blend) glEnable(GL_BLEND);
+    glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+}
@@ -0,0 +1,108 @@
+#ifndef ZODYNAMICRESOLUTION_H
+#define ZODYNAMICRESOLUTION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+
+/*
+Dynamic resolution. The scene is drawn into an offscreen target some
+fraction of the output's size, then upscaled and sharpened into the
+output; anything drawn after that (UI, HUD) is at full resolution.
+
+The fraction is chosen from how long the GPU takes over the scene,
+timed with queries read back a few frames later so nothing waits on
+them. Their smoothed average is held against a budget: over it the
+scale comes down, well under it the scale goes back up, by steps
+sized from the difference, since the cost of most of a frame follows
+the pixel count. Scales are quantised, and changed only every so many
+frames, so the target isn't reallocated over and over by noise
+*/
+class DynamicResolution {
+public:
+    struct Settings {
+        float mMinScale {.5f};
+        float mMaxScale {1.f};
+        float mBudgetMs {1000.f / 60.f}; // GPU time for the scene
+        float mSharpness {.5f};          // 0 upscales only, 1 the most
+    };
+
+    explicit DynamicResolution(const Settings& settings);
+    ~DynamicResolution();
+
+    DynamicResolution(const DynamicResolution& other) = delete;
+    DynamicResolution& operator=(const DynamicResolution& other) = delete;
+
+    bool getBuildSuccess();
+
+    // Size everything for an output of width x height, keeping the
+    // current scale
+    void resize(int width, int height);
+
+    // Disabled, the scene is drawn at the output's full size
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return mEnabled; }
+
+    // Take in any timings that have come back and pick this frame's
+    // scale. True if the render size changed, so everything sized
+    // from it has to be resized too. Call before beginScene()
+    bool update();
+
+    // Bind the scene target, set the viewport to the render size,
+    // and start timing the scene's GPU work
+    void beginScene();
+    // Stop timing. The scene target stays bound
+    void endScene();
+
+    // Upscale and sharpen the scene into framebuffer, at output size;
+    // a straight copy if they're the same size. Leaves framebuffer
+    // bound, with the viewport over all of it
+    void present(GLuint framebuffer);
+
+    // Where the scene is drawn; its name never changes
+    GLuint getFramebuffer() const { return mFBO; }
+    int getRenderWidth() const { return mRenderWidth; }
+    int getRenderHeight() const { return mRenderHeight; }
+    int getOutputWidth() const { return mOutputWidth; }
+    int getOutputHeight() const { return mOutputHeight; }
+    float getScale() const { return mScale; }
+    // Smoothed GPU time for the scene, in milliseconds
+    float getGPUTimeMs() const { return mSmoothedMs; }
+
+private:
+    struct TimerQuery {
+        GLuint mQuery {0};
+        bool mPending {false};
+    };
+
+    // What the render size should be for the output size and scale
+    void getRenderSize(int& width, int& height) const;
+    void resizeTarget();
+
+    Settings mSettings;
+    bool mEnabled {true};
+    float mScale {1.f};
+    int mOutputWidth {0};
+    int mOutputHeight {0};
+    int mRenderWidth {0};
+    int mRenderHeight {0};
+
+    GLuint mFBO {0};
+    GLuint mColor {0};
+    GLuint mDepthStencil {0};
+    Shader mUpscaleShader;
+    GLuint mFullscreenVAO {0};
+
+    // Queries in flight, oldest at mNextQuery
+    std::vector<TimerQuery> mQueries;
+    std::size_t mNextQuery {0};
+    float mSmoothedMs {0.f};
+    bool mHasTiming {false};
+    std::uint64_t mFramesSinceChange {0};
+};
+
+#endif
@@ -1,3 +1,5 @@
+#include <utility>
+
 //SDL
 #include <SDL2/SDL.h>
 
@@ -11,6 +13,7 @@
 
 // Local libraries
 #include "shared_globals.hpp"
+#include "utility.hpp"
 
 // class header
 #include "flycamera.hpp"
@@ -20,6 +23,8 @@ const float MAX_PITCH {89.f};
 const float MIN_PITCH {-89.f};
 const float MAX_FOV {80.f};
 const float MIN_FOV {40.f};
+const float NEAR_PLANE {1.f};
+const float FAR_PLANE {50.f};
 
 FlyCamera::FlyCamera(): 
     FlyCamera {
@@ -32,6 +37,7 @@ FlyCamera::FlyCamera():
 FlyCamera::FlyCamera(glm::vec3 position, float yaw, float pitch, float fov): 
     mFOV {fov},
     mPosition {position},
+    mPreviousPosition {position},
     mOrientation {
         yaw, 
         pitch
@@ -44,6 +50,7 @@ FlyCamera::FlyCamera(glm::vec3 position, float yaw, float pitch, float fov):
 }
 
 void FlyCamera::update(float deltaTime) {
+    mPreviousPosition = mPosition;
     if(!mActive) return;
 
     //Calculate new orientation and position vectors
@@ -53,12 +60,42 @@ void FlyCamera::update(float deltaTime) {
         sin(glm::radians(mOrientation.y)),
         cos(glm::radians(mOrientation.y)) * (-cos(glm::radians(mOrientation.x)))
     };
-    mPosition += deltaTime * mVelocity.z * cameraDirection;
-    mPosition += deltaTime * mVelocity.x * glm::normalize(glm::cross(cameraDirection, tempUp));
+    glm::vec3 target { mPosition + deltaTime * mVelocity.z * cameraDirection };
+    target += deltaTime * mVelocity.x * glm::normalize(glm::cross(cameraDirection, tempUp));
+    mPosition = mCollider && target != mPosition? mCollider(mPosition, target): target;
+}
+
+void FlyCamera::setInterpolation(float alpha) {
+    mInterpolation = alpha;
+}
+
+void FlyCamera::setPose(glm::vec3 position, float yaw, float pitch) {
+    mPosition = mPreviousPosition = position;
+    mOrientation = glm::vec2 {yaw, pitch};
+    updateYaw(0.f);
+    updatePitch(0.f);
+}
+
+FlyCamera::State FlyCamera::getState() const {
+    return State {
+        .mPosition { mPosition },
+        .mOrientation { mOrientation },
+        .mFOV { mFOV },
+        .mVelocity { mVelocity },
+        .mActive { mActive }
+    };
+}
+
+void FlyCamera::setState(const State& state) {
+    mPosition = mPreviousPosition = state.mPosition;
+    mOrientation = state.mOrientation;
+    mFOV = state.mFOV;
+    mVelocity = state.mVelocity;
+    setActive(state.mActive);
 }
 
 glm::vec3 FlyCamera::getPosition() {
-    return mPosition;
+    return glm::mix(mPreviousPosition, mPosition, mInterpolation);
 }
 glm::vec3 FlyCamera::getForward() {
     glm::vec3 cameraDirection {
@@ -74,8 +111,8 @@ glm::mat4 FlyCamera::getViewMatrix(){
     glm::vec3 cameraDirection { getForward() };
     glm::mat4 viewMatrix {
         glm::lookAt(
-            mPosition,
-            mPosition + cameraDirection,
+            getPosition(),
+            getPosition() + cameraDirection,
             tempUp
         )
     };
@@ -86,14 +123,23 @@ glm::mat4 FlyCamera::getProjectionMatrix(){
     glm::mat4 projectionMatrix {
         glm::perspective(
             static_cast<float>(glm::radians(mFOV)),
-            static_cast<float>(gWindowWidth)/static_cast<float>(gWindowHeight),
-            1.f,
-            50.f
+            getAspectRatio(),
+            NEAR_PLANE,
+            FAR_PLANE
         )
     };
     return projectionMatrix;
 }
 
+float FlyCamera::getFOV() { return mFOV; }
+float FlyCamera::getAspectRatio() {
+    int width {0}, height {0};
+    getDrawableSize(width, height);
+    return static_cast<float>(width)/static_cast<float>(height);
+}
+float FlyCamera::getNearPlane() { return NEAR_PLANE; }
+float FlyCamera::getFarPlane() { return FAR_PLANE; }
+
 void FlyCamera::processInput(SDL_Event* event) {
     if(!event) return;
 
@@ -166,6 +212,10 @@ void FlyCamera::setActive(bool active) {
     SDL_ShowCursor(mActive? SDL_FALSE: SDL_TRUE);
 }
 
+void FlyCamera::setCollider(Collider collider) {
+    mCollider = std::move(collider);
+}
+
 void FlyCamera::setLookSensitivity(float lookSensitivity) {
     mLookSensitivity = lookSensitivity;
 }
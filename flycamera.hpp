@@ -1,6 +1,8 @@
 #ifndef ZOFLYCAM_H
 #define ZOFLYCAM_H
 
+#include <functional>
+
 #include <SDL2/SDL.h>
 
 #include <GL/glew.h>
@@ -12,10 +14,33 @@
 
 class FlyCamera {
 public:
+    // Given where a step would move the camera from and to, where it
+    // may actually go
+    using Collider = std::function<glm::vec3(const glm::vec3& from, const glm::vec3& to)>;
+
+    // Everything update() depends on, for putting the camera back
+    // exactly as it was
+    struct State {
+        glm::vec3 mPosition;
+        glm::vec2 mOrientation; // yaw and pitch, in degrees
+        float mFOV;
+        glm::vec3 mVelocity;
+        bool mActive;
+    };
+
     FlyCamera();
     FlyCamera(glm::vec3 position, float yaw, float pitch, float fov);
 
+    // Advance the camera by one simulation step
     void update(float deltaTime);
+    // Blend between the positions before and after the last update
+    // (0 to 1), for rendering between simulation steps
+    void setInterpolation(float alpha);
+    // Jump straight to a position and orientation (degrees), with
+    // nothing to interpolate from
+    void setPose(glm::vec3 position, float yaw, float pitch);
+    State getState() const;
+    void setState(const State& state);
     void processInput(SDL_Event* event);
 
     glm::vec3 getPosition();
@@ -23,7 +48,18 @@ public:
     glm::mat4 getViewMatrix();
     glm::mat4 getProjectionMatrix();
 
+    // Projection parameters, for anything that has to fit itself to
+    // the camera's frustum
+    float getFOV();
+    float getAspectRatio();
+    float getNearPlane();
+    float getFarPlane();
+
     void setActive(bool active);
+    bool isActive() const { return mActive; }
+    // Keep steps out of whatever collider says; an empty one lets
+    // the camera go anywhere
+    void setCollider(Collider collider);
     void setLookSensitivity(float lookSensitivity);
     void setZoomSensitivity(float zoomSensitivity);
 
@@ -38,8 +74,11 @@ private:
     float mZoomSensitivity { 1.5f };
 
     glm::vec3 mPosition; //position in world units
+    glm::vec3 mPreviousPosition; //position before the last update
+    float mInterpolation { 1.f };
     glm::vec2 mOrientation; // pitch and yaw, in degrees
-    glm::vec3 mVelocity;
+    glm::vec3 mVelocity {0.f};
+    Collider mCollider {};
 };
 
 #endif
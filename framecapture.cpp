@@ -0,0 +1,315 @@
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <GL/glew.h>
+
+#include "profiler.hpp"
+#include "framecapture.hpp"
+
+// How long the GL thread waits on a readback before giving up on it
+const GLuint64 READBACK_TIMEOUT_NS {1000000000};
+
+static bool savePNG(const std::string& path, int width, int height, const std::vector<std::uint8_t>& pixels) {
+    SDL_Surface* surface {
+        SDL_CreateRGBSurfaceWithFormatFrom(
+            const_cast<std::uint8_t*>(&pixels[0]), width, height, 32, width * 4, SDL_PIXELFORMAT_RGBA32
+        )
+    };
+    bool saved { surface && IMG_SavePNG(surface, path.c_str()) == 0 };
+    SDL_FreeSurface(surface);
+    if(!saved) std::cout << "ERROR::FRAMECAPTURE::PNG_NOT_SAVED " << path << std::endl;
+    return saved;
+}
+
+FrameCapture::FrameCapture(std::size_t slotCount):
+    mSlots(std::max<std::size_t>(2, slotCount))
+{
+    for(Slot& slot: mSlots) glGenBuffers(1, &slot.mPBO);
+    mWriter = std::thread {&FrameCapture::writerLoop, this};
+}
+
+FrameCapture::~FrameCapture() {
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mQuit = true;
+    }
+    mJobReady.notify_all();
+    mWriter.join();
+
+    for(Slot& slot: mSlots) {
+        glDeleteSync(slot.mFence);
+        glDeleteBuffers(1, &slot.mPBO);
+    }
+}
+
+FrameCapture::Format FrameCapture::formatFromPath(const std::string& path) {
+    std::string extension { path.substr(std::min(path.size(), path.rfind('.'))) };
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if(extension == ".y4m") return y4m;
+    if(extension == ".rgba" || extension == ".raw") return rgba;
+    return png;
+}
+
+bool FrameCapture::beginStream(const std::string& path, Format format, int frameRate) {
+    endStream();
+
+    // Nothing is being written now, so the writer's state is ours
+    if(format != png) {
+        mStream.open(path, std::ios::binary | std::ios::trunc);
+        if(!mStream) {
+            std::cout << "ERROR::FRAMECAPTURE::STREAM_NOT_OPENED " << path << std::endl;
+            return false;
+        }
+    }
+    mFormat = format;
+    mStreamPath = path;
+    mFrameRate = std::max(1, frameRate);
+    mStreamFrames = 0;
+    mStreamWidth = 0;
+    mStreamHeight = 0;
+    mStalls = 0;
+    mStreaming = true;
+    std::cout << "Capturing frames to " << path << std::endl;
+    return true;
+}
+
+void FrameCapture::endStream() {
+    if(!mStreaming) return;
+    flush();
+    mStreaming = false;
+    if(mStream.is_open()) mStream.close();
+    std::cout << "Captured " << mStreamFrames << " frames to " << mStreamPath;
+    if(mStalls) std::cout << " (waited on the writer " << mStalls << " times)";
+    std::cout << std::endl;
+}
+
+void FrameCapture::requestScreenshot(const std::string& path) {
+    mScreenshotPath = path;
+}
+
+void FrameCapture::capture(int width, int height) {
+    PROFILE_ZONE("FrameCapture::capture");
+    update(false);
+    if(!mStreaming && mScreenshotPath.empty()) return;
+
+    // Slots are used round robin, so the next one is the oldest still
+    // in flight, if any are
+    Slot& slot { mSlots[mNextSlot] };
+    if(slot.mState != idle) {
+        ++mStalls;
+        while(slot.mState != idle) update(true);
+    }
+    mNextSlot = (mNextSlot + 1) % mSlots.size();
+
+    GLsizeiptr size { static_cast<GLsizeiptr>(width) * height * 4 };
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.mPBO);
+    if(slot.mSize != size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot.mSize = size;
+    }
+    // With a pack buffer bound this only queues a copy into it
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.mFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.mState = reading;
+    mInFlight.push_back(Job {
+        .mSlot { &slot },
+        .mWidth { width },
+        .mHeight { height },
+        .mToStream { mStreaming },
+        .mScreenshotPath { mScreenshotPath },
+        .mFrame { mStreaming? mStreamFrames++: 0 }
+    });
+    mScreenshotPath.clear();
+}
+
+void FrameCapture::update(bool wait) {
+    // Readbacks finish in the order they were started, since fences
+    // signal in order and the writer takes jobs in order, so only the
+    // oldest is ever waited on
+    for(Job& job: mInFlight) {
+        Slot& slot { *job.mSlot };
+        if(slot.mState != reading) continue;
+
+        bool oldest { &job == &mInFlight.front() };
+        GLenum status {
+            glClientWaitSync(slot.mFence, GL_SYNC_FLUSH_COMMANDS_BIT, (wait && oldest)? READBACK_TIMEOUT_NS: 0)
+        };
+        if(status == GL_TIMEOUT_EXPIRED && !(wait && oldest)) break;
+        glDeleteSync(slot.mFence);
+        slot.mFence = nullptr;
+        slot.mState = writing;
+
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.mPBO);
+            slot.mPixels = static_cast<const std::uint8_t*>(
+                glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.mSize, GL_MAP_READ_BIT)
+            );
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        if(!slot.mPixels) {
+            std::cout << "ERROR::FRAMECAPTURE::READBACK_FAILED" << std::endl;
+            slot.mReleased = true;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock {mMutex};
+            mJobs.push_back(job);
+        }
+        mJobReady.notify_one();
+    }
+
+    while(!mInFlight.empty()) {
+        Slot& slot { *mInFlight.front().mSlot };
+        if(slot.mState != writing) break;
+        if(!slot.mReleased) {
+            if(!wait) break;
+            std::unique_lock<std::mutex> lock {mMutex};
+            mIdle.wait(lock, [&slot]{ return slot.mReleased.load(); });
+        }
+        recycle(slot);
+        mInFlight.pop_front();
+        wait = false;
+    }
+}
+
+void FrameCapture::recycle(Slot& slot) {
+    if(slot.mPixels) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.mPBO);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    slot.mPixels = nullptr;
+    slot.mReleased = false;
+    slot.mState = idle;
+}
+
+void FrameCapture::flush() {
+    while(!mInFlight.empty()) update(true);
+    std::unique_lock<std::mutex> lock {mMutex};
+    mIdle.wait(lock, [this]{ return mJobs.empty() && !mWriting; });
+}
+
+void FrameCapture::writerLoop() {
+    PROFILE_THREAD_NAME("Frame writer");
+    std::vector<std::uint8_t> pixels;
+    for(;;) {
+        Job job {};
+        {
+            std::unique_lock<std::mutex> lock {mMutex};
+            mJobReady.wait(lock, [this]{ return mQuit || !mJobs.empty(); });
+            if(mJobs.empty()) return;
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+            mWriting = true;
+        }
+
+        // Copy the frame out, flipping it the right way up, and hand
+        // the buffer back before the slow part
+        std::size_t rowSize { static_cast<std::size_t>(job.mWidth) * 4 };
+        pixels.resize(rowSize * job.mHeight);
+        const std::uint8_t* source { job.mSlot->mPixels };
+        for(int row {0}; row < job.mHeight; ++row)
+            std::memcpy(&pixels[row * rowSize], source + (job.mHeight - 1 - row) * rowSize, rowSize);
+        {
+            std::lock_guard<std::mutex> lock {mMutex};
+            job.mSlot->mReleased = true;
+        }
+        mIdle.notify_all();
+
+        writeFrame(job, pixels);
+
+        {
+            std::lock_guard<std::mutex> lock {mMutex};
+            mWriting = false;
+        }
+        mIdle.notify_all();
+    }
+}
+
+void FrameCapture::writeFrame(const Job& job, const std::vector<std::uint8_t>& pixels) {
+    PROFILE_ZONE("FrameCapture::writeFrame");
+    if(!job.mScreenshotPath.empty() && savePNG(job.mScreenshotPath, job.mWidth, job.mHeight, pixels))
+        std::cout << "Saved screenshot " << job.mScreenshotPath << std::endl;
+    if(!job.mToStream) return;
+
+    if(mFormat == png) {
+        std::ostringstream path {};
+        path << mStreamPath << "_" << std::setw(5) << std::setfill('0') << job.mFrame << ".png";
+        savePNG(path.str(), job.mWidth, job.mHeight, pixels);
+        return;
+    }
+
+    // Video streams are one size throughout; frames that don't match
+    // the first are left out
+    if(!mStreamWidth) {
+        mStreamWidth = job.mWidth;
+        mStreamHeight = job.mHeight;
+        if(mFormat == y4m)
+            mStream << "YUV4MPEG2 W" << mStreamWidth << " H" << mStreamHeight
+                << " F" << mFrameRate << ":1 Ip A1:1 C420jpeg\n";
+    }
+    if(job.mWidth != mStreamWidth || job.mHeight != mStreamHeight) {
+        std::cout << "ERROR::FRAMECAPTURE::FRAME_SIZE_CHANGED frame " << job.mFrame << " skipped" << std::endl;
+        return;
+    }
+
+    if(mFormat == y4m) writeY4M(job.mWidth, job.mHeight, pixels);
+    else mStream.write(reinterpret_cast<const char*>(&pixels[0]), pixels.size());
+    if(!mStream) std::cout << "ERROR::FRAMECAPTURE::STREAM_WRITE_FAILED " << mStreamPath << std::endl;
+}
+
+void FrameCapture::writeY4M(int width, int height, const std::vector<std::uint8_t>& pixels) {
+    // Full range BT.601, with chroma averaged over each 2x2 block
+    int chromaWidth { (width + 1) / 2 };
+    int chromaHeight { (height + 1) / 2 };
+    std::size_t lumaSize { static_cast<std::size_t>(width) * height };
+    std::size_t chromaSize { static_cast<std::size_t>(chromaWidth) * chromaHeight };
+    mConverted.resize(lumaSize + 2 * chromaSize);
+    std::uint8_t* luma { &mConverted[0] };
+    std::uint8_t* cb { luma + lumaSize };
+    std::uint8_t* cr { cb + chromaSize };
+
+    for(std::size_t i {0}; i < lumaSize; ++i) {
+        const std::uint8_t* pixel { &pixels[i * 4] };
+        luma[i] = static_cast<std::uint8_t>((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2] + 128) >> 8);
+    }
+
+    for(int y {0}; y < chromaHeight; ++y) {
+        int row0 { 2 * y };
+        int row1 { std::min(row0 + 1, height - 1) };
+        for(int x {0}; x < chromaWidth; ++x) {
+            int column0 { 2 * x };
+            int column1 { std::min(column0 + 1, width - 1) };
+            int red {0}, green {0}, blue {0};
+            for(int row: {row0, row1}) {
+                for(int column: {column0, column1}) {
+                    const std::uint8_t* pixel { &pixels[(static_cast<std::size_t>(row) * width + column) * 4] };
+                    red += pixel[0];
+                    green += pixel[1];
+                    blue += pixel[2];
+                }
+            }
+            // Sums of four, so the usual 8 bit shift becomes 10
+            std::size_t i { static_cast<std::size_t>(y) * chromaWidth + x };
+            cb[i] = static_cast<std::uint8_t>(std::clamp(128 + ((-43 * red - 85 * green + 128 * blue + 512) >> 10), 0, 255));
+            cr[i] = static_cast<std::uint8_t>(std::clamp(128 + ((128 * red - 107 * green - 21 * blue + 512) >> 10), 0, 255));
+        }
+    }
+
+    mStream << "FRAME\n";
+    mStream.write(reinterpret_cast<const char*>(&mConverted[0]), mConverted.size());
+}
@@ -0,0 +1,129 @@
+#ifndef ZOFRAMECAPTURE_H
+#define ZOFRAMECAPTURE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+/*
+Screenshots and frame capture without stalling the pipeline. Each
+captured frame is read into one of a ring of pixel buffer objects,
+which the GPU fills asynchronously; a later frame maps it once its
+fence has passed, and a writer thread copies it out and encodes it,
+so the GL thread never waits on the readback or the disk unless the
+writer falls behind.
+
+Frames can be streamed as a PNG sequence, a Y4M video (4:2:0, which
+most players and ffmpeg read directly), or raw top-down RGBA
+*/
+class FrameCapture {
+public:
+    enum Format {
+        png,
+        y4m,
+        rgba
+    };
+
+    explicit FrameCapture(std::size_t slotCount=4);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture& other) = delete;
+    FrameCapture& operator=(const FrameCapture& other) = delete;
+
+    // Capture every frame from now on. PNG sequences are numbered
+    // files starting with path; the other formats go into path
+    bool beginStream(const std::string& path, Format format, int frameRate=60);
+    // Write out everything captured so far and stop
+    void endStream();
+    bool isStreaming() const { return mStreaming; }
+
+    // Save the next captured frame to path as PNG
+    void requestScreenshot(const std::string& path);
+
+    // Start reading back the width x height framebuffer bound for
+    // reading, if streaming or a screenshot is due, and pass on
+    // earlier frames that are ready. Call once a frame, once it's
+    // drawn and before it's presented, on the GL thread
+    void capture(int width, int height);
+
+    // Wait until every frame captured has been written
+    void flush();
+
+    // Times the GL thread had to wait for a free buffer, because the
+    // writer or the GPU fell behind, since the stream began
+    std::size_t getStallCount() const { return mStalls; }
+
+    // Pick a format from a file extension; PNG for anything unknown
+    static Format formatFromPath(const std::string& path);
+
+private:
+    enum SlotState {
+        idle,
+        reading,  // waiting on the GPU
+        writing   // mapped, waiting on the writer
+    };
+
+    struct Slot {
+        GLuint mPBO {0};
+        GLsizeiptr mSize {0};
+        GLsync mFence {nullptr};
+        SlotState mState {idle};
+        std::atomic<bool> mReleased {false}; // set by the writer once it has copied the pixels out
+        const std::uint8_t* mPixels {nullptr};
+    };
+
+    struct Job {
+        Slot* mSlot;
+        int mWidth;
+        int mHeight;
+        bool mToStream;
+        std::string mScreenshotPath;
+        std::size_t mFrame;
+    };
+
+    // Move ready readbacks on to the writer and recycle released
+    // slots; with wait set, block until the oldest busy slot is
+    // free again
+    void update(bool wait);
+    void recycle(Slot& slot);
+    void writerLoop();
+    void writeFrame(const Job& job, const std::vector<std::uint8_t>& pixels);
+    void writeY4M(int width, int height, const std::vector<std::uint8_t>& pixels);
+
+    std::vector<Slot> mSlots;
+    std::size_t mNextSlot {0};
+    std::deque<Job> mInFlight; // oldest first
+    std::size_t mStalls {0};
+
+    bool mStreaming {false};
+    Format mFormat {png};
+    std::string mStreamPath {};
+    int mFrameRate {60};
+    std::size_t mStreamFrames {0};
+    std::string mScreenshotPath {};
+
+    // Owned by the writer thread while it's running jobs
+    std::ofstream mStream;
+    int mStreamWidth {0};
+    int mStreamHeight {0};
+    std::vector<std::uint8_t> mConverted;
+
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mJobReady;
+    std::condition_variable mIdle;
+    std::deque<Job> mJobs;
+    bool mWriting {false};
+    bool mQuit {false};
+};
+
+#endif
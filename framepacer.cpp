@@ -0,0 +1,157 @@
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+
+#include <SDL2/SDL.h>
+#include <GL/glew.h>
+
+#include "framepacer.hpp"
+
+// Frames longer than this are treated as this long, so a stall
+// doesn't trigger a burst of catch-up steps
+const double MAX_FRAME_TIME {.25};
+
+// Seconds between statistics reports
+const double REPORT_PERIOD {1.0};
+
+// How long to wait on a frame's fence before giving up on it
+const GLuint64 FENCE_TIMEOUT_NS {1000000000};
+
+// The limiter sleeps until this close to its target, then spins, as
+// SDL_Delay can overshoot by a millisecond or more
+const double LIMITER_SPIN_TIME {.002};
+
+FramePacer::FramePacer(float fixedStep, std::size_t maxFramesInFlight):
+    mFixedStep {fixedStep},
+    mMaxFramesInFlight { std::max<std::size_t>(1, maxFramesInFlight) },
+    mFrequency { static_cast<double>(SDL_GetPerformanceFrequency()) },
+    mLastFrameStart { SDL_GetPerformanceCounter() },
+    mLastPresent { mLastFrameStart },
+    mInputTime { mLastFrameStart },
+    mReportStart { mLastFrameStart }
+{}
+
+FramePacer::~FramePacer() {
+    for(FrameInFlight& frame: mFramesInFlight) glDeleteSync(frame.mFence);
+}
+
+FramePacer::SwapMode FramePacer::setSwapMode(SwapMode mode) {
+    if(SDL_GL_SetSwapInterval(mode) != 0) {
+        if(mode != adaptive) {
+            std::cout << "ERROR::FRAMEPACER::SWAP_INTERVAL_UNSUPPORTED" << std::endl;
+            return mSwapMode;
+        }
+        // Late swap tearing isn't available; settle for vsync
+        mode = vsync;
+        SDL_GL_SetSwapInterval(mode);
+    }
+    mSwapMode = mode;
+    return mSwapMode;
+}
+
+void FramePacer::beginFrame() {
+    std::uint64_t now { SDL_GetPerformanceCounter() };
+    double frameTime { toSeconds(now - mLastFrameStart) };
+    mLastFrameStart = now;
+
+    mFrameTime = static_cast<float>(frameTime);
+    mAccumulator += std::min(frameTime, MAX_FRAME_TIME);
+
+    ++mFrames;
+    mFrameTimeSum += frameTime;
+    mFrameTimeSumSq += frameTime * frameTime;
+    mMaxFrameTime = std::max(mMaxFrameTime, frameTime);
+}
+
+bool FramePacer::consumeFixedStep() {
+    if(mAccumulator < mFixedStep) return false;
+    mAccumulator -= mFixedStep;
+    return true;
+}
+
+float FramePacer::getInterpolation() const {
+    return static_cast<float>(mAccumulator / mFixedStep);
+}
+
+void FramePacer::waitForFrameSlot() {
+    // Retire whatever has already finished without blocking, so
+    // latency is measured close to when frames actually complete
+    while(!mFramesInFlight.empty()) {
+        GLenum status { glClientWaitSync(mFramesInFlight.front().mFence, 0, 0) };
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+        retireFrame(false);
+    }
+    while(mFramesInFlight.size() >= mMaxFramesInFlight) retireFrame(true);
+}
+
+void FramePacer::markInputSampled() {
+    mInputTime = SDL_GetPerformanceCounter();
+}
+
+void FramePacer::present(SDL_Window* window) {
+    if(mFrameRateLimit > 0.f) {
+        std::uint64_t target {
+            mLastPresent + static_cast<std::uint64_t>(mFrequency / mFrameRateLimit)
+        };
+        std::uint64_t now { SDL_GetPerformanceCounter() };
+        if(now < target) {
+            double remaining { toSeconds(target - now) };
+            if(remaining > LIMITER_SPIN_TIME)
+                SDL_Delay(static_cast<Uint32>((remaining - LIMITER_SPIN_TIME) * 1000.0));
+            while(SDL_GetPerformanceCounter() < target) {}
+            mLastPresent = target;
+        }
+        // Fell behind; pace from now rather than trying to catch up
+        else mLastPresent = now;
+    }
+    else mLastPresent = SDL_GetPerformanceCounter();
+
+    SDL_GL_SwapWindow(window);
+    mFramesInFlight.push_back(FrameInFlight {
+        .mFence { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) },
+        .mInputTime { mInputTime }
+    });
+}
+
+void FramePacer::retireFrame(bool wait) {
+    FrameInFlight frame { mFramesInFlight.front() };
+    mFramesInFlight.erase(mFramesInFlight.begin());
+
+    if(wait) {
+        GLenum status { glClientWaitSync(frame.mFence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS) };
+        if(status == GL_WAIT_FAILED || status == GL_TIMEOUT_EXPIRED) {
+            glDeleteSync(frame.mFence);
+            return;
+        }
+    }
+    glDeleteSync(frame.mFence);
+
+    double latency { toSeconds(SDL_GetPerformanceCounter() - frame.mInputTime) };
+    ++mLatencyCount;
+    mLatencySum += latency;
+    mMaxLatency = std::max(mMaxLatency, latency);
+}
+
+bool FramePacer::collectStats(FrameStats& stats) {
+    std::uint64_t now { SDL_GetPerformanceCounter() };
+    if(toSeconds(now - mReportStart) < REPORT_PERIOD || mFrames == 0) return false;
+
+    double mean { mFrameTimeSum / mFrames };
+    double variance { std::max(0.0, mFrameTimeSumSq / mFrames - mean * mean) };
+    stats = FrameStats {
+        .mFrames { mFrames },
+        .mMeanFrameTime { mean },
+        .mFrameTimeStdDev { std::sqrt(variance) },
+        .mMaxFrameTime { mMaxFrameTime },
+        .mMeanLatency { mLatencyCount? mLatencySum / mLatencyCount: 0.0 },
+        .mMaxLatency { mMaxLatency }
+    };
+
+    mReportStart = now;
+    mFrames = 0;
+    mFrameTimeSum = mFrameTimeSumSq = mMaxFrameTime = 0.0;
+    mLatencyCount = 0;
+    mLatencySum = mMaxLatency = 0.0;
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef ZOFRAMEPACER_H
+#define ZOFRAMEPACER_H
+
+#include <cstdint>
+#include <vector>
+#include <cstddef>
+
+#include <SDL2/SDL.h>
+#include <GL/glew.h>
+
+/*
+Frame timing and pacing. Time is measured with the high resolution
+performance counter and banked into fixed simulation steps, with the
+leftover fraction exposed for interpolating between the last two
+steps. Presentation can be capped to a frame rate and synced to
+vblank (adaptively, where the driver supports it), and a fence per
+frame keeps the CPU from running more than a set number of frames
+ahead of the GPU
+*/
+class FramePacer {
+public:
+    enum SwapMode {
+        adaptive=-1,
+        immediate=0,
+        vsync=1
+    };
+
+    // Timing statistics over one report period
+    struct FrameStats {
+        std::size_t mFrames;
+        double mMeanFrameTime;   // seconds
+        double mFrameTimeStdDev; // seconds
+        double mMaxFrameTime;    // seconds
+        double mMeanLatency;     // input sampled to frame finished on the GPU, seconds
+        double mMaxLatency;      // seconds
+    };
+
+    FramePacer(float fixedStep=1.f/120.f, std::size_t maxFramesInFlight=2);
+    ~FramePacer();
+
+    FramePacer(const FramePacer& other) = delete;
+    FramePacer& operator=(const FramePacer& other) = delete;
+
+    // Set the swap interval. Adaptive vsync falls back to plain vsync
+    // where it isn't supported; returns the mode actually in effect
+    SwapMode setSwapMode(SwapMode mode);
+    SwapMode getSwapMode() const { return mSwapMode; }
+
+    // Cap on presented frames per second; 0 for none
+    void setFrameRateLimit(float framesPerSecond) { mFrameRateLimit = framesPerSecond; }
+    float getFrameRateLimit() const { return mFrameRateLimit; }
+
+    // Measure the time since the last frame and bank it for fixed
+    // steps
+    void beginFrame();
+
+    // Take one fixed step's worth of banked time, if there is that
+    // much; call in a loop, running one update per true
+    bool consumeFixedStep();
+
+    float getFixedStep() const { return mFixedStep; }
+    // Fraction of a fixed step left banked, for interpolating
+    // between the previous and current simulation state
+    float getInterpolation() const;
+    // Duration of the last frame, in seconds
+    float getFrameTime() const { return mFrameTime; }
+
+    // Block until fewer than the maximum number of frames are queued
+    // on the GPU. Call before issuing any of the frame's GL commands
+    void waitForFrameSlot();
+
+    // Timestamp the input the frame's view is built from; call as
+    // late as possible before drawing
+    void markInputSampled();
+
+    // Wait out the frame rate limit, swap buffers, and fence the
+    // frame
+    void present(SDL_Window* window);
+
+    // True once per report period, filling in stats for the period
+    bool collectStats(FrameStats& stats);
+
+private:
+    struct FrameInFlight {
+        GLsync mFence;
+        std::uint64_t mInputTime;
+    };
+
+    double toSeconds(std::uint64_t ticks) const { return static_cast<double>(ticks) / mFrequency; }
+    void retireFrame(bool wait);
+
+    float mFixedStep;
+    std::size_t mMaxFramesInFlight;
+    SwapMode mSwapMode {immediate};
+    float mFrameRateLimit {0.f};
+
+    double mFrequency;
+    std::uint64_t mLastFrameStart;
+    std::uint64_t mLastPresent;
+    std::uint64_t mInputTime;
+    float mFrameTime {0.f};
+    double mAccumulator {0.0};
+
+    // Oldest first. Only ever a few long, and a vector keeps its
+    // storage where a deque frees and reallocates its chunks
+    std::vector<FrameInFlight> mFramesInFlight;
+
+    // Running sums for the current report period
+    std::uint64_t mReportStart;
+    std::size_t mFrames {0};
+    double mFrameTimeSum {0.0};
+    double mFrameTimeSumSq {0.0};
+    double mMaxFrameTime {0.0};
+    std::size_t mLatencyCount {0};
+    double mLatencySum {0.0};
+    double mMaxLatency {0.0};
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef ZOGLCALLCOUNTS_H
+#define ZOGLCALLCOUNTS_H
+
+#include <cstdint>
+
+#include <GL/glew.h>
+
+// Draws, and the state changes that cost the driver the most CPU time
+struct GLCallCounts {
+    std::uint64_t mDrawCalls {0};
+    std::uint64_t mTriangles {0};
+    std::uint64_t mProgramBinds {0};
+    std::uint64_t mVertexArrayBinds {0};
+    std::uint64_t mTextureBinds {0};
+    std::uint64_t mUniformUploads {0};
+};
+
+// Everything made through the wrappers below, since whoever reads
+// them last reset them. Kept per thread, so a context on another
+// thread doesn't race the GL thread's counts or get mixed into them
+inline thread_local GLCallCounts gGLCallCounts {};
+
+/*
+Counting stand-ins for the GL calls tallied in GLCallCounts, used
+instead of the plain calls everywhere the renderer makes them. Each
+bumps a counter and passes straight through. Everything is drawn as
+triangles, so triangles are counted as a third of the vertices
+*/
+namespace counted {
+    inline void useProgram(GLuint program) {
+        ++gGLCallCounts.mProgramBinds;
+        glUseProgram(program);
+    }
+    inline void bindVertexArray(GLuint vao) {
+        ++gGLCallCounts.mVertexArrayBinds;
+        glBindVertexArray(vao);
+    }
+    inline void bindTexture(GLenum target, GLuint texture) {
+        ++gGLCallCounts.mTextureBinds;
+        glBindTexture(target, texture);
+    }
+
+    inline void drawArrays(GLenum mode, GLint first, GLsizei count) {
+        ++gGLCallCounts.mDrawCalls;
+        gGLCallCounts.mTriangles += count / 3;
+        glDrawArrays(mode, first, count);
+    }
+    inline void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+        ++gGLCallCounts.mDrawCalls;
+        gGLCallCounts.mTriangles += static_cast<std::uint64_t>(count / 3) * instances;
+        glDrawArraysInstanced(mode, first, count, instances);
+    }
+    inline void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+        ++gGLCallCounts.mDrawCalls;
+        gGLCallCounts.mTriangles += count / 3;
+        glDrawElements(mode, count, type, indices);
+    }
+    inline void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances) {
+        ++gGLCallCounts.mDrawCalls;
+        gGLCallCounts.mTriangles += static_cast<std::uint64_t>(count / 3) * instances;
+        glDrawElementsInstanced(mode, count, type, indices, instances);
+    }
+
+    inline void uniform1i(GLint location, GLint value) {
+        ++gGLCallCounts.mUniformUploads;
+        glUniform1i(location, value);
+    }
+    inline void uniform1f(GLint location, GLfloat value) {
+        ++gGLCallCounts.mUniformUploads;
+        glUniform1f(location, value);
+    }
+    inline void uniform2fv(GLint location, GLsizei count, const GLfloat* value) {
+        ++gGLCallCounts.mUniformUploads;
+        glUniform2fv(location, count, value);
+    }
+    inline void uniform3fv(GLint location, GLsizei count, const GLfloat* value) {
+        ++gGLCallCounts.mUniformUploads;
+        glUniform3fv(location, count, value);
+    }
+    inline void uniform4fv(GLint location, GLsizei count, const GLfloat* value) {
+        ++gGLCallCounts.mUniformUploads;
+        glUniform4fv(location, count, value);
+    }
+    inline void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+        ++gGLCallCounts.mUniformUploads;
+        glUniformMatrix4fv(location, count, transpose, value);
+    }
+}
+
+#endif
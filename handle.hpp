@@ -0,0 +1,111 @@
+#ifndef ZOHANDLE_H
+#define ZOHANDLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include "allocation.hpp"
+
+/*
+Generational handles. A handle names a slot and the generation the
+slot was on when the handle was given out; freeing the slot moves it
+on to the next generation, so handles to whatever used to live there
+stop resolving instead of quietly pointing at its replacement.
+Handles are plain values, cheap to copy and safe to hold onto past
+the lifetime of the thing they name.
+
+Tag only keeps handles to different kinds of thing apart
+*/
+template<typename Tag>
+struct Handle {
+    std::uint32_t mIndex {0};
+    std::uint32_t mGeneration {0}; // never 0 for a handle that was given out
+
+    bool isNull() const { return mGeneration == 0; }
+    bool operator==(const Handle& other) const {
+        return mIndex == other.mIndex && mGeneration == other.mGeneration;
+    }
+    bool operator!=(const Handle& other) const { return !(*this == other); }
+};
+
+// Objects looked up by handle. Objects live in a pool and never move,
+// so pointers from get() stay good until the object is removed
+template<typename T, typename Tag>
+class HandlePool {
+public:
+    HandlePool() = default;
+    ~HandlePool() {
+        for(Slot& slot: mSlots) mObjects.destroy(slot.mObject);
+    }
+
+    HandlePool(const HandlePool& other) = delete;
+    HandlePool& operator=(const HandlePool& other) = delete;
+
+    template<typename... Args>
+    Handle<Tag> add(Args&&... args) {
+        std::uint32_t index;
+        if(!mFreeSlots.empty()) {
+            index = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        } else {
+            index = static_cast<std::uint32_t>(mSlots.size());
+            mSlots.push_back(Slot {});
+        }
+        Slot& slot { mSlots[index] };
+        slot.mObject = mObjects.create(std::forward<Args>(args)...);
+        return Handle<Tag> { .mIndex {index}, .mGeneration {slot.mGeneration} };
+    }
+
+    // Destroy what handle names; false if it's already gone
+    bool remove(Handle<Tag> handle) {
+        Slot* slot { find(handle) };
+        if(!slot) return false;
+        mObjects.destroy(slot->mObject);
+        slot->mObject = nullptr;
+        // Generation 0 is kept for null handles
+        if(++slot->mGeneration == 0) slot->mGeneration = 1;
+        mFreeSlots.push_back(handle.mIndex);
+        return true;
+    }
+
+    // What handle names, or nullptr if it's been removed
+    T* get(Handle<Tag> handle) {
+        Slot* slot { find(handle) };
+        return slot? slot->mObject: nullptr;
+    }
+    const T* get(Handle<Tag> handle) const {
+        return const_cast<HandlePool*>(this)->get(handle);
+    }
+
+    // Visit every live object along with its handle
+    template<typename Function>
+    void forEach(Function&& function) {
+        for(std::uint32_t i {0}; i < mSlots.size(); ++i) {
+            if(!mSlots[i].mObject) continue;
+            function(Handle<Tag> { .mIndex {i}, .mGeneration {mSlots[i].mGeneration} }, *mSlots[i].mObject);
+        }
+    }
+
+    std::size_t size() const { return mObjects.getLiveCount(); }
+
+private:
+    struct Slot {
+        std::uint32_t mGeneration {1};
+        T* mObject {nullptr};
+    };
+
+    Slot* find(Handle<Tag> handle) {
+        if(handle.mIndex >= mSlots.size()) return nullptr;
+        Slot& slot { mSlots[handle.mIndex] };
+        if(slot.mGeneration != handle.mGeneration || !slot.mObject) return nullptr;
+        return &slot;
+    }
+
+    ObjectPool<T> mObjects;
+    std::vector<Slot> mSlots;
+    std::vector<std::uint32_t> mFreeSlots;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <iostream>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+
+#include "headlesscontext.hpp"
+
+static const EGLint CONTEXT_ATTRIBUTES[] {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+};
+
+HeadlessContext::~HeadlessContext() {
+    destroy();
+}
+
+bool HeadlessContext::create(int width, int height) {
+    destroy();
+
+    // Prefer the surfaceless platform, which needs no GPU or display
+    // server at all; fall back on whatever EGL picks by default
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay {
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"))
+    };
+    if(getPlatformDisplay)
+        mDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if(mDisplay == EGL_NO_DISPLAY)
+        mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(mDisplay == EGL_NO_DISPLAY || !eglInitialize(mDisplay, nullptr, nullptr)) {
+        std::cout << "ERROR::HEADLESS::EGL_INITIALIZE_FAILED" << std::endl;
+        mDisplay = EGL_NO_DISPLAY;
+        return false;
+    }
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        std::cout << "ERROR::HEADLESS::OPENGL_API_UNAVAILABLE" << std::endl;
+        destroy();
+        return false;
+    }
+
+    // Nothing is ever drawn to an EGL surface, so any config that
+    // can render desktop GL will do, or none at all where
+    // EGL_KHR_no_config_context is supported
+    const EGLint configAttributes[] {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config {nullptr};
+    EGLint configCount {0};
+    eglChooseConfig(mDisplay, configAttributes, &config, 1, &configCount);
+    mConfig = configCount > 0? config: EGLConfig {nullptr};
+
+    mContext = eglCreateContext(mDisplay, mConfig, EGL_NO_CONTEXT, CONTEXT_ATTRIBUTES);
+    if(mContext == EGL_NO_CONTEXT) {
+        std::cout << "ERROR::HEADLESS::CONTEXT_NOT_CREATED" << std::endl;
+        destroy();
+        return false;
+    }
+    if(!eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, mContext)) {
+        std::cout << "ERROR::HEADLESS::SURFACELESS_CONTEXT_UNSUPPORTED" << std::endl;
+        destroy();
+        return false;
+    }
+
+    // A GLX build of GLEW complains that there's no X display once
+    // it has loaded the core functions; that's expected here
+    glewExperimental = GL_TRUE;
+    GLenum glewStatus { glewInit() };
+    if(glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY) {
+        std::cout << "ERROR::HEADLESS::GLEW_INIT_FAILED" << std::endl;
+        destroy();
+        return false;
+    }
+
+    // The offscreen stand-in for the window, laid out the same way
+    // as the window's: RGBA8 colour, 24-bit depth and 8-bit stencil
+    mWidth = width;
+    mHeight = height;
+    glGenRenderbuffers(1, &mColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, mColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, mWidth, mHeight);
+    glGenRenderbuffers(1, &mDepthStencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, mDepthStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, mWidth, mHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &mFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, mDepthStencil);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        destroy();
+        return false;
+    }
+    glViewport(0, 0, mWidth, mHeight);
+
+    std::cout << "Headless context: " << glGetString(GL_RENDERER)
+        << ", " << mWidth << "x" << mHeight << std::endl;
+    return true;
+}
+
+void HeadlessContext::destroy() {
+    if(mUploadContext != EGL_NO_CONTEXT) {
+        eglDestroyContext(mDisplay, mUploadContext);
+        mUploadContext = EGL_NO_CONTEXT;
+    }
+    if(mContext != EGL_NO_CONTEXT) {
+        glDeleteFramebuffers(1, &mFBO);
+        glDeleteRenderbuffers(1, &mColor);
+        glDeleteRenderbuffers(1, &mDepthStencil);
+        mFBO = mColor = mDepthStencil = 0;
+
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(mDisplay, mContext);
+        mContext = EGL_NO_CONTEXT;
+    }
+    if(mDisplay != EGL_NO_DISPLAY) {
+        eglTerminate(mDisplay);
+        mDisplay = EGL_NO_DISPLAY;
+    }
+}
+
+bool HeadlessContext::createUploadContext() {
+    if(mContext == EGL_NO_CONTEXT) return false;
+    if(mUploadContext == EGL_NO_CONTEXT)
+        mUploadContext = eglCreateContext(mDisplay, mConfig, mContext, CONTEXT_ATTRIBUTES);
+    if(mUploadContext == EGL_NO_CONTEXT) {
+        std::cout << "ERROR::HEADLESS::UPLOAD_CONTEXT_NOT_CREATED" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HeadlessContext::makeUploadContextCurrent() {
+    // The API is bound per thread, and it isn't desktop GL by default
+    return eglBindAPI(EGL_OPENGL_API)
+        && eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, mUploadContext);
+}
+
+void HeadlessContext::releaseUploadContext() {
+    eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void HeadlessContext::bindFramebuffer() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+    glViewport(0, 0, mWidth, mHeight);
+}
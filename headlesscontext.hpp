@@ -0,0 +1,55 @@
+#ifndef ZOHEADLESSCONTEXT_H
+#define ZOHEADLESSCONTEXT_H
+
+#include <EGL/egl.h>
+#include <GL/glew.h>
+
+/*
+An OpenGL 3.3 core context with no window or display server behind
+it, for running on build and benchmark machines. The context is made
+with EGL on Mesa's surfaceless platform (which llvmpipe provides on
+any Linux box), and everything is drawn into an offscreen framebuffer
+of a chosen size in place of the window's
+*/
+class HeadlessContext {
+public:
+    HeadlessContext() = default;
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext& other) = delete;
+    HeadlessContext& operator=(const HeadlessContext& other) = delete;
+
+    // Create the context, make it current on this thread, load GL
+    // functions and build a width x height framebuffer. False, with
+    // the reason printed, if any of that fails
+    bool create(int width, int height);
+    void destroy();
+
+    // A second context sharing this one's objects, for the upload
+    // thread (see uploadqueue.hpp). Make it current on that thread,
+    // and release it there before destroy()
+    bool createUploadContext();
+    bool makeUploadContextCurrent();
+    void releaseUploadContext();
+
+    // The offscreen framebuffer stands in for the default one
+    GLuint getFramebuffer() const { return mFBO; }
+    void bindFramebuffer() const;
+    int getWidth() const { return mWidth; }
+    int getHeight() const { return mHeight; }
+
+private:
+    EGLDisplay mDisplay {EGL_NO_DISPLAY};
+    EGLConfig mConfig {nullptr};
+    EGLContext mContext {EGL_NO_CONTEXT};
+    EGLContext mUploadContext {EGL_NO_CONTEXT};
+
+    int mWidth {0};
+    int mHeight {0};
+
+    GLuint mFBO {0};
+    GLuint mColor {0};
+    GLuint mDepthStencil {0};
+};
+
+#endif
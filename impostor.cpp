@@ -0,0 +1,288 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shared_globals.hpp"
+#include "streambuffer.hpp"
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "impostor.hpp"
+
+namespace {
+    // Frames baked per update, so a new impostor costs a few frames
+    // a little rather than one frame a lot
+    constexpr int FRAMES_PER_UPDATE {16};
+    // Mip levels the atlases keep; much smaller and neighbouring
+    // frames bleed into each other
+    constexpr int MAX_MIP_LEVEL {4};
+    // Must match impostor.vs
+    constexpr GLuint INSTANCE_LOCATION {4};
+}
+
+// Inverse of the mapping in impostor.vs: a point of the [-1, 1]
+// square to a direction in the upper hemisphere
+static glm::vec3 decodeHemiOctahedral(const glm::vec2& encoded) {
+    glm::vec3 direction { .5f * (encoded.x + encoded.y), 0.f, .5f * (encoded.x - encoded.y) };
+    direction.y = 1.f - std::abs(direction.x) - std::abs(direction.z);
+    return glm::normalize(direction);
+}
+
+ImpostorCache::ImpostorCache(int framesPerSide, int frameSize):
+    mBakeShader {"shaders/vertex.vs", "shaders/impostor_bake.fs"},
+    mFramesPerSide {std::max(2, framesPerSide)},
+    mFrameSize {std::max(16, frameSize)}
+{
+    glGenFramebuffers(1, &mBakeFBO);
+
+    // Corners of a quad from (-1, -1) to (1, 1), and a model matrix
+    // per instance, one column per attribute, from the stream buffer
+    const GLfloat corners[8] { -1.f, -1.f, 1.f, -1.f, 1.f, 1.f, -1.f, 1.f };
+    const GLuint elements[6] { 0, 1, 2, 0, 2, 3 };
+    glGenVertexArrays(1, &mQuadVAO);
+    counted::bindVertexArray(mQuadVAO);
+        glGenBuffers(1, &mQuadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mQuadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glGenBuffers(1, &mQuadEBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mQuadEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+        for(GLuint column {0}; column < 4; ++column) {
+            glEnableVertexAttribArray(INSTANCE_LOCATION + column);
+            glVertexAttribDivisor(INSTANCE_LOCATION + column, 1);
+        }
+    counted::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+ImpostorCache::~ImpostorCache() {
+    for(Impostor& impostor: mImpostors) deleteAtlases(impostor);
+    glDeleteBuffers(1, &mQuadEBO);
+    glDeleteBuffers(1, &mQuadVBO);
+    glDeleteVertexArrays(1, &mQuadVAO);
+    glDeleteFramebuffers(1, &mBakeFBO);
+}
+
+bool ImpostorCache::getBuildSuccess() {
+    return mBakeShader.getBuildSuccess();
+}
+
+ImpostorCache::Impostor* ImpostorCache::find(ModelHandle model) {
+    for(Impostor& impostor: mImpostors) {
+        if(impostor.mModel == model) return &impostor;
+    }
+    return nullptr;
+}
+
+const ImpostorCache::Impostor* ImpostorCache::find(ModelHandle model) const {
+    return const_cast<ImpostorCache*>(this)->find(model);
+}
+
+void ImpostorCache::createAtlases(Impostor& impostor) {
+    int atlasSize { mFramesPerSide * mFrameSize };
+    auto createAtlas = [&](GLuint& texture, GLint format, GLenum pixelFormat, GLenum type, bool mipmapped) {
+        glGenTextures(1, &texture);
+        counted::bindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, atlasSize, atlasSize, 0, pixelFormat, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped? GL_LINEAR_MIPMAP_LINEAR: GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipmapped? MAX_MIP_LEVEL: 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    };
+    createAtlas(impostor.mAlbedo, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, true);
+    createAtlas(impostor.mNormal, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, true);
+    // The bake's depth buffer, read back as plain depth values
+    createAtlas(impostor.mDepth, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ImpostorCache::deleteAtlases(Impostor& impostor) {
+    GLuint textures[3] { impostor.mAlbedo, impostor.mNormal, impostor.mDepth };
+    glDeleteTextures(3, textures);
+    impostor.mAlbedo = impostor.mNormal = impostor.mDepth = 0;
+}
+
+bool ImpostorCache::update(ModelHandle model, const ModelCache& models) {
+    if(!models.isReady(model)) return false;
+    const Model* current { models.getModel(model) };
+    if(!current) return false;
+
+    Impostor* impostor { find(model) };
+    if(!impostor) {
+        mImpostors.push_back(Impostor { .mModel {model} });
+        impostor = &mImpostors.back();
+        createAtlases(*impostor);
+    }
+
+    std::uint64_t version { models.getVersion(model) };
+    if(impostor->mVersion != version) {
+        impostor->mVersion = version;
+        impostor->mBakedFrames = 0;
+        impostor->mCenter = .5f * (current->getBoundsMin() + current->getBoundsMax());
+        impostor->mRadius = std::max(.5f * glm::length(current->getBoundsMax() - current->getBoundsMin()), 1e-3f);
+    }
+    if(impostor->mBakedFrames < getFrameCount()) bakeFrames(*impostor, *current);
+    return impostor->mBakedFrames == getFrameCount();
+}
+
+bool ImpostorCache::hasImpostor(ModelHandle model) const {
+    const Impostor* impostor { find(model) };
+    return impostor && impostor->mBakedFrames == getFrameCount();
+}
+
+void ImpostorCache::removeUnloaded(const ModelCache& models) {
+    // Order doesn't matter, so the last takes each removed one's place
+    for(std::size_t i {0}; i < mImpostors.size();) {
+        if(models.contains(mImpostors[i].mModel)) {
+            ++i;
+            continue;
+        }
+        deleteAtlases(mImpostors[i]);
+        mImpostors[i] = std::move(mImpostors.back());
+        mImpostors.pop_back();
+    }
+}
+
+void ImpostorCache::bakeFrames(Impostor& impostor, const Model& model) {
+    PROFILE_ZONE("ImpostorCache::bakeFrames");
+    PROFILE_GPU_ZONE("Impostor baking");
+    GLint viewport[4] {};
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLint sceneFramebuffer {0};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &sceneFramebuffer);
+    GLboolean blend { glIsEnabled(GL_BLEND) };
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mBakeFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostor.mAlbedo, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, impostor.mNormal, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, impostor.mDepth, 0);
+    const GLenum drawBuffers[2] { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    // Frames are written as they are, not blended over each other
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    if(impostor.mBakedFrames == 0) {
+        const GLfloat empty[4] {0.f, 0.f, 0.f, 0.f};
+        glViewport(0, 0, mFramesPerSide * mFrameSize, mFramesPerSide * mFrameSize);
+        glClearBufferfv(GL_COLOR, 0, empty);
+        glClearBufferfv(GL_COLOR, 1, empty);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    mBakeCommands.record(1, [&](CommandBuffer& commands, std::size_t, std::size_t) {
+        model.record(commands, glm::mat4(1.f));
+    });
+    mBakeShader.use();
+    mBakeShader.setInt("material.texture_diffuse1", 0);
+    mBakeShader.setInt("material.texture_specular1", 1);
+
+    // Each frame looks at the bounding sphere from outside it, along
+    // its own direction, with depth spanning the sphere front to back
+    float radius { impostor.mRadius };
+    mBakeShader.setMat4("projection", glm::ortho(-radius, radius, -radius, radius, radius, 3.f * radius));
+    int end { std::min(getFrameCount(), impostor.mBakedFrames + FRAMES_PER_UPDATE) };
+    for(int frame {impostor.mBakedFrames}; frame < end; ++frame) {
+        int x { frame % mFramesPerSide };
+        int y { frame / mFramesPerSide };
+        glm::vec3 direction {
+            decodeHemiOctahedral(glm::vec2(x, y) / static_cast<float>(mFramesPerSide - 1) * 2.f - 1.f)
+        };
+        // Looking straight down, "up" has to come from elsewhere; the
+        // impostor shaders pick the same axes
+        glm::vec3 up { std::abs(direction.y) > .999f? glm::vec3(0.f, 0.f, -1.f): glm::vec3(0.f, 1.f, 0.f) };
+        mBakeShader.setMat4("view", glm::lookAt(impostor.mCenter + 2.f * radius * direction, impostor.mCenter, up));
+        glViewport(x * mFrameSize, y * mFrameSize, mFrameSize, mFrameSize);
+        mBakeCommands.submit(mBakeShader);
+    }
+    impostor.mBakedFrames = end;
+
+    if(impostor.mBakedFrames == getFrameCount()) {
+        counted::bindTexture(GL_TEXTURE_2D, impostor.mAlbedo);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        counted::bindTexture(GL_TEXTURE_2D, impostor.mNormal);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        counted::bindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    const GLenum sceneDrawBuffer[1] { GL_COLOR_ATTACHMENT0 };
+    glDrawBuffers(1, sceneDrawBuffer);
+    if(blend) glEnable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void ImpostorCache::addInstance(ModelHandle model, const glm::mat4& transform) {
+    Impostor* impostor { find(model) };
+    if(impostor) impostor->mInstances.push_back(transform);
+}
+
+void ImpostorCache::clearInstances() {
+    for(Impostor& impostor: mImpostors) impostor.mInstances.clear();
+}
+
+std::size_t ImpostorCache::getInstanceCount() const {
+    std::size_t count {0};
+    for(const Impostor& impostor: mImpostors) count += impostor.mInstances.size();
+    return count;
+}
+
+std::size_t ImpostorCache::getDrawCount() const {
+    return std::count_if(mImpostors.begin(), mImpostors.end(), [](const Impostor& impostor) {
+        return !impostor.mInstances.empty();
+    });
+}
+
+void ImpostorCache::draw(const Shader& shader) const {
+    PROFILE_ZONE("ImpostorCache::draw");
+    std::size_t instanceCount { getInstanceCount() };
+    if(instanceCount == 0) return;
+
+    // Every instance's transform goes up in one write
+    GLintptr offset {0};
+    char* data {
+        static_cast<char*>(gStreamBuffer->map(instanceCount * sizeof(glm::mat4), sizeof(glm::vec4), offset))
+    };
+    if(!data) return;
+    for(const Impostor& impostor: mImpostors) {
+        std::copy(impostor.mInstances.begin(), impostor.mInstances.end(), reinterpret_cast<glm::mat4*>(data));
+        data += impostor.mInstances.size() * sizeof(glm::mat4);
+    }
+    gStreamBuffer->unmap();
+
+    shader.setInt("impostorDepth", IMPOSTOR_DEPTH_UNIT);
+    shader.setFloat("impostorFrames", static_cast<float>(mFramesPerSide));
+    counted::bindVertexArray(mQuadVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, gStreamBuffer->getBufferID());
+    for(const Impostor& impostor: mImpostors) {
+        if(impostor.mInstances.empty()) continue;
+        for(GLuint column {0}; column < 4; ++column) {
+            glVertexAttribPointer(
+                INSTANCE_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                reinterpret_cast<const void*>(offset + column * sizeof(glm::vec4))
+            );
+        }
+        offset += impostor.mInstances.size() * sizeof(glm::mat4);
+
+        glActiveTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_2D, impostor.mAlbedo);
+        glActiveTexture(GL_TEXTURE1);
+        counted::bindTexture(GL_TEXTURE_2D, impostor.mNormal);
+        glActiveTexture(GL_TEXTURE0 + IMPOSTOR_DEPTH_UNIT);
+        counted::bindTexture(GL_TEXTURE_2D, impostor.mDepth);
+        shader.setVec3("impostorCenter", impostor.mCenter);
+        shader.setFloat("impostorRadius", impostor.mRadius);
+        counted::drawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(impostor.mInstances.size()));
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    counted::bindVertexArray(0);
+}
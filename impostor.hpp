@@ -0,0 +1,102 @@
+#ifndef ZOIMPOSTOR_H
+#define ZOIMPOSTOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "model.hpp"
+#include "modelcache.hpp"
+#include "commandbuffer.hpp"
+
+// Texture unit impostor depth atlases are bound to; albedo and
+// normals go where a material's diffuse and specular maps would
+const GLint IMPOSTOR_DEPTH_UNIT {10};
+
+/*
+Impostors for models seen from far away. A model is rendered once
+from a spread of directions over the hemisphere above it, laid out
+hemi-octahedrally, into albedo, normal (with specular intensity) and
+depth atlases, one frame per direction. Thereafter each far copy of
+it is a single camera-facing quad, every copy of a model in one
+instanced draw, that blends the four frames baked nearest the
+direction it's seen from and writes the depth the model would have.
+
+Impostors are drawn with a shader built from shaders/impostor.vs and
+a fragment shader with IMPOSTOR defined. Copies may be rotated and
+uniformly scaled, and look right from anywhere but below. They don't
+cast shadows
+*/
+class ImpostorCache {
+public:
+    // Frames are frameSize texels square, framesPerSide^2 to a model
+    explicit ImpostorCache(int framesPerSide=8, int frameSize=128);
+    ~ImpostorCache();
+
+    ImpostorCache(const ImpostorCache& other) = delete;
+    ImpostorCache& operator=(const ImpostorCache& other) = delete;
+
+    bool getBuildSuccess();
+
+    // Bake a few more frames of model's impostor, starting over if a
+    // different version of the model is drawn now. True once it has
+    // a complete one. On the GL thread, during a frame, since the
+    // bake's draws go through the frame's stream buffer
+    bool update(ModelHandle model, const ModelCache& models);
+    bool hasImpostor(ModelHandle model) const;
+    // Delete the impostors of models that have since been unloaded.
+    // Once a frame, on the GL thread
+    void removeUnloaded(const ModelCache& models);
+
+    // Queue a copy of model's impostor for draw(), placed by transform
+    void addInstance(ModelHandle model, const glm::mat4& transform);
+    void clearInstances();
+
+    // Draw every queued copy, with shader in use. Draws after the
+    // depth pre-pass's shading pass, since they set their own depth
+    void draw(const Shader& shader) const;
+
+    std::size_t getInstanceCount() const;
+    // Draw calls a draw() issues
+    std::size_t getDrawCount() const;
+
+private:
+    struct Impostor {
+        ModelHandle mModel;
+        std::uint64_t mVersion {0}; // of the model being baked
+        int mBakedFrames {0};
+        GLuint mAlbedo {0};
+        GLuint mNormal {0};
+        GLuint mDepth {0};
+        // Model space sphere every frame is fitted around
+        glm::vec3 mCenter {0.f};
+        float mRadius {1.f};
+        std::vector<glm::mat4> mInstances;
+    };
+
+    Impostor* find(ModelHandle model);
+    const Impostor* find(ModelHandle model) const;
+    void createAtlases(Impostor& impostor);
+    static void deleteAtlases(Impostor& impostor);
+    void bakeFrames(Impostor& impostor, const Model& model);
+    int getFrameCount() const { return mFramesPerSide * mFramesPerSide; }
+
+    Shader mBakeShader;
+    int mFramesPerSide;
+    int mFrameSize;
+    GLuint mBakeFBO {0};
+    CommandQueue mBakeCommands;
+
+    // The quad every instance is drawn with
+    GLuint mQuadVAO {0};
+    GLuint mQuadVBO {0};
+    GLuint mQuadEBO {0};
+
+    std::vector<Impostor> mImpostors;
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+#include <glm/glm.hpp>
+
+#include "flycamera.hpp"
+#include "inputrecording.hpp"
+
+const char RECORDING_MAGIC[4] {'Z', 'O', 'I', 'R'};
+const std::uint32_t RECORDING_VERSION {1};
+
+// How far a replayed camera may end up from where it was recorded
+// before the replay counts as diverged
+const float REPLAY_TOLERANCE {1e-3f};
+
+// Camera state as stored on disk
+struct CameraRecord {
+    float mPosition[3];
+    float mOrientation[2];
+    float mFOV;
+    float mVelocity[3];
+    std::uint32_t mActive;
+};
+
+struct RecordingHeader {
+    char mMagic[4];
+    std::uint32_t mVersion;
+    float mFixedStep;
+    std::uint32_t mStepCount;
+    std::uint32_t mInputCount;
+    CameraRecord mStart;
+    CameraRecord mEnd;
+};
+
+static_assert(sizeof(RecordedInput) == 12, "recorded inputs are stored as is");
+
+static CameraRecord toRecord(const FlyCamera::State& state) {
+    return CameraRecord {
+        .mPosition { state.mPosition.x, state.mPosition.y, state.mPosition.z },
+        .mOrientation { state.mOrientation.x, state.mOrientation.y },
+        .mFOV { state.mFOV },
+        .mVelocity { state.mVelocity.x, state.mVelocity.y, state.mVelocity.z },
+        .mActive { state.mActive? 1u: 0u }
+    };
+}
+
+static FlyCamera::State fromRecord(const CameraRecord& record) {
+    return FlyCamera::State {
+        .mPosition { record.mPosition[0], record.mPosition[1], record.mPosition[2] },
+        .mOrientation { record.mOrientation[0], record.mOrientation[1] },
+        .mFOV { record.mFOV },
+        .mVelocity { record.mVelocity[0], record.mVelocity[1], record.mVelocity[2] },
+        .mActive { record.mActive != 0 }
+    };
+}
+
+void InputRecorder::begin(const FlyCamera::State& state, float fixedStep) {
+    mRecording = true;
+    mFixedStep = fixedStep;
+    mStep = 0;
+    mStartState = state;
+    mInputs.clear();
+}
+
+void InputRecorder::record(const SDL_Event& event) {
+    if(!mRecording) return;
+
+    RecordedInput input { .mStep { mStep }, .mType { static_cast<std::uint16_t>(event.type) }, .mX {0}, .mY {0} };
+    switch(event.type) {
+        case SDL_MOUSEMOTION:
+            input.mX = static_cast<std::int16_t>(std::clamp(event.motion.xrel, -32768, 32767));
+            input.mY = event.motion.yrel;
+        break;
+        case SDL_MOUSEWHEEL:
+            input.mY = event.wheel.y;
+        break;
+        case SDL_KEYDOWN:
+            // Held keys repeat, but only the first press does anything
+            if(event.key.repeat) return;
+            input.mY = event.key.keysym.sym;
+        break;
+        case SDL_KEYUP:
+            input.mY = event.key.keysym.sym;
+        break;
+        default: return;
+    }
+    mInputs.push_back(input);
+}
+
+void InputRecorder::step() {
+    if(mRecording) ++mStep;
+}
+
+bool InputRecorder::end(const FlyCamera::State& state, const std::string& path) {
+    if(!mRecording) return false;
+    mRecording = false;
+
+    RecordingHeader header {
+        .mMagic {},
+        .mVersion { RECORDING_VERSION },
+        .mFixedStep { mFixedStep },
+        .mStepCount { mStep },
+        .mInputCount { static_cast<std::uint32_t>(mInputs.size()) },
+        .mStart { toRecord(mStartState) },
+        .mEnd { toRecord(state) }
+    };
+    std::memcpy(header.mMagic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+
+    std::ofstream file {path, std::ios::binary};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if(!mInputs.empty())
+        file.write(reinterpret_cast<const char*>(&mInputs[0]), mInputs.size() * sizeof(RecordedInput));
+    if(!file) {
+        std::cout << "ERROR::INPUT::RECORDING_NOT_WRITTEN " << path << std::endl;
+        return false;
+    }
+    std::cout << "Recorded " << mStep << " steps (" << mInputs.size() << " inputs) to " << path << std::endl;
+    return true;
+}
+
+bool InputReplay::load(const std::string& path) {
+    mLoaded = false;
+    std::ifstream file {path, std::ios::binary};
+    if(!file) {
+        std::cout << "ERROR::INPUT::RECORDING_NOT_FOUND " << path << std::endl;
+        return false;
+    }
+
+    RecordingHeader header {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!file || std::memcmp(header.mMagic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0) {
+        std::cout << "ERROR::INPUT::NOT_A_RECORDING " << path << std::endl;
+        return false;
+    }
+    if(header.mVersion != RECORDING_VERSION || !(header.mFixedStep > 0.f)) {
+        std::cout << "ERROR::INPUT::UNSUPPORTED_RECORDING " << path << std::endl;
+        return false;
+    }
+
+    mInputs.resize(header.mInputCount);
+    if(!mInputs.empty())
+        file.read(reinterpret_cast<char*>(&mInputs[0]), mInputs.size() * sizeof(RecordedInput));
+    if(!file) {
+        std::cout << "ERROR::INPUT::RECORDING_TRUNCATED " << path << std::endl;
+        return false;
+    }
+
+    mFixedStep = header.mFixedStep;
+    mStepCount = header.mStepCount;
+    mStartState = fromRecord(header.mStart);
+    mEndState = fromRecord(header.mEnd);
+    mStep = 0;
+    mNextInput = 0;
+    mLoaded = true;
+    return true;
+}
+
+void InputReplay::start(FlyCamera& camera) {
+    mStep = 0;
+    mNextInput = 0;
+    camera.setState(mStartState);
+}
+
+bool InputReplay::step(FlyCamera& camera) {
+    if(!mLoaded || isFinished()) return false;
+
+    for(; mNextInput < mInputs.size() && mInputs[mNextInput].mStep <= mStep; ++mNextInput) {
+        const RecordedInput& input { mInputs[mNextInput] };
+        SDL_Event event {};
+        event.type = input.mType;
+        switch(input.mType) {
+            case SDL_MOUSEMOTION:
+                event.motion.xrel = input.mX;
+                event.motion.yrel = input.mY;
+            break;
+            case SDL_MOUSEWHEEL:
+                event.wheel.y = input.mY;
+            break;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+                event.key.keysym.sym = input.mY;
+            break;
+        }
+        camera.processInput(&event);
+    }
+
+    camera.update(mFixedStep);
+    ++mStep;
+    return true;
+}
+
+bool InputReplay::verify(const FlyCamera& camera) const {
+    FlyCamera::State state { camera.getState() };
+    float positionError { glm::length(state.mPosition - mEndState.mPosition) };
+    float orientationError { glm::length(state.mOrientation - mEndState.mOrientation) };
+    if(positionError > REPLAY_TOLERANCE || orientationError > REPLAY_TOLERANCE) {
+        std::cout << "ERROR::INPUT::REPLAY_DIVERGED by " << positionError << " units, "
+            << orientationError << " degrees" << std::endl;
+        return false;
+    }
+    std::cout << "Replay matched its recording over " << mStepCount << " steps" << std::endl;
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef ZOINPUTRECORDING_H
+#define ZOINPUTRECORDING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "flycamera.hpp"
+
+/*
+Camera input recording and replay. Rather than wall-clock time, each
+input is stamped with the number of fixed simulation steps taken
+before it reached the camera, so a replay that feeds the same inputs
+in before the same steps puts the camera through exactly the same
+states, however fast or slow the machine replaying it is.
+
+Recordings are kept in memory and written out when they end, as a
+header followed by 12-byte inputs, in the byte order of the machine
+that made them
+*/
+
+// One camera input: mouse motion (x and y are the relative motion),
+// wheel (y is the wheel delta), or key press or release (y is the
+// key code)
+struct RecordedInput {
+    std::uint32_t mStep;
+    std::uint16_t mType;
+    std::int16_t mX;
+    std::int32_t mY;
+};
+
+class InputRecorder {
+public:
+    // Start recording from the camera's current state, with
+    // simulation steps of fixedStep seconds
+    void begin(const FlyCamera::State& state, float fixedStep);
+
+    // Record an input on its way to the camera. Anything the camera
+    // doesn't respond to is ignored
+    void record(const SDL_Event& event);
+
+    // Count off one simulation step
+    void step();
+
+    // Stop recording and write it to path, with the camera's state at
+    // the end to check replays against
+    bool end(const FlyCamera::State& state, const std::string& path);
+
+    bool isRecording() const { return mRecording; }
+
+private:
+    bool mRecording {false};
+    float mFixedStep {0.f};
+    std::uint32_t mStep {0};
+    FlyCamera::State mStartState {};
+    std::vector<RecordedInput> mInputs;
+};
+
+class InputReplay {
+public:
+    // Load a recording; false, with the reason printed, if it can't
+    // be read
+    bool load(const std::string& path);
+
+    // Put camera back in its recorded starting state
+    void start(FlyCamera& camera);
+
+    // Feed the camera the inputs due before the next step, then step
+    // it. False, doing nothing, once the recording has run out
+    bool step(FlyCamera& camera);
+
+    bool isLoaded() const { return mLoaded; }
+    bool isFinished() const { return mStep >= mStepCount; }
+    float getFixedStep() const { return mFixedStep; }
+    std::uint32_t getStepCount() const { return mStepCount; }
+
+    // Compare camera, at the end of the replay, against the state
+    // it was recorded in, printing how far apart they are
+    bool verify(const FlyCamera& camera) const;
+
+private:
+    bool mLoaded {false};
+    float mFixedStep {0.f};
+    std::uint32_t mStep {0};
+    std::uint32_t mStepCount {0};
+    std::size_t mNextInput {0};
+    FlyCamera::State mStartState {};
+    FlyCamera::State mEndState {};
+    std::vector<RecordedInput> mInputs;
+};
+
+#endif
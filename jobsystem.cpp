@@ -0,0 +1,235 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "profiler.hpp"
+#include "jobsystem.hpp"
+
+// Number of empty polls a worker makes before going to sleep
+const int IDLE_SPINS_BEFORE_SLEEP {64};
+
+// The job system and worker slot the current thread belongs to, if any
+thread_local const JobSystem* tJobSystem {nullptr};
+thread_local int tWorkerIndex {-1};
+thread_local std::uint32_t tStealSeed {0};
+
+JobSystem::JobDeque::JobDeque():
+    mJobs { new std::atomic<Job*>[MAX_JOBS_PER_WORKER] }
+{}
+
+bool JobSystem::JobDeque::push(Job* job) {
+    std::int64_t bottom { mBottom.load(std::memory_order_relaxed) };
+    std::int64_t top { mTop.load(std::memory_order_acquire) };
+    if(bottom - top >= static_cast<std::int64_t>(MAX_JOBS_PER_WORKER)) return false;
+
+    mJobs[bottom & (MAX_JOBS_PER_WORKER - 1)].store(job, std::memory_order_relaxed);
+    mBottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+JobSystem::Job* JobSystem::JobDeque::pop() {
+    std::int64_t bottom { mBottom.load(std::memory_order_relaxed) - 1 };
+    mBottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t top { mTop.load(std::memory_order_relaxed) };
+
+    // Deque was already empty
+    if(top > bottom) {
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job* job { mJobs[bottom & (MAX_JOBS_PER_WORKER - 1)].load(std::memory_order_relaxed) };
+    if(top == bottom) {
+        // Last job left; race any thieves for it
+        if(!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+JobSystem::Job* JobSystem::JobDeque::steal() {
+    std::int64_t top { mTop.load(std::memory_order_acquire) };
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t bottom { mBottom.load(std::memory_order_acquire) };
+    if(top >= bottom) return nullptr;
+
+    Job* job { mJobs[top & (MAX_JOBS_PER_WORKER - 1)].load(std::memory_order_relaxed) };
+    if(!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+
+JobSystem::JobSystem(std::size_t nWorkers, std::size_t nGuests):
+    mWorkerCount { nWorkers == 0? std::max(1u, std::thread::hardware_concurrency()): nWorkers },
+    mGuestSlots(nGuests, false)
+{
+    for(std::size_t i {0}; i < mWorkerCount + nGuests; ++i) {
+        mDeques.push_back(std::make_unique<JobDeque>());
+        mJobPools.push_back(std::make_unique<Job[]>(MAX_JOBS_PER_WORKER));
+        mNextJob.push_back(0);
+    }
+
+    // The constructing thread is worker 0
+    tJobSystem = this;
+    tWorkerIndex = 0;
+
+    for(std::size_t i {1}; i < mWorkerCount; ++i) {
+        mThreads.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock { mSleepMutex };
+        mQuit.store(true);
+    }
+    mWakeCondition.notify_all();
+    for(std::thread& thread: mThreads) thread.join();
+
+    if(tJobSystem == this) {
+        tJobSystem = nullptr;
+        tWorkerIndex = -1;
+    }
+}
+
+bool JobSystem::join() {
+    if(getWorkerIndex() >= 0) return true;
+    std::lock_guard<std::mutex> lock { mGuestMutex };
+    for(std::size_t i {0}; i < mGuestSlots.size(); ++i) {
+        if(mGuestSlots[i]) continue;
+        mGuestSlots[i] = true;
+        tJobSystem = this;
+        tWorkerIndex = static_cast<int>(mWorkerCount + i);
+        tStealSeed = static_cast<std::uint32_t>(tWorkerIndex * 2654435761u);
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::leave() {
+    int slot { getWorkerIndex() };
+    if(slot < static_cast<int>(mWorkerCount)) return;
+    // Its parallel loops have all waited on their jobs, so nothing's
+    // left on its deque
+    std::lock_guard<std::mutex> lock { mGuestMutex };
+    mGuestSlots[slot - mWorkerCount] = false;
+    tJobSystem = nullptr;
+    tWorkerIndex = -1;
+}
+
+int JobSystem::getWorkerIndex() const {
+    return tJobSystem == this? tWorkerIndex: -1;
+}
+
+JobSystem::Job* JobSystem::allocateJob() {
+    std::size_t worker { static_cast<std::size_t>(getWorkerIndex()) };
+    Job* job { &mJobPools[worker][mNextJob[worker] & (MAX_JOBS_PER_WORKER - 1)] };
+    ++mNextJob[worker];
+
+    // The pool wrapped around onto a job that hasn't run yet; help
+    // out until it's free again
+    while(job->mPending.load(std::memory_order_acquire)) {
+        if(!pump()) std::this_thread::yield();
+    }
+    job->mPending.store(true, std::memory_order_relaxed);
+    return job;
+}
+
+void JobSystem::submit(Job* job) {
+    // Counted before the push, so a thief can't take the job and
+    // decrement first
+    mQueuedJobs.fetch_add(1);
+
+    // A full deque means plenty of queued work already, so just
+    // do this one here and now
+    if(!mDeques[getWorkerIndex()]->push(job)) {
+        mQueuedJobs.fetch_sub(1);
+        execute(job);
+        return;
+    }
+
+    if(mSleepers.load() > 0) {
+        // Taking the lock orders this wakeup after any sleeper's
+        // check of mQueuedJobs
+        { std::lock_guard<std::mutex> lock { mSleepMutex }; }
+        mWakeCondition.notify_one();
+    }
+}
+
+void JobSystem::execute(Job* job) {
+    PROFILE_ZONE("Job");
+    JobCounter* counter { job->mCounter };
+    job->mInvoke(job->mPayload);
+    job->mPending.store(false, std::memory_order_release);
+    if(counter) counter->mPending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+JobSystem::Job* JobSystem::findJob() {
+    int worker { getWorkerIndex() };
+    if(worker >= 0) {
+        if(Job* job { mDeques[worker]->pop() }) {
+            mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    // Steal from the other workers, starting at a random victim so
+    // thieves don't all pile onto the same deque
+    tStealSeed = tStealSeed * 1664525u + 1013904223u;
+    std::size_t nDeques { mDeques.size() };
+    std::size_t start { (tStealSeed >> 16) % nDeques };
+    for(std::size_t i {0}; i < nDeques; ++i) {
+        std::size_t victim { (start + i) % nDeques };
+        if(static_cast<int>(victim) == worker) continue;
+        if(Job* job { mDeques[victim]->steal() }) {
+            mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+bool JobSystem::pump() {
+    Job* job { findJob() };
+    if(!job) return false;
+    execute(job);
+    return true;
+}
+
+void JobSystem::wait(const JobCounter& counter) {
+    while(!counter.isDone()) {
+        if(!pump()) std::this_thread::yield();
+    }
+}
+
+void JobSystem::workerLoop(std::size_t workerIndex) {
+    PROFILE_THREAD_NAME("Worker");
+    tJobSystem = this;
+    tWorkerIndex = static_cast<int>(workerIndex);
+    tStealSeed = static_cast<std::uint32_t>(workerIndex * 2654435761u);
+
+    int idleSpins {0};
+    while(!mQuit.load(std::memory_order_relaxed)) {
+        if(pump()) {
+            idleSpins = 0;
+            continue;
+        }
+        if(++idleSpins < IDLE_SPINS_BEFORE_SLEEP) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Nothing to do for a while; sleep until work is queued
+        std::unique_lock<std::mutex> lock { mSleepMutex };
+        mSleepers.fetch_add(1);
+        mWakeCondition.wait(lock, [this]() {
+            return mQuit.load() || mQueuedJobs.load() > 0;
+        });
+        mSleepers.fetch_sub(1);
+        idleSpins = 0;
+    }
+}
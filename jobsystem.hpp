@@ -0,0 +1,171 @@
+#ifndef ZOJOBSYSTEM_H
+#define ZOJOBSYSTEM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+
+// Tracks a group of jobs; reaches zero once every job run against
+// it has finished
+class JobCounter {
+public:
+    bool isDone() const { return mPending.load(std::memory_order_acquire) == 0; }
+
+private:
+    std::atomic<std::uint32_t> mPending {0};
+    friend class JobSystem;
+};
+
+/*
+A fixed-size pool of worker threads, each owning a Chase-Lev
+work-stealing deque. Jobs pushed by a worker go to its own deque;
+idle workers steal from the others. The thread that constructs the
+job system counts as worker 0, and helps with jobs whenever it waits
+on them. Other long-lived threads can join as guests: they get a
+deque of their own to queue jobs on, so their parallel loops are
+shared out, but aren't counted as workers
+*/
+class JobSystem {
+public:
+    // nWorkers includes the calling thread; 0 means one per core.
+    // nGuests is how many other threads may join() at once
+    explicit JobSystem(std::size_t nWorkers=0, std::size_t nGuests=0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem& other) = delete;
+    JobSystem& operator=(const JobSystem& other) = delete;
+
+    // Queue function() to run on some worker, incrementing counter
+    // (if given) until it completes. Jobs queued from threads that
+    // aren't workers of this job system run immediately instead
+    template<typename Function>
+    void run(Function&& function, JobCounter* counter=nullptr);
+
+    // Run function(begin, end) over [0, count) in batches of at
+    // least minBatch items, returning once every batch is done
+    template<typename Function>
+    void parallelFor(std::size_t count, std::size_t minBatch, Function&& function);
+
+    // Block until counter reaches zero, running queued jobs meanwhile
+    void wait(const JobCounter& counter);
+
+    // Run at most one queued job on the calling thread; returns
+    // whether one was run. Lets the GL thread help out between
+    // other work
+    bool pump();
+
+    // Make the calling thread a guest until it calls leave(), which
+    // it must before the job system goes. False, leaving the thread
+    // running its jobs in turn as before, if every guest slot's taken
+    bool join();
+    void leave();
+
+    std::size_t getWorkerCount() const { return mWorkerCount; }
+
+private:
+    static const std::size_t JOB_PAYLOAD_SIZE {48};
+    static const std::size_t MAX_JOBS_PER_WORKER {4096};
+
+    struct alignas(64) Job {
+        void (*mInvoke)(void* payload);
+        JobCounter* mCounter;
+        std::atomic<bool> mPending;
+        alignas(16) unsigned char mPayload[JOB_PAYLOAD_SIZE];
+    };
+
+    // Fixed capacity Chase-Lev deque. Only the owning worker may push
+    // and pop (at the bottom); any thread may steal (from the top)
+    class JobDeque {
+    public:
+        JobDeque();
+        bool push(Job* job);
+        Job* pop();
+        Job* steal();
+
+    private:
+        alignas(64) std::atomic<std::int64_t> mTop {0};
+        alignas(64) std::atomic<std::int64_t> mBottom {0};
+        std::unique_ptr<std::atomic<Job*>[]> mJobs;
+    };
+
+    Job* allocateJob();
+    void submit(Job* job);
+    void execute(Job* job);
+    Job* findJob();
+    void workerLoop(std::size_t workerIndex);
+    int getWorkerIndex() const;
+
+    // Workers' then guests'
+    std::vector<std::unique_ptr<JobDeque>> mDeques;
+    std::vector<std::unique_ptr<Job[]>> mJobPools;
+    std::vector<std::size_t> mNextJob;
+    std::vector<std::thread> mThreads;
+    std::size_t mWorkerCount;
+
+    std::mutex mGuestMutex;
+    std::vector<bool> mGuestSlots; // taken or not
+
+    // Idle workers sleep here until there's something to do
+    std::atomic<std::int64_t> mQueuedJobs {0};
+    std::atomic<int> mSleepers {0};
+    std::atomic<bool> mQuit {false};
+    std::mutex mSleepMutex;
+    std::condition_variable mWakeCondition;
+};
+
+template<typename Function>
+void JobSystem::run(Function&& function, JobCounter* counter) {
+    using Callable = std::decay_t<Function>;
+    static_assert(sizeof(Callable) <= JOB_PAYLOAD_SIZE, "Job captures too much; capture by reference instead");
+    static_assert(alignof(Callable) <= 16, "Job capture is over-aligned");
+
+    if(getWorkerIndex() < 0) {
+        function();
+        return;
+    }
+
+    Job* job { allocateJob() };
+    new (job->mPayload) Callable(std::forward<Function>(function));
+    job->mInvoke = [](void* payload) {
+        Callable* callable { std::launder(reinterpret_cast<Callable*>(payload)) };
+        (*callable)();
+        callable->~Callable();
+    };
+    job->mCounter = counter;
+    if(counter) counter->mPending.fetch_add(1, std::memory_order_relaxed);
+    submit(job);
+}
+
+template<typename Function>
+void JobSystem::parallelFor(std::size_t count, std::size_t minBatch, Function&& function) {
+    if(count == 0) return;
+
+    // A few batches per worker leaves room for stealing to even out
+    // uneven batches
+    std::size_t nBatches {
+        std::max<std::size_t>(1, std::min(
+            count / std::max<std::size_t>(1, minBatch),
+            getWorkerCount() * 4
+        ))
+    };
+    std::size_t batchSize { (count + nBatches - 1) / nBatches };
+
+    JobCounter counter {};
+    for(std::size_t begin {batchSize}; begin < count; begin += batchSize) {
+        std::size_t end { std::min(count, begin + batchSize) };
+        run([&function, begin, end]() { function(begin, end); }, &counter);
+    }
+    function(0, std::min(count, batchSize));
+    wait(counter);
+}
+
+#endif
@@ -1,3 +1,5 @@
+#include <limits>
+
 #include <glm/glm.hpp>
 
 #include "light.hpp"
@@ -48,4 +50,25 @@ Light makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float
     };
 }
 
+float getLightRange(const Light& light) {
+    if(light.mType == Light::directional || (light.mLinear <= 0.f && light.mQuadratic <= 0.f))
+        return std::numeric_limits<float>::infinity();
+
+    // Brightest channel this light can contribute
+    float maxIntensity { glm::max(
+        glm::max(glm::max(light.mDiffuse.r, light.mDiffuse.g), light.mDiffuse.b),
+        glm::max(glm::max(light.mSpecular.r, light.mSpecular.g), light.mSpecular.b)
+    ) };
+    maxIntensity = glm::max(maxIntensity,
+        glm::max(glm::max(light.mAmbient.r, light.mAmbient.g), light.mAmbient.b)
+    );
 
+    // Solve constant + linear*d + quadratic*d^2 = maxIntensity/threshold
+    // for d, where threshold is a single 8-bit colour step
+    const float threshold { 1.f / 256.f };
+    float c { light.mConstant - maxIntensity / threshold };
+    if(light.mQuadratic <= 0.f) return glm::max(0.f, -c / light.mLinear);
+
+    float discriminant { light.mLinear * light.mLinear - 4.f * light.mQuadratic * c };
+    return glm::max(0.f, (-light.mLinear + glm::sqrt(discriminant)) / (2.f * light.mQuadratic));
+}
@@ -35,6 +35,11 @@ struct Light {
 
 Light makeDirectionalLight(const glm::vec3& direction, const glm::vec3& diffuse,  const glm::vec3& specular, const glm::vec3& ambient);
 Light makePointLight(const glm::vec3& position, const glm::vec3& diffuse, const glm::vec3& specular, const glm::vec3& ambient, float linearConst, float quadraticConst);
+// Distance beyond which a light's contribution falls below what's
+// visible in an 8-bit framebuffer. Directional lights, and lights
+// without attenuation, have infinite range
+float getLightRange(const Light& light);
+
 Light makeSpotLight(const glm::vec3& position, const glm::vec3& direction, float innerAngle, float outerAngle, const glm::vec3& diffuse, const glm::vec3& specular, const glm::vec3& ambient, float linearConst, float quadraticConst);
 
 #endif
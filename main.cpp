@@ -3,6 +3,9 @@
 #include <string>
 #include <sstream>
 #include <cmath>
+#include <memory>
+#include <atomic>
+#include <utility>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -18,30 +21,137 @@
 #include "flycamera.hpp"
 #include "shader.hpp"
 #include "light.hpp"
+#include "commandbuffer.hpp"
+#include "transform.hpp"
+#include "jobsystem.hpp"
+#include "clusteredlighting.hpp"
+#include "deferredrenderer.hpp"
+#include "depthprepass.hpp"
+#include "overdrawmeter.hpp"
+#include "shadowmaps.hpp"
+#include "framepacer.hpp"
+#include "profiler.hpp"
+#include "benchmark.hpp"
+#include "inputrecording.hpp"
+#include "streambuffer.hpp"
+#include "framecapture.hpp"
+#include "allocation.hpp"
+#include "modelcache.hpp"
+#include "assetfilesystem.hpp"
+#include "virtualtexture.hpp"
+#include "impostor.hpp"
+#include "animation.hpp"
+#include "occlusionculler.hpp"
+#include "dynamicresolution.hpp"
+#include "perfhud.hpp"
+#include "uploadqueue.hpp"
+#include "utility.hpp"
+#include "glcallcounts.hpp"
+#ifdef ZO_HEADLESS
+#include "headlesscontext.hpp"
+#endif
 
 //Initialize camera variables
 bool gWireframeMode { false };
+bool gDeferredMode { false };
+bool gDepthPrepassMode { true };
+bool gOverdrawMode { false };
+bool gFrameStatsMode { false };
+bool gOcclusionCullingMode { true };
+bool gDynamicResolutionMode { true };
+bool gHUDMode { false };
 
 float gDeltaTime {0.f};
 
-extern const int gWindowWidth {800};
-extern const int gWindowHeight {600};
+int gWindowWidth {800};
+int gWindowHeight {600};
 SDL_Window* gWindow {nullptr};
 FlyCamera* gCamera {nullptr};
+JobSystem* gJobSystem {nullptr};
+StreamBuffer* gStreamBuffer {nullptr};
+FrameArena* gFrameArena {nullptr};
+AssetFileSystem* gAssets {nullptr};
+UploadQueue* gUploadQueue {nullptr};
+SDL_GLContext gUploadContext {nullptr}; // the upload thread's, when windowed
+FramePacer* gFramePacer {nullptr};
+InputRecorder* gInputRecorder {nullptr};
+InputReplay* gInputReplay {nullptr}; // set while a replay drives the camera
+FrameCapture* gFrameCapture {nullptr};
+ModelCache* gModelCache {nullptr};
+ModelHandle gSceneModel {}; // from --model, reloaded with F10
+#ifdef ZO_HEADLESS
+HeadlessContext* gHeadlessContext {nullptr};
+#endif
 
-bool init(SDL_Window*& window, SDL_GLContext& context);
+bool init(SDL_Window*& window, SDL_GLContext& context, bool headless);
+bool initWindow(SDL_Window*& window, SDL_GLContext& context);
+void startUploadThread(SDL_Window* window);
 void close(SDL_GLContext& context);
 void processInput(SDL_Event* event);
+void applyCameraInput(SDL_Event* event);
+void sampleLateInput();
 
 int main(int argc, char* argv[]) {
     SDL_GLContext context {};
 
+    //Benchmark runs are configured from the command line (see
+    //benchmark.hpp), and draw offscreen unless told otherwise
+    BenchmarkConfig benchmarkConfig {};
+    if(!parseBenchmarkArgs(argc, argv, benchmarkConfig)) return 1;
+    bool headless { benchmarkConfig.mEnabled && !benchmarkConfig.mWindowed };
+    if(benchmarkConfig.mEnabled) {
+        gWindowWidth = benchmarkConfig.mWidth;
+        gWindowHeight = benchmarkConfig.mHeight;
+        gDeferredMode = benchmarkConfig.mDeferred;
+        gDepthPrepassMode = benchmarkConfig.mDepthPrepass;
+        gOcclusionCullingMode = benchmarkConfig.mOcclusionCulling;
+        gDynamicResolutionMode = benchmarkConfig.mDynamicResolution;
+    }
+
+    //A recording given on the command line flies the camera in
+    //place of live input
+    InputReplay inputReplay {};
+    if(!benchmarkConfig.mReplayPath.empty() && !inputReplay.load(benchmarkConfig.mReplayPath))
+        return 1;
+    std::size_t replayFrames {
+        (inputReplay.getStepCount() + benchmarkConfig.mReplayStepsPerFrame - 1) / benchmarkConfig.mReplayStepsPerFrame
+    };
+    if(inputReplay.isLoaded() && benchmarkConfig.mEnabled && replayFrames <= benchmarkConfig.mWarmupFrames) {
+        std::cout << "Oops, the recording is over before the benchmark's warm-up is" << std::endl;
+        return 1;
+    }
+
+    //Assets are read from a pack, memory mapped, when there is one,
+    //and from loose files otherwise
+    AssetFileSystem assets {};
+    gAssets = &assets;
+    if(!benchmarkConfig.mPackPath.empty()) {
+        if(!assets.mount(benchmarkConfig.mPackPath)) return 1;
+    } else if(std::ifstream {"assets.pack"}) assets.mount("assets.pack");
+
+    //Worker threads everything else shares; this thread becomes
+    //worker 0, and the model loader joins as a guest. It outlives
+    //every local below, the model cache's loader included, however
+    //main returns
+    JobSystem jobSystem {0, 1};
+    gJobSystem = &jobSystem;
+
     // Initialize SDL context
-    if(!init(gWindow, context)) {
+    if(!init(gWindow, context, headless)) {
         close(context);
         return 1;
     }
 
+    //Scratch memory that only has to last the frame comes from
+    //here, rather than the heap
+    FrameArena frameArena {};
+    gFrameArena = &frameArena;
+
+    //Per-draw transforms are streamed through this each frame
+    //instead of being set as uniforms draw by draw
+    StreamBuffer drawDataStream {GL_UNIFORM_BUFFER, 1 << 20};
+    gStreamBuffer = &drawDataStream;
+
     //Load object shader program
     Shader objectShader {"shaders/vertex.vs", "shaders/object_fragment.fs"};
     if(!objectShader.getBuildSuccess() /*|| !lightSourceShader.getBuildSuccess()*/) {
@@ -50,6 +160,42 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // The same shader, for shading after a depth pre-pass
+    Shader objectPrepassShader {"shaders/vertex.vs", "shaders/object_fragment.fs", "#define DEPTH_EQUAL_PASS"};
+    if(!objectPrepassShader.getBuildSuccess()) {
+        std::cout << "Oops, object shader failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+
+    // And both again, for virtual-textured draws
+    Shader objectVirtualShader {"shaders/vertex.vs", "shaders/object_fragment.fs", "#define VIRTUAL_TEXTURING"};
+    Shader objectVirtualPrepassShader {
+        "shaders/vertex.vs", "shaders/object_fragment.fs", "#define DEPTH_EQUAL_PASS\n#define VIRTUAL_TEXTURING"
+    };
+    if(!objectVirtualShader.getBuildSuccess() || !objectVirtualPrepassShader.getBuildSuccess()) {
+        std::cout << "Oops, object shader failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+
+    // And once more for impostors, which have no pre-pass variant
+    Shader objectImpostorShader {"shaders/impostor.vs", "shaders/object_fragment.fs", "#define IMPOSTOR"};
+    if(!objectImpostorShader.getBuildSuccess()) {
+        std::cout << "Oops, object shader failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+
+    // And for skinned characters, which are drawn after the pre-pass
+    // like impostors
+    Shader objectSkinnedShader {"shaders/vertex.vs", "shaders/object_fragment.fs", "#define SKINNING"};
+    if(!objectSkinnedShader.getBuildSuccess()) {
+        std::cout << "Oops, object shader failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+
     // Load light source shader program
     // Shader lightSourceShader {"shaders/vertex.vs", "shaders/lightsource_fragment.fs"};
 
@@ -58,13 +204,12 @@ int main(int argc, char* argv[]) {
 
     //Use the object shader we loaded as our current shader program
     objectShader.use();
-    //Load our model
-    // Model backpack {"media/backpack.obj", objectShader};
+    //Models are loaded through the model cache (see below)
 
     //Set up a VAO for a single upright square
     GLuint quadVAO {};
     glGenVertexArrays(1, &quadVAO);
-    glBindVertexArray(quadVAO);
+    counted::bindVertexArray(quadVAO);
         std::vector<GLfloat> quadVertices {
             //bottom left
             -0.5f, 0.f, 0.f, //position (xyz)
@@ -116,10 +261,95 @@ int main(int argc, char* argv[]) {
 
         objectShader.enableAttribArray("normal");
         objectShader.setAttribPointerF("normal", 3, 8, 5);
-    glBindVertexArray(0);
+    counted::bindVertexArray(0);
 
     Texture grassTexture {"media/grass.png", "texture_diffuse"};
 
+    //Models load in the background and are drawn as boxes until
+    //they're ready; one can be given with --model
+    ModelCache modelCache {objectShader};
+    gModelCache = &modelCache;
+    if(!benchmarkConfig.mModelPath.empty()) gSceneModel = modelCache.load(benchmarkConfig.mModelPath);
+
+    //Copies of the model (--model-copies) further away than
+    //--impostor-distance are drawn as impostors, baked from it once
+    //it's loaded
+    ImpostorCache impostors {};
+    if(!impostors.getBuildSuccess()) {
+        std::cout << "Oops, impostor baking failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+    std::vector<glm::mat4> modelTransforms {};
+    for(glm::vec3 position: makeModelPlacements(benchmarkConfig))
+        modelTransforms.push_back(glm::translate(glm::mat4(1.f), position));
+    std::vector<bool> modelImpostors(modelTransforms.size(), false); // as of last frame
+    std::vector<std::size_t> nearModelCopies {};
+    nearModelCopies.reserve(modelTransforms.size());
+    std::vector<std::size_t> farModelCopies {};
+    farModelCopies.reserve(modelTransforms.size());
+
+    //Animated characters (--character, --characters of them), each
+    //playing through the model's clips at its own pace, crossfading
+    //from one to the next every few seconds
+    const float CHARACTER_CLIP_SECONDS {4.f};
+    AnimationSystem characters {};
+    CommandQueue characterCommands {};
+    ModelHandle characterModel {};
+    std::vector<CharacterHandle> characterHandles {};
+    std::vector<int> characterClips {}; // as last played
+    float characterClock {0.f};
+    if(!benchmarkConfig.mCharacterPath.empty()) {
+        characterModel = modelCache.load(benchmarkConfig.mCharacterPath);
+        for(glm::vec3 position: makeCharacterPlacements(benchmarkConfig))
+            characterHandles.push_back(characters.addCharacter(characterModel, glm::translate(glm::mat4(1.f), position)));
+        characterClips.resize(characterHandles.size(), -1);
+    }
+
+    //Near copies of the model hide what's behind them from the
+    //camera; that's drawn only if it's in view and not hidden.
+    //Toggled with F1
+    OcclusionCuller occlusionCuller {};
+    std::atomic<std::size_t> culledDraws {0};
+
+    //A ground plane can be textured with an image of any size
+    //(--virtual-texture), streamed in tile by tile as the view
+    //needs it. Its tiles are cut once and kept beside the image
+    std::unique_ptr<VirtualTextureCache> virtualTextures {};
+    CommandQueue groundCommands {};
+    if(!benchmarkConfig.mVirtualTexturePath.empty()) {
+        const std::string& imagePath {benchmarkConfig.mVirtualTexturePath};
+        std::string storePath {imagePath + ".tiles"};
+        if(!std::ifstream {storePath} && !VirtualTextureCache::buildTileStore(imagePath.c_str(), storePath)) {
+            std::cout << "Oops, couldn't cut " << imagePath << " into tiles" << std::endl;
+            close(context);
+            return 1;
+        }
+        virtualTextures = std::make_unique<VirtualTextureCache>();
+        GLuint groundTexture { virtualTextures->addTexture(storePath) };
+        if(!virtualTextures->getBuildSuccess() || !groundTexture) {
+            std::cout << "Oops, virtual texturing failed to load" << std::endl;
+            close(context);
+            return 1;
+        }
+
+        // The vegetation quad, laid flat and stretched 40 units square
+        glm::mat4 groundTransform { glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, 20.f)) };
+        groundTransform = glm::rotate(groundTransform, glm::radians(-90.f), glm::vec3(1.f, 0.f, 0.f));
+        groundTransform = glm::scale(groundTransform, glm::vec3(40.f, 40.f, 1.f));
+        GLuint groundSpecular { modelCache.getTextures().getPlaceholderID() };
+        groundCommands.record(1, [&](CommandBuffer& commands, std::size_t, std::size_t) {
+            commands.bindMaterial(groundTexture, groundSpecular);
+            commands.setDrawData(groundTransform);
+            commands.drawElements(quadVAO, quadElements.size());
+        });
+    }
+
+    //Benchmark scenes use generated textures, so they don't depend
+    //on what's in media/
+    std::vector<GLuint> benchmarkTextures {};
+    if(benchmarkConfig.mEnabled) benchmarkTextures = makeBenchmarkTextures(benchmarkConfig);
+
     //Set up light source properties
     glm::vec3 lightSourcePosition {2.f, 2.f, 2.f};
     glm::vec3 lightAmbient {.2f, .2f, .2f};
@@ -130,6 +360,10 @@ int main(int argc, char* argv[]) {
     float lightLinear {.09f};
     float lightQuadratic {.032f};
 
+    //Scene lights are assigned to view-space clusters each frame,
+    //so that fragments only shade the lights that can reach them
+    LightClusters sceneLights {};
+
     //Create one spotlight
     Light spotLight { 
         makeSpotLight(
@@ -138,29 +372,30 @@ int main(int argc, char* argv[]) {
             lightAmbient, lightLinear, lightQuadratic
         )
     };
-    objectShader.setLight("lights[0]", spotLight);
-    // Create 4 point lights around (0, 4, 2)
-    glm::vec3 pointLightPositions[4];
-    for(int i {0}; i < 4; ++i) {
-        pointLightPositions[i] = glm::vec3 (
-            5.f * sin(glm::radians(360.f/4.f * i)),
-            4.f,
-            2.f + 5.f * cos(glm::radians(360.f/4.f * i))
-        );
-        glm::vec3 pos { pointLightPositions[i] };
-        Light pointLight {
-            makePointLight(pos,
-                lightDiffuse, lightSpecular, lightAmbient,
-                lightLinear, lightQuadratic)
-        };
-        std::stringstream lUniform{};
-        lUniform << "lights[" << (1+i) << "]";
-        objectShader.setLight(lUniform.str(), pointLight);
+    std::size_t spotLightIndex { sceneLights.addLight(spotLight) };
+    if(benchmarkConfig.mEnabled) addBenchmarkLights(benchmarkConfig, sceneLights);
+    else {
+        // Create 4 point lights around (0, 4, 2)
+        glm::vec3 pointLightPositions[4];
+        for(int i {0}; i < 4; ++i) {
+            pointLightPositions[i] = glm::vec3 (
+                5.f * sin(glm::radians(360.f/4.f * i)),
+                4.f,
+                2.f + 5.f * cos(glm::radians(360.f/4.f * i))
+            );
+            glm::vec3 pos { pointLightPositions[i] };
+            Light pointLight {
+                makePointLight(pos,
+                    lightDiffuse, lightSpecular, lightAmbient,
+                    lightLinear, lightQuadratic)
+            };
+            sceneLights.addLight(pointLight);
+        }
     }
     Light directionalLight {
         makeDirectionalLight(glm::vec3(2.f, -3.f, 2.f), lightDiffuse, lightSpecular, lightAmbient)
     };
-    objectShader.setLight("lights[5]", directionalLight);
+    sceneLights.addLight(directionalLight);
 
     //Set up material properties
     GLint materialShine {32};
@@ -182,9 +417,110 @@ int main(int argc, char* argv[]) {
         {-.3f, 0.f, -2.3f},
         {.5f, 0.f, -.6f}
     };
+    if(benchmarkConfig.mEnabled) vegetationPositions = makeBenchmarkInstances(benchmarkConfig);
+
+    // Place each vegetation quad in the scene's transform hierarchy,
+    // under a common root for the whole patch
+    TransformHierarchy sceneTransforms {};
+    TransformID vegetationRoot { sceneTransforms.addTransform(NO_TRANSFORM) };
+    std::vector<TransformID> vegetationTransforms {};
+    for(glm::vec3 position : vegetationPositions) {
+        vegetationTransforms.push_back(
+            sceneTransforms.addTransform(vegetationRoot, position)
+        );
+    }
+
+    // Command buffers for the scene's draws; recorded on worker
+    // threads each frame and replayed here on the GL thread. With
+    // occlusion culling the camera draws only what it can see, but
+    // everything still casts shadows
+    CommandQueue sceneCommands {};
+    CommandQueue visibleCommands {};
 
-    //Timing related variables
-    uint64_t lastFrame {SDL_GetTicks64()}; // time of last frame
+    // The scene is drawn offscreen, at a resolution scaled to keep
+    // its GPU time in budget, then upscaled into the window; scaling
+    // is toggled with 2
+    DynamicResolution dynamicResolution {DynamicResolution::Settings {
+        .mMinScale {benchmarkConfig.mMinRenderScale},
+        .mMaxScale {benchmarkConfig.mMaxRenderScale},
+        .mBudgetMs {benchmarkConfig.mFrameBudgetMs}
+    }};
+    if(!dynamicResolution.getBuildSuccess()) {
+        std::cout << "Oops, upscaling shader failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+    int drawableWidth {0}, drawableHeight {0};
+    getDrawableSize(drawableWidth, drawableHeight);
+    dynamicResolution.setEnabled(gDynamicResolutionMode);
+    dynamicResolution.resize(drawableWidth, drawableHeight);
+
+    // G-buffer and lighting passes for the deferred path, toggled
+    // against forward rendering with F2
+    DeferredRenderer deferredRenderer {dynamicResolution.getRenderWidth(), dynamicResolution.getRenderHeight()};
+    if(!deferredRenderer.getBuildSuccess()) {
+        std::cout << "Oops, deferred renderer failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+    deferredRenderer.setOutputFramebuffer(dynamicResolution.getFramebuffer());
+
+    // Where the finished frame goes: the window, or the framebuffer
+    // standing in for it
+    GLuint outputFramebuffer {0};
+#ifdef ZO_HEADLESS
+    if(gHeadlessContext) outputFramebuffer = gHeadlessContext->getFramebuffer();
+#endif
+
+    // Frame times and GL call counts drawn over the frame, toggled
+    // with 3
+    PerfHUD perfHUD {};
+    if(!perfHUD.getBuildSuccess()) {
+        std::cout << "Oops, performance HUD failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+    perfHUD.setBudget(benchmarkConfig.mFrameBudgetMs);
+
+    // Depth-only pre-pass for the forward path, toggled with F3
+    DepthPrepass depthPrepass {};
+    if(!depthPrepass.getBuildSuccess()) {
+        std::cout << "Oops, depth pre-pass failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+
+    // Cascaded shadows for the directional light and atlas shadows
+    // for the spotlight; the vegetation never moves, so it's drawn
+    // into the static caches only
+    ShadowMaps sceneShadows {};
+    if(!sceneShadows.getBuildSuccess()) {
+        std::cout << "Oops, shadow maps failed to load" << std::endl;
+        close(context);
+        return 1;
+    }
+
+    // Counts forward shading overdraw while toggled on with F4
+    OverdrawMeter overdrawMeter {};
+
+    //Timing related variables. The camera moves in fixed steps and
+    //is drawn interpolated between them; vsync (F5 cycles modes) and
+    //a frame rate cap (F6) pace presentation
+    FramePacer framePacer {};
+    gFramePacer = &framePacer;
+    if(!headless)
+        framePacer.setSwapMode(benchmarkConfig.mEnabled? FramePacer::immediate: FramePacer::adaptive);
+    BenchmarkRun benchmark {benchmarkConfig};
+
+    //Frames are read back asynchronously for screenshots (F12) and
+    //for capturing to disk (F11, or --capture-video)
+    FrameCapture frameCapture {};
+    gFrameCapture = &frameCapture;
+    const std::string& capturePath {benchmarkConfig.mCaptureVideoPath};
+    if(!capturePath.empty())
+        frameCapture.beginStream(capturePath, FrameCapture::formatFromPath(capturePath));
+    if(inputReplay.isLoaded()) benchmark.setFrameCount(replayFrames - benchmarkConfig.mWarmupFrames);
+    uint64_t lastOverdrawReport {SDL_GetTicks64()};
 
     //Initialize camera (and view and projection matrices)
     gCamera = new FlyCamera{};
@@ -193,12 +529,71 @@ int main(int argc, char* argv[]) {
     gCamera->setActive(false);
     glm::vec3 cameraPosition {gCamera->getPosition()};
 
+    //Camera input can be recorded (F9) for replaying later
+    InputRecorder inputRecorder {};
+    gInputRecorder = &inputRecorder;
+    if(inputReplay.isLoaded()) {
+        inputReplay.start(*gCamera);
+        gInputReplay = &inputReplay;
+    }
+
+    //The nearest hit along a ray on any copy of the model, through
+    //each mesh's BVH; which copy, or -1 for none
+    auto castScene = [&](const Ray& ray, RayHit& hit) {
+        const Model* model { modelCache.getModel(gSceneModel) };
+        int copy {-1};
+        Ray nearest {ray};
+        for(std::size_t i {0}; model && i < modelTransforms.size(); ++i) {
+            if(!model->intersect(nearest, modelTransforms[i], hit)) continue;
+            nearest.mMaxDistance = hit.mDistance;
+            copy = static_cast<int>(i);
+        }
+        return copy;
+    };
+
+    //The camera stops short of the model's copies by its near plane,
+    //so it never sees into them, and slides along whatever it hits.
+    //Replays go without, since how far the model has loaded at any
+    //given step differs from run to run
+    if(!inputReplay.isLoaded()) {
+        gCamera->setCollider([&](const glm::vec3& from, const glm::vec3& to) {
+            float radius { gCamera->getNearPlane() };
+            glm::vec3 position {from};
+            glm::vec3 step {to - from};
+            for(int slide {0}; slide < 2; ++slide) {
+                float length { glm::length(step) };
+                if(!(length > 0.f)) break;
+                glm::vec3 direction {step / length};
+                RayHit hit {};
+                Ray ray { .mOrigin {position}, .mDirection {direction}, .mMaxDistance {length + radius} };
+                if(castScene(ray, hit) < 0) return position + step;
+
+                float allowed { std::clamp(hit.mDistance - radius, 0.f, length) };
+                position += direction * allowed;
+                step = direction * (length - allowed);
+                step -= glm::dot(step, hit.mNormal) * hit.mNormal;
+            }
+            return position;
+        });
+    }
+
+    //Clicking with the camera off picks out what's under the cursor
+    bool pickRequested {false};
+    glm::vec2 pickCursor {0.f};
+
     //Main event loop
     SDL_Event event;
     bool quit {false};
     while(true) {
+        PROFILE_ZONE("Frame");
+        AllocationStats frameAllocationStart { getAllocationStats() };
+        framePacer.beginFrame();
+        perfHUD.beginFrame();
+        gDeltaTime = framePacer.getFrameTime();
+        if(benchmarkConfig.mEnabled) benchmark.beginFrame();
+
         //Check SDL event queue for any events, process them
-        while(SDL_PollEvent(&event)) {
+        while(!headless && SDL_PollEvent(&event)) {
             //Handle exit events
             if(
                 event.type == SDL_QUIT 
@@ -216,13 +611,22 @@ int main(int argc, char* argv[]) {
                 switch(event.window.event) {
                     case SDL_WINDOWEVENT_RESIZED:
                     case SDL_WINDOWEVENT_SIZE_CHANGED:
-                        glViewport(
-                            0, 0,
-                            event.window.data1, event.window.data2
-                        );
+                        // The event's size is in screen coordinates,
+                        // which needn't be pixels
+                        getDrawableSize(drawableWidth, drawableHeight);
+                        dynamicResolution.resize(drawableWidth, drawableHeight);
+                        deferredRenderer.resize(dynamicResolution.getRenderWidth(), dynamicResolution.getRenderHeight());
                     break;
                 }
             }
+            else if(
+                event.type == SDL_MOUSEBUTTONDOWN
+                && event.button.button == SDL_BUTTON_LEFT
+                && !gCamera->isActive()
+            ) {
+                pickRequested = true;
+                pickCursor = glm::vec2(event.button.x, event.button.y);
+            }
             else processInput(&event);
 
             if(gWireframeMode)
@@ -232,40 +636,326 @@ int main(int argc, char* argv[]) {
         }
         if(quit) break;
 
-        //Update time related variables
         uint64_t currentFrame {SDL_GetTicks64()};
-        gDeltaTime = static_cast<float>(currentFrame - lastFrame)/1000.f;
-        lastFrame = currentFrame;
 
-        //Update the camera and related matrices
-        gCamera->update(gDeltaTime);
+        //Step the simulation for however much time has built up.
+        //Replays and benchmarks step by frame rather than by time
+        //instead, so every run sees the same frames
+        if(gInputReplay) {
+            for(std::size_t i {0}; i < benchmarkConfig.mReplayStepsPerFrame; ++i)
+                inputReplay.step(*gCamera);
+            gCamera->setInterpolation(1.f);
+            while(framePacer.consumeFixedStep()) {}
+
+            //Hand the camera back once the recording runs out
+            if(inputReplay.isFinished()) {
+                inputReplay.verify(*gCamera);
+                gInputReplay = nullptr;
+            }
+        } else if(benchmarkConfig.mEnabled) {
+            glm::vec3 position {};
+            float yaw {0.f}, pitch {0.f};
+            getBenchmarkCameraPose(benchmarkConfig, benchmark.getFrame(), position, yaw, pitch);
+            gCamera->setPose(position, yaw, pitch);
+        } else {
+            while(framePacer.consumeFixedStep()) {
+                gCamera->update(framePacer.getFixedStep());
+                inputRecorder.step();
+            }
+            gCamera->setInterpolation(framePacer.getInterpolation());
+        }
+
+        //Update world matrices of anything that moved
+        sceneTransforms.update();
+
+        //Upload a little more of any model still loading, taking on
+        //whatever the upload thread has finished. It's drawn among
+        //the static shadow casters, so their caches go stale whenever
+        //it changes shape
+        if(gUploadQueue) gUploadQueue->update();
+        if(modelCache.update()) sceneShadows.invalidateAll();
+
+        //Don't queue up more frames than the GPU is allowed to lag
+        //behind, then pick up the freshest mouse input just before
+        //the view is built from it
+        {
+            PROFILE_ZONE("Wait for frame slot");
+            perfHUD.beginWait();
+            framePacer.waitForFrameSlot();
+            perfHUD.endWait();
+            drawDataStream.beginFrame();
+        }
+        if(!headless) sampleLateInput();
+
+        //Pose the characters. Benchmarks step by frame, so every run
+        //poses them the same
+        if(!characterHandles.empty()) {
+            float characterStep { benchmarkConfig.mEnabled? framePacer.getFixedStep(): gDeltaTime };
+            characterClock += characterStep;
+            const Model* model { modelCache.getModel(characterModel) };
+            int nClips { model? static_cast<int>(model->getSkeleton().mClips.size()): 0 };
+            for(std::size_t i {0}; nClips > 0 && i < characterHandles.size(); ++i) {
+                // Staggered, so they don't all switch at once
+                float phase { CHARACTER_CLIP_SECONDS * std::fmod(i * .618034f, 1.f) };
+                int clip { static_cast<int>((characterClock + phase) / CHARACTER_CLIP_SECONDS + i) % nClips };
+                if(clip == characterClips[i]) continue;
+                float speed { .8f + .4f * std::fmod(i * .381966f, 1.f) };
+                characters.play(characterHandles[i], clip, characterClips[i] < 0? 0.f: .3f, speed);
+                characterClips[i] = clip;
+            }
+            characters.update(characterStep, modelCache, *gJobSystem);
+        }
+
+        //Update the camera related matrices
         glm::mat4 projectionTransform {gCamera->getProjectionMatrix()};
         glm::mat4 viewTransform {gCamera->getViewMatrix()};
         cameraPosition = gCamera->getPosition();
 
-        //Clear colour, stencil, and depth buffers before each render
+        if(pickRequested) {
+            // Back through the projection from the cursor, at the
+            // near and far planes, for the ray under it
+            pickRequested = false;
+            int windowWidth {0}, windowHeight {0};
+            SDL_GetWindowSize(gWindow, &windowWidth, &windowHeight);
+            glm::vec2 cursor {
+                2.f * pickCursor.x / std::max(windowWidth, 1) - 1.f,
+                1.f - 2.f * pickCursor.y / std::max(windowHeight, 1)
+            };
+            glm::mat4 toWorld { glm::inverse(projectionTransform * viewTransform) };
+            glm::vec4 nearPoint { toWorld * glm::vec4(cursor.x, cursor.y, -1.f, 1.f) };
+            glm::vec4 farPoint { toWorld * glm::vec4(cursor.x, cursor.y, 1.f, 1.f) };
+            glm::vec3 origin { nearPoint / nearPoint.w };
+            Ray ray { .mOrigin {origin}, .mDirection { glm::normalize(glm::vec3(farPoint / farPoint.w) - origin) } };
+
+            uint64_t pickStart {SDL_GetPerformanceCounter()};
+            RayHit hit {};
+            int copy { castScene(ray, hit) };
+            double pickMs {
+                1000.0 * (SDL_GetPerformanceCounter() - pickStart) / SDL_GetPerformanceFrequency()
+            };
+            if(copy < 0) std::cout << "Picked nothing (" << pickMs << " ms)" << std::endl;
+            else {
+                std::cout << "Picked model copy " << copy << ", mesh " << hit.mMesh << " triangle "
+                    << hit.mTriangle << ", " << hit.mDistance << " away (" << pickMs << " ms)" << std::endl;
+            }
+        }
+
+        //Pick this frame's resolution from the GPU times that have
+        //come back, then clear colour, stencil, and depth buffers
+        //before drawing the scene at it
+        if(dynamicResolution.isEnabled() != gDynamicResolutionMode)
+            dynamicResolution.setEnabled(gDynamicResolutionMode);
+        if(dynamicResolution.update())
+            deferredRenderer.resize(dynamicResolution.getRenderWidth(), dynamicResolution.getRenderHeight());
+        int renderWidth { dynamicResolution.getRenderWidth() };
+        int renderHeight { dynamicResolution.getRenderHeight() };
+        dynamicResolution.beginScene();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-        // Draw vegetation
-        objectShader.use();
-        objectShader.setMat4("projection", projectionTransform);
-        objectShader.setMat4("view", viewTransform);
-        objectShader.setVec3("eyePos", cameraPosition);
-        objectShader.setVec3("lights[0].position", cameraPosition);
-        objectShader.setVec3("lights[0].direction", gCamera->getForward());
-        glActiveTexture(GL_TEXTURE0);
-        objectShader.setInt("material.texture_diffuse1", 0);
-        grassTexture.bindTexture(true);
-        for(glm::vec3 position : vegetationPositions) {
-            glm::mat4 model { glm::translate(glm::mat4(1.f), position) };
-            glm::mat4 normal { glm::transpose(glm::inverse(model)) };
-            objectShader.setMat4("model", model);
-            objectShader.setMat4("normalMat", normal);
-            glBindVertexArray(quadVAO);
-                glDrawElements(GL_TRIANGLES, quadElements.size(), GL_UNSIGNED_INT, static_cast<void*>(0));
-            glBindVertexArray(0);
+        //The spotlight follows the camera
+        spotLight.mPosition = cameraPosition;
+        spotLight.mDirection = gCamera->getForward();
+        sceneLights.setLight(spotLightIndex, spotLight);
+        sceneShadows.update(
+            sceneLights, viewTransform, gCamera->getFOV(), gCamera->getAspectRatio(),
+            gCamera->getNearPlane(), gCamera->getFarPlane()
+        );
+        sceneLights.update(viewTransform, projectionTransform, gCamera->getNearPlane(), gCamera->getFarPlane());
+
+        // Copies of the model far enough away become impostors, once
+        // it has one. Impostors cast no shadows, so shadow caches
+        // around copies that switch either way are out of date
+        nearModelCopies.clear();
+        farModelCopies.clear();
+        impostors.clearInstances();
+        impostors.removeUnloaded(modelCache);
+        if(!gSceneModel.isNull()) {
+            bool hasImpostor { benchmarkConfig.mImpostorDistance > 0.f && impostors.update(gSceneModel, modelCache) };
+            const Model* model { modelCache.getModel(gSceneModel) };
+            for(std::size_t i {0}; i < modelTransforms.size(); ++i) {
+                glm::vec3 position { modelTransforms[i][3] };
+                // Copies switch back a little closer in than they
+                // switched out, so none flicker at the threshold
+                float threshold { benchmarkConfig.mImpostorDistance * (modelImpostors[i]? .9f: 1.f) };
+                bool impostor { hasImpostor && glm::distance(cameraPosition, position) > threshold };
+                if(impostor != modelImpostors[i] && model) {
+                    glm::vec3 boundsMin { model->getBoundsMin() };
+                    glm::vec3 boundsMax { model->getBoundsMax() };
+                    sceneShadows.invalidateStaticCasters(
+                        position + .5f * (boundsMin + boundsMax), .5f * glm::length(boundsMax - boundsMin)
+                    );
+                }
+                modelImpostors[i] = impostor;
+                if(impostor) farModelCopies.push_back(i);
+                else nearModelCopies.push_back(i);
+            }
+        }
+
+        // The near copies' solid insides are the occluders. Copies
+        // still drawn as placeholder boxes are left out
+        const Model* sceneModel { modelCache.getModel(gSceneModel) };
+        if(gOcclusionCullingMode) {
+            occlusionCuller.beginFrame(projectionTransform * viewTransform);
+            for(std::size_t copy: nearModelCopies) {
+                if(sceneModel && !sceneModel->getOccluderIndices().empty())
+                    occlusionCuller.addOccluder(sceneModel->getOccluderVertices(), sceneModel->getOccluderIndices(), modelTransforms[copy]);
+            }
+            occlusionCuller.rasterize(*gJobSystem);
+        }
+        culledDraws.store(0, std::memory_order_relaxed);
+        for(std::size_t copy: farModelCopies) {
+            bool visible {
+                !gOcclusionCullingMode || !sceneModel || occlusionCuller.isVisible(sceneModel->getBoundsMin(), sceneModel->getBoundsMax(), modelTransforms[copy])
+            };
+            if(visible) impostors.addInstance(gSceneModel, modelTransforms[copy]);
+            else culledDraws.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Record vegetation draws, and the copies of the model near
+        // enough to draw in full after them; culled, or not
+        auto recordScene = [&](CommandBuffer& commands, std::size_t begin, std::size_t end, bool cull) {
+            std::size_t culled {0};
+            for(std::size_t i {begin}; i < end; ++i) {
+                if(i >= vegetationTransforms.size()) {
+                    std::size_t copy { nearModelCopies[i - vegetationTransforms.size()] };
+                    if(cull && sceneModel && !occlusionCuller.isVisible(sceneModel->getBoundsMin(), sceneModel->getBoundsMax(), modelTransforms[copy])) {
+                        ++culled;
+                        continue;
+                    }
+                    modelCache.record(gSceneModel, commands, modelTransforms[copy]);
+                    continue;
+                }
+
+                const glm::mat4& world { sceneTransforms.getWorldMatrix(vegetationTransforms[i]) };
+                if(cull && !occlusionCuller.isVisible(glm::vec3(-.5f, 0.f, 0.f), glm::vec3(.5f, 1.f, 0.f), world)) {
+                    ++culled;
+                    continue;
+                }
+
+                // The grass texture doubles as its own specular
+                // map, as it always has: the vegetation draw never
+                // set texture_specular1, so that sampler read unit 0,
+                // the diffuse map. Repeated binds are dropped as
+                // they're recorded
+                GLuint texture {
+                    benchmarkTextures.empty()? grassTexture.getTextureID():
+                    benchmarkTextures[i % benchmarkTextures.size()]
+                };
+                commands.bindMaterial(texture, texture);
+                commands.setDrawData(world, sceneTransforms.getNormalMatrix(vegetationTransforms[i]));
+                commands.drawElements(quadVAO, quadElements.size());
+            }
+            if(culled) culledDraws.fetch_add(culled, std::memory_order_relaxed);
+        };
+        std::size_t sceneDraws { vegetationTransforms.size() + nearModelCopies.size() };
+        sceneCommands.record(sceneDraws, [&](CommandBuffer& commands, std::size_t begin, std::size_t end) {
+            recordScene(commands, begin, end, false);
+        });
+        if(gOcclusionCullingMode) {
+            visibleCommands.record(sceneDraws, [&](CommandBuffer& commands, std::size_t begin, std::size_t end) {
+                recordScene(commands, begin, end, true);
+            });
+        }
+        CommandQueue& cameraCommands { gOcclusionCullingMode? visibleCommands: sceneCommands };
+        // Nearest first, so hidden fragments fail the depth test
+        // before they're shaded
+        cameraCommands.sortFrontToBack(cameraPosition);
+
+        // Characters aren't culled; they cast shadows over whatever
+        // static casters are cached
+        characters.record(characterCommands, modelCache);
+        characterCommands.sortFrontToBack(cameraPosition);
+
+        // Find out which virtual texture tiles the view needs, and
+        // bring in those that have arrived
+        if(virtualTextures) {
+            virtualTextures->update();
+            virtualTextures->renderFeedback(groundCommands, viewTransform, projectionTransform, renderWidth, renderHeight);
+        }
+
+        sceneShadows.render(sceneCommands, &characterCommands, true);
+
+        if(gDeferredMode) {
+            // Fill the G-buffer, then light it into the window
+            PROFILE_GPU_ZONE("G-buffer");
+            const Shader& geometryShader {
+                deferredRenderer.beginGeometryPass(viewTransform, projectionTransform)
+            };
+            cameraCommands.submit(geometryShader);
+            if(virtualTextures) {
+                const Shader& groundShader { deferredRenderer.useVirtualGeometryShader(viewTransform, projectionTransform) };
+                virtualTextures->bind(groundShader);
+                groundCommands.submit(groundShader);
+            }
+            if(impostors.getInstanceCount() > 0)
+                impostors.draw(deferredRenderer.useImpostorGeometryShader(viewTransform, projectionTransform));
+            if(characterCommands.getCommandCount() > 0) {
+                const Shader& skinnedShader { deferredRenderer.useSkinnedGeometryShader(viewTransform, projectionTransform) };
+                characters.bind(skinnedShader);
+                characterCommands.submit(skinnedShader);
+            }
+            deferredRenderer.lightingPass(sceneLights, sceneShadows, viewTransform, projectionTransform, cameraPosition);
+        } else {
+            // Vegetation is cut out of its quads, so its depth has to
+            // be alpha tested
+            if(gDepthPrepassMode)
+                depthPrepass.render(cameraCommands, viewTransform, projectionTransform, true);
+            if(gDepthPrepassMode && virtualTextures)
+                depthPrepass.render(groundCommands, viewTransform, projectionTransform, false);
+
+            // Draw vegetation
+            PROFILE_GPU_ZONE("Forward shading");
+            auto beginShading = [&](Shader& shader) {
+                shader.use();
+                shader.setMat4("projection", projectionTransform);
+                shader.setMat4("view", viewTransform);
+                shader.setVec3("eyePos", cameraPosition);
+                sceneLights.bind(shader, renderWidth, renderHeight);
+                sceneShadows.bind(shader);
+                shader.setInt("material.texture_diffuse1", 0);
+                shader.setInt("material.texture_specular1", 1);
+            };
+            Shader& shadingShader { gDepthPrepassMode? objectPrepassShader: objectShader };
+            beginShading(shadingShader);
+            if(gDepthPrepassMode) depthPrepass.beginShadingPass();
+            if(gOverdrawMode) overdrawMeter.begin();
+            cameraCommands.submit(shadingShader);
+            if(virtualTextures) {
+                Shader& groundShader { gDepthPrepassMode? objectVirtualPrepassShader: objectVirtualShader };
+                beginShading(groundShader);
+                virtualTextures->bind(groundShader);
+                groundCommands.submit(groundShader);
+            }
+            if(gOverdrawMode) overdrawMeter.end(renderWidth, renderHeight);
+            if(gDepthPrepassMode) depthPrepass.endShadingPass();
+
+            // Impostors work out their own depth, so can't be part of
+            // the pre-pass; they're drawn after it, depth tested as usual
+            if(impostors.getInstanceCount() > 0) {
+                beginShading(objectImpostorShader);
+                impostors.draw(objectImpostorShader);
+            }
+            // Characters are left out of the pre-pass too; being
+            // dynamic, they'd gain little from it
+            if(characterCommands.getCommandCount() > 0) {
+                beginShading(objectSkinnedShader);
+                characters.bind(objectSkinnedShader);
+                characterCommands.submit(objectSkinnedShader);
+            }
+
+            // Report about once a second rather than flooding the console
+            if(gOverdrawMode && currentFrame - lastOverdrawReport >= 1000) {
+                std::cout << "Overdraw (pre-pass " << (gDepthPrepassMode? "on": "off") << "): "
+                    << overdrawMeter.getShadedFragments() << " fragments over "
+                    << overdrawMeter.getCoveredPixels() << " pixels, "
+                    << overdrawMeter.getOverdraw() << " per pixel" << std::endl;
+                lastOverdrawReport = currentFrame;
+            }
         }
-        grassTexture.bindTexture(false);
+        glActiveTexture(GL_TEXTURE1);
+        counted::bindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        counted::bindTexture(GL_TEXTURE_2D, 0);
 
         // //Draw objects
         // objectShader.use();
@@ -288,23 +978,180 @@ int main(int argc, char* argv[]) {
         //     backpack.Draw(objectShader);
         // }
 
+        drawDataStream.endFrame();
+
+        //Bring the scene up to full resolution. Anything drawn from
+        //here on (UI, HUD) is drawn at it
+        dynamicResolution.endScene();
+        dynamicResolution.present(outputFramebuffer);
+        int outputWidth { dynamicResolution.getOutputWidth() };
+        int outputHeight { dynamicResolution.getOutputHeight() };
+
+        //The frame's timings and GL calls end here, so the overlay
+        //isn't counted in what it shows
+        perfHUD.endFrame(gGLCallCounts);
+        gGLCallCounts = {};
+        if(gHUDMode) perfHUD.draw(outputWidth, outputHeight);
+
+        //Start reading the frame back, if it's being captured, from
+        //wherever it was drawn
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFramebuffer);
+        frameCapture.capture(outputWidth, outputHeight);
+
+        //Benchmark frames are timed up to here, with the GPU's
+        //work finished
+        bool benchmarkDone {
+            benchmarkConfig.mEnabled
+            && !benchmark.endFrame(
+                cameraCommands.getDrawCount() + impostors.getDrawCount() + characterCommands.getDrawCount(),
+                outputWidth, outputHeight
+            )
+        };
+
         //Update screen
-        SDL_GL_SwapWindow(gWindow);
+        if(!headless) {
+            PROFILE_ZONE("Present");
+            framePacer.present(gWindow);
+        }
+        PROFILE_END_FRAME();
+        frameArena.reset();
+        AllocationStats frameAllocations { getAllocationStats() - frameAllocationStart };
+
+        FramePacer::FrameStats frameStats {};
+        if(framePacer.collectStats(frameStats) && gFrameStatsMode) {
+            std::cout << "Frame time: " << frameStats.mMeanFrameTime * 1000.0 << " ms mean, "
+                << frameStats.mFrameTimeStdDev * 1000.0 << " ms std dev, "
+                << frameStats.mMaxFrameTime * 1000.0 << " ms max over " << frameStats.mFrames << " frames; "
+                << "input to present: " << frameStats.mMeanLatency * 1000.0 << " ms mean, "
+                << frameStats.mMaxLatency * 1000.0 << " ms max; "
+                << "heap: " << frameAllocations.mAllocations << " allocations ("
+                << frameAllocations.mBytes << " bytes) last frame, frame arena peak "
+                << frameArena.getPeak() << " bytes" << std::endl;
+            if(!gSceneModel.isNull()) {
+                std::cout << "Model copies: " << nearModelCopies.size() << " drawn in full, "
+                    << impostors.getInstanceCount() << " as impostors" << std::endl;
+            }
+            if(!characterHandles.empty()) {
+                std::cout << "Characters: " << characters.getCharacterCount() << " animated, "
+                    << characters.getBoneCount() << " bones posed" << std::endl;
+            }
+            if(dynamicResolution.isEnabled()) {
+                std::cout << "Dynamic resolution: " << renderWidth << "x" << renderHeight << " ("
+                    << dynamicResolution.getScale() * 100.f << "%), scene GPU time "
+                    << dynamicResolution.getGPUTimeMs() << " ms of " << benchmarkConfig.mFrameBudgetMs
+                    << " ms budget" << std::endl;
+            }
+            if(gOcclusionCullingMode) {
+                std::cout << "Occlusion culling: " << culledDraws.load() << " draws culled, "
+                    << occlusionCuller.getTriangleCount() << " occluder triangles from "
+                    << occlusionCuller.getOccluderCount() << " occluders" << std::endl;
+            }
+            if(virtualTextures) {
+                std::cout << "Virtual texture pages: " << virtualTextures->getResidentCount() << " of "
+                    << virtualTextures->getPageCount() << " in use, "
+                    << virtualTextures->getPendingCount() << " tiles loading" << std::endl;
+            }
+        }
+        if(benchmarkDone) break;
     }
+    bool benchmarkPassed {
+        !benchmarkConfig.mEnabled || (benchmark.writeReport() && benchmark.checkAllocations())
+    };
+    if(inputRecorder.isRecording()) inputRecorder.end(gCamera->getState(), "input_recording.bin");
+    frameCapture.endStream();
+    frameCapture.flush();
 
     // de-allocate resources
     delete gCamera;
     gCamera = nullptr;
+    gFramePacer = nullptr;
+    gInputRecorder = nullptr;
+    gInputReplay = nullptr;
+    gStreamBuffer = nullptr;
+    gFrameArena = nullptr;
+    gFrameCapture = nullptr;
+    gModelCache = nullptr;
+    gAssets = nullptr;
 
     close(context);
-    return 0;
+    return benchmarkPassed? 0: 1;
 }
 
 void processInput(SDL_Event* event) {
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F1)
+        gOcclusionCullingMode = !gOcclusionCullingMode;
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F2)
+        gDeferredMode = !gDeferredMode;
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F3)
+        gDepthPrepassMode = !gDepthPrepassMode;
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F4)
+        gOverdrawMode = !gOverdrawMode;
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F5) {
+        // Cycle off -> vsync -> adaptive vsync
+        switch(gFramePacer->getSwapMode()) {
+            case FramePacer::immediate: gFramePacer->setSwapMode(FramePacer::vsync); break;
+            case FramePacer::vsync: gFramePacer->setSwapMode(FramePacer::adaptive); break;
+            case FramePacer::adaptive: gFramePacer->setSwapMode(FramePacer::immediate); break;
+        }
+    }
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F6)
+        gFramePacer->setFrameRateLimit(gFramePacer->getFrameRateLimit() > 0.f? 0.f: 60.f);
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F7)
+        gFrameStatsMode = !gFrameStatsMode;
+    // The function keys are all taken
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_2)
+        gDynamicResolutionMode = !gDynamicResolutionMode;
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_3)
+        gHUDMode = !gHUDMode;
+#if ZO_PROFILING
+    // Start a capture, or write the running one out for
+    // chrome://tracing or Perfetto
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F8) {
+        if(Profiler::isCapturing()) Profiler::endCapture("profile_trace.json");
+        else Profiler::beginCapture();
+    }
+#endif
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F9 && !gInputReplay) {
+        // Start recording camera input, or stop and save it
+        if(gInputRecorder->isRecording())
+            gInputRecorder->end(gCamera->getState(), "input_recording.bin");
+        else gInputRecorder->begin(gCamera->getState(), gFramePacer->getFixedStep());
+    }
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F10 && !gSceneModel.isNull())
+        gModelCache->reload(gSceneModel);
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F11) {
+        // Start or stop capturing every frame to a video
+        if(gFrameCapture->isStreaming()) gFrameCapture->endStream();
+        else gFrameCapture->beginStream("capture.y4m", FrameCapture::y4m);
+    }
+    if(event->type == SDL_KEYUP && event->key.keysym.sym == SDLK_F12) {
+        std::ostringstream path {};
+        path << "screenshot_" << SDL_GetTicks64() << ".png";
+        gFrameCapture->requestScreenshot(path.str());
+    }
+    applyCameraInput(event);
+}
+
+void applyCameraInput(SDL_Event* event) {
+    //Live input is shut out while a replay drives the camera
+    if(gInputReplay) return;
+    gInputRecorder->record(*event);
     gCamera->processInput(event);
 }
 
-bool init(SDL_Window*& window, SDL_GLContext& context) {
+void sampleLateInput() {
+    //Mouse motion that arrived while this frame was being prepared
+    //is applied now; everything else waits for the next poll
+    SDL_PumpEvents();
+    SDL_Event events[32];
+    int count {0};
+    while((count = SDL_PeepEvents(events, 32, SDL_GETEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION)) > 0) {
+        for(int i {0}; i < count; ++i) applyCameraInput(&events[i]);
+    }
+    gFramePacer->markInputSampled();
+}
+
+bool initWindow(SDL_Window*& window, SDL_GLContext& context) {
     //Initialize SDL subsystems
     SDL_Init(SDL_INIT_VIDEO);
     IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
@@ -324,8 +1171,35 @@ bool init(SDL_Window*& window, SDL_GLContext& context) {
     glewExperimental = GL_TRUE;
     glewInit();
 
+    //And a second context sharing the first's objects, for the
+    //upload thread. Being made leaves it current, so the first is
+    //made current again
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    gUploadContext = SDL_GL_CreateContext(window);
+    SDL_GL_MakeCurrent(window, context);
+
     //Set up viewport
-    glViewport(0, 0, 800, 600);
+    glViewport(0, 0, gWindowWidth, gWindowHeight);
+    return true;
+}
+
+bool init(SDL_Window*& window, SDL_GLContext& context, bool headless) {
+    PROFILE_THREAD_NAME("Main");
+
+    if(headless) {
+#ifdef ZO_HEADLESS
+        //No video subsystem or window; EGL provides the context, and
+        //an offscreen framebuffer stands in for the window's
+        SDL_Init(0);
+        IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+        gHeadlessContext = new HeadlessContext {};
+        if(!gHeadlessContext->create(gWindowWidth, gWindowHeight)) return false;
+#else
+        std::cout << "ERROR::MAIN::HEADLESS_NOT_BUILT (use make headless, or --windowed)" << std::endl;
+        return false;
+#endif
+    }
+    else if(!initWindow(window, context)) return false;
 
     // Enable OpenGL depth testing
     glEnable(GL_DEPTH_TEST);
@@ -343,12 +1217,56 @@ bool init(SDL_Window*& window, SDL_GLContext& context) {
     // value, and the color in the color buffer with (1 - the alpha value)
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    startUploadThread(window);
     return true;
 }
 
+void startUploadThread(SDL_Window* window) {
+    UploadQueue::Context uploadContext {};
+    if(gUploadContext) {
+        uploadContext = UploadQueue::Context {
+            .mMakeCurrent { [window]() { return SDL_GL_MakeCurrent(window, gUploadContext) == 0; } },
+            .mRelease { [window]() { SDL_GL_MakeCurrent(window, nullptr); } }
+        };
+    }
+#ifdef ZO_HEADLESS
+    if(gHeadlessContext && gHeadlessContext->createUploadContext()) {
+        uploadContext = UploadQueue::Context {
+            .mMakeCurrent { []() { return gHeadlessContext->makeUploadContextCurrent(); } },
+            .mRelease { []() { gHeadlessContext->releaseUploadContext(); } }
+        };
+    }
+#endif
+    //Without one, meshes and textures are uploaded on this thread
+    //instead, a piece a frame
+    if(!uploadContext.mMakeCurrent) {
+        std::cout << "No shared context for uploads; uploading on the GL thread" << std::endl;
+        return;
+    }
+    gUploadQueue = new UploadQueue {std::move(uploadContext)};
+    if(!gUploadQueue->isRunning()) {
+        delete gUploadQueue;
+        gUploadQueue = nullptr;
+    }
+}
+
 void close(SDL_GLContext& context){
+    //Query objects go with the context
+    PROFILE_SHUTDOWN();
+
+    //The upload thread's context goes first, being shared with the
+    //main one
+    delete gUploadQueue;
+    gUploadQueue = nullptr;
+    if(gUploadContext) SDL_GL_DeleteContext(gUploadContext);
+    gUploadContext = nullptr;
+
     //Kill the OpenGL context before quitting
-    SDL_GL_DeleteContext(context);
+#ifdef ZO_HEADLESS
+    delete gHeadlessContext;
+    gHeadlessContext = nullptr;
+#endif
+    if(context) SDL_GL_DeleteContext(context);
 
     // Then die
     SDL_Quit();
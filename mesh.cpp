@@ -1,30 +1,110 @@
+#include <cstdio>
 #include <string>
 #include <vector>
+#include <utility>
 #include <GL/glew.h>
 
 #include "shader.hpp"
-#include "texture.hpp"
+#include "texturetable.hpp"
+#include "commandbuffer.hpp"
+#include "transform.hpp"
+#include "glcallcounts.hpp"
 #include "mesh.hpp"
 
-Mesh::Mesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<Texture*>& textures, const Shader& shader):
-    vertices{vertices}, indices{indices}, textures{textures}
+Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<TextureHandle> textures, const Shader& shader, std::vector<VertexSkin> skin, MeshBVH bvh):
+    vertices{std::move(vertices)}, indices{std::move(indices)}, textures{std::move(textures)}, skin{std::move(skin)},
+    bvh{std::move(bvh)}
 {
     setupMesh(shader);
 }
 
+Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<TextureHandle> textures, const Shader& shader, std::vector<VertexSkin> skin, MeshBVH bvh, Buffers buffers):
+    vao{0}, vbo{buffers.mVertices}, ebo{buffers.mIndices}, skinVBO{buffers.mSkin},
+    vertices{std::move(vertices)}, indices{std::move(indices)}, textures{std::move(textures)}, skin{std::move(skin)},
+    bvh{std::move(bvh)}
+{
+    buildVertexArray(shader);
+}
+
+Mesh::~Mesh() {
+    release();
+}
+
+Mesh::Mesh(Mesh&& other) noexcept:
+    vao{other.vao}, vbo{other.vbo}, ebo{other.ebo}, skinVBO{other.skinVBO},
+    vertices{std::move(other.vertices)}, indices{std::move(other.indices)}, textures{std::move(other.textures)},
+    skin{std::move(other.skin)}, bvh{std::move(other.bvh)}
+{
+    // The buffers belong to this mesh now
+    other.vao = other.vbo = other.ebo = other.skinVBO = 0;
+}
+
+Mesh& Mesh::operator=(Mesh&& other) noexcept {
+    if(&other == this) return *this;
+    release();
+    vao = other.vao;
+    vbo = other.vbo;
+    ebo = other.ebo;
+    skinVBO = other.skinVBO;
+    vertices = std::move(other.vertices);
+    indices = std::move(other.indices);
+    textures = std::move(other.textures);
+    skin = std::move(other.skin);
+    bvh = std::move(other.bvh);
+    other.vao = other.vbo = other.ebo = other.skinVBO = 0;
+    return *this;
+}
+
+void Mesh::release() {
+    if(vao) glDeleteVertexArrays(1, &vao);
+    if(vbo) glDeleteBuffers(1, &vbo);
+    if(ebo) glDeleteBuffers(1, &ebo);
+    if(skinVBO) glDeleteBuffers(1, &skinVBO);
+    vao = vbo = ebo = skinVBO = 0;
+}
+
+Mesh::Buffers Mesh::uploadBuffers(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<VertexSkin>& skin) {
+    Buffers buffers {};
+    glGenBuffers(1, &buffers.mVertices);
+    glGenBuffers(1, &buffers.mIndices);
+    if(!skin.empty()) glGenBuffers(1, &buffers.mSkin);
+
+    // Buffers have no type of their own, and binding an element
+    // buffer needs a vertex array, which contexts don't share; so
+    // everything's filled through GL_ARRAY_BUFFER
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.mVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.mIndices);
+    glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    if(buffers.mSkin) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.mSkin);
+        glBufferData(GL_ARRAY_BUFFER, skin.size() * sizeof(VertexSkin), skin.data(), GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffers;
+}
+
+void Mesh::deleteBuffers(Buffers& buffers) {
+    if(buffers.mVertices) glDeleteBuffers(1, &buffers.mVertices);
+    if(buffers.mIndices) glDeleteBuffers(1, &buffers.mIndices);
+    if(buffers.mSkin) glDeleteBuffers(1, &buffers.mSkin);
+    buffers = {};
+}
+
 void Mesh::setupMesh(const Shader& shader) {
+    Buffers buffers { uploadBuffers(vertices, indices, skin) };
+    vbo = buffers.mVertices;
+    ebo = buffers.mIndices;
+    skinVBO = buffers.mSkin;
+    buildVertexArray(shader);
+}
+
+void Mesh::buildVertexArray(const Shader& shader) {
     glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
 
-    glBindVertexArray(vao);
-        // load vertex buffer
+    counted::bindVertexArray(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        // load element buffer
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
 
         // Pointers to various interleaved vertex properties
         shader.enableAttribArray("position");
@@ -33,25 +113,81 @@ void Mesh::setupMesh(const Shader& shader) {
         shader.setAttribPointerF("normal", 3, sizeof(Vertex)/sizeof(float), offsetof(Vertex, normal)/sizeof(float));
         shader.enableAttribArray("textureCoord");
         shader.setAttribPointerF("textureCoord", 2, sizeof(Vertex)/sizeof(float), offsetof(Vertex, texCoords)/sizeof(float));
-    glBindVertexArray(0);
+
+        // Skin data goes to fixed locations, since only the skinning
+        // variants of shaders have them: joints as integers, weights
+        // normalised
+        if(skinVBO) {
+            glBindBuffer(GL_ARRAY_BUFFER, skinVBO);
+            glEnableVertexAttribArray(JOINTS_LOCATION);
+            glVertexAttribIPointer(
+                JOINTS_LOCATION, 4, GL_UNSIGNED_BYTE, sizeof(VertexSkin),
+                reinterpret_cast<void*>(offsetof(VertexSkin, joints))
+            );
+            glEnableVertexAttribArray(WEIGHTS_LOCATION);
+            glVertexAttribPointer(
+                WEIGHTS_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VertexSkin),
+                reinterpret_cast<void*>(offsetof(VertexSkin, weights))
+            );
+        }
+    counted::bindVertexArray(0);
 }
 
-void Mesh::Draw (const Shader& shader) const {
+void Mesh::Draw (const Shader& shader, const TextureTable& textureTable) const {
     unsigned int diffuseN {1};
     unsigned int specularN {1};
 
     // bind textures to texture units in GPU
     for(unsigned int i{0}; i < textures.size(); ++i) {
         glActiveTexture(GL_TEXTURE0 + i);
-        std::string name { textures[i]->getType() };
-        std::string number { std::to_string(name == "texture_diffuse"? diffuseN++: specularN++) };
-        shader.setInt(("material." + name + number).c_str(), i);
-        textures[i]->bindTexture();
+        const std::string& type { textureTable.getType(textures[i]) };
+        char name[MAX_UNIFORM_NAME];
+        std::snprintf(
+            name, sizeof(name), "material.%s%u",
+            type.c_str(), type == "texture_diffuse"? diffuseN++: specularN++
+        );
+        shader.setInt(name, i);
+        counted::bindTexture(GL_TEXTURE_2D, textureTable.getTextureID(textures[i]));
     }
     glActiveTexture(GL_TEXTURE0);
 
     // draw mesh
-    glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    counted::bindVertexArray(vao);
+        counted::drawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    counted::bindVertexArray(0);
+}
+
+void Mesh::record(CommandBuffer& commands, const glm::mat4& model, const TextureTable& textureTable) const {
+    record(commands, model, textureTable, 0, 0);
+}
+
+void Mesh::record(CommandBuffer& commands, const glm::mat4& model, const TextureTable& textureTable, GLint firstTexel, GLint boneCount) const {
+    recordMaterial(commands, textureTable);
+    if(boneCount > 0) commands.setSkinnedDrawData(model, firstTexel, boneCount);
+    else commands.setDrawData(model);
+    commands.drawElements(vao, indices.size());
+}
+
+void Mesh::record(CommandBuffer& commands, const glm::mat4& model, const TransformHierarchy& nodes, const std::vector<TransformID>& instances, const TextureTable& textureTable) const {
+    if(instances.empty()) return;
+    recordMaterial(commands, textureTable);
+    commands.setDrawData(model * nodes.getWorldMatrix(instances[0]));
+    for(std::size_t i {1}; i < instances.size(); ++i)
+        commands.addInstanceData(model * nodes.getWorldMatrix(instances[i]));
+    commands.drawElementsInstanced(vao, indices.size(), static_cast<GLsizei>(instances.size()));
+}
+
+void Mesh::recordMaterial(CommandBuffer& commands, const TextureTable& textureTable) const {
+    // Command buffers only carry the first diffuse and specular
+    // map, which is all the object shader samples anyway. Missing
+    // or unloaded maps draw with the table's placeholder
+    TextureHandle diffuse {};
+    TextureHandle specular {};
+    for(TextureHandle texture: textures) {
+        const std::string& type { textureTable.getType(texture) };
+        if(diffuse.isNull() && type == "texture_diffuse") diffuse = texture;
+        else if(specular.isNull() && type == "texture_specular") specular = texture;
+    }
+
+    commands.bindMaterial(textureTable.getTextureID(diffuse), textureTable.getTextureID(specular));
 }
@@ -1,13 +1,17 @@
 #ifndef ZOMESH_H
 #define ZOMESH_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
-#include "texture.hpp"
+#include "texturetable.hpp"
 #include "shader.hpp"
+#include "commandbuffer.hpp"
+#include "meshbvh.hpp"
+#include "transform.hpp"
 
 struct Vertex {
     glm::vec3 position;
@@ -15,17 +19,76 @@ struct Vertex {
     glm::vec2 texCoords;
 };
 
+// The bones (into the model's bone palette) a skinned vertex follows,
+// up to four, and how much: unsigned normalised bytes summing to 255
+struct VertexSkin {
+    std::uint8_t joints[4];
+    std::uint8_t weights[4];
+};
+
+// Attribute locations skin data is fed to (see shaders/vertex.vs)
+const GLuint JOINTS_LOCATION {4};
+const GLuint WEIGHTS_LOCATION {5};
+
 class Mesh {
+public:
+    // The buffers holding a mesh's vertices, indices and skin (0 if
+    // it has none)
+    struct Buffers {
+        GLuint mVertices {0};
+        GLuint mIndices {0};
+        GLuint mSkin {0};
+    };
+
+private:
     GLuint vao, vbo, ebo;
+    GLuint skinVBO {0};
     void setupMesh(const Shader& shader);
+    void buildVertexArray(const Shader& shader);
+    void release();
+    void recordMaterial(CommandBuffer& commands, const TextureTable& textureTable) const;
 
 public:
     std::vector<Vertex> vertices;
     std::vector<GLuint> indices;
-    std::vector<Texture*> textures;
+    // Looked up in the texture table the mesh is drawn with
+    std::vector<TextureHandle> textures;
+    // One per vertex for skinned meshes, in a buffer of its own;
+    // empty otherwise
+    std::vector<VertexSkin> skin;
+    // Over the triangles as imported; skinned meshes' at rest
+    MeshBVH bvh;
+
+    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<TextureHandle> textures, const Shader& shader, std::vector<VertexSkin> skin={}, MeshBVH bvh={});
+    // Or around buffers already filled by uploadBuffers(), which the
+    // mesh takes over; only its vertex array is made here
+    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<TextureHandle> textures, const Shader& shader, std::vector<VertexSkin> skin, MeshBVH bvh, Buffers buffers);
+    ~Mesh();
+
+    // Meshes own their buffers, so they move but don't copy
+    Mesh(const Mesh& other) = delete;
+    Mesh& operator=(const Mesh& other) = delete;
+    Mesh(Mesh&& other) noexcept;
+    Mesh& operator=(Mesh&& other) noexcept;
+
+    void Draw(const Shader& shader, const TextureTable& textureTable) const;
+
+    // Record this mesh's draw into a command buffer, without touching GL
+    void record(CommandBuffer& commands, const glm::mat4& model, const TextureTable& textureTable) const;
+    // Or a skinned draw, bent by boneCount bones whose matrices start
+    // at texel firstTexel of the bone palette (see animation.hpp)
+    void record(CommandBuffer& commands, const glm::mat4& model, const TextureTable& textureTable, GLint firstTexel, GLint boneCount) const;
+    // Or one instanced draw, an instance per node in instances, each
+    // placed by its node's world transform relative to model
+    void record(CommandBuffer& commands, const glm::mat4& model, const TransformHierarchy& nodes, const std::vector<TransformID>& instances, const TextureTable& textureTable) const;
+
+    bool isSkinned() const { return !skin.empty(); }
 
-    Mesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<Texture*>& textures, const Shader& shader);
-    void Draw (const Shader& shader) const;
+    // Make and fill a mesh's buffers through whichever context is
+    // current on the calling thread, for any context sharing with it
+    // to build a Mesh around
+    static Buffers uploadBuffers(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<VertexSkin>& skin);
+    static void deleteBuffers(Buffers& buffers);
 };
 
 #endif
@@ -0,0 +1,365 @@
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "jobsystem.hpp"
+#include "profiler.hpp"
+#include "meshbvh.hpp"
+
+namespace {
+    // Bins each axis is split into when looking for where to split
+    constexpr int BIN_COUNT {16};
+    // What visiting a node costs, against testing a triangle
+    constexpr float TRAVERSAL_COST {1.f};
+    // Nodes over this many triangles build their children as jobs
+    constexpr std::uint32_t PARALLEL_BUILD_TRIANGLES {4096};
+    // Queries put off the further child of every node on their way
+    // down on a stack this deep, so no leaf is built deeper
+    constexpr int MAX_TRAVERSAL_DEPTH {64};
+
+    constexpr float INFINITE_DISTANCE { std::numeric_limits<float>::infinity() };
+
+    struct Bounds {
+        glm::vec3 mMin { std::numeric_limits<float>::max() };
+        glm::vec3 mMax { -std::numeric_limits<float>::max() };
+
+        void grow(const glm::vec3& point) {
+            mMin = glm::min(mMin, point);
+            mMax = glm::max(mMax, point);
+        }
+        void grow(const Bounds& bounds) {
+            mMin = glm::min(mMin, bounds.mMin);
+            mMax = glm::max(mMax, bounds.mMax);
+        }
+        float area() const {
+            glm::vec3 extent { glm::max(mMax - mMin, glm::vec3(0.f)) };
+            return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+        }
+    };
+
+    struct Split {
+        int mAxis {-1};
+        int mBin {0}; // the last bin on the left
+        float mCost { INFINITE_DISTANCE };
+    };
+
+    class Builder {
+    public:
+        Builder(std::vector<MeshBVH::Node>& nodes, std::uint32_t nTriangles, JobSystem* jobs):
+            mNodes {nodes}, mTriangleBounds(nTriangles), mCentroids(nTriangles), mOrder(nTriangles), mJobs {jobs}
+        {
+            std::iota(mOrder.begin(), mOrder.end(), 0u);
+        }
+
+        void buildNode(std::uint32_t node, std::uint32_t first, std::uint32_t count, int depth);
+
+        std::vector<MeshBVH::Node>& mNodes;
+        std::vector<Bounds> mTriangleBounds;
+        std::vector<glm::vec3> mCentroids;
+        std::vector<std::uint32_t> mOrder; // triangles, grouped by leaf as they're built
+        std::atomic<std::uint32_t> mNodeCount {1};
+        JobSystem* mJobs;
+
+    private:
+        Split findSplit(std::uint32_t first, std::uint32_t count, const Bounds& bounds, const Bounds& centroidBounds) const;
+    };
+
+    Split Builder::findSplit(std::uint32_t first, std::uint32_t count, const Bounds& bounds, const Bounds& centroidBounds) const {
+        // Every axis binned in the one pass over the triangles
+        glm::vec3 low {centroidBounds.mMin};
+        glm::vec3 extent {centroidBounds.mMax - low};
+        glm::vec3 scale {0.f};
+        for(int axis {0}; axis < 3; ++axis) scale[axis] = extent[axis] > 0.f? BIN_COUNT / extent[axis]: 0.f;
+
+        Bounds binBounds[3][BIN_COUNT] {};
+        std::uint32_t binCounts[3][BIN_COUNT] {};
+        for(std::uint32_t i {first}; i < first + count; ++i) {
+            std::uint32_t triangle {mOrder[i]};
+            glm::vec3 offset {(mCentroids[triangle] - low) * scale};
+            const Bounds& triangleBounds {mTriangleBounds[triangle]};
+            for(int axis {0}; axis < 3; ++axis) {
+                int bin { std::min(BIN_COUNT - 1, static_cast<int>(offset[axis])) };
+                binBounds[axis][bin].grow(triangleBounds);
+                ++binCounts[axis][bin];
+            }
+        }
+
+        Split best {};
+        float parentArea { std::max(bounds.area(), std::numeric_limits<float>::min()) };
+        for(int axis {0}; axis < 3; ++axis) {
+            if(!(extent[axis] > 0.f)) continue;
+
+            // Everything left of each plane swept one way, then the
+            // right of it the other, costing each plane on the way back
+            float leftAreas[BIN_COUNT - 1] {};
+            std::uint32_t leftCounts[BIN_COUNT - 1] {};
+            Bounds left {};
+            std::uint32_t leftCount {0};
+            for(int plane {0}; plane < BIN_COUNT - 1; ++plane) {
+                left.grow(binBounds[axis][plane]);
+                leftCount += binCounts[axis][plane];
+                leftAreas[plane] = left.area();
+                leftCounts[plane] = leftCount;
+            }
+            Bounds right {};
+            std::uint32_t rightCount {0};
+            for(int plane {BIN_COUNT - 2}; plane >= 0; --plane) {
+                right.grow(binBounds[axis][plane + 1]);
+                rightCount += binCounts[axis][plane + 1];
+                if(leftCounts[plane] == 0 || rightCount == 0) continue;
+                float cost {
+                    TRAVERSAL_COST + (leftAreas[plane] * leftCounts[plane] + right.area() * rightCount) / parentArea
+                };
+                if(cost < best.mCost) best = Split { .mAxis {axis}, .mBin {plane}, .mCost {cost} };
+            }
+        }
+        return best;
+    }
+
+    void Builder::buildNode(std::uint32_t node, std::uint32_t first, std::uint32_t count, int depth) {
+        Bounds bounds {}, centroidBounds {};
+        for(std::uint32_t i {first}; i < first + count; ++i) {
+            bounds.grow(mTriangleBounds[mOrder[i]]);
+            centroidBounds.grow(mCentroids[mOrder[i]]);
+        }
+        mNodes[node].mMin = bounds.mMin;
+        mNodes[node].mMax = bounds.mMax;
+
+        // Split in half from here on, the tree gets no deeper than
+        // this. Once another lopsided split could take it past the
+        // queries' stacks, nodes are only halved
+        int halvedDepth {depth + static_cast<int>(std::bit_width(count - 1))};
+        Split split {};
+        if(count > 1 && halvedDepth < MAX_TRAVERSAL_DEPTH) split = findSplit(first, count, bounds, centroidBounds);
+        if(count == 1 || (count <= MeshBVH::MAX_LEAF_TRIANGLES && split.mCost >= static_cast<float>(count))) {
+            mNodes[node].mFirst = first;
+            mNodes[node].mCount = count;
+            return;
+        }
+
+        std::uint32_t* begin {mOrder.data() + first};
+        std::uint32_t* end {begin + count};
+        std::uint32_t* middle {begin};
+        if(split.mAxis >= 0) {
+            int axis {split.mAxis};
+            float low {centroidBounds.mMin[axis]};
+            float scale {BIN_COUNT / (centroidBounds.mMax[axis] - low)};
+            middle = std::partition(begin, end, [&](std::uint32_t triangle) {
+                return std::min(BIN_COUNT - 1, static_cast<int>((mCentroids[triangle][axis] - low) * scale)) <= split.mBin;
+            });
+        }
+        if(middle == begin || middle == end) {
+            // Nothing to choose between (or too deep to keep trying):
+            // halve them along the widest spread of centres
+            glm::vec3 extent {centroidBounds.mMax - centroidBounds.mMin};
+            int axis { extent.x >= extent.y && extent.x >= extent.z? 0: (extent.y >= extent.z? 1: 2) };
+            middle = begin + count / 2;
+            std::nth_element(begin, middle, end, [&](std::uint32_t a, std::uint32_t b) {
+                return mCentroids[a][axis] < mCentroids[b][axis];
+            });
+        }
+        std::uint32_t leftCount { static_cast<std::uint32_t>(middle - begin) };
+
+        std::uint32_t left { mNodeCount.fetch_add(2, std::memory_order_relaxed) };
+        mNodes[node].mFirst = left;
+        mNodes[node].mCount = 0;
+        auto buildChild = [&](std::size_t child) {
+            if(child == 0) buildNode(left, first, leftCount, depth + 1);
+            else buildNode(left + 1, first + leftCount, count - leftCount, depth + 1);
+        };
+        if(mJobs && count >= PARALLEL_BUILD_TRIANGLES) {
+            mJobs->parallelFor(2, 1, [&](std::size_t firstChild, std::size_t endChild) {
+                for(std::size_t child {firstChild}; child < endChild; ++child) buildChild(child);
+            });
+        } else {
+            buildChild(0);
+            buildChild(1);
+        }
+    }
+
+    // Two sided Moller-Trumbore, for hits nearer than closest
+    bool intersectTriangle(const Ray& ray, const glm::vec3& corner, const glm::vec3& edge1, const glm::vec3& edge2, float closest, float& distance, glm::vec2& barycentric) {
+        glm::vec3 p { glm::cross(ray.mDirection, edge2) };
+        float determinant { glm::dot(edge1, p) };
+        if(determinant == 0.f) return false;
+        float inverse {1.f / determinant};
+
+        glm::vec3 s {ray.mOrigin - corner};
+        float u { glm::dot(s, p) * inverse };
+        if(u < 0.f || u > 1.f) return false;
+        glm::vec3 q { glm::cross(s, edge1) };
+        float v { glm::dot(ray.mDirection, q) * inverse };
+        if(v < 0.f || u + v > 1.f) return false;
+        float t { glm::dot(edge2, q) * inverse };
+        if(!(t >= 0.f && t < closest)) return false;
+
+        distance = t;
+        barycentric = glm::vec2(u, v);
+        return true;
+    }
+}
+
+void MeshBVH::build(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, JobSystem* jobs) {
+    PROFILE_ZONE("MeshBVH::build");
+    mNodes.clear();
+    mTriangles.clear();
+    mTriangleIds.clear();
+    std::uint32_t nTriangles { static_cast<std::uint32_t>(indices.size() / 3) };
+    if(nTriangles == 0) return;
+
+    // A tree of single triangle leaves is as big as it can get
+    mNodes.resize(2 * static_cast<std::size_t>(nTriangles) - 1);
+    Builder builder {mNodes, nTriangles, jobs};
+    auto forEachTriangle = [&](auto&& function) {
+        if(jobs) jobs->parallelFor(nTriangles, 4096, function);
+        else function(std::size_t {0}, std::size_t {nTriangles});
+    };
+    forEachTriangle([&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            Bounds bounds {};
+            for(std::size_t corner {0}; corner < 3; ++corner) bounds.grow(positions[indices[3 * i + corner]]);
+            builder.mTriangleBounds[i] = bounds;
+            builder.mCentroids[i] = .5f * (bounds.mMin + bounds.mMax);
+        }
+    });
+
+    builder.buildNode(0, 0, nTriangles, 0);
+    mNodes.resize(builder.mNodeCount.load());
+    mNodes.shrink_to_fit();
+
+    mTriangles.resize(nTriangles);
+    mTriangleIds = std::move(builder.mOrder);
+    forEachTriangle([&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            std::size_t first {3 * static_cast<std::size_t>(mTriangleIds[i])};
+            const glm::vec3& a {positions[indices[first]]};
+            mTriangles[i] = Triangle {
+                .mCorner {a},
+                .mEdge1 {positions[indices[first + 1]] - a},
+                .mEdge2 {positions[indices[first + 2]] - a}
+            };
+        }
+    });
+}
+
+template<bool ANY_HIT>
+bool MeshBVH::traverse(const Ray& ray, RayHit* hit) const {
+    if(mNodes.empty()) return false;
+
+    // Divisions by zero give infinities, which the slab test copes with
+    glm::vec3 inverse { 1.f / ray.mDirection };
+    float closest {ray.mMaxDistance};
+#if defined(__SSE2__)
+    // The fourth lane of each bound holds a child or count, so it's
+    // masked to zero and stands for the ray's own extent
+    __m128 origin { _mm_set_ps(0.f, ray.mOrigin.z, ray.mOrigin.y, ray.mOrigin.x) };
+    __m128 inverseDirection { _mm_set_ps(0.f, inverse.z, inverse.y, inverse.x) };
+    __m128 xyz { _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)) };
+#endif
+    // Where the ray enters node's box, or infinity if it misses it
+    // or only gets there past the closest hit
+    auto enterBox = [&](const Node& node) {
+#if defined(__SSE2__)
+        __m128 t1 { _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_load_ps(&node.mMin.x), xyz), origin), inverseDirection) };
+        __m128 t2 { _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_load_ps(&node.mMax.x), xyz), origin), inverseDirection) };
+        __m128 entry { _mm_and_ps(_mm_min_ps(t1, t2), xyz) };
+        __m128 exit { _mm_or_ps(_mm_and_ps(_mm_max_ps(t1, t2), xyz), _mm_andnot_ps(xyz, _mm_set1_ps(closest))) };
+        entry = _mm_max_ps(entry, _mm_shuffle_ps(entry, entry, _MM_SHUFFLE(2, 3, 0, 1)));
+        entry = _mm_max_ps(entry, _mm_shuffle_ps(entry, entry, _MM_SHUFFLE(1, 0, 3, 2)));
+        exit = _mm_min_ps(exit, _mm_shuffle_ps(exit, exit, _MM_SHUFFLE(2, 3, 0, 1)));
+        exit = _mm_min_ps(exit, _mm_shuffle_ps(exit, exit, _MM_SHUFFLE(1, 0, 3, 2)));
+        float enter {_mm_cvtss_f32(entry)}, leave {_mm_cvtss_f32(exit)};
+#else
+        glm::vec3 t1 { (node.mMin - ray.mOrigin) * inverse };
+        glm::vec3 t2 { (node.mMax - ray.mOrigin) * inverse };
+        glm::vec3 entry { glm::min(t1, t2) }, exit { glm::max(t1, t2) };
+        float enter { std::max({0.f, entry.x, entry.y, entry.z}) };
+        float leave { std::min({closest, exit.x, exit.y, exit.z}) };
+#endif
+        return enter <= leave? enter: INFINITE_DISTANCE;
+    };
+
+    struct Pending {
+        std::uint32_t mNode;
+        float mDistance;
+    };
+    Pending stack[MAX_TRAVERSAL_DEPTH];
+    int depth {0};
+    std::uint32_t nearest {0};
+    glm::vec2 nearestBarycentric {0.f};
+    bool found {false};
+
+    const Node* node {&mNodes[0]};
+    if(enterBox(*node) == INFINITE_DISTANCE) return false;
+    for(;;) {
+        if(node->mCount > 0) {
+            for(std::uint32_t i {node->mFirst}; i < node->mFirst + node->mCount; ++i) {
+                const Triangle& triangle {mTriangles[i]};
+                float distance {0.f};
+                glm::vec2 barycentric {0.f};
+                if(!intersectTriangle(ray, triangle.mCorner, triangle.mEdge1, triangle.mEdge2, closest, distance, barycentric)) continue;
+                if(ANY_HIT) return true;
+                closest = distance;
+                nearest = i;
+                nearestBarycentric = barycentric;
+                found = true;
+            }
+        } else {
+            // Nearer child first; the other waits, unless it's missed
+            const Node* nearer {&mNodes[node->mFirst]};
+            const Node* further {nearer + 1};
+            float nearerDistance {enterBox(*nearer)}, furtherDistance {enterBox(*further)};
+            if(furtherDistance < nearerDistance) {
+                std::swap(nearer, further);
+                std::swap(nearerDistance, furtherDistance);
+            }
+            if(nearerDistance != INFINITE_DISTANCE) {
+                // build() keeps leaves shallow enough for this to fit
+                if(furtherDistance != INFINITE_DISTANCE)
+                    stack[depth++] = Pending { .mNode {static_cast<std::uint32_t>(further - mNodes.data())}, .mDistance {furtherDistance} };
+                node = nearer;
+                continue;
+            }
+        }
+
+        // Anything put off that's now further than the closest hit
+        // can't hold a closer one
+        while(depth > 0 && stack[depth - 1].mDistance > closest) --depth;
+        if(depth == 0) break;
+        node = &mNodes[stack[--depth].mNode];
+    }
+
+    if(!found || !hit) return found;
+    const Triangle& triangle {mTriangles[nearest]};
+    glm::vec3 normal { glm::normalize(glm::cross(triangle.mEdge1, triangle.mEdge2)) };
+    *hit = RayHit {
+        .mDistance {closest},
+        .mTriangle {mTriangleIds[nearest]},
+        .mBarycentric {nearestBarycentric},
+        .mNormal { glm::dot(normal, ray.mDirection) > 0.f? -normal: normal }
+    };
+    return true;
+}
+
+bool MeshBVH::intersect(const Ray& ray, RayHit& hit) const {
+    return traverse<false>(ray, &hit);
+}
+
+bool MeshBVH::occluded(const Ray& ray) const {
+    return traverse<true>(ray, nullptr);
+}
+
+std::size_t MeshBVH::getMemorySize() const {
+    return mNodes.size() * sizeof(Node) + mTriangles.size() * sizeof(Triangle) + mTriangleIds.size() * sizeof(std::uint32_t);
+}
@@ -0,0 +1,95 @@
+#ifndef ZOMESHBVH_H
+#define ZOMESHBVH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+class JobSystem;
+
+// A ray from mOrigin along mDirection, out to mMaxDistance; a
+// segment when that's finite. Distances are in multiples of
+// mDirection's length
+struct Ray {
+    glm::vec3 mOrigin {0.f};
+    glm::vec3 mDirection {0.f, 0.f, -1.f};
+    float mMaxDistance {std::numeric_limits<float>::max()};
+};
+
+struct RayHit {
+    float mDistance {0.f};
+    std::uint32_t mTriangle {0}; // as numbered in the mesh's indices, 3 to a triangle
+    std::uint32_t mMesh {0};     // set by Model::intersect()
+    glm::vec2 mBarycentric {0.f}; // weights of the triangle's second and third corners
+    glm::vec3 mNormal {0.f};     // of the triangle, facing back along the ray
+};
+
+/*
+Bounding volume hierarchy over a mesh's triangles, for ray and
+segment queries (picking, camera collision) without testing every
+triangle.
+
+Built top down, splitting each node where the surface area heuristic
+says rays will be cheapest, judged over a handful of bins along each
+axis rather than at every triangle. Where a run of lopsided splits
+nears the depth queries can handle, nodes are halved instead. Big
+subtrees are built as jobs of their own. Nodes are 32 bytes, two to
+a cache line, with siblings side by side so one index finds both;
+leaves hold up to
+MAX_LEAF_TRIANGLES triangles. Triangles are copied out in leaf order,
+as a corner and two edges ready for the intersection test, so queries
+don't need the mesh at all.
+
+Queries walk the tree nearest child first, testing rays against each
+node's box with SSE where there is any, and skip subtrees beyond the
+closest hit so far
+*/
+class MeshBVH {
+public:
+    static constexpr std::uint32_t MAX_LEAF_TRIANGLES {4};
+
+    struct alignas(32) Node {
+        glm::vec3 mMin;
+        std::uint32_t mFirst; // first child (its sibling's next), or a leaf's first triangle
+        glm::vec3 mMax;
+        std::uint32_t mCount; // triangles in a leaf; 0 for an interior node
+    };
+    static_assert(sizeof(Node) == 32, "BVH nodes should pack into 32 bytes");
+
+    // Build over every triangle of indices, 3 to a triangle, into
+    // positions. Subtrees are shared out over jobs, if given and
+    // called on one of its workers
+    void build(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, JobSystem* jobs=nullptr);
+
+    // The nearest triangle ray hits, from either side
+    bool intersect(const Ray& ray, RayHit& hit) const;
+    // Whether ray hits anything at all; cheaper, stopping at the first
+    bool occluded(const Ray& ray) const;
+
+    bool empty() const { return mNodes.empty(); }
+    glm::vec3 getBoundsMin() const { return mNodes.empty()? glm::vec3(0.f): mNodes[0].mMin; }
+    glm::vec3 getBoundsMax() const { return mNodes.empty()? glm::vec3(0.f): mNodes[0].mMax; }
+    std::size_t getNodeCount() const { return mNodes.size(); }
+    std::size_t getTriangleCount() const { return mTriangles.size(); }
+    std::size_t getMemorySize() const;
+
+private:
+    struct Triangle {
+        glm::vec3 mCorner;
+        glm::vec3 mEdge1;
+        glm::vec3 mEdge2;
+    };
+
+    template<bool ANY_HIT>
+    bool traverse(const Ray& ray, RayHit* hit) const;
+
+    std::vector<Node> mNodes; // root first
+    std::vector<Triangle> mTriangles; // in leaf order
+    std::vector<std::uint32_t> mTriangleIds; // each one's number in the mesh
+};
+
+#endif
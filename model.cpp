@@ -1,30 +1,377 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <array>
+#include <unordered_map>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <SDL2/SDL.h>
+#include <glm/gtc/type_ptr.hpp>
 
 #include <assimp/Importer.hpp>
+#include <assimp/IOSystem.hpp>
+#include <assimp/IOStream.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "shared_globals.hpp"
+#include "jobsystem.hpp"
 #include "shader.hpp"
 #include "mesh.hpp"
 #include "texture.hpp"
+#include "texturetable.hpp"
+#include "commandbuffer.hpp"
+#include "transform.hpp"
+#include "streambuffer.hpp"
+#include "assetfilesystem.hpp"
+#include "uploadqueue.hpp"
 
+#include "profiler.hpp"
 #include "model.hpp"
 
-Model::Model(const std::string& path, const Shader& shader): isTextureLoaded {}, modelPath {path} {
-    loadModel(path, shader);
+// Assimp reads models, and any files they refer to, through these,
+// so they come from asset packs when they're there
+class AssetIOStream : public Assimp::IOStream {
+public:
+    AssetData mData {};
+    std::size_t mPosition {0};
+
+    std::size_t Read(void* buffer, std::size_t size, std::size_t count) override {
+        if(size == 0) return 0;
+        count = std::min(count, (mData.size() - mPosition) / size);
+        std::memcpy(buffer, mData.data() + mPosition, size * count);
+        mPosition += size * count;
+        return count;
+    }
+    std::size_t Write(const void*, std::size_t, std::size_t) override { return 0; }
+    aiReturn Seek(std::size_t offset, aiOrigin origin) override {
+        // Offsets back from the current position or the end come
+        // wrapped around, as they would through fseek
+        std::size_t base { origin == aiOrigin_SET? 0: origin == aiOrigin_CUR? mPosition: mData.size() };
+        std::size_t position { base + offset };
+        if(position > mData.size()) return aiReturn_FAILURE;
+        mPosition = position;
+        return aiReturn_SUCCESS;
+    }
+    std::size_t Tell() const override { return mPosition; }
+    std::size_t FileSize() const override { return mData.size(); }
+    void Flush() override {}
+};
+
+class AssetIOSystem : public Assimp::IOSystem {
+public:
+    bool Exists(const char* path) const override { return assetExists(path); }
+    char getOsSeparator() const override { return '/'; }
+    Assimp::IOStream* Open(const char* path, const char* mode) override {
+        if(std::strchr(mode, 'w') || std::strchr(mode, 'a')) return nullptr;
+        AssetIOStream* stream { new AssetIOStream {} };
+        if(!readAsset(path, stream->mData)) {
+            delete stream;
+            return nullptr;
+        }
+        return stream;
+    }
+    void Close(Assimp::IOStream* stream) override { delete stream; }
+};
+
+ModelData::~ModelData() {
+    for(Image& image: mImages) SDL_FreeSurface(image.mSurface);
+}
+
+Model::Model(const std::string& path, const Shader& shader, TextureTable& textures):
+    Model {importNow(path), textures}
+{
+    while(uploadNow(shader)) {}
+}
+
+Model::Model(std::unique_ptr<ModelData> data, TextureTable& textures):
+    nodes {std::move(data->mNodes)},
+    boundsMin {data->mBoundsMin},
+    boundsMax {data->mBoundsMax},
+    occluderVertices {std::move(data->mOccluderVertices)},
+    occluderIndices {std::move(data->mOccluderIndices)},
+    skeleton {std::move(data->mSkeleton)},
+    textureTable {&textures},
+    pending {std::move(data)}
+{
+    // Meshes can refer to their textures before any are loaded
+    for(const ModelData::Image& image: pending->mImages)
+        this->textures.push_back(textureTable->acquire(image.mPath, image.mType));
+    for(const ModelData::MeshData& mesh: pending->mMeshes)
+        meshInstances.push_back(mesh.mInstances);
+    meshes.reserve(meshInstances.size());
+}
+
+Model::~Model() {
+    for(TextureHandle texture: textures) textureTable->release(texture);
+
+    // Whatever the upload thread made that was never taken on is
+    // deleted there, after the jobs making it
+    if(pending && uploadsQueued && gUploadQueue) {
+        gUploadQueue->submit([data = pending]() {
+            for(ModelData::MeshData& mesh: data->mMeshes) Mesh::deleteBuffers(mesh.mBuffers);
+            for(ModelData::Image& image: data->mImages) {
+                if(image.mTexture) glDeleteTextures(1, &image.mTexture);
+            }
+        });
+    }
+}
+
+std::unique_ptr<ModelData> Model::importNow(const std::string& path) {
+    std::unique_ptr<ModelData> data { std::make_unique<ModelData>() };
+    import(path, *data);
+    return data;
+}
+
+bool Model::uploadNext(const Shader& shader) {
+    if(!pending) return false;
+    if(gUploadQueue) return adoptNext(shader, *gUploadQueue);
+    return uploadNow(shader);
+}
+
+bool Model::uploadNow(const Shader& shader) {
+    if(!pending) return false;
+
+    if(!hasAllMeshes()) {
+        ModelData::MeshData& mesh { pending->mMeshes[meshes.size()] };
+        std::vector<TextureHandle> meshTextures {};
+        for(std::size_t image: mesh.mImages) meshTextures.push_back(textures[image]);
+        meshes.push_back(Mesh {
+            std::move(mesh.mVertices), std::move(mesh.mIndices), std::move(meshTextures), shader, std::move(mesh.mSkin),
+            std::move(mesh.mBVH)
+        });
+        return true;
+    }
+
+    // Textures another model already loaded are skipped
+    for(; nextImage < pending->mImages.size(); ++nextImage) {
+        if(textureTable->isLoaded(textures[nextImage])) continue;
+        ModelData::Image& image { pending->mImages[nextImage] };
+        textureTable->upload(textures[nextImage], image.mSurface);
+        SDL_FreeSurface(image.mSurface);
+        image.mSurface = nullptr;
+        ++nextImage;
+        return true;
+    }
+
+    pending.reset();
+    return false;
+}
+
+void Model::queueUploads(UploadQueue& uploads) {
+    // A job per mesh and per texture, so they can be taken on one at
+    // a time as they finish. Each job has the data to itself until
+    // it's done
+    for(std::size_t i {0}; i < pending->mMeshes.size(); ++i) {
+        pending->mMeshes[i].mUploadTicket = uploads.submit([data = pending, i]() {
+            ModelData::MeshData& mesh { data->mMeshes[i] };
+            mesh.mBuffers = Mesh::uploadBuffers(mesh.mVertices, mesh.mIndices, mesh.mSkin);
+        });
+    }
+    for(std::size_t i {0}; i < pending->mImages.size(); ++i) {
+        // Textures another model already loaded are skipped
+        if(textureTable->isLoaded(textures[i])) continue;
+        pending->mImages[i].mUploadTicket = uploads.submit([data = pending, i]() {
+            ModelData::Image& image { data->mImages[i] };
+            image.mTexture = Texture::uploadSurface(image.mSurface);
+            SDL_FreeSurface(image.mSurface);
+            image.mSurface = nullptr;
+        });
+    }
+    uploadsQueued = true;
+}
+
+bool Model::adoptNext(const Shader& shader, UploadQueue& uploads) {
+    if(!uploadsQueued) queueUploads(uploads);
+
+    // Only a vertex array is made here; contexts don't share those
+    if(!hasAllMeshes()) {
+        ModelData::MeshData& mesh { pending->mMeshes[meshes.size()] };
+        if(!uploads.isDone(mesh.mUploadTicket)) return false;
+        std::vector<TextureHandle> meshTextures {};
+        for(std::size_t image: mesh.mImages) meshTextures.push_back(textures[image]);
+        meshes.push_back(Mesh {
+            std::move(mesh.mVertices), std::move(mesh.mIndices), std::move(meshTextures), shader, std::move(mesh.mSkin),
+            std::move(mesh.mBVH), mesh.mBuffers
+        });
+        mesh.mBuffers = {};
+        return true;
+    }
+
+    for(; nextImage < pending->mImages.size(); ++nextImage) {
+        ModelData::Image& image { pending->mImages[nextImage] };
+        if(!image.mUploadTicket) continue;
+        if(!uploads.isDone(image.mUploadTicket)) return false;
+        textureTable->adopt(textures[nextImage], image.mTexture);
+        image.mTexture = 0;
+        ++nextImage;
+        return true;
+    }
+
+    pending.reset();
+    return false;
+}
+
+void Model::Draw(const Shader& shader, const glm::mat4& model) const {
+    if(meshes.empty()) return;
+
+    // Every mesh's transforms go up in a single write, then each draw
+    // binds its own slice
+    GLint alignment {0};
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    GLsizeiptr stride { (static_cast<GLsizeiptr>(sizeof(DrawData)) + alignment - 1) / alignment * alignment };
+    std::size_t nInstances {0};
+    for(std::size_t i {0}; i < meshes.size(); ++i) nInstances += meshInstances[i].size();
+    if(nInstances == 0) return;
+    GLintptr offset {0};
+    char* data { static_cast<char*>(gStreamBuffer->map(nInstances * stride, alignment, offset)) };
+    if(!data) return;
+    for(std::size_t i {0}; i < meshes.size(); ++i){
+        for(TransformID node: meshInstances[i]) {
+            glm::mat4 meshModel { model * nodes.getWorldMatrix(node) };
+            DrawData drawData {
+                .mModel { meshModel },
+                .mNormalMat { glm::transpose(glm::inverse(meshModel)) },
+                .mSkin { glm::ivec4(0) }
+            };
+            std::memcpy(data, &drawData, sizeof(DrawData));
+            data += stride;
+        }
+    }
+    gStreamBuffer->unmap();
+
+    // Drawn here one instance at a time; only recorded draws are
+    // instanced
+    for(std::size_t i {0}; i < meshes.size(); ++i){
+        for(std::size_t instance {0}; instance < meshInstances[i].size(); ++instance) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_DATA_BINDING, gStreamBuffer->getBufferID(), offset, sizeof(DrawData));
+            meshes[i].Draw(shader, *textureTable);
+            offset += stride;
+        }
+    }
+}
+
+void Model::record(CommandBuffer& commands, const glm::mat4& model) const {
+    for(std::size_t i {0}; i < meshes.size(); ++i){
+        meshes[i].record(commands, model, nodes, meshInstances[i], *textureTable);
+    }
 }
 
-void Model::Draw(const Shader& shader) const {
+void Model::record(CommandBuffer& commands, const glm::mat4& model, GLint firstTexel, GLint boneCount) const {
     for(std::size_t i {0}; i < meshes.size(); ++i){
-        meshes[i].Draw(shader);
+        if(meshes[i].isSkinned()) meshes[i].record(commands, model, *textureTable, firstTexel, boneCount);
+        else meshes[i].record(commands, model, nodes, meshInstances[i], *textureTable);
+    }
+}
+
+// The same ray in another space, out to maxDistance. The map's linear,
+// so distances along the ray come through unchanged
+static Ray transformRay(const Ray& ray, const glm::mat4& transform, float maxDistance) {
+    return Ray {
+        .mOrigin { glm::vec3(transform * glm::vec4(ray.mOrigin, 1.f)) },
+        .mDirection { glm::vec3(transform * glm::vec4(ray.mDirection, 0.f)) },
+        .mMaxDistance {maxDistance}
+    };
+}
+
+glm::mat4 Model::getMeshTransform(std::size_t mesh, std::size_t instance, const glm::mat4& model) const {
+    // Skinned meshes are placed by their bones, which are in model
+    // space, so at rest by the model matrix alone (as in record())
+    return meshes[mesh].isSkinned()? model: model * nodes.getWorldMatrix(meshInstances[mesh][instance]);
+}
+
+bool Model::hitsBounds(const Ray& ray, const glm::mat4& model) const {
+    // Slab test against the model's box, in model space
+    Ray local { transformRay(ray, glm::inverse(model), ray.mMaxDistance) };
+    glm::vec3 origin {local.mOrigin};
+    glm::vec3 inverse { 1.f / local.mDirection };
+    glm::vec3 t1 { (boundsMin - origin) * inverse }, t2 { (boundsMax - origin) * inverse };
+    glm::vec3 entry { glm::min(t1, t2) }, exit { glm::max(t1, t2) };
+    return std::max({0.f, entry.x, entry.y, entry.z}) <= std::min({ray.mMaxDistance, exit.x, exit.y, exit.z});
+}
+
+bool Model::intersect(const Ray& ray, const glm::mat4& model, RayHit& hit) const {
+    if(!hitsBounds(ray, model)) return false;
+    bool found {false};
+    float closest {ray.mMaxDistance};
+    for(std::size_t i {0}; i < meshes.size(); ++i) {
+        // Skinned meshes are all in one place, however many nodes
+        std::size_t nInstances { meshes[i].isSkinned()? 1: meshInstances[i].size() };
+        for(std::size_t instance {0}; instance < nInstances; ++instance) {
+            // Into the instance's own space, where the mesh's BVH is
+            glm::mat4 toMesh { glm::inverse(getMeshTransform(i, instance, model)) };
+            RayHit meshHit {};
+            if(!meshes[i].bvh.intersect(transformRay(ray, toMesh, closest), meshHit)) continue;
+            meshHit.mMesh = static_cast<std::uint32_t>(i);
+            meshHit.mNormal = glm::normalize(glm::transpose(glm::mat3(toMesh)) * meshHit.mNormal);
+            hit = meshHit;
+            closest = meshHit.mDistance;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool Model::occluded(const Ray& ray, const glm::mat4& model) const {
+    if(!hitsBounds(ray, model)) return false;
+    for(std::size_t i {0}; i < meshes.size(); ++i) {
+        std::size_t nInstances { meshes[i].isSkinned()? 1: meshInstances[i].size() };
+        for(std::size_t instance {0}; instance < nInstances; ++instance) {
+            glm::mat4 toMesh { glm::inverse(getMeshTransform(i, instance, model)) };
+            if(meshes[i].bvh.occluded(transformRay(ray, toMesh, ray.mMaxDistance))) return true;
+        }
+    }
+    return false;
+}
+
+// Marks a scene mesh no node has used yet
+const std::size_t NO_MESH {static_cast<std::size_t>(-1)};
+
+// 64-bit FNV-1a, a word at a time rather than a byte; it only has to
+// tell meshes apart, not spread keys well
+static std::uint64_t hashBytes(const void* bytes, std::size_t size, std::uint64_t hash) {
+    const unsigned char* data { static_cast<const unsigned char*>(bytes) };
+    for(std::size_t i {0}; i < size; i += sizeof(std::uint64_t)) {
+        std::uint64_t word {0};
+        std::memcpy(&word, data + i, std::min(sizeof(word), size - i));
+        hash = (hash ^ word) * 1099511628211ull;
     }
+    return hash;
+}
+
+static std::uint64_t hashGeometry(const ModelData::MeshData& mesh) {
+    std::uint64_t hash {14695981039346656037ull};
+    hash = hashBytes(mesh.mVertices.data(), mesh.mVertices.size() * sizeof(Vertex), hash);
+    hash = hashBytes(mesh.mIndices.data(), mesh.mIndices.size() * sizeof(GLuint), hash);
+    return hashBytes(mesh.mSkin.data(), mesh.mSkin.size() * sizeof(VertexSkin), hash);
 }
 
-void Model::loadModel(const std::string& path, const Shader& shader) {
-    //create an instance of an assimp model importer
+template<typename T>
+static bool isSameBytes(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+// Byte for byte, so only copies of one mesh match, never meshes that
+// merely look alike
+static bool isSameMesh(const ModelData::MeshData& a, const ModelData::MeshData& b) {
+    return a.mIndices == b.mIndices
+        && a.mImages == b.mImages
+        && isSameBytes(a.mVertices, b.mVertices)
+        && isSameBytes(a.mSkin, b.mSkin);
+}
+
+bool Model::import(const std::string& path, ModelData& data) {
+    PROFILE_ZONE("Model::import");
+    //create an instance of an assimp model importer, reading
+    //through the asset file system (the importer deletes it)
     Assimp::Importer importer;
+    importer.SetIOHandler(new AssetIOSystem {});
 
     // Get a pointer to the model's scene object
     const aiScene* scene {
@@ -41,6 +388,10 @@ void Model::loadModel(const std::string& path, const Shader& shader) {
                 // to an image's bottom left, but images are 
                 // usually read from top left -> bottom right
                 | aiProcess_FlipUVs 
+
+                // No more than the 4 bones a vertex can follow,
+                // the rest of the weight spread over those kept
+                | aiProcess_LimitBoneWeights
             )
         )
     };
@@ -53,32 +404,139 @@ void Model::loadModel(const std::string& path, const Shader& shader) {
         || !(scene->mRootNode)
     ){
         std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
-        return;
+        return false;
     }
+    data.mPath = path;
 
-    //get path to the directory containing the model
-    this->directory = path.substr(0, path.find_last_of('/'));
+    // Each of the scene's meshes is read once, however many nodes
+    // use it
+    std::vector<aiMesh*> sceneMeshes {};
+    std::vector<std::size_t> meshOfSceneMesh(scene->mNumMeshes, NO_MESH);
+    processNode(scene->mRootNode, scene, NO_TRANSFORM, -1, data, sceneMeshes, meshOfSceneMesh);
+    std::vector<std::vector<std::uint8_t>> paletteOfBone {};
+    gatherBones(data, sceneMeshes, paletteOfBone);
 
-    processNode(scene->mRootNode, scene, shader);
+    // Convert Assimp's geometry on the job system, if this is one of
+    // its threads
+    std::vector<std::uint64_t> hashes(sceneMeshes.size());
+    gJobSystem->parallelFor(sceneMeshes.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            ModelData::MeshData& mesh {data.mMeshes[i]};
+            extractGeometry(sceneMeshes[i], paletteOfBone[i], mesh.mVertices, mesh.mIndices, mesh.mSkin);
+            hashes[i] = hashGeometry(mesh);
+        }
+    });
+
+    // Joints only matter to models with something to bend
+    if(data.mSkeleton.mBones.empty()) data.mSkeleton.mJoints.clear();
+    else gatherAnimations(scene, data.mSkeleton);
+
+    //textures are assumed to sit in the same directory as the model
+    gatherImages(scene, path.substr(0, path.find_last_of('/')), data, sceneMeshes);
+    mergeIdenticalMeshes(data, hashes);
+
+    gJobSystem->parallelFor(data.mMeshes.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            // For picking and collision, once per mesh however many
+            // instances it has; big meshes split their builds up
+            // further
+            ModelData::MeshData& mesh {data.mMeshes[i]};
+            std::vector<glm::vec3> positions(mesh.mVertices.size());
+            for(std::size_t v {0}; v < positions.size(); ++v) positions[v] = mesh.mVertices[v].position;
+            mesh.mBVH.build(positions, mesh.mIndices, gJobSystem);
+        }
+    });
+
+    // Node transforms don't change after import, so this is the
+    // only update the hierarchy ever needs
+    data.mNodes.update();
+    computeBounds(data);
+    buildOccluder(data);
+    return true;
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene, const Shader& shader) {
-    //Process all the node's meshes, if any
+void Model::processNode(aiNode* node, const aiScene* scene, TransformID parent, int parentJoint, ModelData& data, std::vector<aiMesh*>& sceneMeshes, std::vector<std::size_t>& meshOfSceneMesh) {
+    //Add this node's transform, relative to its parent, to the hierarchy
+    aiVector3D scaling, position;
+    aiQuaternion rotation;
+    node->mTransformation.Decompose(scaling, rotation, position);
+    TransformID transform {
+        data.mNodes.addTransform(
+            parent,
+            glm::vec3(position.x, position.y, position.z),
+            glm::quat(rotation.w, rotation.x, rotation.y, rotation.z),
+            glm::vec3(scaling.x, scaling.y, scaling.z)
+        )
+    };
+
+    //Each node is a joint too, in case bones hang off it; the walk
+    //is depth first, so parents come before their children
+    int joint { static_cast<int>(data.mSkeleton.mJoints.size()) };
+    data.mSkeleton.mJoints.push_back(Joint {
+        .mName { node->mName.C_Str() },
+        .mParent { parentJoint },
+        .mRest {
+            .mTranslation { position.x, position.y, position.z },
+            .mRotation { rotation.w, rotation.x, rotation.y, rotation.z },
+            .mScale { scaling.x, scaling.y, scaling.z }
+        }
+    });
+
+    //Note all the node's meshes, if any, to be processed once the
+    //whole scene has been walked. Meshes already used by another node
+    //just get another instance
     for(std::size_t i {0}; i < node->mNumMeshes; ++i) {
-        aiMesh *mesh { scene->mMeshes[node->mMeshes[i]] };
-        meshes.push_back(processMesh(mesh, scene, shader));
+        std::size_t& mesh { meshOfSceneMesh[node->mMeshes[i]] };
+        if(mesh == NO_MESH) {
+            mesh = data.mMeshes.size();
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+            data.mMeshes.push_back(ModelData::MeshData { .mVertices {}, .mIndices {}, .mInstances {}, .mImages {} });
+        }
+        data.mMeshes[mesh].mInstances.push_back(transform);
     }
 
     //Recursively process this node's children
     for(std::size_t i{0}; i < node->mNumChildren; ++i) {
-        processNode(node->mChildren[i], scene, shader);
+        processNode(node->mChildren[i], scene, transform, joint, data, sceneMeshes, meshOfSceneMesh);
+    }
+}
+
+void Model::gatherBones(ModelData& data, std::vector<aiMesh*>& sceneMeshes, std::vector<std::vector<std::uint8_t>>& paletteOfBone) {
+    // Bones are shared by name between the meshes of a model, so
+    // every mesh indexes the same palette. Each mesh's bones are
+    // mapped to palette entries here, before its vertices are read
+    Skeleton& skeleton {data.mSkeleton};
+    std::unordered_map<std::string, std::uint8_t> paletteOfName {};
+    paletteOfBone.resize(sceneMeshes.size());
+    for(std::size_t m {0}; m < sceneMeshes.size(); ++m) {
+        const aiMesh* mesh {sceneMeshes[m]};
+        for(std::size_t b {0}; b < mesh->mNumBones; ++b) {
+            const aiBone* bone {mesh->mBones[b]};
+            std::string name {bone->mName.C_Str()};
+            auto found { paletteOfName.find(name) };
+            if(found == paletteOfName.end()) {
+                int joint { skeleton.findJoint(name) };
+                if(joint < 0 || skeleton.mBones.size() == MAX_BONES) {
+                    std::cout << "ERROR::MODEL::BONE_DROPPED " << name << std::endl;
+                    paletteOfBone[m].clear();
+                    break;
+                }
+                // Assimp's matrices are row major
+                found = paletteOfName.emplace(name, static_cast<std::uint8_t>(skeleton.mBones.size())).first;
+                const aiMatrix4x4& offset {bone->mOffsetMatrix};
+                skeleton.mBones.push_back(Bone {
+                    .mJoint { joint },
+                    .mInverseBind { glm::transpose(glm::make_mat4(&offset.a1)) }
+                });
+            }
+            paletteOfBone[m].push_back(found->second);
+        }
     }
 }
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene, const Shader& shader) {
-    std::vector<Vertex> vertices;
-    std::vector<GLuint> indices;
-    std::vector<Texture*> textures;
+void Model::extractGeometry(const aiMesh* mesh, const std::vector<std::uint8_t>& palette, std::vector<Vertex>& vertices, std::vector<GLuint>& indices, std::vector<VertexSkin>& skin) {
+    vertices.reserve(mesh->mNumVertices);
+    indices.reserve(mesh->mNumFaces * 3);
 
     //load vertices
     for(std::size_t i{0}; i < mesh->mNumVertices; ++i) {
@@ -114,56 +572,408 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene, const Shader& shader
         }
     }
 
-    // load textures
-    if(mesh->mMaterialIndex >= 0) {
-        aiMaterial *material { scene->mMaterials[mesh->mMaterialIndex] };
+    // A mesh with a bone that couldn't be placed stays rigid
+    if(mesh->mNumBones == 0 || palette.size() != mesh->mNumBones) return;
 
-        //Get a list of all diffuse maps associated with this material
-        std::vector<Texture*> diffuseMaps {
-            loadMaterialTextures(
-                material, aiTextureType_DIFFUSE, "texture_diffuse"
-            )
-        };
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+    // Every bone's weights, spread over the vertices they move
+    std::vector<float> weights(mesh->mNumVertices * 4, 0.f);
+    skin.assign(mesh->mNumVertices, VertexSkin {});
+    for(std::size_t b {0}; b < mesh->mNumBones; ++b) {
+        const aiBone* bone {mesh->mBones[b]};
+        for(std::size_t w {0}; w < bone->mNumWeights; ++w) {
+            const aiVertexWeight& weight {bone->mWeights[w]};
+            if(weight.mVertexId >= mesh->mNumVertices) continue;
+            float* vertexWeights {&weights[weight.mVertexId * 4]};
+            // Take the free slot, or the lightest if they're all
+            // taken, though bone weights are limited to 4 already
+            int slot { static_cast<int>(std::min_element(vertexWeights, vertexWeights + 4) - vertexWeights) };
+            if(vertexWeights[slot] >= weight.mWeight) continue;
+            vertexWeights[slot] = weight.mWeight;
+            skin[weight.mVertexId].joints[slot] = palette[b];
+        }
+    }
 
-        //Get a list of all specular maps associated with this material
-        std::vector<Texture*> specularMaps { 
-            loadMaterialTextures(
-                material, aiTextureType_SPECULAR, "texture_specular"
-            )
-        };
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+    // Weights as bytes summing to exactly 255, whatever was lost
+    // rounding them going to the heaviest. Vertices no bone moves
+    // follow the first bone, so they at least stay with the model
+    for(std::size_t i {0}; i < skin.size(); ++i) {
+        float* vertexWeights {&weights[i * 4]};
+        float total { vertexWeights[0] + vertexWeights[1] + vertexWeights[2] + vertexWeights[3] };
+        if(!(total > 0.f)) {
+            skin[i] = VertexSkin { .joints { palette[0], 0, 0, 0 }, .weights { 255, 0, 0, 0 } };
+            continue;
+        }
+        int sum {0}, heaviest {0};
+        for(int slot {0}; slot < 4; ++slot) {
+            skin[i].weights[slot] = static_cast<std::uint8_t>(std::lround(vertexWeights[slot] / total * 255.f));
+            sum += skin[i].weights[slot];
+            if(vertexWeights[slot] > vertexWeights[heaviest]) heaviest = slot;
+        }
+        skin[i].weights[heaviest] = static_cast<std::uint8_t>(skin[i].weights[heaviest] + 255 - sum);
+    }
+}
+
+void Model::gatherAnimations(const aiScene* scene, Skeleton& skeleton) {
+    PROFILE_ZONE("Model::gatherAnimations");
+    for(std::size_t a {0}; a < scene->mNumAnimations; ++a) {
+        const aiAnimation* animation {scene->mAnimations[a]};
+        // Files that don't say are taken to be at 25 ticks a second
+        float ticksPerSecond { animation->mTicksPerSecond > 0.0? static_cast<float>(animation->mTicksPerSecond): 25.f };
+        std::string name {animation->mName.C_Str()};
+        if(name.empty()) name = "animation" + std::to_string(a);
+        AnimationClip clip { name, static_cast<float>(animation->mDuration) / ticksPerSecond };
+
+        std::vector<float> translationTimes {}, rotationTimes {}, scaleTimes {};
+        std::vector<glm::vec3> translations {}, scales {};
+        std::vector<glm::quat> rotations {};
+        for(std::size_t c {0}; c < animation->mNumChannels; ++c) {
+            const aiNodeAnim* channel {animation->mChannels[c]};
+            int joint { skeleton.findJoint(channel->mNodeName.C_Str()) };
+            if(joint < 0) continue;
+
+            translationTimes.clear(); translations.clear();
+            rotationTimes.clear(); rotations.clear();
+            scaleTimes.clear(); scales.clear();
+            for(std::size_t k {0}; k < channel->mNumPositionKeys; ++k) {
+                const aiVectorKey& key {channel->mPositionKeys[k]};
+                translationTimes.push_back(static_cast<float>(key.mTime) / ticksPerSecond);
+                translations.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            for(std::size_t k {0}; k < channel->mNumRotationKeys; ++k) {
+                const aiQuatKey& key {channel->mRotationKeys[k]};
+                rotationTimes.push_back(static_cast<float>(key.mTime) / ticksPerSecond);
+                rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            for(std::size_t k {0}; k < channel->mNumScalingKeys; ++k) {
+                const aiVectorKey& key {channel->mScalingKeys[k]};
+                scaleTimes.push_back(static_cast<float>(key.mTime) / ticksPerSecond);
+                scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            clip.addTrack(joint, translationTimes, translations, rotationTimes, rotations, scaleTimes, scales);
+        }
+        skeleton.mClips.push_back(std::move(clip));
     }
+}
 
-    return Mesh {
-        vertices, indices, textures, shader
+void Model::gatherImages(const aiScene* scene, const std::string& directory, ModelData& data, std::vector<aiMesh*>& sceneMeshes) {
+    PROFILE_ZONE("Model::gatherImages");
+    // Find the diffuse and specular maps of every mesh's material,
+    // noting each image once however many meshes share it
+    const std::pair<aiTextureType, const char*> textureTypes[] {
+        {aiTextureType_DIFFUSE, "texture_diffuse"},
+        {aiTextureType_SPECULAR, "texture_specular"}
     };
+    std::map<std::string, std::size_t> imageOfName {};
+    for(std::size_t m {0}; m < sceneMeshes.size(); ++m) {
+        aiMaterial* material { scene->mMaterials[sceneMeshes[m]->mMaterialIndex] };
+        for(const auto& [type, typeName]: textureTypes) {
+            for(std::size_t i {0}; i < material->GetTextureCount(type); ++i) {
+                aiString textureNameAi;
+                material->GetTexture(type, i, &textureNameAi);
+                std::string textureName {textureNameAi.C_Str()};
+
+                auto [found, added] { imageOfName.try_emplace(textureName, data.mImages.size()) };
+                if(added) {
+                    data.mImages.push_back(ModelData::Image {
+                        .mPath { directory + "/" + textureName },
+                        .mType { typeName },
+                        .mSurface { nullptr }
+                    });
+                }
+                data.mMeshes[m].mImages.push_back(found->second);
+            }
+        }
+    }
+
+    // Decoding doesn't touch GL, so every image is read at once
+    gJobSystem->parallelFor(data.mImages.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) {
+            data.mImages[i].mSurface = Texture::decodeImageFile(data.mImages[i].mPath.c_str());
+        }
+    });
 }
 
-std::vector<Texture*> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName) {
-    std::vector<Texture*> textures {};
+void Model::mergeIdenticalMeshes(ModelData& data, const std::vector<std::uint64_t>& hashes) {
+    PROFILE_ZONE("Model::mergeIdenticalMeshes");
+    // Some files store a mesh over again for every node it's placed
+    // at. Copies with the same geometry and images are folded into
+    // the first, which takes on their instances
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> keptOfHash {};
+    std::vector<ModelData::MeshData> kept {};
+    kept.reserve(data.mMeshes.size());
+    for(std::size_t m {0}; m < data.mMeshes.size(); ++m) {
+        ModelData::MeshData& mesh { data.mMeshes[m] };
+        std::vector<std::size_t>& candidates { keptOfHash[hashes[m]] };
+        auto same {
+            std::find_if(candidates.begin(), candidates.end(), [&](std::size_t k) { return isSameMesh(kept[k], mesh); })
+        };
+        if(same != candidates.end()) {
+            std::vector<TransformID>& instances { kept[*same].mInstances };
+            instances.insert(instances.end(), mesh.mInstances.begin(), mesh.mInstances.end());
+            continue;
+        }
+        candidates.push_back(kept.size());
+        kept.push_back(std::move(mesh));
+    }
+    data.mMeshes = std::move(kept);
+}
 
-    for(std::size_t i{0}; i < mat->GetTextureCount(type); ++i) {
+void Model::computeBounds(ModelData& data) {
+    bool first {true};
+    for(const ModelData::MeshData& mesh: data.mMeshes) {
+        if(mesh.mVertices.empty()) continue;
+        glm::vec3 meshMin {mesh.mVertices[0].position};
+        glm::vec3 meshMax {meshMin};
+        for(const Vertex& vertex: mesh.mVertices) {
+            meshMin = glm::min(meshMin, vertex.position);
+            meshMax = glm::max(meshMax, vertex.position);
+        }
 
-        //Retrieve the name of the textures
-        aiString textureNameAi;
-        mat->GetTexture(type, i, &textureNameAi);
-        std::string textureName {textureNameAi.C_Str()};
+        // Each corner of the mesh's own box, placed by each of its
+        // nodes
+        for(TransformID node: mesh.mInstances) {
+            const glm::mat4& world { data.mNodes.getWorldMatrix(node) };
+            for(int corner {0}; corner < 8; ++corner) {
+                glm::vec3 local {
+                    corner & 1? meshMax.x: meshMin.x,
+                    corner & 2? meshMax.y: meshMin.y,
+                    corner & 4? meshMax.z: meshMin.z
+                };
+                glm::vec3 point { world * glm::vec4(local, 1.f) };
+                data.mBoundsMin = first? point: glm::min(data.mBoundsMin, point);
+                data.mBoundsMax = first? point: glm::max(data.mBoundsMax, point);
+                first = false;
+            }
+        }
+    }
+}
 
-        // Ensure that reused textures are loaded just once from file
-        if(!isTextureLoaded[textureName]){
-            Texture texture {
-                //texture image file name, assuming it's located in the
-                //same directory as the model that uses it
-                directory + std::string("/") + textureName,
-                typeName
-            };
-            loadedTexture[textureName] = std::move(texture);
-            isTextureLoaded[textureName] = true;
+// Whether the shaders' alpha test, at 0.1, cuts any texel out of
+// surface, which is RGBA as Texture::decodeImageFile leaves it
+static bool hasCutouts(const SDL_Surface* surface) {
+    if(!surface) return false;
+    for(int y {0}; y < surface->h; ++y) {
+        const std::uint8_t* row { static_cast<const std::uint8_t*>(surface->pixels) + static_cast<std::size_t>(y) * surface->pitch };
+        for(int x {0}; x < surface->w; ++x) {
+            if(row[x * 4 + 3] < 26) return true;
         }
+    }
+    return false;
+}
+
+// Whether every edge of the mesh, with its vertices welded by
+// position, has exactly two triangles running opposite ways along
+// it, so that the mesh has an inside
+static bool isClosed(const ModelData::MeshData& mesh) {
+    std::map<std::array<float, 3>, GLuint> weldedOf {};
+    std::vector<GLuint> welded(mesh.mVertices.size());
+    for(std::size_t i {0}; i < mesh.mVertices.size(); ++i) {
+        const glm::vec3& position {mesh.mVertices[i].position};
+        welded[i] = weldedOf.try_emplace({position.x, position.y, position.z}, static_cast<GLuint>(weldedOf.size())).first->second;
+    }
+
+    std::vector<std::pair<GLuint, GLuint>> edges {};
+    for(std::size_t i {0}; i + 2 < mesh.mIndices.size(); i += 3) {
+        GLuint corners[3] {welded[mesh.mIndices[i]], welded[mesh.mIndices[i + 1]], welded[mesh.mIndices[i + 2]]};
+        if(corners[0] == corners[1] || corners[1] == corners[2] || corners[2] == corners[0]) continue;
+        for(int e {0}; e < 3; ++e) edges.push_back({corners[e], corners[(e + 1) % 3]});
+    }
+    std::sort(edges.begin(), edges.end());
+    for(std::size_t i {0}; i < edges.size(); ++i) {
+        if(i > 0 && edges[i] == edges[i - 1]) return false;
+        if(!std::binary_search(edges.begin(), edges.end(), std::make_pair(edges[i].second, edges[i].first))) return false;
+    }
+    return !edges.empty();
+}
+
+// Twice the signed area of a, b and point: positive if point is left
+// of the line from a to b. Exactly negated when the line is taken
+// the other way round, so triangles either side of an edge agree
+static double sideOf(const glm::vec2& a, const glm::vec2& b, const glm::vec2& point) {
+    if(b.x < a.x || (b.x == a.x && b.y < a.y)) return -sideOf(b, a, point);
+    return (static_cast<double>(b.x) - a.x) * (static_cast<double>(point.y) - a.y)
+        - (static_cast<double>(b.y) - a.y) * (static_cast<double>(point.x) - a.x);
+}
+
+void Model::buildOccluder(ModelData& data) {
+    PROFILE_ZONE("Model::buildOccluder");
+    // The occluder is the solid inside the model, on a grid over its
+    // bounds: cells wholly inside some closed mesh, that no triangle
+    // passes through. It never reaches past the model's surface, so
+    // it can't hide anything that would have been seen. Anything
+    // open, cut out by alpha testing, or thinner than a cell isn't
+    // part of it
+    const int CELLS {16}; // along the longest side
+    glm::vec3 extent {data.mBoundsMax - data.mBoundsMin};
+    float cellSize { std::max({extent.x, extent.y, extent.z}) / CELLS };
+    if(!(cellSize > 0.f)) return;
+    int size[3];
+    for(int axis {0}; axis < 3; ++axis)
+        size[axis] = std::clamp(static_cast<int>(std::ceil(extent[axis] / cellSize)), 1, CELLS);
+    auto cellIndex = [&](int x, int y, int z) {
+        return (static_cast<std::size_t>(z) * size[1] + y) * size[0] + x;
+    };
+
+    std::vector<bool> cutout(data.mImages.size());
+    for(std::size_t i {0}; i < data.mImages.size(); ++i)
+        cutout[i] = data.mImages[i].mType == "texture_diffuse" && hasCutouts(data.mImages[i].mSurface);
+
+    std::vector<std::uint8_t> solid(static_cast<std::size_t>(size[0]) * size[1] * size[2], 0);
+    std::vector<std::uint8_t> touched(solid.size());
+    // Per column of cells along z, where the mesh crosses the line
+    // through their centres
+    std::vector<std::vector<float>> crossings(static_cast<std::size_t>(size[0]) * size[1]);
+    for(const ModelData::MeshData& mesh: data.mMeshes) {
+        // Skinned meshes bend away from the shape they're imported in
+        if(!mesh.mSkin.empty() || !isClosed(mesh)) continue;
+        if(std::any_of(mesh.mImages.begin(), mesh.mImages.end(), [&](std::size_t image) { return cutout[image]; })) continue;
+
+        for(TransformID node: mesh.mInstances) {
+            const glm::mat4& world { data.mNodes.getWorldMatrix(node) };
+            std::fill(touched.begin(), touched.end(), 0);
+            for(std::vector<float>& column: crossings) column.clear();
+
+            for(std::size_t i {0}; i + 2 < mesh.mIndices.size(); i += 3) {
+                // In cells, from the grid's corner
+                glm::vec3 corners[3];
+                for(int v {0}; v < 3; ++v) {
+                    glm::vec3 position { world * glm::vec4(mesh.mVertices[mesh.mIndices[i + v]].position, 1.f) };
+                    corners[v] = (position - data.mBoundsMin) / cellSize;
+                }
+                glm::vec3 low {glm::min(corners[0], glm::min(corners[1], corners[2]))};
+                glm::vec3 high {glm::max(corners[0], glm::max(corners[1], corners[2]))};
+
+                // Cells the triangle's plane cuts, within its box
+                glm::vec3 normal {glm::cross(corners[1] - corners[0], corners[2] - corners[0])};
+                float reach { .5f * (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z)) * 1.001f };
+                int first[3], last[3];
+                for(int axis {0}; axis < 3; ++axis) {
+                    first[axis] = std::clamp(static_cast<int>(std::floor(low[axis])), 0, size[axis] - 1);
+                    last[axis] = std::clamp(static_cast<int>(std::floor(high[axis])), 0, size[axis] - 1);
+                }
+                for(int z {first[2]}; z <= last[2]; ++z) {
+                    for(int y {first[1]}; y <= last[1]; ++y) {
+                        for(int x {first[0]}; x <= last[0]; ++x) {
+                            glm::vec3 centre {x + .5f, y + .5f, z + .5f};
+                            if(std::abs(glm::dot(normal, centre - corners[0])) <= reach) touched[cellIndex(x, y, z)] = 1;
+                        }
+                    }
+                }
+
+                // Columns it crosses. A centre right on an edge goes to
+                // whichever triangle that edge runs down (or right
+                // along) for, so it's counted once
+                glm::vec2 flat[3] { {corners[0].x, corners[0].y}, {corners[1].x, corners[1].y}, {corners[2].x, corners[2].y} };
+                float depth[3] {corners[0].z, corners[1].z, corners[2].z};
+                double area {sideOf(flat[0], flat[1], flat[2])};
+                if(area == 0.) continue;
+                if(area < 0.) {
+                    std::swap(flat[1], flat[2]);
+                    std::swap(depth[1], depth[2]);
+                    area = -area;
+                }
+                int firstX {std::max(static_cast<int>(std::ceil(low.x - .5f)), 0)};
+                int lastX {std::min(static_cast<int>(std::floor(high.x - .5f)), size[0] - 1)};
+                int firstY {std::max(static_cast<int>(std::ceil(low.y - .5f)), 0)};
+                int lastY {std::min(static_cast<int>(std::floor(high.y - .5f)), size[1] - 1)};
+                for(int y {firstY}; y <= lastY; ++y) {
+                    for(int x {firstX}; x <= lastX; ++x) {
+                        glm::vec2 centre {x + .5f, y + .5f};
+                        double weights[3];
+                        bool inside {true};
+                        for(int e {0}; e < 3 && inside; ++e) {
+                            const glm::vec2& from {flat[e]};
+                            const glm::vec2& to {flat[(e + 1) % 3]};
+                            weights[(e + 2) % 3] = sideOf(from, to, centre);
+                            bool owned { to.y < from.y || (to.y == from.y && to.x > from.x) };
+                            inside = weights[(e + 2) % 3] > 0. || (weights[(e + 2) % 3] == 0. && owned);
+                        }
+                        if(!inside) continue;
+                        double crossing {(weights[0] * depth[0] + weights[1] * depth[1] + weights[2] * depth[2]) / area};
+                        crossings[static_cast<std::size_t>(y) * size[0] + x].push_back(static_cast<float>(crossing));
+                    }
+                }
+            }
 
-        textures.push_back(&loadedTexture[textureName]);
+            // A centre is inside where the line up to it has crossed
+            // the surface an odd number of times. A column crossing it
+            // an odd number in all must have miscounted, and is left out
+            for(int y {0}; y < size[1]; ++y) {
+                for(int x {0}; x < size[0]; ++x) {
+                    std::vector<float>& column {crossings[static_cast<std::size_t>(y) * size[0] + x]};
+                    if(column.size() % 2 != 0) continue;
+                    std::sort(column.begin(), column.end());
+                    for(int z {0}; z < size[2]; ++z) {
+                        std::size_t below { static_cast<std::size_t>(std::lower_bound(column.begin(), column.end(), z + .5f) - column.begin()) };
+                        if(below % 2 == 1 && !touched[cellIndex(x, y, z)]) solid[cellIndex(x, y, z)] = 1;
+                    }
+                }
+            }
+        }
     }
 
-    return textures;
+    // Faces of solid cells with no solid cell beyond them, merged
+    // with their neighbours into rectangles and wound to face out.
+    // Rectangles share corners, so the culler knows their inner edges
+    std::unordered_map<std::uint32_t, GLuint> vertexOfCorner {};
+    auto corner = [&](const int* at) {
+        std::uint32_t key { static_cast<std::uint32_t>((at[0] * (CELLS + 1) + at[1]) * (CELLS + 1) + at[2]) };
+        auto [found, added] { vertexOfCorner.try_emplace(key, static_cast<GLuint>(data.mOccluderVertices.size())) };
+        if(added) data.mOccluderVertices.push_back(data.mBoundsMin + glm::vec3(at[0], at[1], at[2]) * cellSize);
+        return found->second;
+    };
+    auto isSolid = [&](const int* at) {
+        for(int axis {0}; axis < 3; ++axis) {
+            if(at[axis] < 0 || at[axis] >= size[axis]) return false;
+        }
+        return solid[cellIndex(at[0], at[1], at[2])] != 0;
+    };
+    for(int axis {0}; axis < 3; ++axis) {
+        // u, v and axis turn the same way as x, y and z
+        int u {(axis + 1) % 3}, v {(axis + 2) % 3};
+        std::vector<std::uint8_t> open(static_cast<std::size_t>(size[u]) * size[v]);
+        for(int side: {-1, 1}) {
+            for(int layer {0}; layer < size[axis]; ++layer) {
+                for(int b {0}; b < size[v]; ++b) {
+                    for(int a {0}; a < size[u]; ++a) {
+                        int cell[3], beyond[3];
+                        cell[axis] = layer;
+                        cell[u] = a;
+                        cell[v] = b;
+                        std::copy(cell, cell + 3, beyond);
+                        beyond[axis] += side;
+                        open[static_cast<std::size_t>(b) * size[u] + a] = isSolid(cell) && !isSolid(beyond);
+                    }
+                }
+
+                for(int b {0}; b < size[v]; ++b) {
+                    for(int a {0}; a < size[u]; ++a) {
+                        if(!open[static_cast<std::size_t>(b) * size[u] + a]) continue;
+                        // As wide as the row allows, then as tall as
+                        // every row below matches it
+                        int width {1}, height {1};
+                        while(a + width < size[u] && open[static_cast<std::size_t>(b) * size[u] + a + width]) ++width;
+                        for(; b + height < size[v]; ++height) {
+                            const std::uint8_t* row {open.data() + static_cast<std::size_t>(b + height) * size[u] + a};
+                            if(!std::all_of(row, row + width, [](std::uint8_t face) { return face != 0; })) break;
+                        }
+                        for(int row {b}; row < b + height; ++row)
+                            std::fill_n(open.begin() + static_cast<std::size_t>(row) * size[u] + a, width, 0);
+
+                        GLuint quad[4];
+                        const int spans[4][2] { {a, b}, {a + width, b}, {a + width, b + height}, {a, b + height} };
+                        for(int q {0}; q < 4; ++q) {
+                            int at[3];
+                            at[axis] = layer + (side > 0? 1: 0);
+                            at[u] = spans[q][0];
+                            at[v] = spans[q][1];
+                            quad[q] = corner(at);
+                        }
+                        if(side > 0) data.mOccluderIndices.insert(data.mOccluderIndices.end(), {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]});
+                        else data.mOccluderIndices.insert(data.mOccluderIndices.end(), {quad[0], quad[2], quad[1], quad[0], quad[3], quad[2]});
+                    }
+                }
+            }
+        }
+    }
 }
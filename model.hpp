@@ -1,32 +1,170 @@
 #ifndef ZOMODEL_H
 #define ZOMODEL_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
-#include <map>
+#include <memory>
 
 #include <assimp/scene.h>
+#include <glm/glm.hpp>
 
 #include "shader.hpp"
 #include "mesh.hpp"
+#include "texturetable.hpp"
+#include "commandbuffer.hpp"
+#include "transform.hpp"
+#include "skeleton.hpp"
+
+struct SDL_Surface;
+class UploadQueue;
+
+// Everything about a model that can be read without touching GL, as
+// filled in by Model::import on any thread
+struct ModelData {
+    struct MeshData {
+        std::vector<Vertex> mVertices;
+        std::vector<GLuint> mIndices;
+        // Every node the mesh is drawn at, as one instanced draw
+        std::vector<TransformID> mInstances;
+        std::vector<std::size_t> mImages; // into mImages
+        std::vector<VertexSkin> mSkin; // empty unless skinned
+        MeshBVH mBVH;
+        // Filled on the upload thread, if there is one, by the job
+        // with this ticket
+        Mesh::Buffers mBuffers;
+        std::uint64_t mUploadTicket {0};
+    };
+
+    struct Image {
+        std::string mPath;
+        std::string mType;
+        SDL_Surface* mSurface; // decoded, or null if it couldn't be
+        // Made from mSurface on the upload thread, as for meshes; no
+        // ticket if the texture was already loaded
+        GLuint mTexture {0};
+        std::uint64_t mUploadTicket {0};
+    };
+
+    ModelData() = default;
+    ~ModelData();
+    ModelData(const ModelData& other) = delete;
+    ModelData& operator=(const ModelData& other) = delete;
+
+    std::string mPath;
+    TransformHierarchy mNodes;
+    std::vector<MeshData> mMeshes;
+    std::vector<Image> mImages; // each texture the model uses, once
+    // Model space box around every mesh
+    glm::vec3 mBoundsMin {0.f};
+    glm::vec3 mBoundsMax {0.f};
+    // The solid inside the model's closed meshes, in model space and
+    // never past their surface, to occlusion cull with (see
+    // occlusionculler.hpp); empty if nothing's solid enough
+    std::vector<glm::vec3> mOccluderVertices;
+    std::vector<GLuint> mOccluderIndices;
+    // Every node as a joint, the bones skinned meshes follow, and
+    // the animations; empty if nothing's skinned
+    Skeleton mSkeleton;
+};
 
 class Model {
 public:
-    Model(const std::string& path, const Shader& shader);
-    void Draw(const Shader& shader) const;
+    // Load the model at path, blocking until it's all on the GPU
+    Model(const std::string& path, const Shader& shader, TextureTable& textures);
+    // Take over imported data. Nothing reaches the GPU until
+    // uploadNext() is called
+    Model(std::unique_ptr<ModelData> data, TextureTable& textures);
+    ~Model();
+
+    Model(const Model& other) = delete;
+    Model& operator=(const Model& other) = delete;
+
+    // Read the model at path: geometry, node hierarchy, and decoded
+    // texture images. Makes no GL calls, so it's safe on any thread.
+    // Meshes used at several nodes, or stored more than once over,
+    // are kept once, with every node they're drawn at. False, having
+    // said why, if the file couldn't be imported
+    static bool import(const std::string& path, ModelData& data);
+
+    // Put the next mesh, or once every mesh is up the next texture,
+    // on the GPU. With an upload thread (gUploadQueue), the first call
+    // hands all of it over, and each after takes on the next piece
+    // once the thread's done with it. False if nothing was done,
+    // either because it's all done or it's not ready yet
+    bool uploadNext(const Shader& shader);
+
+    // Every mesh is on the GPU; textures may still be placeholders
+    bool hasAllMeshes() const { return meshes.size() == meshInstances.size(); }
+    bool isComplete() const { return !pending; }
+
+    // Draw or record every mesh uploaded so far, at each of its nodes
+    // relative to the model matrix given. Recorded meshes are drawn
+    // once per mesh, instanced, however many nodes share them
+    void Draw(const Shader& shader, const glm::mat4& model=glm::mat4(1.f)) const;
+    void record(CommandBuffer& commands, const glm::mat4& model) const;
+    // Or posed: skinned meshes bent by boneCount bone matrices from
+    // texel firstTexel of the bone palette, in model space, so placed
+    // by the model matrix alone, once however many nodes share them
+    void record(CommandBuffer& commands, const glm::mat4& model, GLint firstTexel, GLint boneCount) const;
+
+    const glm::vec3& getBoundsMin() const { return boundsMin; }
+    const glm::vec3& getBoundsMax() const { return boundsMax; }
+    // A rough stand-in for the model, to occlusion cull with
+    const std::vector<glm::vec3>& getOccluderVertices() const { return occluderVertices; }
+    const std::vector<GLuint>& getOccluderIndices() const { return occluderIndices; }
+    const Skeleton& getSkeleton() const { return skeleton; }
+
+    // The nearest hit along ray, in world space, on the model placed
+    // by the model matrix given, with distances as along ray; or
+    // just whether there is one. Only meshes uploaded so far count,
+    // and skinned meshes are tested in their rest pose. The hit's
+    // mMesh is the mesh, whichever of its instances was hit
+    bool intersect(const Ray& ray, const glm::mat4& model, RayHit& hit) const;
+    bool occluded(const Ray& ray, const glm::mat4& model) const;
 
 private:
     // model data
     std::vector<Mesh> meshes;
-    std::map<std::string, bool> isTextureLoaded;
-    std::map<std::string, Texture> loadedTexture;
-    std::string directory;
-    std::string modelPath;
-
-    void loadModel(const std::string& path, const Shader& shader);
-    void processNode(aiNode* node, const aiScene* scene, const Shader& shader);
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene, const Shader& shader);
-    std::vector<Texture*> loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName);
+    // node hierarchy from the imported scene, and the nodes each mesh
+    // (by index) is drawn at
+    TransformHierarchy nodes;
+    std::vector<std::vector<TransformID>> meshInstances;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    std::vector<glm::vec3> occluderVertices;
+    std::vector<GLuint> occluderIndices;
+    Skeleton skeleton;
+
+    // Textures, one per image in the imported data, shared through
+    // the table with any other model using them
+    TextureTable* textureTable;
+    std::vector<TextureHandle> textures;
+
+    // Imported data still to be uploaded, and how far along it is.
+    // Shared with jobs on the upload thread, which outlive the model
+    // if it's dropped before they run
+    std::shared_ptr<ModelData> pending;
+    std::size_t nextImage {0};
+    bool uploadsQueued {false};
+
+    // Upload on this thread, or through the upload thread
+    bool uploadNow(const Shader& shader);
+    bool adoptNext(const Shader& shader, UploadQueue& uploads);
+    void queueUploads(UploadQueue& uploads);
+
+    glm::mat4 getMeshTransform(std::size_t mesh, std::size_t instance, const glm::mat4& model) const;
+    bool hitsBounds(const Ray& ray, const glm::mat4& model) const;
+
+    static std::unique_ptr<ModelData> importNow(const std::string& path);
+    static void processNode(aiNode* node, const aiScene* scene, TransformID parent, int parentJoint, ModelData& data, std::vector<aiMesh*>& sceneMeshes, std::vector<std::size_t>& meshOfSceneMesh);
+    static void gatherBones(ModelData& data, std::vector<aiMesh*>& sceneMeshes, std::vector<std::vector<std::uint8_t>>& paletteOfBone);
+    static void extractGeometry(const aiMesh* mesh, const std::vector<std::uint8_t>& palette, std::vector<Vertex>& vertices, std::vector<GLuint>& indices, std::vector<VertexSkin>& skin);
+    static void gatherAnimations(const aiScene* scene, Skeleton& skeleton);
+    static void gatherImages(const aiScene* scene, const std::string& directory, ModelData& data, std::vector<aiMesh*>& sceneMeshes);
+    static void mergeIdenticalMeshes(ModelData& data, const std::vector<std::uint64_t>& hashes);
+    static void computeBounds(ModelData& data);
+    static void buildOccluder(ModelData& data);
 };
 
 #endif
@@ -0,0 +1,233 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <chrono>
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shared_globals.hpp"
+#include "jobsystem.hpp"
+#include "profiler.hpp"
+#include "modelcache.hpp"
+
+static Mesh makeUnitCube(const Shader& shader) {
+    // Four corners per face, so each face gets its own normal,
+    // wound anticlockwise seen from outside
+    std::vector<Vertex> vertices {};
+    std::vector<GLuint> indices {};
+    const glm::vec2 corners[4] { {0.f, 0.f}, {1.f, 0.f}, {1.f, 1.f}, {0.f, 1.f} };
+    for(int axis {0}; axis < 3; ++axis) {
+        int u { (axis + 1) % 3 };
+        int v { (axis + 2) % 3 };
+        for(int side {0}; side < 2; ++side) {
+            GLuint first { static_cast<GLuint>(vertices.size()) };
+            for(int i {0}; i < 4; ++i) {
+                glm::vec2 corner { corners[side? i: 3 - i] };
+                Vertex vertex {};
+                vertex.position[axis] = static_cast<float>(side);
+                vertex.position[u] = corner.x;
+                vertex.position[v] = corner.y;
+                vertex.normal[axis] = side? 1.f: -1.f;
+                vertex.texCoords = corner;
+                vertices.push_back(vertex);
+            }
+            for(GLuint index: {0u, 1u, 2u, 0u, 2u, 3u}) indices.push_back(first + index);
+        }
+    }
+    return Mesh {std::move(vertices), std::move(indices), {}, shader};
+}
+
+ModelCache::ModelCache(const Shader& shader):
+    mShader {shader},
+    mPlaceholder {makeUnitCube(shader)}
+{
+    mLoader = std::thread {&ModelCache::loaderLoop, this};
+}
+
+ModelCache::~ModelCache() {
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mQuit = true;
+    }
+    mRequestReady.notify_all();
+    mLoader.join();
+}
+
+ModelHandle ModelCache::load(const std::string& path) {
+    ModelHandle model { mModels.add(Entry { .mPath {path} }) };
+    requestImport(model, *mModels.get(model));
+    return model;
+}
+
+void ModelCache::reload(ModelHandle model) {
+    Entry* entry { mModels.get(model) };
+    if(!entry) return;
+    // Anything still on its way in is out of date now
+    entry->mNext.reset();
+    requestImport(model, *entry);
+}
+
+void ModelCache::unload(ModelHandle model) {
+    // Any import still in flight is dropped when it comes back
+    mModels.remove(model);
+}
+
+bool ModelCache::isReady(ModelHandle model) const {
+    const Entry* entry { mModels.get(model) };
+    return entry && entry->mCurrent && entry->mCurrent->isComplete();
+}
+
+bool ModelCache::hasFailed(ModelHandle model) const {
+    const Entry* entry { mModels.get(model) };
+    return entry && entry->mFailed;
+}
+
+bool ModelCache::contains(ModelHandle model) const {
+    return mModels.get(model) != nullptr;
+}
+
+std::uint64_t ModelCache::getVersion(ModelHandle model) const {
+    const Entry* entry { mModels.get(model) };
+    return entry? entry->mVersion: 0;
+}
+
+const Model* ModelCache::getModel(ModelHandle model) const {
+    const Entry* entry { mModels.get(model) };
+    if(!entry || !entry->mCurrent || !entry->mCurrent->hasAllMeshes()) return nullptr;
+    return entry->mCurrent.get();
+}
+
+void ModelCache::requestImport(ModelHandle model, Entry& entry) {
+    entry.mRequest = mNextRequest++;
+    entry.mFailed = false;
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mRequests.push_back(Request { .mModel {model}, .mRequest {entry.mRequest}, .mPath {entry.mPath} });
+    }
+    mRequestReady.notify_one();
+}
+
+void ModelCache::adopt(Result& result) {
+    // Drop imports for models since unloaded or reloaded again
+    Entry* entry { mModels.get(result.mModel) };
+    if(!entry || entry->mRequest != result.mRequest) return;
+
+    if(!result.mData) {
+        std::cout << "ERROR::MODELCACHE::LOAD_FAILED " << entry->mPath << std::endl;
+        // A failed reload leaves the old version up
+        if(!entry->mCurrent) entry->mFailed = true;
+        return;
+    }
+
+    std::unique_ptr<Model> model { std::make_unique<Model>(std::move(result.mData), mTextures) };
+    if(entry->mCurrent) entry->mNext = std::move(model);
+    else {
+        entry->mCurrent = std::move(model);
+        ++entry->mVersion;
+    }
+}
+
+bool ModelCache::update(float budgetMs) {
+    PROFILE_ZONE("ModelCache::update");
+    bool changed {false};
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        std::swap(mAdopting, mResults);
+    }
+    for(Result& result: mAdopting) adopt(result);
+    mAdopting.clear();
+
+    // Upload a piece at a time until the budget's spent, always
+    // managing at least one so loading can't stall entirely. With an
+    // upload thread, a piece is just taking on what it made
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point deadline {
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli> {budgetMs})
+    };
+    bool first {true};
+    mModels.forEach([&](ModelHandle, Entry& entry) {
+        for(;;) {
+            if(!first && Clock::now() >= deadline) return;
+            Model* model { entry.mNext? entry.mNext.get(): entry.mCurrent.get() };
+            if(!model || model->isComplete()) return;
+
+            bool hadAllMeshes { model->hasAllMeshes() };
+            bool uploaded { model->uploadNext(mShader) };
+            first = false;
+
+            // A reload is swapped in whole; the first version shows
+            // as it arrives, its box giving way once its meshes do
+            if(model == entry.mNext.get()) {
+                if(model->isComplete()) {
+                    entry.mCurrent = std::move(entry.mNext);
+                    ++entry.mVersion;
+                    changed = true;
+                }
+            } else if(model->hasAllMeshes() && !hadAllMeshes) changed = true;
+            // Waiting on the upload thread
+            if(!uploaded) return;
+        }
+    });
+    return changed;
+}
+
+void ModelCache::record(ModelHandle model, CommandBuffer& commands, const glm::mat4& transform) const {
+    record(model, commands, transform, 0, 0);
+}
+
+void ModelCache::record(ModelHandle model, CommandBuffer& commands, const glm::mat4& transform, GLint firstTexel, GLint boneCount) const {
+    const Entry* entry { mModels.get(model) };
+    if(!entry || entry->mFailed) return;
+
+    if(const Model* current { getModel(model) }) {
+        if(boneCount > 0) current->record(commands, transform, firstTexel, boneCount);
+        else current->record(commands, transform);
+        return;
+    }
+
+    // Still loading: a box over where the model will be, kept from
+    // going flat so its normals stay sound
+    glm::vec3 boundsMin {0.f};
+    glm::vec3 boundsMax {1.f};
+    if(entry->mCurrent) {
+        boundsMin = entry->mCurrent->getBoundsMin();
+        boundsMax = entry->mCurrent->getBoundsMax();
+    }
+    glm::mat4 box { glm::translate(transform, boundsMin) };
+    box = glm::scale(box, glm::max(boundsMax - boundsMin, glm::vec3(1e-3f)));
+    mPlaceholder.record(commands, box, mTextures);
+}
+
+void ModelCache::loaderLoop() {
+    PROFILE_THREAD_NAME("Model loader");
+    // Imports aren't jobs: they can take seconds, which would hold up
+    // a worker every frame is waiting on. Joined as a guest, though,
+    // this thread still shares out their parallel loops (mesh
+    // conversion, BVH builds, image decoding) rather than running
+    // them in turn
+    JobSystem* jobs {gJobSystem};
+    if(!jobs->join()) std::cout << "ERROR::MODELCACHE::NO_JOB_SYSTEM_GUEST_SLOT" << std::endl;
+    for(;;) {
+        Request request {};
+        {
+            std::unique_lock<std::mutex> lock {mMutex};
+            mRequestReady.wait(lock, [this]{ return mQuit || !mRequests.empty(); });
+            if(mQuit) break;
+            request = std::move(mRequests.front());
+            mRequests.pop_front();
+        }
+
+        std::unique_ptr<ModelData> data { std::make_unique<ModelData>() };
+        if(!Model::import(request.mPath, *data)) data.reset();
+
+        {
+            std::lock_guard<std::mutex> lock {mMutex};
+            mResults.push_back(Result { .mModel {request.mModel}, .mRequest {request.mRequest}, .mData {std::move(data)} });
+        }
+    }
+    jobs->leave();
+}
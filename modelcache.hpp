@@ -0,0 +1,130 @@
+#ifndef ZOMODELCACHE_H
+#define ZOMODELCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <glm/glm.hpp>
+
+#include "handle.hpp"
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "model.hpp"
+#include "texturetable.hpp"
+#include "commandbuffer.hpp"
+
+struct ModelTag;
+using ModelHandle = Handle<ModelTag>;
+
+/*
+Models loaded in the background. load() hands back a handle straight
+away; a loader thread imports the file and decodes its textures, and
+update() puts the result on the GPU a mesh or texture at a time,
+within a time budget, so a big model never costs a long frame. Where
+there's an upload thread (see uploadqueue.hpp) the data is copied to
+the GPU there, and update() only takes on what it has finished.
+
+Until all of a model's meshes are up it's drawn as a grey box the size
+of its bounds (a unit box before those are known), and its textures
+stay grey placeholders until they're uploaded. Reloading keeps drawing
+the old version until the new one is complete. Handles to unloaded
+models just stop drawing anything.
+
+Everything but the import and uploads runs on the GL thread. The
+loader thread takes one of gJobSystem's guest slots while the cache
+is around, so imports still spread their work over the workers; the
+job system has to outlive the cache
+*/
+class ModelCache {
+public:
+    explicit ModelCache(const Shader& shader);
+    ~ModelCache();
+
+    ModelCache(const ModelCache& other) = delete;
+    ModelCache& operator=(const ModelCache& other) = delete;
+
+    // Start loading the model at path
+    ModelHandle load(const std::string& path);
+    // Read model's file again, swapping the new version in once it's
+    // fully uploaded
+    void reload(ModelHandle model);
+    void unload(ModelHandle model);
+
+    // Model is on the GPU, textures and all. False for models that
+    // failed to load, or are gone
+    bool isReady(ModelHandle model) const;
+    bool hasFailed(ModelHandle model) const;
+    // False once model has been unloaded, for anything kept per
+    // model to let go of it
+    bool contains(ModelHandle model) const;
+    // Changes whenever a different version of model starts being
+    // drawn, for anything built from it to know it's out of date
+    std::uint64_t getVersion(ModelHandle model) const;
+
+    // Adopt whatever the loader has finished and spend up to
+    // budgetMs uploading it. Call once a frame, on the GL thread.
+    // True if anything now draws differently than before
+    bool update(float budgetMs=2.f);
+
+    // Record model's draws (or its placeholder) placed by transform
+    void record(ModelHandle model, CommandBuffer& commands, const glm::mat4& transform) const;
+    // Or posed by bones from the bone palette (see Model::record)
+    void record(ModelHandle model, CommandBuffer& commands, const glm::mat4& transform, GLint firstTexel, GLint boneCount) const;
+
+    // The model as drawn right now; null while it's still a
+    // placeholder, or if it's gone
+    const Model* getModel(ModelHandle model) const;
+    const TextureTable& getTextures() const { return mTextures; }
+
+private:
+    struct Entry {
+        std::string mPath;
+        std::unique_ptr<Model> mCurrent; // what's drawn
+        std::unique_ptr<Model> mNext;    // a reload, still uploading
+        std::uint64_t mRequest {0};      // latest import asked for
+        std::uint64_t mVersion {0};      // bumped when mCurrent changes
+        bool mFailed {false};
+    };
+
+    struct Request {
+        ModelHandle mModel;
+        std::uint64_t mRequest;
+        std::string mPath;
+    };
+
+    struct Result {
+        ModelHandle mModel;
+        std::uint64_t mRequest;
+        std::unique_ptr<ModelData> mData; // null if the import failed
+    };
+
+    void requestImport(ModelHandle model, Entry& entry);
+    void adopt(Result& result);
+    void loaderLoop();
+
+    const Shader& mShader;
+    TextureTable mTextures;
+    HandlePool<Entry, ModelTag> mModels;
+    Mesh mPlaceholder; // unit cube from (0, 0, 0) to (1, 1, 1)
+    std::uint64_t mNextRequest {1};
+
+    // Shared with the loader thread
+    std::mutex mMutex;
+    std::condition_variable mRequestReady;
+    std::deque<Request> mRequests;
+    std::vector<Result> mResults;
+    bool mQuit {false};
+    std::thread mLoader;
+
+    // Results taken from the loader, kept to reuse their storage
+    std::vector<Result> mAdopting;
+};
+
+#endif
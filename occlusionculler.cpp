@@ -0,0 +1,316 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "jobsystem.hpp"
+#include "profiler.hpp"
+#include "occlusionculler.hpp"
+
+// AVX2 is picked at run time, so builds don't need -mavx2 and still
+// run on CPUs without it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ZO_OCCLUSION_AVX2 1
+#include <immintrin.h>
+#else
+#define ZO_OCCLUSION_AVX2 0
+#endif
+
+// Nearer than this to the eye, in clip space w, and a triangle or
+// box is treated as crossing the near plane
+const float MIN_CLIP_W {1e-4f};
+
+OcclusionCuller::OcclusionCuller(int width, int height):
+    mWidth {(std::max(width, 1) + TILE_WIDTH - 1) / TILE_WIDTH * TILE_WIDTH},
+    mHeight {(std::max(height, 1) + TILE_HEIGHT - 1) / TILE_HEIGHT * TILE_HEIGHT},
+    mTilesX {mWidth / TILE_WIDTH},
+    mTilesY {mHeight / TILE_HEIGHT},
+    mAVX2 {false},
+    mDepth(static_cast<std::size_t>(mWidth) * mHeight, 1.f),
+    mTileDepth(static_cast<std::size_t>(mTilesX) * mTilesY, 1.f)
+{
+    setAVX2(true);
+}
+
+void OcclusionCuller::setAVX2(bool enabled) {
+#if ZO_OCCLUSION_AVX2
+    mAVX2 = enabled && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    mAVX2 = false;
+#endif
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4& viewProjection) {
+    mViewProjection = viewProjection;
+    mOccluders.clear();
+}
+
+void OcclusionCuller::addOccluder(const std::vector<glm::vec3>& vertices, const std::vector<GLuint>& indices, const glm::mat4& transform) {
+    if(indices.size() < 3) return;
+    mOccluders.push_back(Occluder { .mVertices {&vertices}, .mIndices {&indices}, .mTransform {transform} });
+}
+
+void OcclusionCuller::rasterize(JobSystem& jobs) {
+    PROFILE_ZONE("OcclusionCuller::rasterize");
+    if(mSetups.size() < mOccluders.size()) mSetups.resize(mOccluders.size());
+
+    jobs.parallelFor(mOccluders.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i {begin}; i < end; ++i) setupTriangles(mOccluders[i], mSetups[i]);
+    });
+
+    // Each job owns whole rows of tiles, so none write the same pixel
+    jobs.parallelFor(mTilesY, 1, [&](std::size_t begin, std::size_t end) {
+        rasterizeRows(static_cast<int>(begin), static_cast<int>(end));
+        updateTileDepth(static_cast<int>(begin), static_cast<int>(end));
+    });
+}
+
+std::size_t OcclusionCuller::getTriangleCount() const {
+    std::size_t count {0};
+    for(std::size_t i {0}; i < mOccluders.size(); ++i) count += mSetups[i].mTriangles.size();
+    return count;
+}
+
+void OcclusionCuller::setupTriangles(const Occluder& occluder, Setup& setup) const {
+    const std::vector<glm::vec3>& vertices {*occluder.mVertices};
+    const std::vector<GLuint>& indices {*occluder.mIndices};
+    glm::mat4 toClip {mViewProjection * occluder.mTransform};
+
+    setup.mClip.resize(vertices.size());
+    for(std::size_t i {0}; i < vertices.size(); ++i) setup.mClip[i] = toClip * glm::vec4(vertices[i], 1.f);
+
+    // Screen position of a triangle's corners, or false if it's facing
+    // away or crosses the near plane
+    auto project = [&](std::size_t first, float* x, float* y, float* z) {
+        for(int v {0}; v < 3; ++v) {
+            const glm::vec4& clip {setup.mClip[indices[first + v]]};
+            if(clip.w < MIN_CLIP_W) return false;
+            // Pixels, with y up like NDC so winding is unchanged
+            x[v] = (clip.x / clip.w * .5f + .5f) * mWidth;
+            y[v] = (clip.y / clip.w * .5f + .5f) * mHeight;
+            z[v] = clip.z / clip.w;
+        }
+        float area { (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]) };
+        return area > 0.f;
+    };
+    auto edgeKey = [](GLuint from, GLuint to) {
+        return static_cast<std::uint64_t>(from) << 32 | to;
+    };
+
+    // An edge two kept triangles share is inside the occluder's outline
+    setup.mFacing.clear();
+    setup.mEdges.clear();
+    for(std::size_t i {0}; i + 2 < indices.size(); i += 3) {
+        float x[3], y[3], z[3];
+        if(!project(i, x, y, z)) continue;
+        setup.mFacing.push_back(i);
+        for(int e {0}; e < 3; ++e) setup.mEdges.push_back(edgeKey(indices[i + e], indices[i + (e + 1) % 3]));
+    }
+    std::sort(setup.mEdges.begin(), setup.mEdges.end());
+
+    setup.mTriangles.clear();
+    for(std::size_t i: setup.mFacing) {
+        float x[3], y[3], z[3];
+        project(i, x, y, z);
+        float area { (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]) };
+
+        // Pixel centres sit at half pixels
+        int minX { std::max(static_cast<int>(std::ceil(std::min({x[0], x[1], x[2]}) - .5f)), 0) };
+        int maxX { std::min(static_cast<int>(std::floor(std::max({x[0], x[1], x[2]}) - .5f)), mWidth - 1) };
+        int minY { std::max(static_cast<int>(std::ceil(std::min({y[0], y[1], y[2]}) - .5f)), 0) };
+        int maxY { std::min(static_cast<int>(std::floor(std::max({y[0], y[1], y[2]}) - .5f)), mHeight - 1) };
+        if(minX > maxX || minY > maxY) continue;
+
+        // Edges on the outline are pulled in by half a pixel, so only
+        // pixels the occluder covers entirely are drawn. Shared edges
+        // aren't, or the pixels along them would be left to neither
+        // triangle and leak through the middle of the occluder
+        Triangle triangle {};
+        for(int e {0}; e < 3; ++e) {
+            int next {(e + 1) % 3};
+            triangle.mEdgeA[e] = y[e] - y[next];
+            triangle.mEdgeB[e] = x[next] - x[e];
+            triangle.mEdgeC[e] = -(triangle.mEdgeA[e] * x[e] + triangle.mEdgeB[e] * y[e]);
+            bool shared {std::binary_search(setup.mEdges.begin(), setup.mEdges.end(),
+                edgeKey(indices[i + next], indices[i + e]))};
+            if(!shared) triangle.mEdgeC[e] -= .5f * (std::abs(triangle.mEdgeA[e]) + std::abs(triangle.mEdgeB[e]));
+        }
+        triangle.mDepthDX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+        triangle.mDepthDY = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+        triangle.mDepthC = z[0] - triangle.mDepthDX * x[0] - triangle.mDepthDY * y[0];
+        // Each pixel takes the farthest depth the triangle has
+        // anywhere over it, so no pixel hides more than it should
+        triangle.mDepthBias = .5f * (std::abs(triangle.mDepthDX) + std::abs(triangle.mDepthDY));
+        triangle.mDepthMax = std::max({z[0], z[1], z[2]});
+        triangle.mMinX = minX;
+        triangle.mMaxX = maxX;
+        triangle.mMinY = minY;
+        triangle.mMaxY = maxY;
+        setup.mTriangles.push_back(triangle);
+    }
+}
+
+void OcclusionCuller::rasterizeRows(int firstTileRow, int endTileRow) {
+    int firstRow {firstTileRow * TILE_HEIGHT};
+    int lastRow {endTileRow * TILE_HEIGHT - 1};
+    std::fill(mDepth.begin() + firstRow * mWidth, mDepth.begin() + (lastRow + 1) * mWidth, 1.f);
+
+    for(std::size_t i {0}; i < mOccluders.size(); ++i) {
+        for(const Triangle& triangle: mSetups[i].mTriangles) {
+            int minY {std::max(triangle.mMinY, firstRow)};
+            int maxY {std::min(triangle.mMaxY, lastRow)};
+            if(minY > maxY) continue;
+#if ZO_OCCLUSION_AVX2
+            if(mAVX2) {
+                rasterizeTriangleAVX2(triangle, mDepth.data(), mWidth, minY, maxY);
+                continue;
+            }
+#endif
+            rasterizeTriangle(triangle, mDepth.data(), mWidth, minY, maxY);
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeTriangle(const Triangle& triangle, float* depth, int width, int minY, int maxY) {
+    for(int y {minY}; y <= maxY; ++y) {
+        float centreY {y + .5f};
+        float* row {depth + static_cast<std::size_t>(y) * width};
+        for(int x {triangle.mMinX}; x <= triangle.mMaxX; ++x) {
+            float centreX {x + .5f};
+            bool inside {true};
+            for(int e {0}; e < 3; ++e) {
+                inside = inside && triangle.mEdgeA[e] * centreX + triangle.mEdgeB[e] * centreY + triangle.mEdgeC[e] >= 0.f;
+            }
+            if(!inside) continue;
+            float z {triangle.mDepthC + triangle.mDepthDX * centreX + triangle.mDepthDY * centreY + triangle.mDepthBias};
+            row[x] = std::min(row[x], std::min(z, triangle.mDepthMax));
+        }
+    }
+}
+
+#if ZO_OCCLUSION_AVX2
+__attribute__((target("avx2,fma")))
+void OcclusionCuller::rasterizeTriangleAVX2(const Triangle& triangle, float* depth, int width, int minY, int maxY) {
+    // Spans start on a multiple of 8 pixels; rows are whole tiles
+    // wide, so spans never run off the end of one
+    int startX {triangle.mMinX & ~7};
+    const __m256 laneOffsets {_mm256_setr_ps(.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f)};
+    const __m256 zero {_mm256_setzero_ps()};
+    const __m256 edgeA0 {_mm256_set1_ps(triangle.mEdgeA[0])};
+    const __m256 edgeA1 {_mm256_set1_ps(triangle.mEdgeA[1])};
+    const __m256 edgeA2 {_mm256_set1_ps(triangle.mEdgeA[2])};
+    const __m256 depthDX {_mm256_set1_ps(triangle.mDepthDX)};
+    const __m256 depthMax {_mm256_set1_ps(triangle.mDepthMax)};
+
+    for(int y {minY}; y <= maxY; ++y) {
+        float centreY {y + .5f};
+        // Everything but the x terms is constant along a row
+        __m256 edgeRow0 {_mm256_set1_ps(triangle.mEdgeB[0] * centreY + triangle.mEdgeC[0])};
+        __m256 edgeRow1 {_mm256_set1_ps(triangle.mEdgeB[1] * centreY + triangle.mEdgeC[1])};
+        __m256 edgeRow2 {_mm256_set1_ps(triangle.mEdgeB[2] * centreY + triangle.mEdgeC[2])};
+        __m256 depthRow {_mm256_set1_ps(triangle.mDepthC + triangle.mDepthDY * centreY + triangle.mDepthBias)};
+        float* row {depth + static_cast<std::size_t>(y) * width};
+
+        for(int x {startX}; x <= triangle.mMaxX; x += 8) {
+            __m256 centreX {_mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets)};
+            __m256 inside {_mm256_cmp_ps(_mm256_fmadd_ps(edgeA0, centreX, edgeRow0), zero, _CMP_GE_OQ)};
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_fmadd_ps(edgeA1, centreX, edgeRow1), zero, _CMP_GE_OQ));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_fmadd_ps(edgeA2, centreX, edgeRow2), zero, _CMP_GE_OQ));
+            if(_mm256_testz_ps(inside, inside)) continue;
+
+            __m256 z {_mm256_min_ps(_mm256_fmadd_ps(depthDX, centreX, depthRow), depthMax)};
+            __m256 current {_mm256_loadu_ps(row + x)};
+            _mm256_storeu_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, z), inside));
+        }
+    }
+}
+#endif
+
+void OcclusionCuller::updateTileDepth(int firstTileRow, int endTileRow) {
+    for(int tileY {firstTileRow}; tileY < endTileRow; ++tileY) {
+        for(int tileX {0}; tileX < mTilesX; ++tileX) {
+            float farthest {-1.f};
+            for(int y {tileY * TILE_HEIGHT}; y < (tileY + 1) * TILE_HEIGHT; ++y) {
+                const float* row {mDepth.data() + static_cast<std::size_t>(y) * mWidth + tileX * TILE_WIDTH};
+                farthest = std::max(farthest, *std::max_element(row, row + TILE_WIDTH));
+            }
+            mTileDepth[static_cast<std::size_t>(tileY) * mTilesX + tileX] = farthest;
+        }
+    }
+}
+
+bool OcclusionCuller::isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform) const {
+    glm::mat4 toClip {mViewProjection * transform};
+
+    // Corners are one corner plus some of the box's edges, all
+    // transformed once
+    glm::vec4 origin {toClip * glm::vec4(boundsMin, 1.f)};
+    glm::vec4 edgeX {toClip[0] * (boundsMax.x - boundsMin.x)};
+    glm::vec4 edgeY {toClip[1] * (boundsMax.y - boundsMin.y)};
+    glm::vec4 edgeZ {toClip[2] * (boundsMax.z - boundsMin.z)};
+    glm::vec4 corners[8];
+    unsigned outsideAll {0x3f};
+    bool nearCamera {false};
+    for(int corner {0}; corner < 8; ++corner) {
+        glm::vec4& clip {corners[corner]};
+        clip = origin;
+        if(corner & 1) clip += edgeX;
+        if(corner & 2) clip += edgeY;
+        if(corner & 4) clip += edgeZ;
+        // Which frustum planes the corner is past
+        unsigned outside {
+            (clip.x < -clip.w? 1u: 0u) | (clip.x > clip.w? 2u: 0u) |
+            (clip.y < -clip.w? 4u: 0u) | (clip.y > clip.w? 8u: 0u) |
+            (clip.w < MIN_CLIP_W? 16u: 0u) | (clip.z > clip.w? 32u: 0u)
+        };
+        outsideAll &= outside;
+        nearCamera = nearCamera || clip.w < MIN_CLIP_W;
+    }
+    // Entirely past one plane, so out of view
+    if(outsideAll) return false;
+    // Boxes the camera is in, or near, are always drawn
+    if(nearCamera) return true;
+
+    // The box's outline on screen, and its nearest point
+    float minX {0.f}, maxX {0.f}, minY {0.f}, maxY {0.f}, nearest {0.f};
+    for(int corner {0}; corner < 8; ++corner) {
+        const glm::vec4& clip {corners[corner]};
+        float x {(clip.x / clip.w * .5f + .5f) * mWidth};
+        float y {(clip.y / clip.w * .5f + .5f) * mHeight};
+        float z {clip.z / clip.w};
+        minX = corner? std::min(minX, x): x;
+        maxX = corner? std::max(maxX, x): x;
+        minY = corner? std::min(minY, y): y;
+        maxY = corner? std::max(maxY, y): y;
+        nearest = corner? std::min(nearest, z): z;
+    }
+
+    // Every pixel the outline touches
+    int firstX {std::max(static_cast<int>(std::floor(minX)), 0)};
+    int lastX {std::min(static_cast<int>(std::ceil(maxX)) - 1, mWidth - 1)};
+    int firstY {std::max(static_cast<int>(std::floor(minY)), 0)};
+    int lastY {std::min(static_cast<int>(std::ceil(maxY)) - 1, mHeight - 1)};
+    lastX = std::max(lastX, firstX);
+    lastY = std::max(lastY, firstY);
+
+    for(int tileY {firstY / TILE_HEIGHT}; tileY <= lastY / TILE_HEIGHT; ++tileY) {
+        for(int tileX {firstX / TILE_WIDTH}; tileX <= lastX / TILE_WIDTH; ++tileX) {
+            // Everything in the tile is in front of the box
+            if(mTileDepth[static_cast<std::size_t>(tileY) * mTilesX + tileX] < nearest) continue;
+
+            int tileFirstX {std::max(firstX, tileX * TILE_WIDTH)};
+            int tileLastX {std::min(lastX, (tileX + 1) * TILE_WIDTH - 1)};
+            int tileFirstY {std::max(firstY, tileY * TILE_HEIGHT)};
+            int tileLastY {std::min(lastY, (tileY + 1) * TILE_HEIGHT - 1)};
+            for(int y {tileFirstY}; y <= tileLastY; ++y) {
+                const float* row {mDepth.data() + static_cast<std::size_t>(y) * mWidth};
+                for(int x {tileFirstX}; x <= tileLastX; ++x) {
+                    if(row[x] >= nearest) return true;
+                }
+            }
+        }
+    }
+    return false;
+}
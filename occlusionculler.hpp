@@ -0,0 +1,119 @@
+#ifndef ZOOCCLUSIONCULLER_H
+#define ZOOCCLUSIONCULLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+class JobSystem;
+
+/*
+Software occlusion culling. Each frame a handful of big occluders,
+usually simplified stand-ins for the real meshes, are rasterised on
+the CPU into a small depth buffer, and boxes around whatever might be
+drawn are tested against it before their draws are recorded.
+
+The buffer is split into tiles 8 pixels wide by 4 high. Occluders are
+rasterised a row of tiles per job, 8 pixels at a time with AVX2 where
+the CPU has it. A pixel only takes an occluder's depth if it's wholly
+covered, and then the farthest depth the occluder has over it; the
+nearest such depth is kept. Each tile then notes the farthest depth
+left in it, so most boxes are settled a tile at a time without
+looking at its pixels. Boxes off screen or beyond the far plane count
+as hidden too, so this frustum culls as well.
+
+Faces turned away are skipped, so occluders are best as closed meshes
+wound anticlockwise. Triangles that reach behind the near plane are
+skipped too, so an occluder half past the camera hides less than it
+might, but never too much. Occludee tests only read, so they can run from
+any number of jobs at once, once rasterize() has returned
+*/
+class OcclusionCuller {
+public:
+    static constexpr int TILE_WIDTH {8};
+    static constexpr int TILE_HEIGHT {4};
+
+    // Depth buffer size, rounded up to whole tiles. It's stretched
+    // over the whole view, whatever the window's shape
+    explicit OcclusionCuller(int width=256, int height=128);
+
+    // Forget last frame's occluders and depth
+    void beginFrame(const glm::mat4& viewProjection);
+
+    // Queue vertices, indexed as triangles, placed by transform to
+    // be rasterised. Both are read during rasterize(), so must last
+    // until then
+    void addOccluder(const std::vector<glm::vec3>& vertices, const std::vector<GLuint>& indices, const glm::mat4& transform);
+
+    // Rasterise every queued occluder, spread over jobs' workers
+    void rasterize(JobSystem& jobs);
+
+    // False if the box between boundsMin and boundsMax, placed by
+    // transform, is certainly hidden behind occluders or out of view
+    bool isVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& transform=glm::mat4(1.f)) const;
+
+    int getWidth() const { return mWidth; }
+    int getHeight() const { return mHeight; }
+    // Nearest occluder depth per pixel, rows bottom up, in NDC
+    const std::vector<float>& getDepth() const { return mDepth; }
+    std::size_t getOccluderCount() const { return mOccluders.size(); }
+    // Triangles last rasterised, after those facing away or behind
+    // the camera were dropped
+    std::size_t getTriangleCount() const;
+    bool usesAVX2() const { return mAVX2; }
+    // Rasterise with AVX2 where the CPU has it (the default), or
+    // always on the scalar path, to check one against the other
+    void setAVX2(bool enabled);
+
+private:
+    // A triangle set up for rasterising: edge functions, each
+    // positive inside, and its depth plane, in pixels
+    struct Triangle {
+        float mEdgeA[3];
+        float mEdgeB[3];
+        float mEdgeC[3];
+        float mDepthC;
+        float mDepthDX;
+        float mDepthDY;
+        float mDepthBias; // half a pixel's worth of depth slope
+        float mDepthMax;
+        int mMinX, mMaxX, mMinY, mMaxY; // inclusive, on screen
+    };
+
+    struct Occluder {
+        const std::vector<glm::vec3>* mVertices;
+        const std::vector<GLuint>* mIndices;
+        glm::mat4 mTransform;
+    };
+
+    // Per occluder, kept between frames for their storage
+    struct Setup {
+        std::vector<glm::vec4> mClip;
+        std::vector<std::size_t> mFacing; // first index of each triangle kept
+        std::vector<std::uint64_t> mEdges; // their edges, sorted
+        std::vector<Triangle> mTriangles;
+    };
+
+    void setupTriangles(const Occluder& occluder, Setup& setup) const;
+    void rasterizeRows(int firstTileRow, int endTileRow);
+    // Rows minY to maxY of triangle, into depth width pixels wide
+    static void rasterizeTriangle(const Triangle& triangle, float* depth, int width, int minY, int maxY);
+    static void rasterizeTriangleAVX2(const Triangle& triangle, float* depth, int width, int minY, int maxY);
+    void updateTileDepth(int firstTileRow, int endTileRow);
+
+    int mWidth;
+    int mHeight;
+    int mTilesX;
+    int mTilesY;
+    bool mAVX2;
+    glm::mat4 mViewProjection {1.f};
+    std::vector<Occluder> mOccluders;
+    std::vector<Setup> mSetups;
+    std::vector<float> mDepth;
+    std::vector<float> mTileDepth; // farthest depth in each tile
+};
+
+#endif
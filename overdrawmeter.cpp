@@ -0,0 +1,37 @@
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "overdrawmeter.hpp"
+
+void OverdrawMeter::begin() {
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xFF);
+    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+    // Count on depth pass only; the 8-bit count saturates at 255
+    glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+}
+
+void OverdrawMeter::end(int width, int height) {
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDisable(GL_STENCIL_TEST);
+
+    mCounts.resize(static_cast<std::size_t>(width) * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &mCounts[0]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    mShadedFragments = 0;
+    mCoveredPixels = 0;
+    for(GLubyte count: mCounts) {
+        mShadedFragments += count;
+        mCoveredPixels += count > 0;
+    }
+}
+
+float OverdrawMeter::getOverdraw() const {
+    if(mCoveredPixels == 0) return 0.f;
+    return static_cast<float>(mShadedFragments) / mCoveredPixels;
+}
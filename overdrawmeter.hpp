@@ -0,0 +1,37 @@
+#ifndef ZOOVERDRAWMETER_H
+#define ZOOVERDRAWMETER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+/*
+Measures overdraw by counting, in the stencil buffer, every fragment
+that passes the depth test between begin() and end(). The counts are
+read back synchronously, so this is for measurement runs only
+*/
+class OverdrawMeter {
+public:
+    // Clear the stencil buffer and start counting. Anything else that
+    // uses stencil has to stay out of the measured draws
+    void begin();
+
+    // Stop counting and read the counts for a width x height
+    // framebuffer back
+    void end(int width, int height);
+
+    // Results of the last measurement
+    std::size_t getShadedFragments() const { return mShadedFragments; }
+    std::size_t getCoveredPixels() const { return mCoveredPixels; }
+
+    // Fragments shaded per covered pixel; 1 means no overdraw at all
+    float getOverdraw() const;
+
+private:
+    std::vector<GLubyte> mCounts;
+    std::size_t mShadedFragments {0};
+    std::size_t mCoveredPixels {0};
+};
+
+#endif
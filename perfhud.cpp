@@ -0,0 +1,287 @@
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "perfhud.hpp"
+
+namespace {
+    // Frames of history in each graph, one bar apiece
+    constexpr std::size_t HISTORY {240};
+    // Timestamp pairs in flight; results are read this many frames late
+    constexpr std::size_t QUERY_COUNT {4};
+
+    // Layout, in pixels. Font pixels are SCALE across
+    constexpr float SCALE {2.f};
+    constexpr float MARGIN {8.f};
+    constexpr float PADDING {6.f};
+    constexpr float GLYPH_ADVANCE {4.f * SCALE};
+    constexpr float LINE_HEIGHT {7.f * SCALE};
+    constexpr float BAR_WIDTH {2.f};
+    constexpr float GRAPH_WIDTH {HISTORY * BAR_WIDTH};
+    constexpr float GRAPH_HEIGHT {64.f};
+
+    const float PERCENTILES[] {.5f, .95f, .99f};
+    constexpr std::size_t PERCENTILE_COUNT {sizeof(PERCENTILES) / sizeof(PERCENTILES[0])};
+
+    // Bytes in memory order, which is how the vertex attribute reads
+    // them, on the little-endian machines this runs on
+    constexpr std::uint32_t rgba(std::uint32_t r, std::uint32_t g, std::uint32_t b, std::uint32_t a) {
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+    constexpr std::uint32_t PANEL_COLOR {rgba(0, 0, 0, 170)};
+    constexpr std::uint32_t GRAPH_COLOR {rgba(40, 40, 40, 200)};
+    constexpr std::uint32_t TEXT_COLOR {rgba(230, 230, 230, 255)};
+    constexpr std::uint32_t CPU_COLOR {rgba(90, 160, 255, 255)};
+    constexpr std::uint32_t GPU_COLOR {rgba(110, 220, 110, 255)};
+    constexpr std::uint32_t OVER_BUDGET_COLOR {rgba(240, 70, 60, 255)};
+    constexpr std::uint32_t BUDGET_LINE_COLOR {rgba(255, 255, 255, 120)};
+
+    // 3x5 glyphs, a row to an octal digit from the top, the leftmost
+    // pixel in each digit's high bit. Lower case is drawn as upper
+    std::uint16_t getGlyph(char c) {
+        static const std::uint16_t LETTERS[26] {
+            025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 011152, 055655, 044447, 057755,
+            065555, 025552, 065644, 025563, 065655, 034216, 072222, 055557, 055552, 055775, 055255, 055222, 071247
+        };
+        static const std::uint16_t DIGITS[10] {
+            075557, 026227, 061247, 061216, 055711, 074616, 034652, 071222, 025252, 025316
+        };
+        if(c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if(c >= 'A' && c <= 'Z') return LETTERS[c - 'A'];
+        if(c >= '0' && c <= '9') return DIGITS[c - '0'];
+        switch(c) {
+            case '.': return 000002;
+            case ':': return 002020;
+            case '%': return 051245;
+            case '/': return 011244;
+            case '-': return 000700;
+            default: return 0;
+        }
+    }
+}
+
+void PerfHUD::History::push(float ms) {
+    if(mSamples.size() < HISTORY) mSamples.push_back(ms);
+    else mSamples[mNext] = ms;
+    mNext = (mNext + 1) % HISTORY;
+    mCount = mSamples.size();
+}
+
+float PerfHUD::History::latest() const {
+    if(mCount == 0) return 0.f;
+    return mSamples[(mNext + HISTORY - 1) % HISTORY];
+}
+
+PerfHUD::PerfHUD():
+    mShader {"shaders/hud.vs", "shaders/hud.fs"},
+    mQueries(QUERY_COUNT)
+{
+    glGenVertexArrays(1, &mVAO);
+    glGenBuffers(1, &mVBO);
+    glBindVertexArray(mVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, mPosition)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, mColor)));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    for(TimestampPair& pair: mQueries) glGenQueries(2, pair.mQueries);
+    mCPUTimes.mSamples.reserve(HISTORY);
+    mGPUTimes.mSamples.reserve(HISTORY);
+    mScratch.reserve(HISTORY);
+}
+
+PerfHUD::~PerfHUD() {
+    for(TimestampPair& pair: mQueries) glDeleteQueries(2, pair.mQueries);
+    glDeleteBuffers(1, &mVBO);
+    glDeleteVertexArrays(1, &mVAO);
+}
+
+bool PerfHUD::getBuildSuccess() {
+    return mShader.getBuildSuccess();
+}
+
+void PerfHUD::beginFrame() {
+    collectGPUTimes();
+    mFrameStart = SDL_GetPerformanceCounter();
+    mWaited = 0;
+
+    // Skip timing this frame on the GPU rather than wait, if every
+    // pair's still in flight
+    TimestampPair& pair { mQueries[mNextQuery] };
+    if(pair.mPending) return;
+    glQueryCounter(pair.mQueries[0], GL_TIMESTAMP);
+}
+
+void PerfHUD::beginWait() {
+    mWaitStart = SDL_GetPerformanceCounter();
+}
+
+void PerfHUD::endWait() {
+    mWaited += SDL_GetPerformanceCounter() - mWaitStart;
+}
+
+void PerfHUD::endFrame(const GLCallCounts& counts) {
+    std::uint64_t elapsed { SDL_GetPerformanceCounter() - mFrameStart - mWaited };
+    mCPUTimes.push(static_cast<float>(1000.0 * elapsed / SDL_GetPerformanceFrequency()));
+    mCounts = counts;
+
+    TimestampPair& pair { mQueries[mNextQuery] };
+    if(pair.mPending) return;
+    glQueryCounter(pair.mQueries[1], GL_TIMESTAMP);
+    pair.mPending = true;
+    mNextQuery = (mNextQuery + 1) % mQueries.size();
+}
+
+void PerfHUD::collectGPUTimes() {
+    // Oldest first; once one isn't back, none after it are either
+    for(std::size_t i {0}; i < mQueries.size(); ++i) {
+        TimestampPair& pair { mQueries[(mNextQuery + i) % mQueries.size()] };
+        if(!pair.mPending) continue;
+        GLint available {0};
+        glGetQueryObjectiv(pair.mQueries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) break;
+        GLuint64 begin {0}, end {0};
+        glGetQueryObjectui64v(pair.mQueries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(pair.mQueries[1], GL_QUERY_RESULT, &end);
+        pair.mPending = false;
+        mGPUTimes.push(static_cast<float>(end - begin) * 1e-6f);
+    }
+}
+
+void PerfHUD::getPercentiles(const History& history, const float* percentiles, float* results, std::size_t count) {
+    mScratch.assign(history.mSamples.begin(), history.mSamples.end());
+    std::sort(mScratch.begin(), mScratch.end());
+    for(std::size_t i {0}; i < count; ++i) {
+        if(mScratch.empty()) { results[i] = 0.f; continue; }
+        std::size_t rank { static_cast<std::size_t>(percentiles[i] * (mScratch.size() - 1) + .5f) };
+        results[i] = mScratch[rank];
+    }
+}
+
+void PerfHUD::addQuad(float left, float top, float right, float bottom, std::uint32_t color) {
+    mVertices.insert(mVertices.end(), {
+        Vertex { {left, top}, color }, Vertex { {left, bottom}, color }, Vertex { {right, bottom}, color },
+        Vertex { {left, top}, color }, Vertex { {right, bottom}, color }, Vertex { {right, top}, color }
+    });
+}
+
+void PerfHUD::addText(float left, float top, const char* text, std::uint32_t color) {
+    float x {left};
+    for(const char* c {text}; *c; ++c, x += GLYPH_ADVANCE) {
+        std::uint16_t glyph { getGlyph(*c) };
+        for(int row {0}; row < 5; ++row) {
+            int bits { (glyph >> (3 * (4 - row))) & 7 };
+            // A quad for each run of lit pixels along the row
+            for(int column {0}; column < 3; ++column) {
+                if(!(bits & (4 >> column))) continue;
+                int end {column};
+                while(end + 1 < 3 && (bits & (4 >> (end + 1)))) ++end;
+                addQuad(
+                    x + column * SCALE, top + row * SCALE,
+                    x + (end + 1) * SCALE, top + (row + 1) * SCALE,
+                    color
+                );
+                column = end;
+            }
+        }
+    }
+}
+
+void PerfHUD::addGraph(float left, float top, const History& history, std::uint32_t color) {
+    float bottom {top + GRAPH_HEIGHT};
+    addQuad(left, top, left + GRAPH_WIDTH, bottom, GRAPH_COLOR);
+    // Newest at the right
+    float range {2.f * mBudgetMs};
+    float x { left + GRAPH_WIDTH - history.mCount * BAR_WIDTH };
+    for(std::size_t i {0}; i < history.mCount; ++i, x += BAR_WIDTH) {
+        float ms { history.mSamples[(history.mNext + HISTORY - history.mCount + i) % HISTORY] };
+        float height { std::min(ms / range, 1.f) * GRAPH_HEIGHT };
+        addQuad(x, bottom - height, x + BAR_WIDTH, bottom, ms > mBudgetMs? OVER_BUDGET_COLOR: color);
+    }
+    float budget {top + GRAPH_HEIGHT * .5f};
+    addQuad(left, budget, left + GRAPH_WIDTH, budget + 1.f, BUDGET_LINE_COLOR);
+}
+
+void PerfHUD::draw(int width, int height) {
+    if(width <= 0 || height <= 0) return;
+
+    // Lines are put together in a buffer on the stack rather than in
+    // strings, so the overlay allocates nothing once warmed up
+    char line[128];
+    float results[PERCENTILE_COUNT] {};
+    mVertices.clear();
+    float left {MARGIN + PADDING};
+    float top {MARGIN + PADDING};
+    // The panel goes first, behind everything else: two graphs with
+    // a line over each, then three lines of counts
+    float panelBottom {top + 2.f * (LINE_HEIGHT + GRAPH_HEIGHT + PADDING) + 2.f * LINE_HEIGHT + 5.f * SCALE + PADDING};
+    addQuad(MARGIN, MARGIN, left + GRAPH_WIDTH + PADDING, panelBottom, PANEL_COLOR);
+
+    auto addTimes = [&](const char* label, const History& history, std::uint32_t color) {
+        getPercentiles(history, PERCENTILES, results, PERCENTILE_COUNT);
+        std::snprintf(
+            line, sizeof(line), "%s MS  NOW %.2f  P50 %.2f  P95 %.2f  P99 %.2f",
+            label, history.latest(), results[0], results[1], results[2]
+        );
+        addText(left, top, line, TEXT_COLOR);
+        top += LINE_HEIGHT;
+        addGraph(left, top, history, color);
+        top += GRAPH_HEIGHT + PADDING;
+    };
+    addTimes("CPU", mCPUTimes, CPU_COLOR);
+    addTimes("GPU", mGPUTimes, GPU_COLOR);
+
+    std::snprintf(
+        line, sizeof(line), "DRAWS %llu  TRIANGLES %llu",
+        static_cast<unsigned long long>(mCounts.mDrawCalls), static_cast<unsigned long long>(mCounts.mTriangles)
+    );
+    addText(left, top, line, TEXT_COLOR);
+    top += LINE_HEIGHT;
+    std::snprintf(
+        line, sizeof(line), "BINDS  PROGRAM %llu  VAO %llu  TEXTURE %llu",
+        static_cast<unsigned long long>(mCounts.mProgramBinds),
+        static_cast<unsigned long long>(mCounts.mVertexArrayBinds),
+        static_cast<unsigned long long>(mCounts.mTextureBinds)
+    );
+    addText(left, top, line, TEXT_COLOR);
+    top += LINE_HEIGHT;
+    std::snprintf(
+        line, sizeof(line), "UNIFORM UPLOADS %llu", static_cast<unsigned long long>(mCounts.mUniformUploads)
+    );
+    addText(left, top, line, TEXT_COLOR);
+
+    // Orphan the last frame's vertices rather than wait for the GPU
+    // to be done with them
+    glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+    if(mVertices.size() > mVBOCapacity) mVBOCapacity = mVertices.size() * 2;
+    glBufferData(GL_ARRAY_BUFFER, mVBOCapacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, mVertices.size() * sizeof(Vertex), mVertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLboolean depthTest { glIsEnabled(GL_DEPTH_TEST) };
+    GLboolean blend { glIsEnabled(GL_BLEND) };
+    GLint polygonMode[2] {GL_FILL, GL_FILL};
+    glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    // Plain GL from here on, so none of this is counted
+    glUseProgram(mShader.getProgramID());
+    glUniform2f(mShader.uniformLocation("screenSize"), static_cast<float>(width), static_cast<float>(height));
+    glBindVertexArray(mVAO);
+    glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(mVertices.size()));
+    glBindVertexArray(0);
+
+    if(depthTest) glEnable(GL_DEPTH_TEST);
+    if(!blend) glDisable(GL_BLEND);
+    glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+}
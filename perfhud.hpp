@@ -0,0 +1,107 @@
+#ifndef ZOPERFHUD_H
+#define ZOPERFHUD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "glcallcounts.hpp"
+
+/*
+On-screen performance overlay: rolling graphs of CPU and GPU frame
+times with their percentiles, and the last frame's draws, triangles,
+binds and uniform uploads as counted by the wrappers in
+glcallcounts.hpp.
+
+CPU time runs from beginFrame() to endFrame(), less any time spent
+waiting on the GPU for a frame slot. GPU time is between timestamps
+written at the same two points, read back a few frames later so
+nothing waits on them.
+
+Everything (panel, graphs, and text in a built-in 3x5 pixel font) is
+put into one vertex array and drawn with a single draw call, made
+with the plain GL calls, so the overlay stays out of its own counts
+*/
+class PerfHUD {
+public:
+    PerfHUD();
+    ~PerfHUD();
+
+    PerfHUD(const PerfHUD& other) = delete;
+    PerfHUD& operator=(const PerfHUD& other) = delete;
+
+    bool getBuildSuccess();
+
+    // Graphs are scaled to twice this, with a line across at it
+    void setBudget(float ms) { mBudgetMs = ms; }
+
+    // Start timing a frame; call before any of its GL work
+    void beginFrame();
+    // Bracket a wait for the GPU, left out of the frame's CPU time
+    void beginWait();
+    void endWait();
+    // Stop timing the frame, keeping counts as its GL calls. Call
+    // once everything but the overlay has been issued
+    void endFrame(const GLCallCounts& counts);
+
+    // Draw over the bound framebuffer, width x height pixels
+    void draw(int width, int height);
+
+private:
+    struct Vertex {
+        glm::vec2 mPosition; // pixels from the top left
+        std::uint32_t mColor; // RGBA, a byte each
+    };
+
+    struct TimestampPair {
+        GLuint mQueries[2] {0, 0};
+        bool mPending {false};
+    };
+
+    // Rolling history of frame times, in milliseconds, oldest at
+    // mNext once full
+    struct History {
+        std::vector<float> mSamples;
+        std::size_t mNext {0};
+        std::size_t mCount {0};
+
+        void push(float ms);
+        float latest() const;
+    };
+
+    void collectGPUTimes();
+
+    // Fill percentiles (0 to 1 each) of history into results
+    void getPercentiles(const History& history, const float* percentiles, float* results, std::size_t count);
+
+    void addQuad(float left, float top, float right, float bottom, std::uint32_t color);
+    void addText(float left, float top, const char* text, std::uint32_t color);
+    void addGraph(float left, float top, const History& history, std::uint32_t color);
+
+    Shader mShader;
+    GLuint mVAO {0};
+    GLuint mVBO {0};
+    std::size_t mVBOCapacity {0}; // vertices
+    std::vector<Vertex> mVertices;
+    std::vector<float> mScratch; // for percentiles
+
+    float mBudgetMs {1000.f / 60.f};
+
+    std::uint64_t mFrameStart {0};
+    std::uint64_t mWaitStart {0};
+    std::uint64_t mWaited {0};
+
+    // Timestamps in flight, oldest at mNextQuery
+    std::vector<TimestampPair> mQueries;
+    std::size_t mNextQuery {0};
+
+    History mCPUTimes;
+    History mGPUTimes;
+    GLCallCounts mCounts {};
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "profiler.hpp"
+
+#if ZO_PROFILING
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+// Events each thread can have recorded but not yet drained; must be
+// a power of two
+const std::uint64_t CPU_RING_SIZE {1 << 14};
+
+// Frames between issuing GPU queries and reading them back
+const std::size_t GPU_FRAME_LATENCY {4};
+
+// A capture stops growing past this many events
+const std::size_t MAX_CAPTURED_EVENTS {1 << 21};
+
+struct CPUEvent {
+    const char* mName;
+    std::uint64_t mBegin;
+    std::uint64_t mEnd;
+};
+
+// Single producer (the owning thread), single consumer (the GL
+// thread, in endFrame) ring of finished zones
+struct ThreadBuffer {
+    std::uint32_t mThreadID {0};
+    const char* mName {nullptr};
+    std::atomic<std::uint64_t> mHead {0};
+    std::atomic<std::uint64_t> mTail {0};
+    std::atomic<std::uint64_t> mDropped {0};
+    CPUEvent mEvents[CPU_RING_SIZE];
+};
+
+// CPU events are in ticks until the capture is written; GPU events
+// are already in nanoseconds on the steady clock
+struct CapturedEvent {
+    const char* mName;
+    std::uint64_t mBegin;
+    std::uint64_t mEnd;
+    std::uint32_t mThreadID;
+    bool mGPU;
+};
+
+struct GPUZone {
+    const char* mName;
+    GLuint mBeginQuery;
+    GLuint mEndQuery;
+};
+
+// Queries issued during one frame; reused GPU_FRAME_LATENCY frames
+// later
+struct GPUFrame {
+    std::vector<GLuint> mQueries;
+    std::vector<GPUZone> mZones;
+};
+
+// Buffers are owned here, not by their threads, so events survive
+// threads that exit before they're drained
+static std::mutex sRegistryMutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> sThreadBuffers;
+static thread_local ThreadBuffer* tThreadBuffer {nullptr};
+
+static std::vector<CapturedEvent> sCaptured;
+static GPUFrame sGPUFrames[GPU_FRAME_LATENCY];
+static std::size_t sGPUFrame {0};
+static std::int64_t sGPUClockOffset {0}; // steady clock minus GPU time, ns
+
+// Steady clock and tick readings at the start of the capture, for
+// converting ticks to time
+static std::uint64_t sCaptureStartNs {0};
+static std::uint64_t sCaptureStartTicks {0};
+
+static std::uint64_t steadyNanoseconds() {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count()
+    );
+}
+
+static ThreadBuffer* getThreadBuffer() {
+    if(!tThreadBuffer) {
+        std::lock_guard<std::mutex> lock { sRegistryMutex };
+        sThreadBuffers.push_back(std::make_unique<ThreadBuffer>());
+        tThreadBuffer = sThreadBuffers.back().get();
+        tThreadBuffer->mThreadID = static_cast<std::uint32_t>(sThreadBuffers.size());
+    }
+    return tThreadBuffer;
+}
+
+// Move every thread's finished zones into the capture, or throw
+// them away if there is none
+static void drainThreadBuffers(bool keep) {
+    std::lock_guard<std::mutex> lock { sRegistryMutex };
+    for(std::unique_ptr<ThreadBuffer>& buffer: sThreadBuffers) {
+        std::uint64_t tail { buffer->mTail.load(std::memory_order_relaxed) };
+        std::uint64_t head { buffer->mHead.load(std::memory_order_acquire) };
+        for(; keep && tail < head && sCaptured.size() < MAX_CAPTURED_EVENTS; ++tail) {
+            const CPUEvent& event { buffer->mEvents[tail & (CPU_RING_SIZE - 1)] };
+            sCaptured.push_back(CapturedEvent {
+                .mName { event.mName },
+                .mBegin { event.mBegin },
+                .mEnd { event.mEnd },
+                .mThreadID { buffer->mThreadID },
+                .mGPU { false }
+            });
+        }
+        buffer->mTail.store(head, std::memory_order_release);
+    }
+}
+
+// Read back a frame's GPU zones if all of them are ready, or if
+// wait is set. Results that aren't ready are dropped rather than
+// stalling on them
+static void collectGPUFrame(GPUFrame& frame, bool wait) {
+    if(frame.mZones.empty()) return;
+
+    GLuint available {GL_TRUE};
+    if(!wait)
+        glGetQueryObjectuiv(frame.mZones.back().mEndQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if(available && Profiler::isCapturing()) {
+        for(const GPUZone& zone: frame.mZones) {
+            GLuint64 begin {0}, end {0};
+            glGetQueryObjectui64v(zone.mBeginQuery, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(zone.mEndQuery, GL_QUERY_RESULT, &end);
+            if(sCaptured.size() >= MAX_CAPTURED_EVENTS) break;
+            sCaptured.push_back(CapturedEvent {
+                .mName { zone.mName },
+                .mBegin { static_cast<std::uint64_t>(static_cast<std::int64_t>(begin) + sGPUClockOffset) },
+                .mEnd { static_cast<std::uint64_t>(static_cast<std::int64_t>(end) + sGPUClockOffset) },
+                .mThreadID {0},
+                .mGPU { true }
+            });
+        }
+    }
+    frame.mZones.clear();
+}
+
+void Profiler::recordCPUZone(const char* name, std::uint64_t begin, std::uint64_t end) {
+    ThreadBuffer* buffer { getThreadBuffer() };
+    std::uint64_t head { buffer->mHead.load(std::memory_order_relaxed) };
+    if(head - buffer->mTail.load(std::memory_order_acquire) >= CPU_RING_SIZE) {
+        buffer->mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->mEvents[head & (CPU_RING_SIZE - 1)] = CPUEvent { name, begin, end };
+    buffer->mHead.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::setThreadName(const char* name) {
+    getThreadBuffer()->mName = name;
+}
+
+void Profiler::beginCapture() {
+    drainThreadBuffers(false);
+    for(GPUFrame& frame: sGPUFrames) frame.mZones.clear();
+    sCaptured.clear();
+
+    // Line the GPU's clock up with ours
+    GLint64 gpuNow {0};
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    sCaptureStartNs = steadyNanoseconds();
+    sCaptureStartTicks = ticks();
+    sGPUClockOffset = static_cast<std::int64_t>(sCaptureStartNs) - gpuNow;
+
+    sCapturing.store(true, std::memory_order_relaxed);
+}
+
+int Profiler::beginGPUZone(const char* name) {
+    if(!isCapturing()) return -1;
+
+    GPUFrame& frame { sGPUFrames[sGPUFrame] };
+    std::size_t zone { frame.mZones.size() };
+    while(frame.mQueries.size() < 2 * (zone + 1)) {
+        GLuint query {0};
+        glGenQueries(1, &query);
+        frame.mQueries.push_back(query);
+    }
+    frame.mZones.push_back(GPUZone {
+        .mName { name },
+        .mBeginQuery { frame.mQueries[2 * zone] },
+        .mEndQuery { frame.mQueries[2 * zone + 1] }
+    });
+    glQueryCounter(frame.mZones.back().mBeginQuery, GL_TIMESTAMP);
+    return static_cast<int>(zone);
+}
+
+void Profiler::endGPUZone(int zone) {
+    if(zone < 0) return;
+    GPUFrame& frame { sGPUFrames[sGPUFrame] };
+    // The capture was restarted while this zone was open
+    if(static_cast<std::size_t>(zone) >= frame.mZones.size()) return;
+    glQueryCounter(frame.mZones[zone].mEndQuery, GL_TIMESTAMP);
+}
+
+void Profiler::endFrame() {
+    drainThreadBuffers(isCapturing());
+
+    // The oldest frame's queries are about to be reused
+    sGPUFrame = (sGPUFrame + 1) % GPU_FRAME_LATENCY;
+    collectGPUFrame(sGPUFrames[sGPUFrame], false);
+}
+
+bool Profiler::endCapture(const char* path) {
+    drainThreadBuffers(true);
+    // Waiting is fine here; the capture's over
+    for(std::size_t i {1}; i <= GPU_FRAME_LATENCY; ++i) {
+        collectGPUFrame(sGPUFrames[(sGPUFrame + i) % GPU_FRAME_LATENCY], true);
+    }
+    sCapturing.store(false, std::memory_order_relaxed);
+
+    // Work out the tick rate over the capture, and bring CPU events
+    // into nanoseconds
+    std::uint64_t elapsedNs { steadyNanoseconds() - sCaptureStartNs };
+    std::uint64_t elapsedTicks { ticks() - sCaptureStartTicks };
+    double nsPerTick { elapsedTicks? static_cast<double>(elapsedNs) / elapsedTicks: 1.0 };
+    for(CapturedEvent& event: sCaptured) {
+        if(event.mGPU) continue;
+        event.mBegin = sCaptureStartNs + static_cast<std::uint64_t>((event.mBegin - sCaptureStartTicks) * nsPerTick);
+        event.mEnd = sCaptureStartNs + static_cast<std::uint64_t>((event.mEnd - sCaptureStartTicks) * nsPerTick);
+    }
+
+    std::uint64_t dropped {0};
+    {
+        std::lock_guard<std::mutex> lock { sRegistryMutex };
+        for(std::unique_ptr<ThreadBuffer>& buffer: sThreadBuffers)
+            dropped += buffer->mDropped.exchange(0, std::memory_order_relaxed);
+    }
+    if(dropped) std::cout << "ERROR::PROFILER::EVENTS_DROPPED " << dropped << std::endl;
+
+    std::ofstream trace {path};
+    if(!trace) {
+        std::cout << "ERROR::PROFILER::TRACE_NOT_WRITTEN " << path << std::endl;
+        return false;
+    }
+
+    // Timestamps are written in microseconds, relative to the first
+    // event
+    std::uint64_t origin { sCaptured.empty()? 0: sCaptured.front().mBegin };
+    for(const CapturedEvent& event: sCaptured) origin = std::min(origin, event.mBegin);
+
+    trace << std::fixed << std::setprecision(3);
+    trace << "{\"traceEvents\":[\n";
+    trace << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+    trace << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}}";
+    {
+        std::lock_guard<std::mutex> lock { sRegistryMutex };
+        for(std::unique_ptr<ThreadBuffer>& buffer: sThreadBuffers) {
+            if(!buffer->mName) continue;
+            trace << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->mThreadID
+                << ",\"args\":{\"name\":\"" << buffer->mName << "\"}}";
+        }
+    }
+    for(const CapturedEvent& event: sCaptured) {
+        trace << ",\n{\"name\":\"" << event.mName << "\",\"ph\":\"X\""
+            << ",\"pid\":" << (event.mGPU? 2: 1) << ",\"tid\":" << event.mThreadID
+            << ",\"ts\":" << (event.mBegin - origin) / 1000.0
+            << ",\"dur\":" << (event.mEnd - event.mBegin) / 1000.0 << "}";
+    }
+    trace << "\n]}\n";
+
+    std::cout << "Wrote " << sCaptured.size() << " profiler events to " << path << std::endl;
+    sCaptured.clear();
+    return static_cast<bool>(trace);
+}
+
+void Profiler::shutdown() {
+    sCapturing.store(false, std::memory_order_relaxed);
+    for(GPUFrame& frame: sGPUFrames) {
+        if(!frame.mQueries.empty())
+            glDeleteQueries(static_cast<GLsizei>(frame.mQueries.size()), &frame.mQueries[0]);
+        frame.mQueries.clear();
+        frame.mZones.clear();
+    }
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef ZOPROFILER_H
+#define ZOPROFILER_H
+
+#include <cstdint>
+#include <atomic>
+
+// The profiler is compiled in everywhere but release builds
+#if !defined(NDEBUG)
+#define ZO_PROFILING 1
+#else
+#define ZO_PROFILING 0
+#endif
+
+#if ZO_PROFILING
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ZO_PROFILE_TSC 1
+#else
+#include <chrono>
+#define ZO_PROFILE_TSC 0
+#endif
+
+/*
+Scoped CPU and GPU zone profiler. CPU zones are written by the thread
+that ran them into its own lock-free ring buffer, and drained once a
+frame by the GL thread. GPU zones are bracketed with timestamp queries
+whose results are only read back several frames later, once they're
+certain to be ready, so the CPU never waits on them. Everything
+recorded between beginCapture() and endCapture() is written out as
+Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+
+Use through the PROFILE_* macros below, which compile to nothing in
+release builds
+*/
+class Profiler {
+public:
+    static void beginCapture();
+    // Stop capturing and write the capture to path; false if the
+    // file couldn't be written
+    static bool endCapture(const char* path);
+    static bool isCapturing() { return sCapturing.load(std::memory_order_relaxed); }
+
+    // Label the calling thread in traces
+    static void setThreadName(const char* name);
+
+    // Drain thread buffers and collect GPU results that have become
+    // available. Call once per frame on the GL thread
+    static void endFrame();
+
+    // Release GL query objects; call before the context goes away
+    static void shutdown();
+
+    // Raw CPU timestamp. The time stamp counter is read directly
+    // where there is one, being several times cheaper than asking
+    // the OS; it's converted to real time when a capture is written
+    static std::uint64_t ticks() {
+#if ZO_PROFILE_TSC
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    static void recordCPUZone(const char* name, std::uint64_t begin, std::uint64_t end);
+    static int beginGPUZone(const char* name);
+    static void endGPUZone(int zone);
+
+private:
+    static inline std::atomic<bool> sCapturing {false};
+};
+
+class ScopedCPUZone {
+public:
+    // Names must be string literals, or otherwise outlive the capture
+    explicit ScopedCPUZone(const char* name):
+        mName {name},
+        mBegin { Profiler::isCapturing()? Profiler::ticks(): 0 }
+    {}
+    ~ScopedCPUZone() {
+        if(mBegin) Profiler::recordCPUZone(mName, mBegin, Profiler::ticks());
+    }
+
+    ScopedCPUZone(const ScopedCPUZone& other) = delete;
+    ScopedCPUZone& operator=(const ScopedCPUZone& other) = delete;
+
+private:
+    const char* mName;
+    std::uint64_t mBegin;
+};
+
+class ScopedGPUZone {
+public:
+    // GL thread only
+    explicit ScopedGPUZone(const char* name): mZone { Profiler::beginGPUZone(name) } {}
+    ~ScopedGPUZone() { Profiler::endGPUZone(mZone); }
+
+    ScopedGPUZone(const ScopedGPUZone& other) = delete;
+    ScopedGPUZone& operator=(const ScopedGPUZone& other) = delete;
+
+private:
+    int mZone;
+};
+
+#define ZO_PROFILE_CONCAT_INNER(a, b) a##b
+#define ZO_PROFILE_CONCAT(a, b) ZO_PROFILE_CONCAT_INNER(a, b)
+
+#define PROFILE_ZONE(name) ScopedCPUZone ZO_PROFILE_CONCAT(profileZone, __LINE__) {name}
+#define PROFILE_GPU_ZONE(name) ScopedGPUZone ZO_PROFILE_CONCAT(profileGPUZone, __LINE__) {name}
+#define PROFILE_THREAD_NAME(name) Profiler::setThreadName(name)
+#define PROFILE_END_FRAME() Profiler::endFrame()
+#define PROFILE_SHUTDOWN() Profiler::shutdown()
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#define PROFILE_THREAD_NAME(name)
+#define PROFILE_END_FRAME()
+#define PROFILE_SHUTDOWN()
+
+#endif
+
+#endif
@@ -1,6 +1,5 @@
+#include <cstdio>
 #include <string>
-#include <sstream>
-#include <fstream>
 #include <iostream>
 
 #include <GL/glew.h>
@@ -9,44 +8,33 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "assetfilesystem.hpp"
+#include "glcallcounts.hpp"
 #include "shader.hpp"
 
+// Defines have to follow the #version directive
+static std::string insertDefines(const std::string& code, const std::string& defines) {
+    if(defines.empty()) return code;
+    std::size_t versionEnd { code.find('\n') };
+    if(versionEnd == std::string::npos) return code + "\n" + defines + "\n";
+    return code.substr(0, versionEnd + 1) + defines + "\n" + code.substr(versionEnd + 1);
+}
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) :mBuildState{false} {
-    //Vertex and fragment shader file pointers and sources
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-
-    //Enable exceptions on filepointers
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-    bool readSuccess {true};
-
-    try {
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
-
-        // Read file buffer's contents into string stream
-        std::stringstream vShaderStream, fShaderStream;
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
-
-        //Close file handles
-        vShaderFile.close();
-        fShaderFile.close();
-
-        //convert stream into string
-        vertexCode = vShaderStream.str();
-        fragmentCode = fShaderStream.str();
-
-    } catch(std::ifstream::failure& e) {
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines) :mBuildState{false} {
+    //Read vertex and fragment shader sources, from an asset pack
+    //if one has them
+    AssetData vertexFile {};
+    AssetData fragmentFile {};
+    if(!readAsset(vertexPath, vertexFile) || !readAsset(fragmentPath, fragmentFile)) {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
-        readSuccess = false;
+        return;
     }
-    if(!readSuccess) return;
+    std::string vertexCode {
+        insertDefines(std::string {reinterpret_cast<const char*>(vertexFile.data()), vertexFile.size()}, defines)
+    };
+    std::string fragmentCode {
+        insertDefines(std::string {reinterpret_cast<const char*>(fragmentFile.data()), fragmentFile.size()}, defines)
+    };
 
     const char* vShaderCode = vertexCode.c_str();
     const char* fShaderCode = fragmentCode.c_str();
@@ -101,6 +89,18 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) :mBuildState{fa
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
+    //Per-draw transforms are read from ranges of a uniform buffer
+    GLuint drawBlock { glGetUniformBlockIndex(mID, "DrawBlock") };
+    if(drawBlock != GL_INVALID_INDEX) glUniformBlockBinding(mID, drawBlock, DRAW_DATA_BINDING);
+    GLint drawDataTexels { glGetUniformLocation(mID, "drawDataTexels") };
+    if(drawDataTexels != -1) {
+        GLint current {0};
+        glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+        counted::useProgram(mID);
+        counted::uniform1i(drawDataTexels, DRAW_DATA_UNIT);
+        counted::useProgram(static_cast<GLuint>(current));
+    }
+
     // Store build success
     mBuildState = true;
 }
@@ -109,23 +109,23 @@ Shader::~Shader() {
 }
 
 void Shader::use() {
-    glUseProgram(mID);
+    counted::useProgram(mID);
 }
 bool Shader::getBuildSuccess() { return mBuildState; }
 
-GLint Shader::attribLocation(const std::string& name) const {
-    return glGetAttribLocation(mID, name.c_str());
+GLint Shader::attribLocation(const char* name) const {
+    return glGetAttribLocation(mID, name);
 }
-GLint Shader::uniformLocation(const std::string& name) const {
-    return glGetUniformLocation(mID, name.c_str());
+GLint Shader::uniformLocation(const char* name) const {
+    return glGetUniformLocation(mID, name);
 }
-void Shader::enableAttribArray(const std::string& name) const {
+void Shader::enableAttribArray(const char* name) const {
     glEnableVertexAttribArray(attribLocation(name));
 }
-void Shader::disableAttribArray(const std::string& name) const {
+void Shader::disableAttribArray(const char* name) const {
     glDisableVertexAttribArray(attribLocation(name));
 }
-void Shader::setAttribPointerF(const std::string& name, int nComponents, int stride, int offset) const {
+void Shader::setAttribPointerF(const char* name, int nComponents, int stride, int offset) const {
     glVertexAttribPointer(
         attribLocation(name),
         nComponents, // number of components per elements
@@ -136,40 +136,47 @@ void Shader::setAttribPointerF(const std::string& name, int nComponents, int str
     );
 }
 
-void Shader::setBool(const std::string& name, bool value) const {
-    glUniform1i(
+void Shader::setBool(const char* name, bool value) const {
+    counted::uniform1i(
         uniformLocation(name),
         static_cast<GLint>(value)
     );
 }
-void Shader::setInt(const std::string& name, int value) const {
-    glUniform1i(
+void Shader::setInt(const char* name, int value) const {
+    counted::uniform1i(
         uniformLocation(name),
         static_cast<GLint>(value)
     );
 }
-void Shader::setFloat(const std::string& name, float value) const {
-    glUniform1f(
+void Shader::setFloat(const char* name, float value) const {
+    counted::uniform1f(
         uniformLocation(name),
         static_cast<GLfloat>(value)
     );
 }
-void Shader::setVec3(const std::string& name, const glm::vec3& value) const {
-    glUniform3fv(
+void Shader::setVec2(const char* name, const glm::vec2& value) const {
+    counted::uniform2fv(
+        uniformLocation(name),
+        1,
+        glm::value_ptr(value)
+    );
+}
+void Shader::setVec3(const char* name, const glm::vec3& value) const {
+    counted::uniform3fv(
         uniformLocation(name),
         1,
         glm::value_ptr(value)
     );
 }
-void Shader::setVec4(const std::string& name, const glm::vec4& value) const {
-    glUniform4fv(
+void Shader::setVec4(const char* name, const glm::vec4& value) const {
+    counted::uniform4fv(
         uniformLocation(name),
         1,
         glm::value_ptr(value)
     );
 }
-void Shader::setMat4(const std::string& name, const glm::mat4& value) const {
-    glUniformMatrix4fv(
+void Shader::setMat4(const char* name, const glm::mat4& value) const {
+    counted::uniformMatrix4fv(
         uniformLocation(name),
         1,
         GL_FALSE,
@@ -177,21 +184,28 @@ void Shader::setMat4(const std::string& name, const glm::mat4& value) const {
     );
 }
 
-void Shader::setLight(const std::string& name, const Light& light) const {
+void Shader::setLight(const char* name, const Light& light) const {
+    //Member names are built on the stack; this runs every frame
+    char member[MAX_UNIFORM_NAME];
+    auto memberName = [&](const char* field) {
+        std::snprintf(member, sizeof(member), "%s.%s", name, field);
+        return member;
+    };
+
     //basic light attributes
-    setInt(name + ".type", light.mType);
-    setVec3(name + ".position", light.mPosition);
-    setVec3(name + ".direction", light.mDirection);
-    setVec3(name + ".diffuse", light.mDiffuse);
-    setVec3(name + ".specular", light.mSpecular);
-    setVec3(name + ".ambient", light.mAmbient);
+    setInt(memberName("type"), light.mType);
+    setVec3(memberName("position"), light.mPosition);
+    setVec3(memberName("direction"), light.mDirection);
+    setVec3(memberName("diffuse"), light.mDiffuse);
+    setVec3(memberName("specular"), light.mSpecular);
+    setVec3(memberName("ambient"), light.mAmbient);
 
     //attenuation related attributes
-    setFloat(name + ".constant", light.mConstant);
-    setFloat(name  + ".linear", light.mLinear);
-    setFloat(name + ".quadratic", light.mQuadratic);
+    setFloat(memberName("constant"), light.mConstant);
+    setFloat(memberName("linear"), light.mLinear);
+    setFloat(memberName("quadratic"), light.mQuadratic);
 
     //spotlight attributes
-    setFloat(name + ".cosCutoffInner", light.mCosCutoffInner);
-    setFloat(name + ".cosCutoffOuter", light.mCosCutoffOuter);
+    setFloat(memberName("cosCutoffInner"), light.mCosCutoffInner);
+    setFloat(memberName("cosCutoffOuter"), light.mCosCutoffOuter);
 }
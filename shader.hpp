@@ -1,6 +1,7 @@
 #ifndef ZOSHADER_H
 #define ZOSHADER_H
 
+#include <cstddef>
 #include <string>
 #include <map>
 
@@ -8,10 +9,23 @@
 
 #include "light.hpp"
 
+// Uniform block binding points, set up for every program that
+// declares the block
+const GLuint DRAW_DATA_BINDING {0}; // DrawBlock: model, normalMat
+// Texture unit the same draw data is read from as texels, by
+// instanced draws after their first instance (drawDataTexels)
+const GLint DRAW_DATA_UNIT {12};
+
+// Room for uniform names put together at run time ("lights[3].position"),
+// which are built in buffers on the stack rather than in strings
+const std::size_t MAX_UNIFORM_NAME {64};
+
 class Shader {
 public:
-    // Constructor, reads and builds shader
-    Shader(const char* vertexPath, const char* fragmentPath);
+    // Constructor, reads and builds shader. Any defines given (one
+    // "#define NAME" per line) are inserted into both stages right
+    // after their #version line, for building variants of one source
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines="");
     ~Shader();
 
     //use/activate this shader
@@ -19,20 +33,21 @@ public:
     bool getBuildSuccess();
 
     //utility attrib array functions
-    GLint attribLocation(const std::string& name) const;
-    void enableAttribArray(const std::string& name) const;
-    void disableAttribArray(const std::string& name) const;
-    void setAttribPointerF(const std::string& name, int nComponents, int stride, int offset) const;
+    GLint attribLocation(const char* name) const;
+    void enableAttribArray(const char* name) const;
+    void disableAttribArray(const char* name) const;
+    void setAttribPointerF(const char* name, int nComponents, int stride, int offset) const;
 
     //utility uniform functions
-    GLint uniformLocation(const std::string& name) const;
-    void setBool(const std::string& name, bool value) const;
-    void setInt(const std::string& name, int value) const;
-    void setFloat(const std::string& name, float value) const;
-    void setVec3(const std::string& name, const glm::vec3& value) const;
-    void setVec4(const std::string& name, const glm::vec4& value) const;
-    void setMat4(const std::string& name, const glm::mat4& value) const;
-    void setLight(const std::string& name, const Light& light) const;
+    GLint uniformLocation(const char* name) const;
+    void setBool(const char* name, bool value) const;
+    void setInt(const char* name, int value) const;
+    void setFloat(const char* name, float value) const;
+    void setVec2(const char* name, const glm::vec2& value) const;
+    void setVec3(const char* name, const glm::vec3& value) const;
+    void setVec4(const char* name, const glm::vec4& value) const;
+    void setMat4(const char* name, const glm::mat4& value) const;
+    void setLight(const char* name, const Light& light) const;
 
     GLuint getProgramID() { return mID; }
 
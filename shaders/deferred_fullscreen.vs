@@ -0,0 +1,16 @@
+#version 330 core
+
+// Covers the screen with a single triangle, once per directional
+// light; vertices come from gl_VertexID, so no buffers are needed
+
+uniform usamplerBuffer lightIndices;
+
+flat out uint LightIndex;
+
+void main() {
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+
+    // Directional lights come first in the index buffer
+    LightIndex = texelFetch(lightIndices, gl_InstanceID).r;
+}
@@ -0,0 +1,177 @@
+#version 330 core
+
+struct Light {
+    // 0 - directional
+    // 1 - point
+    // 2 - spot
+    int type; 
+
+    //basic light properties
+    vec3 position;
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    // attenuation properties
+    float constant;
+    float linear;
+    float quadratic;
+
+    // spotlight properties
+    float cosCutoffOuter;
+    float cosCutoffInner;
+
+    // see calculateShadow
+    int shadowSlot;
+};
+
+// G-buffer
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+// Light properties, 6 texels per light (see LightClusters::upload)
+uniform samplerBuffer lightData;
+
+// Must match the limits in shadowmaps.hpp
+#define SHADOW_CASCADES 4
+#define MAX_SPOT_SHADOWS 16
+
+// Shadow maps. A light's shadowSlot is 0 for the cascades, n + 1 for
+// spot shadow n, or -1 if it casts none
+uniform sampler2DArrayShadow cascadeShadowMap;
+uniform mat4 cascadeMatrices[SHADOW_CASCADES];
+uniform float cascadeFarDepths[SHADOW_CASCADES];
+uniform sampler2DShadow spotShadowAtlas;
+uniform mat4 spotShadowMatrices[MAX_SPOT_SHADOWS];
+
+uniform mat4 view;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+uniform vec3 eyePos;
+
+flat in uint LightIndex;
+
+out vec4 outColor;
+
+vec3 calculateLight(Light light, vec3 fragPos, vec3 normal, vec3 eyeDir, vec3 txtrColor, vec3 specColor, float shadow);
+float calculateShadow(int slot, vec3 fragPos, vec3 norm, float viewDepth);
+Light fetchLight(uint index);
+vec3 decodeOctahedral(vec2 e);
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    float depth = texture(gDepth, uv).r;
+
+    // Nothing was drawn here
+    if(depth == 1.0) discard;
+
+    // Rebuild the world position from depth
+    vec4 clipPos = vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec4 worldPos = inverseViewProjection * clipPos;
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+
+    vec4 albedoSpecular = texture(gAlbedoSpecular, uv);
+    vec3 norm = decodeOctahedral(texture(gNormal, uv).rg);
+    vec3 eyeDir = normalize(eyePos - fragPos);
+
+    Light light = fetchLight(LightIndex);
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    float shadow = calculateShadow(light.shadowSlot, fragPos, norm, viewDepth);
+    outColor = vec4(
+        calculateLight(light, fragPos, norm, eyeDir, albedoSpecular.rgb, vec3(albedoSpecular.a), shadow),
+        1.0
+    );
+}
+
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return normalize(n);
+}
+
+Light fetchLight(uint index) {
+    int base = int(index) * 6;
+    vec4 positionType = texelFetch(lightData, base);
+    vec4 direction = texelFetch(lightData, base + 1);
+    vec4 diffuseConstant = texelFetch(lightData, base + 2);
+    vec4 specularLinear = texelFetch(lightData, base + 3);
+    vec4 ambientQuadratic = texelFetch(lightData, base + 4);
+    vec4 cutoffs = texelFetch(lightData, base + 5);
+
+    Light light;
+    light.type = int(positionType.w);
+    light.position = positionType.xyz;
+    light.direction = direction.xyz;
+    light.diffuse = diffuseConstant.rgb;
+    light.constant = diffuseConstant.w;
+    light.specular = specularLinear.rgb;
+    light.linear = specularLinear.w;
+    light.ambient = ambientQuadratic.rgb;
+    light.quadratic = ambientQuadratic.w;
+    light.cosCutoffInner = cutoffs.x;
+    light.cosCutoffOuter = cutoffs.y;
+    light.shadowSlot = int(cutoffs.z);
+    return light;
+}
+
+// Same lighting model as object_fragment.fs, with the fragment's
+// position passed in rather than interpolated
+vec3 calculateLight(Light light, vec3 fragPos, vec3 norm, vec3 eyeDir, vec3 txtrColor, vec3 specColor, float shadow) {
+    vec3 incidentRay = normalize(fragPos - light.position);
+    vec3 lightDir = normalize(light.direction);
+
+    if(light.type == 0) { 
+        incidentRay = lightDir;
+    }
+
+    vec3 ambient = txtrColor * light.ambient;
+    vec3 diffuse = max(dot(norm, -incidentRay), 0.0) * txtrColor * light.diffuse;
+
+    vec3 reflectionDir = incidentRay - 2 * dot(incidentRay, norm) * norm;
+    vec3 specular = pow(max(dot(reflectionDir, eyeDir), 0.0), 32) * specColor * light.specular;
+
+    float attenuation = 1.0;
+    if(light.type == 1 || light.type == 2){
+        float dist = length(light.position - fragPos);
+        attenuation = 1.0 /
+            (light.constant + light.linear * dist
+            + light.quadratic * (dist*dist));
+    }
+
+    float spotIntensity = 1.0;
+    if(light.type == 2){
+        float cosTheta = dot(incidentRay, lightDir);
+        spotIntensity = clamp(
+            (cosTheta - light.cosCutoffOuter) / (light.cosCutoffInner - light.cosCutoffOuter),
+            0.0, 1.0
+        );
+    }
+
+    return (ambient + (diffuse + specular) * spotIntensity * shadow) * attenuation;
+}
+
+float calculateShadow(int slot, vec3 fragPos, vec3 norm, float viewDepth) {
+    if(slot < 0) return 1.0;
+
+    // Look up a point nudged off the surface, against acne
+    vec4 position = vec4(fragPos + norm * 0.02, 1.0);
+    if(slot == 0) {
+        for(int i = 0; i < SHADOW_CASCADES; i++) {
+            if(viewDepth <= cascadeFarDepths[i]) {
+                vec3 coord = (cascadeMatrices[i] * position).xyz;
+                return texture(cascadeShadowMap, vec4(coord.xy, float(i), coord.z));
+            }
+        }
+        // Past the last cascade
+        return 1.0;
+    }
+
+    vec4 coord = spotShadowMatrices[slot - 1] * position;
+    if(coord.w <= 0.0) return 1.0;
+    return texture(spotShadowAtlas, coord.xyz / coord.w);
+}
@@ -0,0 +1,19 @@
+#version 330 core
+
+// Places a unit sphere around each point or spot light, scaled to
+// the light's range
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec4 lightVolume; // centre (xyz), range (w)
+layout(location = 2) in uint lightIndex;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+flat out uint LightIndex;
+
+void main() {
+    vec3 worldPosition = lightVolume.xyz + position * lightVolume.w;
+    gl_Position = projection * view * vec4(worldPosition, 1.0);
+    LightIndex = lightIndex;
+}
@@ -0,0 +1,21 @@
+#version 330 core
+
+// Depth pre-pass fragment shader. Opaque geometry writes depth and
+// nothing else; built with ALPHA_TEST, texels below the object
+// shader's alpha threshold are cut out instead
+
+#ifdef ALPHA_TEST
+struct Material {
+    sampler2D texture_diffuse1;
+};
+
+uniform Material material;
+
+in vec2 TextureCoord;
+#endif
+
+void main() {
+#ifdef ALPHA_TEST
+    if(texture(material.texture_diffuse1, TextureCoord).a < 0.1) discard;
+#endif
+}
@@ -0,0 +1,66 @@
+#version 330 core
+
+// Depth pre-pass vertex shader; only what's needed to place the
+// vertex and, for alpha tested materials, look up its texture
+
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 textureCoord;
+
+// Per-draw transforms, bound from this frame's stream buffer
+layout(std140) uniform DrawBlock {
+    mat4 model;
+    mat4 normalMat;
+    ivec4 skin; // see vertex.vs
+};
+uniform mat4 view;
+uniform mat4 projection;
+
+// Later instances' model matrices, from the stream buffer as texels
+uniform samplerBuffer drawDataTexels;
+
+#ifdef SKINNING
+// Up to 4 bones per vertex, by index into the draw's bones, with
+// weights summing to 1
+layout(location = 4) in uvec4 joints;
+layout(location = 5) in vec4 weights;
+
+// Bone matrices as 3 texels each, the top rows of the matrix; see
+// animation.hpp
+uniform samplerBuffer bonePalette;
+
+// The weighted sum of the vertex's bone matrices, rows as columns
+mat3x4 skinMatrix() {
+    mat3x4 rows = mat3x4(0.0);
+    for(int i = 0; i < 4; ++i) {
+        int texel = skin.x + int(joints[i]) * 3;
+        rows[0] += weights[i] * texelFetch(bonePalette, texel);
+        rows[1] += weights[i] * texelFetch(bonePalette, texel + 1);
+        rows[2] += weights[i] * texelFetch(bonePalette, texel + 2);
+    }
+    return rows;
+}
+
+vec3 skinPoint(mat3x4 rows, vec4 point) {
+    return vec3(dot(rows[0], point), dot(rows[1], point), dot(rows[2], point));
+}
+#endif
+
+out vec2 TextureCoord;
+
+void main() {
+    mat4 drawModel = model;
+    if(gl_InstanceID > 0) {
+        int texel = skin.z + gl_InstanceID * skin.w;
+        drawModel = mat4(
+            texelFetch(drawDataTexels, texel), texelFetch(drawDataTexels, texel + 1),
+            texelFetch(drawDataTexels, texel + 2), texelFetch(drawDataTexels, texel + 3)
+        );
+    }
+
+    vec3 modelPosition = position;
+#ifdef SKINNING
+    if(skin.y > 0) modelPosition = skinPoint(skinMatrix(), vec4(position, 1.0));
+#endif
+    gl_Position = projection * view * drawModel * vec4(modelPosition, 1.0);
+    TextureCoord = textureCoord;
+}
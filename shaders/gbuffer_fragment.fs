@@ -0,0 +1,198 @@
+#version 330 core
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+};
+
+uniform Material material;
+
+#ifdef IMPOSTOR
+// Impostor atlases (see impostor.hpp). The material's diffuse map is
+// the albedo atlas and its specular map the normal atlas
+uniform sampler2D impostorDepth;
+uniform vec3 impostorCenter;
+uniform float impostorRadius;
+uniform float impostorFrames;
+uniform mat4 view;
+uniform mat4 projection;
+#endif
+
+#ifdef VIRTUAL_TEXTURING
+// Must match VirtualTextureCache in virtualtexture.hpp
+#define VT_TILE_SIZE 128.0
+#define VT_TILE_BORDER 4.0
+#define VT_PAGE_SIZE 136.0
+
+// Pages of virtual textures; the material's diffuse map is the
+// texture's indirection table instead of its texels
+uniform sampler2D vtAtlas;
+uniform float vtPagesPerSide;
+#endif
+
+#ifdef IMPOSTOR
+// See impostor.vs
+in vec3 BillboardPos;
+in vec3 ToEye;
+in vec3 ImpostorRay;
+flat in vec3 ImpostorEye;
+flat in vec2 ImpostorFrame;
+flat in vec2 ImpostorBlend;
+flat in mat3 ImpostorBasis;
+flat in float ImpostorScale;
+// Where on the model's surface this fragment is; set by
+// sampleImpostor
+vec3 FragPos = vec3(0.0);
+#else
+in vec3 Color;
+in vec2 TextureCoord;
+in vec3 FragPos;
+in vec3 Normal;
+#endif
+
+layout(location = 0) out vec4 gAlbedoSpecular;
+layout(location = 1) out vec2 gNormal;
+
+/*
+Maps a unit vector onto the octahedron's unfolded square, so that a
+normal fits in two channels
+*/
+vec2 encodeOctahedral(vec3 n);
+
+#ifdef VIRTUAL_TEXTURING
+/*
+Samples a virtual texture through its indirection table, from the
+finest level of it that's resident
+*/
+vec4 sampleVirtual(sampler2D indirection, vec2 uv);
+#endif
+
+#ifdef IMPOSTOR
+/*
+Blends the impostor frames nearest the view direction into this
+fragment's colour, normal and specular, and moves the fragment onto
+the model's surface: FragPos and depth both
+*/
+vec4 sampleImpostor(out vec3 norm, out vec3 specColor);
+#endif
+
+void main() {
+#ifdef IMPOSTOR
+    vec3 norm;
+    vec3 specColor;
+    vec4 txtrColor = sampleImpostor(norm, specColor);
+    if(txtrColor.a < 0.1) discard;
+#else
+    vec3 norm = normalize(Normal);
+#ifdef VIRTUAL_TEXTURING
+    vec4 txtrColor = sampleVirtual(material.texture_diffuse1, TextureCoord);
+#else
+    vec4 txtrColor = texture(material.texture_diffuse1, TextureCoord);
+#endif
+    if(txtrColor.a < 0.1) discard;
+    vec3 specColor = vec3(texture(material.texture_specular1, TextureCoord));
+#endif
+
+    // Specular maps are stored as a single intensity
+    float specular = dot(specColor, vec3(1.0 / 3.0));
+
+    gAlbedoSpecular = vec4(txtrColor.rgb, specular);
+    gNormal = encodeOctahedral(norm);
+}
+
+vec2 encodeOctahedral(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if(n.z < 0.0) {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * signs;
+    }
+    return n.xy;
+}
+
+#ifdef VIRTUAL_TEXTURING
+vec4 sampleVirtual(sampler2D indirection, vec2 uv) {
+    int tiles = textureSize(indirection, 0).x;
+    int maxLevel = int(round(log2(float(tiles))));
+
+    // The level wanted, going by how many level 0 texels a pixel spans
+    vec2 texel = uv * (float(tiles) * VT_TILE_SIZE);
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    int level = clamp(int(floor(lod)), 0, maxLevel);
+
+    // The page that tile, or the nearest resident ancestor, is in
+    vec2 wrapped = fract(uv);
+    int levelTiles = tiles >> level;
+    ivec2 tile = min(ivec2(wrapped * float(levelTiles)), ivec2(levelTiles - 1));
+    vec4 entry = floor(texelFetch(indirection, tile, level) * 255.0 + 0.5);
+
+    vec2 inTile = fract(wrapped * float(tiles >> int(entry.b)));
+    vec2 atlasTexel = entry.rg * VT_PAGE_SIZE + VT_TILE_BORDER + inTile * VT_TILE_SIZE;
+    return textureLod(vtAtlas, atlasTexel / (vtPagesPerSide * VT_PAGE_SIZE), 0.0);
+}
+#endif
+
+#ifdef IMPOSTOR
+vec3 decodeHemiOctahedral(vec2 e) {
+    vec3 d = vec3(e.x + e.y, 0.0, e.x - e.y) * 0.5;
+    d.y = 1.0 - abs(d.x) - abs(d.z);
+    return normalize(d);
+}
+
+// Adds in what one frame shows where the ray through this fragment
+// crosses that frame's plane, weighted by its coverage there
+void sampleImpostorFrame(vec2 frame, float weight, inout vec4 albedo, inout vec4 normal, inout float height) {
+    // The same axes ImpostorCache::bakeFrames looked along
+    vec3 dir = decodeHemiOctahedral(frame / (impostorFrames - 1.0) * 2.0 - 1.0);
+    vec3 right = normalize(cross(abs(dir.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0), dir));
+    vec3 up = cross(dir, right);
+
+    // Where the ray crosses the frame's plane, then, going by the
+    // depth there, where it crosses the surface it would have hit
+    vec3 ray = normalize(ImpostorRay);
+    float facing = min(dot(ray, dir), -1e-3);
+    float surfaceHeight = 0.0;
+    vec2 uv;
+    vec2 atlasCoord;
+    for(int i = 0; i < 2; i++) {
+        vec3 onPlane = ImpostorEye + ray * (dot(impostorCenter + dir * surfaceHeight - ImpostorEye, dir) / facing) - impostorCenter;
+        uv = vec2(dot(onPlane, right), dot(onPlane, up)) / (2.0 * impostorRadius) + 0.5;
+        atlasCoord = (frame + clamp(uv, 0.0, 1.0)) / impostorFrames;
+        // Where the frame's empty, there's nothing to move to
+        float depth = texture(impostorDepth, atlasCoord).r;
+        surfaceHeight = depth < 1.0 ? (0.5 - depth) * 2.0 * impostorRadius : surfaceHeight;
+    }
+    // Sampled regardless, so derivatives stay sound, but only
+    // counted inside the frame
+    weight *= step(0.0, uv.x) * step(uv.x, 1.0) * step(0.0, uv.y) * step(uv.y, 1.0);
+
+    vec4 texel = texture(material.texture_diffuse1, atlasCoord);
+    float coverage = texel.a * weight;
+    albedo += vec4(texel.rgb, 1.0) * coverage;
+    normal += texture(material.texture_specular1, atlasCoord) * coverage;
+    height += surfaceHeight * coverage;
+}
+
+vec4 sampleImpostor(out vec3 norm, out vec3 specColor) {
+    vec4 albedo = vec4(0.0);
+    vec4 normal = vec4(0.0);
+    float height = 0.0;
+    vec2 blend = ImpostorBlend;
+    sampleImpostorFrame(ImpostorFrame, (1.0 - blend.x) * (1.0 - blend.y), albedo, normal, height);
+    sampleImpostorFrame(ImpostorFrame + vec2(1.0, 0.0), blend.x * (1.0 - blend.y), albedo, normal, height);
+    sampleImpostorFrame(ImpostorFrame + vec2(0.0, 1.0), (1.0 - blend.x) * blend.y, albedo, normal, height);
+    sampleImpostorFrame(ImpostorFrame + vec2(1.0, 1.0), blend.x * blend.y, albedo, normal, height);
+
+    float coverage = max(albedo.a, 1e-4);
+    norm = normalize(ImpostorBasis * (normal.rgb / coverage * 2.0 - 1.0));
+    specColor = vec3(normal.a / coverage);
+
+    // The depth atlas has the surface in front of (or behind) the
+    // frame's plane by this much
+    FragPos = BillboardPos + normalize(ToEye) * (height / coverage * ImpostorScale);
+    vec4 clipPos = projection * view * vec4(FragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+    return vec4(albedo.rgb / coverage, albedo.a);
+}
+#endif
@@ -0,0 +1,69 @@
+#version 330 core
+
+// Impostor billboards (see impostor.hpp). Each instance is one quad,
+// turned to face the camera and big enough to cover the model's
+// bounding sphere; the fragment shader, built with IMPOSTOR defined,
+// works out what's on it from the frames baked nearest the direction
+// the model is seen from
+
+layout(location = 0) in vec2 corner; // (-1, -1) to (1, 1)
+// Per instance: rotation, uniform scale and translation only
+layout(location = 4) in mat4 instanceModel;
+
+uniform mat4 view;
+uniform mat4 projection;
+// Model space sphere the frames were baked around
+uniform vec3 impostorCenter;
+uniform float impostorRadius;
+// Frames along each side of the atlases
+uniform float impostorFrames;
+
+// World space, on the billboard, and from there to the eye
+out vec3 BillboardPos;
+out vec3 ToEye;
+// Model space, from the eye through the billboard
+out vec3 ImpostorRay;
+flat out vec3 ImpostorEye;
+// The frame at the bottom left of the four blended, and how far
+// towards the others the view direction is
+flat out vec2 ImpostorFrame;
+flat out vec2 ImpostorBlend;
+// Model to world rotation, and the instance's scale
+flat out mat3 ImpostorBasis;
+flat out float ImpostorScale;
+
+/*
+Maps a direction in the upper hemisphere onto the [-1, 1] square
+*/
+vec2 encodeHemiOctahedral(vec3 d);
+
+void main() {
+    mat3 basis = mat3(instanceModel);
+    float scale = length(basis[0]);
+    vec3 center = vec3(instanceModel * vec4(impostorCenter, 1.0));
+
+    // The camera's axes and position, out of the view matrix
+    mat3 cameraBasis = transpose(mat3(view));
+    vec3 eye = -(cameraBasis * view[3].xyz);
+    BillboardPos = center + (cameraBasis[0] * corner.x + cameraBasis[1] * corner.y) * (impostorRadius * scale);
+    ToEye = eye - BillboardPos;
+    gl_Position = projection * view * vec4(BillboardPos, 1.0);
+
+    mat3 toModel = transpose(basis) / (scale * scale);
+    ImpostorEye = toModel * (eye - instanceModel[3].xyz);
+    ImpostorRay = toModel * (BillboardPos - eye);
+
+    // Seen from below, the frames along the horizon are closest
+    vec3 seenFrom = ImpostorEye - impostorCenter;
+    seenFrom.y = max(seenFrom.y, 0.0);
+    vec2 grid = (encodeHemiOctahedral(seenFrom + vec3(0.0, 1e-6, 0.0)) * 0.5 + 0.5) * (impostorFrames - 1.0);
+    ImpostorFrame = min(floor(grid), vec2(impostorFrames - 2.0));
+    ImpostorBlend = grid - ImpostorFrame;
+    ImpostorBasis = basis;
+    ImpostorScale = scale;
+}
+
+vec2 encodeHemiOctahedral(vec3 d) {
+    d /= abs(d.x) + abs(d.y) + abs(d.z);
+    return vec2(d.x + d.z, d.x - d.z);
+}
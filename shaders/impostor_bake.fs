@@ -0,0 +1,30 @@
+#version 330 core
+
+// Impostor baking (see impostor.hpp). Writes one frame of a model's
+// atlases: its colour, and its model space normal with specular
+// intensity. Depth is the frame's depth buffer
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+};
+
+uniform Material material;
+
+in vec3 Color;
+in vec2 TextureCoord;
+in vec3 FragPos;
+in vec3 Normal;
+
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec4 normalSpecular;
+
+void main() {
+    vec4 txtrColor = texture(material.texture_diffuse1, TextureCoord);
+    if(txtrColor.a < 0.1) discard;
+    vec3 specColor = vec3(texture(material.texture_specular1, TextureCoord));
+
+    // Alpha is coverage, so frames blended together don't fade
+    albedo = vec4(txtrColor.rgb, 1.0);
+    normalSpecular = vec4(normalize(Normal) * 0.5 + 0.5, dot(specColor, vec3(1.0 / 3.0)));
+}
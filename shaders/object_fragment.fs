@@ -33,20 +33,88 @@ struct Light {
     // spotlight properties
     float cosCutoffOuter;
     float cosCutoffInner;
+
+    // see calculateShadow
+    int shadowSlot;
 };
 
-#define NR_LIGHTS 6
-uniform Light lights[NR_LIGHTS];
+// Must match the cluster grid dimensions in clusteredlighting.hpp
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+
+// Light properties, 6 texels per light (see LightClusters::upload)
+uniform samplerBuffer lightData;
+// Per cluster offset into lightIndices, and light count
+uniform usamplerBuffer lightGrid;
+// Directional light indices, followed by every cluster's light list
+uniform usamplerBuffer lightIndices;
+uniform int nDirectionalLights;
+
+// Must match the limits in shadowmaps.hpp
+#define SHADOW_CASCADES 4
+#define MAX_SPOT_SHADOWS 16
+
+// Shadow maps. A light's shadowSlot is 0 for the cascades, n + 1 for
+// spot shadow n, or -1 if it casts none
+uniform sampler2DArrayShadow cascadeShadowMap;
+uniform mat4 cascadeMatrices[SHADOW_CASCADES];
+uniform float cascadeFarDepths[SHADOW_CASCADES];
+uniform sampler2DShadow spotShadowAtlas;
+uniform mat4 spotShadowMatrices[MAX_SPOT_SHADOWS];
+
+// Maps a fragment to its cluster
+uniform float clusterScale;
+uniform float clusterBias;
+uniform vec2 clusterTileSize;
+uniform mat4 view;
+
+#ifdef VIRTUAL_TEXTURING
+// Must match VirtualTextureCache in virtualtexture.hpp
+#define VT_TILE_SIZE 128.0
+#define VT_TILE_BORDER 4.0
+#define VT_PAGE_SIZE 136.0
+
+// Pages of virtual textures; the material's diffuse map is the
+// texture's indirection table instead of its texels
+uniform sampler2D vtAtlas;
+uniform float vtPagesPerSide;
+#endif
+
+#ifdef IMPOSTOR
+// Impostor atlases (see impostor.hpp). The material's diffuse map is
+// the albedo atlas and its specular map the normal atlas
+uniform sampler2D impostorDepth;
+uniform vec3 impostorCenter;
+uniform float impostorRadius;
+uniform float impostorFrames;
+uniform mat4 projection;
+#endif
 
 uniform vec3 eyePos;
 uniform Material material;
 uniform float nearDepth;
 uniform float farDepth;
 
+#ifdef IMPOSTOR
+// See impostor.vs
+in vec3 BillboardPos;
+in vec3 ToEye;
+in vec3 ImpostorRay;
+flat in vec3 ImpostorEye;
+flat in vec2 ImpostorFrame;
+flat in vec2 ImpostorBlend;
+flat in mat3 ImpostorBasis;
+flat in float ImpostorScale;
+// Where on the model's surface this fragment is; set by
+// sampleImpostor
+vec3 FragPos = vec3(0.0);
+#else
 in vec3 Color;
 in vec2 TextureCoord;
 in vec3 FragPos;
 in vec3 Normal;
+#endif
 
 out vec4 outColor;
 
@@ -54,18 +122,81 @@ out vec4 outColor;
 Returns the fragment colour contribution from a particular light source, given
 a material's texture and specular colour at this point
 */
-vec3 calculateLight(Light light, vec3 normal, vec3 eyeDir, vec3 txtrColor, vec3 specColor);
+vec3 calculateLight(Light light, vec3 normal, vec3 eyeDir, vec3 txtrColor, vec3 specColor, float shadow);
+
+/*
+Returns how much of a light in the given shadow slot reaches a point,
+from 0 (fully shadowed) to 1
+*/
+float calculateShadow(int slot, vec3 fragPos, vec3 norm, float viewDepth);
+
+/*
+Reads the light at a given index out of the light data buffer
+*/
+Light fetchLight(uint index);
+
+#ifdef VIRTUAL_TEXTURING
+/*
+Samples a virtual texture through its indirection table, from the
+finest level of it that's resident
+*/
+vec4 sampleVirtual(sampler2D indirection, vec2 uv);
+#endif
+
+#ifdef IMPOSTOR
+/*
+Blends the impostor frames nearest the view direction into this
+fragment's colour, normal and specular, and moves the fragment onto
+the model's surface: FragPos and depth both
+*/
+vec4 sampleImpostor(out vec3 norm, out vec3 specColor);
+#endif
 
 void main() {
+#ifdef IMPOSTOR
+    vec3 norm;
+    vec3 specColor;
+    vec4 txtrColor = sampleImpostor(norm, specColor);
+    vec3 eyeDir = normalize(eyePos - FragPos);
+    if(txtrColor.a < 0.1) discard;
+#else
     vec3 norm = normalize(Normal);
     vec3 eyeDir = normalize(eyePos - FragPos);
+#ifdef VIRTUAL_TEXTURING
+    vec4 txtrColor = sampleVirtual(material.texture_diffuse1, TextureCoord);
+#else
     vec4 txtrColor = texture(material.texture_diffuse1, TextureCoord);
+#endif
+#ifndef DEPTH_EQUAL_PASS
+    // Skipped when a depth pre-pass has already alpha tested, since
+    // discard would turn off early depth rejection
     if(txtrColor.a < 0.1) discard;
+#endif
     vec3 specColor = vec3(texture(material.texture_specular1, TextureCoord));
+#endif
 
     vec3 result = vec3(0.0, 0.0, 0.0);
-    for(int i = 0; i < NR_LIGHTS; i++) {
-        result += calculateLight(lights[i], norm, eyeDir, txtrColor.rgb, specColor);
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+
+    // Directional lights reach every fragment
+    for(int i = 0; i < nDirectionalLights; i++) {
+        Light light = fetchLight(texelFetch(lightIndices, i).r);
+        float shadow = calculateShadow(light.shadowSlot, FragPos, norm, viewDepth);
+        result += calculateLight(light, norm, eyeDir, txtrColor.rgb, specColor, shadow);
+    }
+
+    // Point and spot lights come from this fragment's cluster alone
+    int slice = clamp(int(log(viewDepth) * clusterScale - clusterBias), 0, CLUSTERS_Z - 1);
+    ivec2 tile = clamp(
+        ivec2(gl_FragCoord.xy / clusterTileSize),
+        ivec2(0, 0), ivec2(CLUSTERS_X - 1, CLUSTERS_Y - 1)
+    );
+    int cluster = tile.x + CLUSTERS_X * (tile.y + CLUSTERS_Y * slice);
+    uvec2 lightRange = texelFetch(lightGrid, cluster).rg;
+    for(uint i = 0u; i < lightRange.y; i++) {
+        Light light = fetchLight(texelFetch(lightIndices, int(lightRange.x + i)).r);
+        float shadow = calculateShadow(light.shadowSlot, FragPos, norm, viewDepth);
+        result += calculateLight(light, norm, eyeDir, txtrColor.rgb, specColor, shadow);
     }
 
     outColor = vec4(result, txtrColor.a);
@@ -75,7 +206,7 @@ void main() {
     // outColor = vec4(vec3(linearDepth/farDepth), 1.0);
 }
 
-vec3 calculateLight(Light light, vec3 norm, vec3 eyeDir, vec3 txtrColor, vec3 specColor) {
+vec3 calculateLight(Light light, vec3 norm, vec3 eyeDir, vec3 txtrColor, vec3 specColor, float shadow) {
     //Vectors we'll reuse for various lighting calculations
     vec3 incidentRay = normalize(FragPos - light.position);
     vec3 lightDir = normalize(light.direction);
@@ -128,5 +259,139 @@ vec3 calculateLight(Light light, vec3 norm, vec3 eyeDir, vec3 txtrColor, vec3 sp
     }
 
     // Fragment colour contribution from this lightsource
-    return (ambient + (diffuse + specular) * spotIntensity) * attenuation;
+    return (ambient + (diffuse + specular) * spotIntensity * shadow) * attenuation;
+}
+
+Light fetchLight(uint index) {
+    int base = int(index) * 6;
+    vec4 positionType = texelFetch(lightData, base);
+    vec4 direction = texelFetch(lightData, base + 1);
+    vec4 diffuseConstant = texelFetch(lightData, base + 2);
+    vec4 specularLinear = texelFetch(lightData, base + 3);
+    vec4 ambientQuadratic = texelFetch(lightData, base + 4);
+    vec4 cutoffs = texelFetch(lightData, base + 5);
+
+    Light light;
+    light.type = int(positionType.w);
+    light.position = positionType.xyz;
+    light.direction = direction.xyz;
+    light.diffuse = diffuseConstant.rgb;
+    light.constant = diffuseConstant.w;
+    light.specular = specularLinear.rgb;
+    light.linear = specularLinear.w;
+    light.ambient = ambientQuadratic.rgb;
+    light.quadratic = ambientQuadratic.w;
+    light.cosCutoffInner = cutoffs.x;
+    light.cosCutoffOuter = cutoffs.y;
+    light.shadowSlot = int(cutoffs.z);
+    return light;
+}
+
+float calculateShadow(int slot, vec3 fragPos, vec3 norm, float viewDepth) {
+    if(slot < 0) return 1.0;
+
+    // Look up a point nudged off the surface, against acne
+    vec4 position = vec4(fragPos + norm * 0.02, 1.0);
+    if(slot == 0) {
+        for(int i = 0; i < SHADOW_CASCADES; i++) {
+            if(viewDepth <= cascadeFarDepths[i]) {
+                vec3 coord = (cascadeMatrices[i] * position).xyz;
+                return texture(cascadeShadowMap, vec4(coord.xy, float(i), coord.z));
+            }
+        }
+        // Past the last cascade
+        return 1.0;
+    }
+
+    vec4 coord = spotShadowMatrices[slot - 1] * position;
+    if(coord.w <= 0.0) return 1.0;
+    return texture(spotShadowAtlas, coord.xyz / coord.w);
+}
+
+#ifdef VIRTUAL_TEXTURING
+vec4 sampleVirtual(sampler2D indirection, vec2 uv) {
+    int tiles = textureSize(indirection, 0).x;
+    int maxLevel = int(round(log2(float(tiles))));
+
+    // The level wanted, going by how many level 0 texels a pixel spans
+    vec2 texel = uv * (float(tiles) * VT_TILE_SIZE);
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    int level = clamp(int(floor(lod)), 0, maxLevel);
+
+    // The page that tile, or the nearest resident ancestor, is in
+    vec2 wrapped = fract(uv);
+    int levelTiles = tiles >> level;
+    ivec2 tile = min(ivec2(wrapped * float(levelTiles)), ivec2(levelTiles - 1));
+    vec4 entry = floor(texelFetch(indirection, tile, level) * 255.0 + 0.5);
+
+    vec2 inTile = fract(wrapped * float(tiles >> int(entry.b)));
+    vec2 atlasTexel = entry.rg * VT_PAGE_SIZE + VT_TILE_BORDER + inTile * VT_TILE_SIZE;
+    return textureLod(vtAtlas, atlasTexel / (vtPagesPerSide * VT_PAGE_SIZE), 0.0);
+}
+#endif
+
+#ifdef IMPOSTOR
+vec3 decodeHemiOctahedral(vec2 e) {
+    vec3 d = vec3(e.x + e.y, 0.0, e.x - e.y) * 0.5;
+    d.y = 1.0 - abs(d.x) - abs(d.z);
+    return normalize(d);
+}
+
+// Adds in what one frame shows where the ray through this fragment
+// crosses that frame's plane, weighted by its coverage there
+void sampleImpostorFrame(vec2 frame, float weight, inout vec4 albedo, inout vec4 normal, inout float height) {
+    // The same axes ImpostorCache::bakeFrames looked along
+    vec3 dir = decodeHemiOctahedral(frame / (impostorFrames - 1.0) * 2.0 - 1.0);
+    vec3 right = normalize(cross(abs(dir.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0), dir));
+    vec3 up = cross(dir, right);
+
+    // Where the ray crosses the frame's plane, then, going by the
+    // depth there, where it crosses the surface it would have hit
+    vec3 ray = normalize(ImpostorRay);
+    float facing = min(dot(ray, dir), -1e-3);
+    float surfaceHeight = 0.0;
+    vec2 uv;
+    vec2 atlasCoord;
+    for(int i = 0; i < 2; i++) {
+        vec3 onPlane = ImpostorEye + ray * (dot(impostorCenter + dir * surfaceHeight - ImpostorEye, dir) / facing) - impostorCenter;
+        uv = vec2(dot(onPlane, right), dot(onPlane, up)) / (2.0 * impostorRadius) + 0.5;
+        atlasCoord = (frame + clamp(uv, 0.0, 1.0)) / impostorFrames;
+        // Where the frame's empty, there's nothing to move to
+        float depth = texture(impostorDepth, atlasCoord).r;
+        surfaceHeight = depth < 1.0 ? (0.5 - depth) * 2.0 * impostorRadius : surfaceHeight;
+    }
+    // Sampled regardless, so derivatives stay sound, but only
+    // counted inside the frame
+    weight *= step(0.0, uv.x) * step(uv.x, 1.0) * step(0.0, uv.y) * step(uv.y, 1.0);
+
+    vec4 texel = texture(material.texture_diffuse1, atlasCoord);
+    float coverage = texel.a * weight;
+    albedo += vec4(texel.rgb, 1.0) * coverage;
+    normal += texture(material.texture_specular1, atlasCoord) * coverage;
+    height += surfaceHeight * coverage;
+}
+
+vec4 sampleImpostor(out vec3 norm, out vec3 specColor) {
+    vec4 albedo = vec4(0.0);
+    vec4 normal = vec4(0.0);
+    float height = 0.0;
+    vec2 blend = ImpostorBlend;
+    sampleImpostorFrame(ImpostorFrame, (1.0 - blend.x) * (1.0 - blend.y), albedo, normal, height);
+    sampleImpostorFrame(ImpostorFrame + vec2(1.0, 0.0), blend.x * (1.0 - blend.y), albedo, normal, height);
+    sampleImpostorFrame(ImpostorFrame + vec2(0.0, 1.0), (1.0 - blend.x) * blend.y, albedo, normal, height);
+    sampleImpostorFrame(ImpostorFrame + vec2(1.0, 1.0), blend.x * blend.y, albedo, normal, height);
+
+    float coverage = max(albedo.a, 1e-4);
+    norm = normalize(ImpostorBasis * (normal.rgb / coverage * 2.0 - 1.0));
+    specColor = vec3(normal.a / coverage);
+
+    // The depth atlas has the surface in front of (or behind) the
+    // frame's plane by this much
+    FragPos = BillboardPos + normalize(ToEye) * (height / coverage * ImpostorScale);
+    vec4 clipPos = projection * view * vec4(FragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+    return vec4(albedo.rgb / coverage, albedo.a);
 }
+#endif
@@ -0,0 +1,32 @@
+#version 330 core
+
+// Stretches the scene over the output with a bilinear fetch, then
+// sharpens it against its four neighbours a source texel away. How
+// much is adaptive: less where the neighbourhood's already contrasty
+// or near black or white, so edges don't ring and nothing clips
+
+in vec2 TextureCoord;
+
+uniform sampler2D scene;
+uniform vec2 sourceTexelSize;
+uniform float sharpness; // 0 to 1
+
+out vec4 FragColor;
+
+void main() {
+    vec3 centre = texture(scene, TextureCoord).rgb;
+    vec3 north = texture(scene, TextureCoord + vec2(0.0, sourceTexelSize.y)).rgb;
+    vec3 south = texture(scene, TextureCoord - vec2(0.0, sourceTexelSize.y)).rgb;
+    vec3 east = texture(scene, TextureCoord + vec2(sourceTexelSize.x, 0.0)).rgb;
+    vec3 west = texture(scene, TextureCoord - vec2(sourceTexelSize.x, 0.0)).rgb;
+
+    vec3 low = min(centre, min(min(north, south), min(east, west)));
+    vec3 high = max(centre, max(max(north, south), max(east, west)));
+    vec3 amount = sqrt(clamp(min(low, 1.0 - high) / max(high, vec3(1e-4)), 0.0, 1.0));
+
+    // Negative lobe on the neighbours, normalised so flat areas
+    // come through unchanged
+    vec3 weight = -amount * mix(0.0, 0.2, sharpness);
+    vec3 color = (centre + (north + south + east + west) * weight) / (1.0 + 4.0 * weight);
+    FragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+// Covers the output with a single triangle; vertices come from
+// gl_VertexID, so no buffers are needed
+
+out vec2 TextureCoord;
+
+void main() {
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+    TextureCoord = corner;
+}
@@ -4,27 +4,95 @@
 // and place it as output the final vertex position in 
 // normalized device coordinates
 
-in vec3 position;
-in vec3 color;
-in vec2 textureCoord;
-in vec3 normal;
-
-// Model-View-Projection matrices; see https://jsantell.com/model-view-projection/
-uniform mat4 model;
-uniform mat4 normalMat;
+// Locations are fixed so that one VAO works with every program
+// built from this vertex shader
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 color;
+layout(location = 2) in vec2 textureCoord;
+layout(location = 3) in vec3 normal;
+
+// Model-View-Projection matrices; see https://jsantell.com/model-view-projection/.
+// Per-draw transforms come from a range of this frame's stream buffer
+layout(std140) uniform DrawBlock {
+    mat4 model;
+    mat4 normalMat;
+    // First texel of the draw's bones in the bone palette, and how
+    // many bones it has; none if it isn't skinned. Then where this
+    // block starts in the stream buffer and how far apart instances'
+    // blocks are, both in texels
+    ivec4 skin;
+};
 uniform mat4 view;
 uniform mat4 projection;
 
+// The stream buffer again as texels, for instanced draws' instances
+// after the first to find their own model and normal matrices
+uniform samplerBuffer drawDataTexels;
+
+mat4 fetchMatrix(int texel) {
+    return mat4(
+        texelFetch(drawDataTexels, texel), texelFetch(drawDataTexels, texel + 1),
+        texelFetch(drawDataTexels, texel + 2), texelFetch(drawDataTexels, texel + 3)
+    );
+}
+
+#ifdef SKINNING
+// Up to 4 bones per vertex, by index into the draw's bones, with
+// weights summing to 1
+layout(location = 4) in uvec4 joints;
+layout(location = 5) in vec4 weights;
+
+// Bone matrices as 3 texels each, the top rows of the matrix; see
+// animation.hpp
+uniform samplerBuffer bonePalette;
+
+// The weighted sum of the vertex's bone matrices, rows as columns
+mat3x4 skinMatrix() {
+    mat3x4 rows = mat3x4(0.0);
+    for(int i = 0; i < 4; ++i) {
+        int texel = skin.x + int(joints[i]) * 3;
+        rows[0] += weights[i] * texelFetch(bonePalette, texel);
+        rows[1] += weights[i] * texelFetch(bonePalette, texel + 1);
+        rows[2] += weights[i] * texelFetch(bonePalette, texel + 2);
+    }
+    return rows;
+}
+
+vec3 skinPoint(mat3x4 rows, vec4 point) {
+    return vec3(dot(rows[0], point), dot(rows[1], point), dot(rows[2], point));
+}
+#endif
+
 out vec3 Color;
 out vec2 TextureCoord;
 out vec3 Normal;
 out vec3 FragPos;
 
 void main() {
+    mat4 drawModel = model;
+    mat4 drawNormalMat = normalMat;
+    if(gl_InstanceID > 0) {
+        int texel = skin.z + gl_InstanceID * skin.w;
+        drawModel = fetchMatrix(texel);
+        drawNormalMat = fetchMatrix(texel + 4);
+    }
+
+    vec3 modelPosition = position;
+    vec3 modelNormal = normal;
+#ifdef SKINNING
+    // Bent into the pose first; bone matrices keep to rotation and
+    // uniform scale, so normals go through them as they are
+    if(skin.y > 0) {
+        mat3x4 rows = skinMatrix();
+        modelPosition = skinPoint(rows, vec4(position, 1.0));
+        modelNormal = skinPoint(rows, vec4(normal, 0.0));
+    }
+#endif
+
     // Vertex position is transformed by our MVP matrices
-    gl_Position = projection * view * model * vec4(position, 1.0);
+    gl_Position = projection * view * drawModel * vec4(modelPosition, 1.0);
     Color = color;
-    FragPos = vec3(model * vec4(position, 1.0));
-    Normal = vec3(normalMat * vec4(normal, 0.0));
+    FragPos = vec3(drawModel * vec4(modelPosition, 1.0));
+    Normal = vec3(drawNormalMat * vec4(modelNormal, 0.0));
     TextureCoord = textureCoord;
 }
@@ -0,0 +1,41 @@
+#version 330 core
+
+// Virtual texture feedback (see virtualtexture.hpp). Every pixel
+// records the tile of its texture it wants, and at what level, as
+// x, y, level, and the texture's index + 1; 0 where nothing's drawn
+
+// Must match VirtualTextureCache::TILE_SIZE
+#define VT_TILE_SIZE 128.0
+
+struct Material {
+    // The virtual texture's indirection table
+    sampler2D texture_diffuse1;
+};
+
+uniform Material material;
+// The feedback buffer is smaller than the screen, so its derivatives
+// are larger by this many levels
+uniform float lodBias;
+
+in vec2 TextureCoord;
+
+out vec4 feedback;
+
+void main() {
+    int tiles = textureSize(material.texture_diffuse1, 0).x;
+    int maxLevel = int(round(log2(float(tiles))));
+
+    vec2 texel = TextureCoord * (float(tiles) * VT_TILE_SIZE);
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+    int level = clamp(int(floor(lod)), 0, maxLevel);
+
+    int levelTiles = tiles >> level;
+    ivec2 tile = min(ivec2(fract(TextureCoord) * float(levelTiles)), ivec2(levelTiles - 1));
+
+    // The coarsest tile is always mapped, and knows which texture
+    // this is
+    float textureIndex = texelFetch(material.texture_diffuse1, ivec2(0), maxLevel).a;
+    feedback = vec4(vec3(tile, level) / 255.0, textureIndex);
+}
@@ -0,0 +1,408 @@
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.hpp"
+#include "commandbuffer.hpp"
+#include "clusteredlighting.hpp"
+#include "animation.hpp"
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "shadowmaps.hpp"
+
+// Shadow map sizes, in texels
+const GLsizei CASCADE_RESOLUTION {1024};
+const GLsizei SPOT_ATLAS_RESOLUTION {2048};
+const GLsizei SPOT_TILES_PER_ROW {4};
+const GLsizei SPOT_TILE_RESOLUTION { SPOT_ATLAS_RESOLUTION / SPOT_TILES_PER_ROW };
+
+// Blend between logarithmic (1) and uniform (0) cascade splits
+const float CASCADE_SPLIT_LAMBDA {.75f};
+
+// Cascades cache a wider area than they need, so the camera can move
+// a while before their static casters have to be re-rendered
+const float CASCADE_CACHE_MARGIN {1.5f};
+
+// How far towards the light, beyond a cascade, casters are still
+// caught
+const float CASTER_REACH {50.f};
+
+// Spot shadow depth range; lights without attenuation are capped
+const float SPOT_SHADOW_NEAR {.2f};
+const float SPOT_SHADOW_MAX_RANGE {100.f};
+
+// Depth offset applied while rendering casters, against acne
+const float SHADOW_SLOPE_BIAS {2.f};
+const float SHADOW_CONSTANT_BIAS {4.f};
+
+// Maps clip space to texture space
+const glm::mat4 TEXTURE_SPACE_BIAS {
+    glm::scale(
+        glm::translate(glm::mat4(1.f), glm::vec3(.5f)),
+        glm::vec3(.5f)
+    )
+};
+
+// Some up vector that isn't parallel to direction
+static glm::vec3 upFor(const glm::vec3& direction) {
+    return std::abs(direction.y) > .99f? glm::vec3(1.f, 0.f, 0.f): glm::vec3(0.f, 1.f, 0.f);
+}
+
+// Depth textures sampled either with hardware comparison (the maps
+// lighting reads) or not at all (the static caches, which are only
+// ever copied from)
+static void setDepthParameters(GLenum target, bool compare) {
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, compare? GL_LINEAR: GL_NEAREST);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, compare? GL_LINEAR: GL_NEAREST);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if(compare) {
+        glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+}
+
+ShadowMaps::ShadowMaps():
+    // Skinned so that animated characters cast shadows too; draws
+    // without bones skip the skinning
+    mOpaqueShader {"shaders/depth.vs", "shaders/depth.fs", "#define SKINNING"},
+    mAlphaTestedShader {"shaders/depth.vs", "shaders/depth.fs", "#define SKINNING\n#define ALPHA_TEST"}
+{
+    GLuint arrays[2] {};
+    glGenTextures(2, arrays);
+    mCascadeMaps = arrays[0];
+    mStaticCascadeMaps = arrays[1];
+    for(GLuint texture: arrays) {
+        counted::bindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(
+            GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+            CASCADE_RESOLUTION, CASCADE_RESOLUTION, SHADOW_CASCADES,
+            0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr
+        );
+        setDepthParameters(GL_TEXTURE_2D_ARRAY, texture == mCascadeMaps);
+    }
+    counted::bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    GLuint atlases[2] {};
+    glGenTextures(2, atlases);
+    mSpotAtlas = atlases[0];
+    mStaticSpotAtlas = atlases[1];
+    for(GLuint texture: atlases) {
+        counted::bindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24,
+            SPOT_ATLAS_RESOLUTION, SPOT_ATLAS_RESOLUTION,
+            0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr
+        );
+        setDepthParameters(GL_TEXTURE_2D, texture == mSpotAtlas);
+    }
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+
+    // Depth-only framebuffers, for rendering into and copying out of
+    // the maps above
+    glGenFramebuffers(1, &mDrawFBO);
+    glGenFramebuffers(1, &mReadFBO);
+    for(GLuint fbo: {mDrawFBO, mReadFBO}) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowMaps::~ShadowMaps() {
+    glDeleteFramebuffers(1, &mDrawFBO);
+    glDeleteFramebuffers(1, &mReadFBO);
+    glDeleteTextures(1, &mCascadeMaps);
+    glDeleteTextures(1, &mStaticCascadeMaps);
+    glDeleteTextures(1, &mSpotAtlas);
+    glDeleteTextures(1, &mStaticSpotAtlas);
+}
+
+bool ShadowMaps::getBuildSuccess() {
+    return mOpaqueShader.getBuildSuccess() && mAlphaTestedShader.getBuildSuccess();
+}
+
+void ShadowMaps::update(LightClusters& lights, const glm::mat4& view, float fov, float aspectRatio, float nearDepth, float farDepth) {
+    // Hand out shadow slots: 0 for the cascades, n + 1 for spot
+    // shadow n
+    bool hadCascades { mHasCascades };
+    mHasCascades = false;
+    std::size_t nSpots {0};
+    for(std::size_t i {0}; i < lights.getLightCount(); ++i) {
+        const Light& light { lights.getLight(i) };
+        int slot {-1};
+
+        if(light.mType == Light::directional && !mHasCascades) {
+            glm::vec3 direction { glm::normalize(light.mDirection) };
+            if(!hadCascades || direction != mCascadeDirection) {
+                mCascadeDirection = direction;
+                mLightRotation = glm::lookAt(glm::vec3(0.f), direction, upFor(direction));
+                for(Cascade& cascade: mCascades) cascade.mShadow.mStaticValid = false;
+            }
+            mHasCascades = true;
+            slot = 0;
+        }
+
+        else if(light.mType == Light::spot && nSpots < MAX_SPOT_SHADOWS) {
+            if(mSpots.size() <= nSpots) mSpots.push_back(SpotShadow {});
+            SpotShadow& spot { mSpots[nSpots] };
+            float range { std::min(lights.getLightRange(i), SPOT_SHADOW_MAX_RANGE) };
+            glm::vec3 direction { glm::normalize(light.mDirection) };
+
+            // Anything that changes the light's frustum invalidates
+            // its cache
+            if(
+                !spot.mShadow.mStaticValid
+                || spot.mLight != i || spot.mPosition != light.mPosition
+                || spot.mDirection != direction || spot.mCosCutoffOuter != light.mCosCutoffOuter
+                || spot.mRange != range
+            ) {
+                spot.mLight = i;
+                spot.mPosition = light.mPosition;
+                spot.mDirection = direction;
+                spot.mCosCutoffOuter = light.mCosCutoffOuter;
+                spot.mRange = range;
+                spot.mShadow.mStaticValid = false;
+
+                float fovY { 2.f * std::acos(std::clamp(light.mCosCutoffOuter, -1.f, 1.f)) };
+                spot.mShadow.mView = glm::lookAt(light.mPosition, light.mPosition + direction, upFor(direction));
+                spot.mShadow.mProjection = glm::perspective(
+                    std::min(fovY, glm::radians(170.f)), 1.f, SPOT_SHADOW_NEAR, range
+                );
+
+                // Squeeze texture space into this spot's atlas tile
+                glm::vec3 tileOffset {
+                    static_cast<float>(nSpots % SPOT_TILES_PER_ROW) / SPOT_TILES_PER_ROW,
+                    static_cast<float>(nSpots / SPOT_TILES_PER_ROW) / SPOT_TILES_PER_ROW,
+                    0.f
+                };
+                glm::mat4 tile {
+                    glm::scale(
+                        glm::translate(glm::mat4(1.f), tileOffset),
+                        glm::vec3(1.f / SPOT_TILES_PER_ROW, 1.f / SPOT_TILES_PER_ROW, 1.f)
+                    )
+                };
+                spot.mShadow.mShadowMatrix = (
+                    tile * TEXTURE_SPACE_BIAS * spot.mShadow.mProjection * spot.mShadow.mView
+                );
+            }
+            slot = static_cast<int>(nSpots + 1);
+            ++nSpots;
+        }
+
+        lights.setShadowSlot(i, slot);
+    }
+    mSpots.resize(nSpots);
+
+    if(!mHasCascades) return;
+
+    // Split the camera's depth range between cascades, mostly
+    // logarithmically so that near cascades stay sharp
+    glm::mat4 inverseView { glm::inverse(view) };
+    float sliceNear { nearDepth };
+    for(std::size_t i {0}; i < SHADOW_CASCADES; ++i) {
+        float t { static_cast<float>(i + 1) / SHADOW_CASCADES };
+        float logSplit { nearDepth * std::pow(farDepth / nearDepth, t) };
+        float uniformSplit { nearDepth + (farDepth - nearDepth) * t };
+        float sliceFar { CASCADE_SPLIT_LAMBDA * logSplit + (1.f - CASCADE_SPLIT_LAMBDA) * uniformSplit };
+        fitCascade(mCascades[i], inverseView, fov, aspectRatio, sliceNear, sliceFar);
+        sliceNear = sliceFar;
+    }
+}
+
+void ShadowMaps::fitCascade(Cascade& cascade, const glm::mat4& inverseView, float fov, float aspectRatio, float sliceNear, float sliceFar) {
+    // Bound the frustum slice with a sphere, which doesn't change
+    // size as the camera turns
+    float tanHalfFOV { std::tan(glm::radians(fov) * .5f) };
+    glm::vec3 corners[8];
+    for(int i {0}; i < 8; ++i) {
+        float depth { i < 4? sliceNear: sliceFar };
+        float x { (i & 1? 1.f: -1.f) * depth * tanHalfFOV * aspectRatio };
+        float y { (i & 2? 1.f: -1.f) * depth * tanHalfFOV };
+        corners[i] = glm::vec3(inverseView * glm::vec4(x, y, -depth, 1.f));
+    }
+    glm::vec3 center {0.f};
+    for(const glm::vec3& corner: corners) center += corner;
+    center /= 8.f;
+    float radius {0.f};
+    for(const glm::vec3& corner: corners) radius = std::max(radius, glm::length(corner - center));
+    radius = std::ceil(radius * 16.f) / 16.f;
+
+    cascade.mFarDepth = sliceFar;
+
+    // Keep the cached area while the sphere still fits inside it
+    glm::vec3 lightCenter { mLightRotation * glm::vec4(center, 1.f) };
+    glm::vec3 offset { glm::abs(lightCenter - cascade.mCenter) };
+    if(
+        cascade.mShadow.mStaticValid
+        && std::max(offset.x, std::max(offset.y, offset.z)) + radius <= cascade.mHalfExtent
+    ) return;
+
+    // Otherwise re-centre it, snapped to whole texels so that static
+    // shadows don't shimmer as it moves
+    cascade.mHalfExtent = radius * CASCADE_CACHE_MARGIN;
+    float texelSize { 2.f * cascade.mHalfExtent / CASCADE_RESOLUTION };
+    cascade.mCenter = glm::vec3(
+        std::floor(lightCenter.x / texelSize) * texelSize,
+        std::floor(lightCenter.y / texelSize) * texelSize,
+        lightCenter.z
+    );
+    cascade.mShadow.mStaticValid = false;
+
+    // The light looks down -z in light space; casters up to
+    // CASTER_REACH towards the light are included
+    glm::vec3 c { cascade.mCenter };
+    float h { cascade.mHalfExtent };
+    cascade.mShadow.mView = mLightRotation;
+    cascade.mShadow.mProjection = glm::ortho(
+        c.x - h, c.x + h, c.y - h, c.y + h,
+        -(c.z + h + CASTER_REACH), -(c.z - h)
+    );
+    cascade.mShadow.mShadowMatrix = TEXTURE_SPACE_BIAS * cascade.mShadow.mProjection * cascade.mShadow.mView;
+}
+
+void ShadowMaps::invalidateStaticCasters(const glm::vec3& center, float radius) {
+    if(mHasCascades) {
+        glm::vec3 lightCenter { mLightRotation * glm::vec4(center, 1.f) };
+        for(Cascade& cascade: mCascades) {
+            glm::vec3 offset { lightCenter - cascade.mCenter };
+            float reach { cascade.mHalfExtent + radius };
+            if(
+                std::abs(offset.x) <= reach && std::abs(offset.y) <= reach
+                && offset.z >= -reach && offset.z <= reach + CASTER_REACH
+            ) cascade.mShadow.mStaticValid = false;
+        }
+    }
+    for(SpotShadow& spot: mSpots) {
+        if(glm::length(center - spot.mPosition) <= spot.mRange + radius)
+            spot.mShadow.mStaticValid = false;
+    }
+}
+
+void ShadowMaps::invalidateAll() {
+    for(Cascade& cascade: mCascades) cascade.mShadow.mStaticValid = false;
+    for(SpotShadow& spot: mSpots) spot.mShadow.mStaticValid = false;
+}
+
+void ShadowMaps::render(const CommandQueue& staticCasters, const CommandQueue* dynamicCasters, bool alphaTested) {
+    PROFILE_ZONE("ShadowMaps::render");
+    PROFILE_GPU_ZONE("Shadow maps");
+    mStaticRenderCount = 0;
+    if(!mHasCascades && mSpots.empty()) return;
+
+    // Whatever the scene is drawn into gets put back afterwards
+    GLint viewport[4] {};
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLint sceneFramebuffer {0};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &sceneFramebuffer);
+
+    Shader& shader { alphaTested? mAlphaTestedShader: mOpaqueShader };
+    shader.use();
+    if(alphaTested) shader.setInt("material.texture_diffuse1", 0);
+    shader.setInt("bonePalette", BONE_PALETTE_UNIT);
+
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+
+    if(mHasCascades) {
+        for(std::size_t i {0}; i < SHADOW_CASCADES; ++i) {
+            renderShadow(
+                shader, mCascades[i].mShadow, mStaticCascadeMaps, mCascadeMaps, static_cast<GLint>(i),
+                0, 0, CASCADE_RESOLUTION, staticCasters, dynamicCasters
+            );
+        }
+    }
+    for(std::size_t i {0}; i < mSpots.size(); ++i) {
+        renderShadow(
+            shader, mSpots[i].mShadow, mStaticSpotAtlas, mSpotAtlas, -1,
+            (i % SPOT_TILES_PER_ROW) * SPOT_TILE_RESOLUTION, (i / SPOT_TILES_PER_ROW) * SPOT_TILE_RESOLUTION,
+            SPOT_TILE_RESOLUTION, staticCasters, dynamicCasters
+        );
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void ShadowMaps::renderShadow(Shader& shader, ShadowView& shadow, GLuint staticMap, GLuint finalMap, GLint layer, GLint x, GLint y, GLsizei size, const CommandQueue& staticCasters, const CommandQueue* dynamicCasters) {
+    bool hasDynamic { dynamicCasters && dynamicCasters->getCommandCount() > 0 };
+    bool staticRendered {false};
+
+    if(!shadow.mStaticValid) {
+        glBindFramebuffer(GL_FRAMEBUFFER, mDrawFBO);
+        attachDepth(GL_FRAMEBUFFER, staticMap, layer);
+        glViewport(x, y, size, size);
+
+        // Atlas tiles are cleared one at a time
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(x, y, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+
+        shader.setMat4("view", shadow.mView);
+        shader.setMat4("projection", shadow.mProjection);
+        staticCasters.submit(shader);
+        shadow.mStaticValid = true;
+        staticRendered = true;
+        ++mStaticRenderCount;
+    }
+
+    // The map lighting reads is already up to date if nothing has
+    // been drawn into either copy since the last frame
+    if(!staticRendered && !shadow.mHoldsDynamic && !hasDynamic) return;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mReadFBO);
+    attachDepth(GL_READ_FRAMEBUFFER, staticMap, layer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mDrawFBO);
+    attachDepth(GL_DRAW_FRAMEBUFFER, finalMap, layer);
+    glBlitFramebuffer(x, y, x + size, y + size, x, y, x + size, y + size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    if(hasDynamic) {
+        glBindFramebuffer(GL_FRAMEBUFFER, mDrawFBO);
+        glViewport(x, y, size, size);
+        shader.setMat4("view", shadow.mView);
+        shader.setMat4("projection", shadow.mProjection);
+        dynamicCasters->submit(shader);
+    }
+    shadow.mHoldsDynamic = hasDynamic;
+}
+
+void ShadowMaps::attachDepth(GLenum target, GLuint texture, GLint layer) {
+    if(layer >= 0)
+        glFramebufferTextureLayer(target, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+    else
+        glFramebufferTexture2D(target, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+}
+
+void ShadowMaps::bind(const Shader& shader) const {
+    glActiveTexture(GL_TEXTURE0 + CASCADE_SHADOW_UNIT);
+    counted::bindTexture(GL_TEXTURE_2D_ARRAY, mCascadeMaps);
+    glActiveTexture(GL_TEXTURE0 + SPOT_SHADOW_UNIT);
+    counted::bindTexture(GL_TEXTURE_2D, mSpotAtlas);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setInt("cascadeShadowMap", CASCADE_SHADOW_UNIT);
+    shader.setInt("spotShadowAtlas", SPOT_SHADOW_UNIT);
+    char name[MAX_UNIFORM_NAME];
+    for(std::size_t i {0}; i < SHADOW_CASCADES; ++i) {
+        std::snprintf(name, sizeof(name), "cascadeMatrices[%zu]", i);
+        shader.setMat4(name, mCascades[i].mShadow.mShadowMatrix);
+        std::snprintf(name, sizeof(name), "cascadeFarDepths[%zu]", i);
+        shader.setFloat(name, mCascades[i].mFarDepth);
+    }
+    for(std::size_t i {0}; i < mSpots.size(); ++i) {
+        std::snprintf(name, sizeof(name), "spotShadowMatrices[%zu]", i);
+        shader.setMat4(name, mSpots[i].mShadow.mShadowMatrix);
+    }
+}
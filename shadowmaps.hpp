@@ -0,0 +1,116 @@
+#ifndef ZOSHADOWMAPS_H
+#define ZOSHADOWMAPS_H
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "commandbuffer.hpp"
+#include "clusteredlighting.hpp"
+
+// Must match the limits in the lighting shaders
+const std::size_t SHADOW_CASCADES {4};
+const std::size_t MAX_SPOT_SHADOWS {16};
+
+// Texture units shadow maps are bound to, after the light buffers
+const GLint CASCADE_SHADOW_UNIT {7};
+const GLint SPOT_SHADOW_UNIT {8};
+
+/*
+Shadow maps for the scene's lights. The first directional light gets
+cascaded shadow maps, split over the camera's depth range; spot lights
+each get a tile of a shared atlas. Point lights cast no shadows.
+
+Every map has a cached copy holding static casters only, re-rendered
+just when its light moves, the camera leaves the area it covers, or
+a static caster inside it is reported moved. Each frame the cached
+depth is copied out and dynamic casters are drawn over it
+*/
+class ShadowMaps {
+public:
+    ShadowMaps();
+    ~ShadowMaps();
+
+    ShadowMaps(const ShadowMaps& other) = delete;
+    ShadowMaps& operator=(const ShadowMaps& other) = delete;
+
+    bool getBuildSuccess();
+
+    // Hand out shadow maps to lights, recording each light's slot in
+    // lights, and fit cascades to the camera's frustum (fov in
+    // degrees). Call before lights.update() so slots get uploaded
+    void update(LightClusters& lights, const glm::mat4& view, float fov, float aspectRatio, float nearDepth, float farDepth);
+
+    // Report a static caster that moved, or was added or removed,
+    // so that any cached map it could appear in gets re-rendered
+    void invalidateStaticCasters(const glm::vec3& center, float radius);
+    void invalidateAll();
+
+    // Bring every shadow map up to date. dynamicCasters may be null.
+    // With alphaTested, casters cut out transparent texels of their
+    // diffuse texture. The viewport is restored afterwards
+    void render(const CommandQueue& staticCasters, const CommandQueue* dynamicCasters, bool alphaTested);
+
+    // Bind shadow maps and set the uniforms lighting shaders use to
+    // sample them. Shader must be in use
+    void bind(const Shader& shader) const;
+
+    // Number of cached maps re-rendered during the last render()
+    std::size_t getStaticRenderCount() const { return mStaticRenderCount; }
+
+private:
+    // One shadow map, and the state its static cache was built with
+    struct ShadowView {
+        glm::mat4 mView {1.f};
+        glm::mat4 mProjection {1.f};
+        glm::mat4 mShadowMatrix {1.f}; // world space to shadow map texture space
+        bool mStaticValid {false};
+        bool mHoldsDynamic {false};
+    };
+
+    struct Cascade {
+        ShadowView mShadow;
+        glm::vec3 mCenter {0.f}; // light space centre of the cached area
+        float mHalfExtent {0.f};
+        float mFarDepth {0.f}; // view depth this cascade covers up to
+    };
+
+    struct SpotShadow {
+        ShadowView mShadow;
+        std::size_t mLight {0};
+        glm::vec3 mPosition {0.f};
+        glm::vec3 mDirection {0.f};
+        float mCosCutoffOuter {0.f};
+        float mRange {0.f};
+    };
+
+    void fitCascade(Cascade& cascade, const glm::mat4& inverseView, float fov, float aspectRatio, float sliceNear, float sliceFar);
+    void renderShadow(Shader& shader, ShadowView& shadow, GLuint staticMap, GLuint finalMap, GLint layer, GLint x, GLint y, GLsizei size, const CommandQueue& staticCasters, const CommandQueue* dynamicCasters);
+    void attachDepth(GLenum target, GLuint texture, GLint layer);
+
+    Shader mOpaqueShader;
+    Shader mAlphaTestedShader;
+
+    GLuint mDrawFBO {0};
+    GLuint mReadFBO {0};
+
+    // Cascades live in the layers of a depth texture array, spot
+    // shadows in the tiles of a depth atlas; each has a static twin
+    GLuint mCascadeMaps {0};
+    GLuint mStaticCascadeMaps {0};
+    GLuint mSpotAtlas {0};
+    GLuint mStaticSpotAtlas {0};
+
+    bool mHasCascades {false};
+    glm::vec3 mCascadeDirection {0.f};
+    glm::mat4 mLightRotation {1.f};
+    Cascade mCascades[SHADOW_CASCADES];
+    std::vector<SpotShadow> mSpots;
+
+    std::size_t mStaticRenderCount {0};
+};
+
+#endif
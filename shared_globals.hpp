@@ -4,7 +4,28 @@
 #include <SDL2/SDL.h>
 
 extern SDL_Window* gWindow;
-extern const int gWindowHeight;
-extern const int gWindowWidth;
+extern int gWindowHeight;
+extern int gWindowWidth;
+
+class JobSystem;
+extern JobSystem* gJobSystem;
+
+// Per-frame ring that per-draw data is streamed through
+class StreamBuffer;
+extern StreamBuffer* gStreamBuffer;
+
+// Scratch memory for the main thread, emptied at the end of each frame
+class FrameArena;
+extern FrameArena* gFrameArena;
+
+// Uploads through a second context on a thread of its own; null
+// where no shared context could be made, and everything's uploaded
+// on the GL thread
+class UploadQueue;
+extern UploadQueue* gUploadQueue;
+
+// Mounted asset packs; null reads loose files only
+class AssetFileSystem;
+extern AssetFileSystem* gAssets;
 
 #endif
@@ -0,0 +1,198 @@
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "skeleton.hpp"
+
+glm::mat4 toMatrix(const JointPose& pose) {
+    // Rotation, scaled along each column, then the translation; the
+    // same as translate * mat4_cast * scale without the products
+    const glm::quat& q {pose.mRotation};
+    float xx {q.x * q.x}, yy {q.y * q.y}, zz {q.z * q.z};
+    float xy {q.x * q.y}, xz {q.x * q.z}, yz {q.y * q.z};
+    float wx {q.w * q.x}, wy {q.w * q.y}, wz {q.w * q.z};
+    glm::mat4 matrix {1.f};
+    matrix[0] = glm::vec4(1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy), 0.f) * pose.mScale.x;
+    matrix[1] = glm::vec4(2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx), 0.f) * pose.mScale.y;
+    matrix[2] = glm::vec4(2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy), 0.f) * pose.mScale.z;
+    matrix[3] = glm::vec4(pose.mTranslation, 1.f);
+    return matrix;
+}
+
+JointPose blend(const JointPose& a, const JointPose& b, float weight) {
+    // Normalised lerp: close enough to a slerp for the small angles
+    // between poses being blended, and much cheaper
+    glm::quat to { glm::dot(a.mRotation, b.mRotation) < 0.f? -b.mRotation: b.mRotation };
+    return JointPose {
+        .mTranslation { a.mTranslation + (b.mTranslation - a.mTranslation) * weight },
+        .mRotation { glm::normalize(a.mRotation * (1.f - weight) + to * weight) },
+        .mScale { a.mScale + (b.mScale - a.mScale) * weight }
+    };
+}
+
+AnimationClip::AnimationClip(std::string name, float duration):
+    mName {std::move(name)}, mDuration {std::max(duration, 1e-6f)}
+{}
+
+void AnimationClip::addTrack(
+    int joint,
+    const std::vector<float>& translationTimes, const std::vector<glm::vec3>& translations,
+    const std::vector<float>& rotationTimes, const std::vector<glm::quat>& rotations,
+    const std::vector<float>& scaleTimes, const std::vector<glm::vec3>& scales,
+    float tolerance
+) {
+    std::vector<glm::vec4> values {};
+    Track track { .mJoint {joint} };
+
+    for(const glm::vec3& translation: translations) values.push_back(glm::vec4(translation, 0.f));
+    track.mTranslation = compress(translationTimes, values, 3, tolerance);
+
+    // Each key on the same side as the one before, so interpolating
+    // between any two takes the short way
+    values.clear();
+    for(const glm::quat& rotation: rotations) {
+        glm::vec4 value {rotation.x, rotation.y, rotation.z, rotation.w};
+        if(!values.empty() && glm::dot(value, values.back()) < 0.f) value = -value;
+        values.push_back(value);
+    }
+    track.mRotation = compress(rotationTimes, values, 4, tolerance);
+
+    values.clear();
+    for(const glm::vec3& scale: scales) values.push_back(glm::vec4(scale, 0.f));
+    track.mScale = compress(scaleTimes, values, 3, tolerance);
+
+    mTracks.push_back(std::move(track));
+}
+
+AnimationClip::Channel AnimationClip::compress(const std::vector<float>& times, const std::vector<glm::vec4>& values, int components, float tolerance) const {
+    Channel channel { .mComponents {components} };
+    std::size_t nKeys { std::min(times.size(), values.size()) };
+    if(nKeys == 0) return channel;
+
+    float maxRange {0.f};
+    for(int c {0}; c < components; ++c) {
+        float low {values[0][c]}, high {values[0][c]};
+        for(std::size_t i {0}; i < nKeys; ++i) {
+            low = std::min(low, values[i][c]);
+            high = std::max(high, values[i][c]);
+        }
+        channel.mMin[c] = low;
+        channel.mStep[c] = (high - low) / 65535.f;
+        maxRange = std::max(maxRange, high - low);
+    }
+    float maxError { tolerance * std::max(maxRange, 1.f) };
+
+    // Greedily stretch each span between kept keys until some key
+    // inside it strays too far from the line across it
+    std::vector<std::size_t> kept {0};
+    for(std::size_t end {2}; end < nKeys; ++end) {
+        std::size_t start {kept.back()};
+        float span {times[end] - times[start]};
+        bool fits {true};
+        for(std::size_t i {start + 1}; i < end && fits; ++i) {
+            float t { span > 0.f? (times[i] - times[start]) / span: 0.f };
+            glm::vec4 error { values[start] + (values[end] - values[start]) * t - values[i] };
+            for(int c {0}; c < components; ++c) fits = fits && std::abs(error[c]) <= maxError;
+        }
+        if(!fits) kept.push_back(end - 1);
+    }
+    // A channel that never moves needs just the one key
+    if(nKeys > 1 && maxRange > 0.f) kept.push_back(nKeys - 1);
+
+    for(std::size_t key: kept) {
+        float time { std::clamp(times[key] / mDuration, 0.f, 1.f) };
+        channel.mTimes.push_back(static_cast<std::uint16_t>(std::lround(time * 65535.f)));
+        for(int c {0}; c < components; ++c) {
+            float step { channel.mStep[c] > 0.f? (values[key][c] - channel.mMin[c]) / channel.mStep[c]: 0.f };
+            channel.mValues.push_back(static_cast<std::uint16_t>(std::clamp(std::lround(step), 0l, 65535l)));
+        }
+    }
+    return channel;
+}
+
+void AnimationClip::Channel::decode(std::size_t key, float* values) const {
+    const std::uint16_t* quantised { &mValues[key * mComponents] };
+    for(int c {0}; c < mComponents; ++c) values[c] = mMin[c] + quantised[c] * mStep[c];
+}
+
+bool AnimationClip::Channel::sample(float time, float* values) const {
+    if(mTimes.empty()) return false;
+
+    auto next { std::upper_bound(mTimes.begin(), mTimes.end(), time, [](float time, std::uint16_t key) { return time < key; }) };
+    if(next == mTimes.begin() || next == mTimes.end()) {
+        decode(next == mTimes.begin()? 0: mTimes.size() - 1, values);
+        return true;
+    }
+
+    std::size_t key { static_cast<std::size_t>(next - mTimes.begin()) };
+    float t { (time - mTimes[key - 1]) / static_cast<float>(mTimes[key] - mTimes[key - 1]) };
+    float after[4] {};
+    decode(key - 1, values);
+    decode(key, after);
+    for(int c {0}; c < mComponents; ++c) values[c] += (after[c] - values[c]) * t;
+    return true;
+}
+
+void AnimationClip::sample(float time, std::vector<JointPose>& pose) const {
+    float quantisedTime { std::clamp(time / mDuration, 0.f, 1.f) * 65535.f };
+    float values[4] {};
+    for(const Track& track: mTracks) {
+        if(track.mJoint < 0 || static_cast<std::size_t>(track.mJoint) >= pose.size()) continue;
+        JointPose& joint { pose[track.mJoint] };
+        if(track.mTranslation.sample(quantisedTime, values))
+            joint.mTranslation = glm::vec3(values[0], values[1], values[2]);
+        if(track.mRotation.sample(quantisedTime, values))
+            joint.mRotation = glm::normalize(glm::quat(values[3], values[0], values[1], values[2]));
+        if(track.mScale.sample(quantisedTime, values))
+            joint.mScale = glm::vec3(values[0], values[1], values[2]);
+    }
+}
+
+std::size_t AnimationClip::getKeyCount() const {
+    std::size_t count {0};
+    for(const Track& track: mTracks)
+        count += track.mTranslation.mTimes.size() + track.mRotation.mTimes.size() + track.mScale.mTimes.size();
+    return count;
+}
+
+std::size_t AnimationClip::getCompressedSize() const {
+    std::size_t size {0};
+    for(const Track& track: mTracks) {
+        for(const Channel* channel: {&track.mTranslation, &track.mRotation, &track.mScale})
+            size += sizeof(Channel) + (channel->mTimes.size() + channel->mValues.size()) * sizeof(std::uint16_t);
+    }
+    return size;
+}
+
+int Skeleton::findJoint(const std::string& name) const {
+    for(std::size_t i {0}; i < mJoints.size(); ++i) {
+        if(mJoints[i].mName == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+int Skeleton::findClip(const std::string& name) const {
+    for(std::size_t i {0}; i < mClips.size(); ++i) {
+        if(mClips[i].getName() == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void Skeleton::getRestPose(std::vector<JointPose>& pose) const {
+    pose.resize(mJoints.size());
+    for(std::size_t i {0}; i < mJoints.size(); ++i) pose[i] = mJoints[i].mRest;
+}
+
+void Skeleton::getGlobalPose(const std::vector<JointPose>& pose, std::vector<glm::mat4>& global) const {
+    global.resize(mJoints.size());
+    for(std::size_t i {0}; i < mJoints.size(); ++i) {
+        glm::mat4 local { toMatrix(pose[i]) };
+        global[i] = mJoints[i].mParent < 0? local: global[mJoints[i].mParent] * local;
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef ZOSKELETON_H
+#define ZOSKELETON_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// A joint's transform relative to its parent
+struct JointPose {
+    glm::vec3 mTranslation {0.f};
+    glm::quat mRotation {1.f, 0.f, 0.f, 0.f};
+    glm::vec3 mScale {1.f};
+};
+
+glm::mat4 toMatrix(const JointPose& pose);
+// Blend from a to b by weight, rotations taking the short way round
+JointPose blend(const JointPose& a, const JointPose& b, float weight);
+
+/*
+An animation clip, compressed. Each joint's translation, rotation and
+scale keys are reduced to those that can't be recovered, to within a
+tolerance, by interpolating between their neighbours, then quantised
+to 16 bits: times over the clip's duration and values over the range
+each component covers. Rotations are kept on one hemisphere so that
+neighbouring keys never interpolate the long way round.
+
+Sampling only reads, so any number of threads can sample a clip at once
+*/
+class AnimationClip {
+public:
+    AnimationClip(std::string name, float duration);
+
+    // Compress and add one joint's keys, times in seconds. Any of
+    // them may be empty to leave that part of the joint at rest.
+    // Keys are dropped while the error stays under tolerance, in
+    // units of the component's range (or absolute, if that's under 1)
+    void addTrack(
+        int joint,
+        const std::vector<float>& translationTimes, const std::vector<glm::vec3>& translations,
+        const std::vector<float>& rotationTimes, const std::vector<glm::quat>& rotations,
+        const std::vector<float>& scaleTimes, const std::vector<glm::vec3>& scales,
+        float tolerance=1e-3f
+    );
+
+    // Overwrite every joint the clip animates with where it is at
+    // time, clamped to the clip. Others are left as they are
+    void sample(float time, std::vector<JointPose>& pose) const;
+
+    const std::string& getName() const { return mName; }
+    float getDuration() const { return mDuration; }
+    // Keys kept, over every channel, and the bytes they take
+    std::size_t getKeyCount() const;
+    std::size_t getCompressedSize() const;
+
+private:
+    // One part of a joint's transform, with mComponents floats to a key
+    struct Channel {
+        int mComponents {0};
+        std::vector<std::uint16_t> mTimes;  // over the clip's duration
+        std::vector<std::uint16_t> mValues; // mComponents to a key
+        float mMin[4] {};
+        float mStep[4] {}; // value of one quantisation step
+
+        void decode(std::size_t key, float* values) const;
+        // Interpolated at time, quantised the way mTimes are; false
+        // if there are no keys
+        bool sample(float time, float* values) const;
+    };
+
+    struct Track {
+        int mJoint;
+        Channel mTranslation;
+        Channel mRotation;
+        Channel mScale;
+    };
+
+    Channel compress(const std::vector<float>& times, const std::vector<glm::vec4>& values, int components, float tolerance) const;
+
+    std::string mName;
+    float mDuration;
+    std::vector<Track> mTracks;
+};
+
+struct Joint {
+    std::string mName;
+    int mParent; // -1 for the root
+    JointPose mRest;
+};
+
+// A joint that skinned vertices follow, and the matrix taking those
+// vertices from their mesh into the joint's space
+struct Bone {
+    int mJoint;
+    glm::mat4 mInverseBind;
+};
+
+// Skin indices are bytes
+const std::size_t MAX_BONES {256};
+
+struct Skeleton {
+    std::vector<Joint> mJoints; // parents always before children
+    std::vector<Bone> mBones;
+    std::vector<AnimationClip> mClips;
+
+    // Index by name, or -1 if there's none
+    int findJoint(const std::string& name) const;
+    int findClip(const std::string& name) const;
+    bool empty() const { return mBones.empty(); }
+
+    // The rest pose of every joint
+    void getRestPose(std::vector<JointPose>& pose) const;
+    // Take pose, local to each joint's parent, into model space
+    void getGlobalPose(const std::vector<JointPose>& pose, std::vector<glm::mat4>& global) const;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "streambuffer.hpp"
+
+// How long to wait on a region's fence before giving up on it
+const GLuint64 REGION_TIMEOUT_NS {1000000000};
+
+StreamBuffer::StreamBuffer(GLenum target, GLsizeiptr regionSize, std::size_t regionCount):
+    mTarget {target},
+    mRegionSize {regionSize},
+    mFences(std::max<std::size_t>(1, regionCount), nullptr)
+{
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(mTarget, mBuffer);
+    glBufferData(mTarget, mRegionSize * mFences.size(), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(mTarget, 0);
+
+    glGenTextures(1, &mTexture);
+    counted::bindTexture(GL_TEXTURE_BUFFER, mTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mBuffer);
+    counted::bindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+StreamBuffer::~StreamBuffer() {
+    for(GLsync fence: mFences) glDeleteSync(fence);
+    glDeleteTextures(1, &mTexture);
+    glDeleteBuffers(1, &mBuffer);
+}
+
+void StreamBuffer::beginFrame() {
+    PROFILE_ZONE("StreamBuffer::beginFrame");
+    mRegion = (mRegion + 1) % mFences.size();
+    mHead = 0;
+    ++mFrame;
+
+    GLsync& fence { mFences[mRegion] };
+    if(!fence) return;
+    GLenum status { glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, REGION_TIMEOUT_NS) };
+    if(status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+        std::cout << "ERROR::STREAMBUFFER::REGION_WAIT_FAILED" << std::endl;
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void StreamBuffer::endFrame() {
+    GLsync& fence { mFences[mRegion] };
+    glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* StreamBuffer::map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset) {
+    GLsizeiptr start { (mHead + alignment - 1) / alignment * alignment };
+    if(start + size > mRegionSize) {
+        grow(std::max(2 * mRegionSize, start + size));
+        start = (mHead + alignment - 1) / alignment * alignment;
+    }
+
+    offset = static_cast<GLintptr>(mRegion * mRegionSize + start);
+    mHead = start + size;
+
+    // Nothing the GPU might still be reading is touched, so there's
+    // nothing for the driver to wait on
+    glBindBuffer(mTarget, mBuffer);
+    return glMapBufferRange(
+        mTarget, offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+    );
+}
+
+void StreamBuffer::unmap() {
+    glBindBuffer(mTarget, mBuffer);
+    if(glUnmapBuffer(mTarget) != GL_TRUE)
+        std::cout << "ERROR::STREAMBUFFER::CONTENTS_LOST" << std::endl;
+    glBindBuffer(mTarget, 0);
+}
+
+void StreamBuffer::grow(GLsizeiptr minRegionSize) {
+    // New storage has no reads pending, so the old fences can go.
+    // What was written so far this frame stays with the old storage,
+    // which draws already issued keep reading from; anyone planning
+    // to reuse it is told to write it again by the frame count
+    std::cout << "Stream buffer regions grown to " << minRegionSize << " bytes" << std::endl;
+    mRegionSize = minRegionSize;
+    for(GLsync& fence: mFences) {
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    glBindBuffer(mTarget, mBuffer);
+    glBufferData(mTarget, mRegionSize * mFences.size(), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(mTarget, 0);
+    mHead = 0;
+    ++mFrame;
+}
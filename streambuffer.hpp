@@ -0,0 +1,66 @@
+#ifndef ZOSTREAMBUFFER_H
+#define ZOSTREAMBUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+/*
+A ring buffer for data that's written once a frame and read by that
+frame's draws. The buffer is split into a region per frame in flight;
+each frame writes only its own region, mapped unsynchronised so the
+driver never stalls on (or copies around) reads of older regions, and
+a fence at the end of the frame says when the GPU is done with it.
+A region is only handed out again once its fence has passed.
+The whole buffer can also be read as a buffer texture of RGBA32F
+texels, for shaders that look further along it than a bound range.
+
+If a frame needs more than a region holds, the buffer's storage is
+replaced with a bigger one; the driver keeps the old storage alive
+for the frames still reading it
+*/
+class StreamBuffer {
+public:
+    StreamBuffer(GLenum target, GLsizeiptr regionSize, std::size_t regionCount=3);
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer& other) = delete;
+    StreamBuffer& operator=(const StreamBuffer& other) = delete;
+
+    // Move on to the next region, waiting for the GPU to finish with
+    // it if it hasn't already
+    void beginFrame();
+    // Fence off the current region; call once the frame's draws have
+    // all been issued
+    void endFrame();
+
+    // Map size bytes of the current region, starting at a multiple of
+    // alignment, for writing. offset is set to where they start in
+    // the buffer. Every map must be unmapped before drawing
+    void* map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset);
+    void unmap();
+
+    GLuint getBufferID() const { return mBuffer; }
+    // Sees the buffer object, so it follows the buffer when it grows
+    GLuint getTextureID() const { return mTexture; }
+
+    // Changes every frame, and when the buffer grows; anything
+    // written before it last changed has to be written again
+    std::uint64_t getFrame() const { return mFrame; }
+
+private:
+    void grow(GLsizeiptr minRegionSize);
+
+    GLenum mTarget;
+    GLuint mBuffer {0};
+    GLuint mTexture {0};
+    GLsizeiptr mRegionSize;
+    std::size_t mRegion {0};
+    GLsizeiptr mHead {0}; // next free byte in the current region
+    std::uint64_t mFrame {0};
+    std::vector<GLsync> mFences;
+};
+
+#endif
@@ -5,7 +5,10 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
+#include "assetfilesystem.hpp"
+#include "glcallcounts.hpp"
 #include "texture.hpp"
+#include "profiler.hpp"
 #include "utility.hpp"
 
 void flip_surface(SDL_Surface* surface);
@@ -17,6 +20,13 @@ Texture::Texture(const std::string& filepath, const std::string& type): mID{0},
     } else std::cout << "Texture at " << filepath << " loaded successfully!" << std::endl;
 }
 
+Texture::Texture(SDL_Surface* image, const std::string& filepath, const std::string& type): mID{0}, filepath{filepath}, type{type} {
+    bool success { image && loadTextureFromSurface(image) };
+    if(!success) {
+        std::cout << "Could not load texture from " << filepath << '!' << std::endl;
+    } else std::cout << "Texture at " << filepath << " loaded successfully!" << std::endl;
+}
+
 Texture::Texture(GLuint textureID, const std::string& type):
     mID{textureID}, filepath {""}, type{type} 
 {}
@@ -97,12 +107,29 @@ void Texture::freeTexture() {
 bool Texture::loadTextureFromFile(const char* filename) {
     freeTexture();
 
-    // Load image from file into a convenient SDL surface, per the image itself
-    SDL_Surface* texture_image { IMG_Load(filename) };
+    SDL_Surface* pretexture { decodeImageFile(filename) };
+    if(!pretexture) return false;
+
+    bool success { loadTextureFromSurface(pretexture) };
+    SDL_FreeSurface(pretexture);
+    return success;
+}
+
+SDL_Surface* Texture::decodeImageFile(const char* filename) {
+    PROFILE_ZONE("Texture::decodeImageFile");
+    // Load image from file into a convenient SDL surface, per the
+    // image itself. Images in an asset pack are decoded in place
+    AssetData file {};
+    if(!readAsset(filename, file)) {
+        std::cout << "Could not load texture!\n"
+            << "Couldn't open " << filename << std::endl;
+        return nullptr;
+    }
+    SDL_Surface* texture_image { IMG_Load_RW(SDL_RWFromConstMem(file.data(), static_cast<int>(file.size())), 1) };
     if(!texture_image) {
         std::cout << "Could not load texture!\n" 
             << IMG_GetError() << std::endl;
-        return false;
+        return nullptr;
     }
 
     //Convert image from its present format -> RGBA
@@ -111,7 +138,7 @@ bool Texture::loadTextureFromFile(const char* filename) {
     texture_image = nullptr;
     if(!pretexture) {
         std::cout << "Something went wrong: " << SDL_GetError() << std::endl;
-        return false;
+        return nullptr;
     }
 
     // Flip texture vertically before loading them into OpenGL
@@ -119,30 +146,38 @@ bool Texture::loadTextureFromFile(const char* filename) {
     // the opposite)
     flip_surface(pretexture);
 
+    return pretexture;
+}
+
+bool Texture::loadTextureFromSurface(SDL_Surface* pretexture) {
+    freeTexture();
+    mID = uploadSurface(pretexture);
+    return mID != 0;
+}
+
+GLuint Texture::uploadSurface(SDL_Surface* pretexture) {
+    PROFILE_ZONE("Texture::uploadSurface");
+    if(!pretexture) return 0;
+
     // Move surface pixels to graphics card
     GLuint texture {};
     glGenTextures(1, &texture);
-    if(!texture) {
-        SDL_FreeSurface(pretexture);
-        return false;
-    }
-    glBindTexture(GL_TEXTURE_2D, texture);
+    if(!texture) return 0;
+    counted::bindTexture(GL_TEXTURE_2D, texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
         pretexture->w, pretexture->h,
         0, GL_RGBA, GL_UNSIGNED_BYTE, 
         reinterpret_cast<void*>(pretexture->pixels)
     );
-    SDL_FreeSurface(pretexture);
-    pretexture = nullptr;
 
     // Verify that no errors occurred while copying
     // texture to video memory
     if(glGetError() != GL_NO_ERROR) {
         std::cout << "Could not convert image to OpenGL texture!\n"
             << glewGetErrorString(glGetError()) << std::endl;
-        glBindTexture(GL_TEXTURE_2D, 0);
+        counted::bindTexture(GL_TEXTURE_2D, 0);
         glDeleteTextures(1, &texture);
-        return false;
+        return 0;
     }
 
     // Generate mipmaps, set some texture params
@@ -155,25 +190,22 @@ bool Texture::loadTextureFromFile(const char* filename) {
         GL_LINEAR_MIPMAP_LINEAR 
     );
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    mID = texture;
 
     //Unbind texture
-    bindTexture(false);
-
-    //return success
-    return true;
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+    return texture;
 }
 
 void Texture::bindTexture(bool bind) const {
     if(!bind || !mID){
-        glBindTexture(GL_TEXTURE_2D, 0);
+        counted::bindTexture(GL_TEXTURE_2D, 0);
         return;
     }
-    glBindTexture(GL_TEXTURE_2D, mID);
+    counted::bindTexture(GL_TEXTURE_2D, mID);
 }
 
 GLuint Texture::getTextureID() const { return mID; }
-std::string Texture::getType() const { return type; }
+const std::string& Texture::getType() const { return type; }
 
 void flip_surface(SDL_Surface* surface) {
     if(!surface) return;
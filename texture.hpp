@@ -5,9 +5,13 @@
 
 #include <GL/glew.h>
 
+struct SDL_Surface;
+
 class Texture {
 public:
     Texture(const std::string& filepath, const std::string& type);
+    // Upload an image already decoded with decodeImageFile
+    Texture(SDL_Surface* image, const std::string& filepath, const std::string& type);
     Texture(GLuint textureID, const std::string& type);
     Texture();
 
@@ -25,6 +29,7 @@ public:
 
     // Basic alloc and dealloc functions
     bool loadTextureFromFile(const char* filename);
+    bool loadTextureFromSurface(SDL_Surface* image);
     void freeTexture();
 
     //Bind/unbind texture
@@ -32,7 +37,16 @@ public:
 
     // Getter functions
     GLuint getTextureID() const;
-    std::string getType() const;
+    const std::string& getType() const;
+
+    // Read an image file into an RGBA surface, flipped the way GL
+    // expects. Makes no GL calls, so it's safe to run on any thread.
+    // The caller owns (and must free) the surface returned
+    static SDL_Surface* decodeImageFile(const char* filename);
+    // Make a mipmapped texture of an image from decodeImageFile, through
+    // whichever context is current on the calling thread. 0 if it
+    // couldn't be made
+    static GLuint uploadSurface(SDL_Surface* image);
 
 private:
     GLuint mID;
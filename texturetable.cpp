@@ -0,0 +1,96 @@
+#include <string>
+#include <iostream>
+
+#include <GL/glew.h>
+#include <SDL2/SDL.h>
+
+#include "texture.hpp"
+#include "glcallcounts.hpp"
+#include "texturetable.hpp"
+
+static const std::string NO_STRING {};
+
+static GLuint makePlaceholder() {
+    // Mid grey, opaque, so untextured geometry still shades and
+    // passes alpha tests
+    const GLubyte grey[4] {128, 128, 128, 255};
+    GLuint placeholder {0};
+    glGenTextures(1, &placeholder);
+    counted::bindTexture(GL_TEXTURE_2D, placeholder);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+    return placeholder;
+}
+
+TextureTable::TextureTable():
+    mPlaceholder {makePlaceholder(), "texture_diffuse"}
+{}
+
+TextureHandle TextureTable::acquire(const std::string& path, const std::string& type) {
+    auto found { mByPath.find(path) };
+    if(found != mByPath.end()) {
+        if(Entry* entry { mEntries.get(found->second) }) {
+            ++entry->mReferences;
+            return found->second;
+        }
+    }
+
+    TextureHandle texture {
+        mEntries.add(Entry {
+            .mPath {path},
+            .mTexture {GLuint {0}, type},
+            .mReferences {1},
+            .mLoaded {false}
+        })
+    };
+    mByPath[path] = texture;
+    return texture;
+}
+
+void TextureTable::release(TextureHandle texture) {
+    Entry* entry { mEntries.get(texture) };
+    if(!entry || --entry->mReferences > 0) return;
+    mByPath.erase(entry->mPath);
+    mEntries.remove(texture);
+}
+
+void TextureTable::upload(TextureHandle texture, SDL_Surface* image) {
+    Entry* entry { mEntries.get(texture) };
+    if(!entry || entry->mLoaded || !image) return;
+    entry->mTexture = Texture {image, entry->mPath, entry->mTexture.getType()};
+    entry->mLoaded = entry->mTexture.getTextureID() != 0;
+}
+
+void TextureTable::adopt(TextureHandle texture, GLuint textureID) {
+    if(!textureID) return;
+    Entry* entry { mEntries.get(texture) };
+    // Another model sharing it may have got there first
+    if(!entry || entry->mLoaded) {
+        glDeleteTextures(1, &textureID);
+        return;
+    }
+    entry->mTexture = Texture {textureID, entry->mTexture.getType()};
+    entry->mLoaded = true;
+}
+
+bool TextureTable::isLoaded(TextureHandle texture) const {
+    const Entry* entry { mEntries.get(texture) };
+    return entry && entry->mLoaded;
+}
+
+GLuint TextureTable::getTextureID(TextureHandle texture) const {
+    const Entry* entry { mEntries.get(texture) };
+    return entry && entry->mLoaded? entry->mTexture.getTextureID(): mPlaceholder.getTextureID();
+}
+
+const std::string& TextureTable::getType(TextureHandle texture) const {
+    const Entry* entry { mEntries.get(texture) };
+    return entry? entry->mTexture.getType(): NO_STRING;
+}
+
+const std::string& TextureTable::getPath(TextureHandle texture) const {
+    const Entry* entry { mEntries.get(texture) };
+    return entry? entry->mPath: NO_STRING;
+}
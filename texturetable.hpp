@@ -0,0 +1,72 @@
+#ifndef ZOTEXTURETABLE_H
+#define ZOTEXTURETABLE_H
+
+#include <cstddef>
+#include <string>
+#include <map>
+
+#include <GL/glew.h>
+
+#include "handle.hpp"
+#include "texture.hpp"
+
+struct SDL_Surface;
+
+struct TextureTag;
+using TextureHandle = Handle<TextureTag>;
+
+/*
+Textures shared between models, looked up by handle. A texture gets
+its handle as soon as something asks for it, before its image has
+been read, and is drawn as a flat grey placeholder until its image is
+uploaded. Textures are shared by path and counted; the last release
+deletes one. All on the GL thread, though textures can be made
+elsewhere and adopted
+*/
+class TextureTable {
+public:
+    TextureTable();
+
+    TextureTable(const TextureTable& other) = delete;
+    TextureTable& operator=(const TextureTable& other) = delete;
+
+    // Handle for the texture at path, sampled as type
+    // ("texture_diffuse" or "texture_specular"). Nothing is loaded;
+    // that's up to whoever gets the handle first, through upload()
+    TextureHandle acquire(const std::string& path, const std::string& type);
+    void release(TextureHandle texture);
+
+    // Give texture its image, decoded with Texture::decodeImageFile.
+    // A null image leaves it on the placeholder for good
+    void upload(TextureHandle texture, SDL_Surface* image);
+    // Or one already made, on the upload thread (see uploadqueue.hpp).
+    // The table owns textureID from then on, deleting it if texture
+    // has been loaded since or is gone; 0 leaves the placeholder
+    void adopt(TextureHandle texture, GLuint textureID);
+
+    bool isLoaded(TextureHandle texture) const;
+
+    // The texture to bind for handle: the placeholder until it's
+    // loaded, and for null or stale handles
+    GLuint getTextureID(TextureHandle texture) const;
+    // Empty for null or stale handles
+    const std::string& getType(TextureHandle texture) const;
+    const std::string& getPath(TextureHandle texture) const;
+
+    GLuint getPlaceholderID() const { return mPlaceholder.getTextureID(); }
+    std::size_t size() const { return mEntries.size(); }
+
+private:
+    struct Entry {
+        std::string mPath;
+        Texture mTexture;
+        std::size_t mReferences;
+        bool mLoaded;
+    };
+
+    HandlePool<Entry, TextureTag> mEntries;
+    std::map<std::string, TextureHandle> mByPath;
+    Texture mPlaceholder;
+};
+
+#endif
@@ -0,0 +1,159 @@
+// Builds an asset pack (see assetpack.hpp) from files and directories,
+// stored under the paths given, relative to where this is run:
+//
+//   packassets [--compress none|lz4|zstd] [--align N] out.pack media shaders
+//
+// Assets are looked up by the same paths the program would open them
+// by, so run it from the directory the program runs from
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+
+#include "../assetpack.hpp"
+
+using namespace AssetPackFormat;
+
+struct PackedAsset {
+    std::string mName;
+    std::vector<std::uint8_t> mBytes;
+    Entry mEntry;
+};
+
+static void gatherFiles(const std::filesystem::path& path, std::vector<std::string>& files) {
+    if(std::filesystem::is_directory(path)) {
+        for(const auto& item: std::filesystem::recursive_directory_iterator {path}) {
+            if(item.is_regular_file()) files.push_back(item.path().generic_string());
+        }
+    } else files.push_back(path.generic_string());
+}
+
+static bool readFile(const std::string& path, std::vector<std::uint8_t>& bytes) {
+    std::ifstream file {path, std::ios::binary};
+    if(!file) return false;
+    bytes.assign(std::istreambuf_iterator<char> {file}, std::istreambuf_iterator<char> {});
+    return true;
+}
+
+static void pad(std::ofstream& out, std::uint64_t& offset, std::uint64_t alignment) {
+    while(offset % alignment) {
+        out.put('\0');
+        ++offset;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Compression compression {stored};
+    std::uint32_t alignment {64};
+    std::vector<std::string> arguments {};
+    for(int i {1}; i < argc; ++i) {
+        std::string argument {argv[i]};
+        if(argument == "--compress" && i + 1 < argc) {
+            std::string name {argv[++i]};
+            if(name == "lz4") compression = lz4;
+            else if(name == "zstd") compression = zstd;
+            else if(name != "none") {
+                std::cout << "Unknown compression " << name << std::endl;
+                return 1;
+            }
+        } else if(argument == "--align" && i + 1 < argc) {
+            alignment = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+            if(alignment < alignof(Entry) || (alignment & (alignment - 1))) {
+                std::cout << "Alignment has to be a power of two, at least " << alignof(Entry) << std::endl;
+                return 1;
+            }
+        } else arguments.push_back(argument);
+    }
+    if(arguments.size() < 2) {
+        std::cout << "Usage: packassets [--compress none|lz4|zstd] [--align N] out.pack file-or-directory..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files {};
+    for(std::size_t i {1}; i < arguments.size(); ++i) gatherFiles(arguments[i], files);
+
+    // Read and compress everything, dropping repeats
+    std::vector<PackedAsset> assets {};
+    std::vector<std::uint8_t> compressed {};
+    for(const std::string& file: files) {
+        std::string name { normalizeAssetPath(file) };
+        bool repeated {
+            std::any_of(assets.begin(), assets.end(), [&](const PackedAsset& asset) { return asset.mName == name; })
+        };
+        if(repeated) continue;
+
+        PackedAsset asset { .mName {name}, .mBytes {}, .mEntry {} };
+        if(!readFile(file, asset.mBytes)) {
+            std::cout << "Couldn't read " << file << std::endl;
+            return 1;
+        }
+        asset.mEntry.mHash = hashAssetPath(name);
+        asset.mEntry.mSize = asset.mBytes.size();
+        asset.mEntry.mCompression = stored;
+        if(compression != stored && compressAsset(compression, asset.mBytes.data(), asset.mBytes.size(), compressed)) {
+            asset.mBytes.swap(compressed);
+            asset.mEntry.mCompression = compression;
+        }
+        asset.mEntry.mStoredSize = asset.mBytes.size();
+        assets.push_back(std::move(asset));
+    }
+    if(compression != stored && std::none_of(assets.begin(), assets.end(), [](const PackedAsset& asset) { return asset.mEntry.mCompression != stored; }))
+        std::cout << "Nothing was compressed (is this build missing ZO_PACK_LZ4 or ZO_PACK_ZSTD?)" << std::endl;
+
+    // Lookups binary search the index by hash
+    std::sort(assets.begin(), assets.end(), [](const PackedAsset& a, const PackedAsset& b) {
+        return a.mEntry.mHash != b.mEntry.mHash? a.mEntry.mHash < b.mEntry.mHash: a.mName < b.mName;
+    });
+
+    std::ofstream out {arguments[0], std::ios::binary};
+    if(!out) {
+        std::cout << "Couldn't write " << arguments[0] << std::endl;
+        return 1;
+    }
+    Header header {};
+    std::memcpy(header.mMagic, MAGIC, sizeof(MAGIC));
+    header.mVersion = VERSION;
+    header.mEntryCount = static_cast<std::uint32_t>(assets.size());
+    header.mAlignment = alignment;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::uint64_t offset {sizeof(header)};
+    std::uint32_t nameOffset {0};
+    for(PackedAsset& asset: assets) {
+        pad(out, offset, alignment);
+        asset.mEntry.mOffset = offset;
+        asset.mEntry.mNameOffset = nameOffset;
+        asset.mEntry.mNameLength = static_cast<std::uint32_t>(asset.mName.size());
+        out.write(reinterpret_cast<const char*>(asset.mBytes.data()), asset.mBytes.size());
+        offset += asset.mBytes.size();
+        nameOffset += asset.mEntry.mNameLength;
+    }
+
+    pad(out, offset, alignof(Entry));
+    header.mIndexOffset = offset;
+    for(const PackedAsset& asset: assets) {
+        out.write(reinterpret_cast<const char*>(&asset.mEntry), sizeof(Entry));
+        offset += sizeof(Entry);
+    }
+    header.mNamesOffset = offset;
+    for(const PackedAsset& asset: assets) out.write(asset.mName.data(), asset.mName.size());
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if(!out) {
+        std::cout << "Couldn't write " << arguments[0] << std::endl;
+        return 1;
+    }
+
+    std::uint64_t originalSize {0};
+    for(const PackedAsset& asset: assets) originalSize += asset.mEntry.mSize;
+    std::cout << "Packed " << assets.size() << " assets, " << originalSize << " bytes, into "
+        << arguments[0] << " (" << offset + nameOffset << " bytes)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "shared_globals.hpp"
+#include "jobsystem.hpp"
+#include "profiler.hpp"
+#include "transform.hpp"
+
+// Smallest batch of transforms worth handing to another worker
+const std::size_t MIN_TRANSFORMS_PER_BATCH {1024};
+
+TransformID TransformHierarchy::addTransform(TransformID parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    std::uint32_t parentSlot { parent == NO_TRANSFORM? NO_TRANSFORM: mSlotOfID[parent] };
+    std::uint32_t depth { parent == NO_TRANSFORM? 0: mDepths[parentSlot] + 1 };
+    std::uint32_t slot { static_cast<std::uint32_t>(mParents.size()) };
+    TransformID id { static_cast<TransformID>(mSlotOfID.size()) };
+
+    mPositions.push_back(position);
+    mRotations.push_back(rotation);
+    mScales.push_back(scale);
+    mParents.push_back(parentSlot);
+    mDepths.push_back(depth);
+    mDirty.push_back(1);
+    mWorldMatrices.push_back(glm::mat4(1.f));
+    mNormalMatrices.push_back(glm::mat4(1.f));
+    mSlotOfID.push_back(slot);
+    mIDOfSlot.push_back(id);
+
+    // Level boundaries have to be rebuilt, and the new transform may
+    // be shallower than the deepest existing one
+    mNeedsSort = true;
+    mAnyDirty = true;
+
+    return id;
+}
+
+void TransformHierarchy::setPosition(TransformID id, const glm::vec3& position) {
+    mPositions[mSlotOfID[id]] = position;
+    markDirty(id);
+}
+void TransformHierarchy::setRotation(TransformID id, const glm::quat& rotation) {
+    mRotations[mSlotOfID[id]] = rotation;
+    markDirty(id);
+}
+void TransformHierarchy::setScale(TransformID id, const glm::vec3& scale) {
+    mScales[mSlotOfID[id]] = scale;
+    markDirty(id);
+}
+
+glm::vec3 TransformHierarchy::getPosition(TransformID id) const { return mPositions[mSlotOfID[id]]; }
+glm::quat TransformHierarchy::getRotation(TransformID id) const { return mRotations[mSlotOfID[id]]; }
+glm::vec3 TransformHierarchy::getScale(TransformID id) const { return mScales[mSlotOfID[id]]; }
+TransformID TransformHierarchy::getParent(TransformID id) const {
+    std::uint32_t parentSlot { mParents[mSlotOfID[id]] };
+    return parentSlot == NO_TRANSFORM? NO_TRANSFORM: mIDOfSlot[parentSlot];
+}
+
+const glm::mat4& TransformHierarchy::getWorldMatrix(TransformID id) const {
+    return mWorldMatrices[mSlotOfID[id]];
+}
+const glm::mat4& TransformHierarchy::getNormalMatrix(TransformID id) const {
+    return mNormalMatrices[mSlotOfID[id]];
+}
+
+void TransformHierarchy::markDirty(TransformID id) {
+    mDirty[mSlotOfID[id]] = 1;
+    mAnyDirty = true;
+}
+
+void TransformHierarchy::update() {
+    PROFILE_ZONE("TransformHierarchy::update");
+    if(mNeedsSort) {
+        sortByDepth();
+        mNeedsSort = false;
+    }
+
+    // Static scenes stop here
+    if(!mAnyDirty) return;
+
+    // Parents always precede their children, so a single forward
+    // pass pushes dirtiness all the way down the hierarchy
+    for(std::size_t i {0}; i < mParents.size(); ++i) {
+        if(mParents[i] != NO_TRANSFORM && mDirty[mParents[i]])
+            mDirty[i] = 1;
+    }
+
+    // Every transform in a level depends only on the level above it,
+    // so each level is split into independent contiguous batches
+    for(std::size_t level {0}; level + 1 < mLevelStarts.size(); ++level) {
+        std::size_t begin { mLevelStarts[level] };
+        std::size_t end { mLevelStarts[level + 1] };
+        gJobSystem->parallelFor(end - begin, MIN_TRANSFORMS_PER_BATCH,
+            [this, begin](std::size_t batchBegin, std::size_t batchEnd) {
+                updateRange(begin + batchBegin, begin + batchEnd);
+            }
+        );
+    }
+
+    std::fill(mDirty.begin(), mDirty.end(), 0);
+    mAnyDirty = false;
+}
+
+void TransformHierarchy::updateRange(std::size_t begin, std::size_t end) {
+    for(std::size_t i {begin}; i < end; ++i) {
+        if(!mDirty[i]) continue;
+
+        glm::mat4 local { glm::translate(glm::mat4(1.f), mPositions[i]) };
+        local = local * glm::mat4_cast(mRotations[i]);
+        local = glm::scale(local, mScales[i]);
+
+        mWorldMatrices[i] = (
+            mParents[i] == NO_TRANSFORM?
+            local: mWorldMatrices[mParents[i]] * local
+        );
+        mNormalMatrices[i] = glm::mat4(
+            glm::transpose(glm::inverse(glm::mat3(mWorldMatrices[i])))
+        );
+    }
+}
+
+void TransformHierarchy::sortByDepth() {
+    std::size_t count { mParents.size() };
+
+    if(!std::is_sorted(mDepths.begin(), mDepths.end())) {
+        // Find each slot's new position, keeping insertion order
+        // within a level
+        std::vector<std::uint32_t> order (count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+            [this](std::uint32_t a, std::uint32_t b) { return mDepths[a] < mDepths[b]; }
+        );
+        std::vector<std::uint32_t> newSlotOf (count);
+        for(std::size_t i {0}; i < count; ++i) newSlotOf[order[i]] = i;
+
+        auto permute = [&order](auto& values) {
+            auto sorted { values };
+            for(std::size_t i {0}; i < order.size(); ++i) sorted[i] = values[order[i]];
+            values = std::move(sorted);
+        };
+        permute(mPositions);
+        permute(mRotations);
+        permute(mScales);
+        permute(mParents);
+        permute(mDepths);
+        permute(mDirty);
+        permute(mWorldMatrices);
+        permute(mNormalMatrices);
+        permute(mIDOfSlot);
+
+        for(std::uint32_t& parent: mParents) {
+            if(parent != NO_TRANSFORM) parent = newSlotOf[parent];
+        }
+        for(std::size_t i {0}; i < count; ++i) mSlotOfID[mIDOfSlot[i]] = i;
+    }
+
+    mLevelStarts.clear();
+    for(std::size_t i {0}; i < count; ++i) {
+        while(mLevelStarts.size() <= mDepths[i]) mLevelStarts.push_back(i);
+    }
+    mLevelStarts.push_back(count);
+}
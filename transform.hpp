@@ -0,0 +1,78 @@
+#ifndef ZOTRANSFORM_H
+#define ZOTRANSFORM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Stable handle to a transform; unlike the transform's storage slot,
+// it survives the hierarchy being re-sorted
+using TransformID = std::uint32_t;
+const TransformID NO_TRANSFORM { 0xFFFFFFFFu };
+
+/*
+A hierarchy of transforms stored as structure-of-arrays. Slots are
+kept sorted by depth so that a parent always precedes its children,
+which lets world matrices be computed one depth level at a time, with
+every transform in a level updated independently of the others
+*/
+class TransformHierarchy {
+public:
+    TransformID addTransform(
+        TransformID parent,
+        const glm::vec3& position=glm::vec3(0.f),
+        const glm::quat& rotation=glm::quat(1.f, 0.f, 0.f, 0.f),
+        const glm::vec3& scale=glm::vec3(1.f)
+    );
+
+    // Local transform setters; each marks the transform (and so its
+    // descendants) as needing an update
+    void setPosition(TransformID id, const glm::vec3& position);
+    void setRotation(TransformID id, const glm::quat& rotation);
+    void setScale(TransformID id, const glm::vec3& scale);
+
+    glm::vec3 getPosition(TransformID id) const;
+    glm::quat getRotation(TransformID id) const;
+    glm::vec3 getScale(TransformID id) const;
+    TransformID getParent(TransformID id) const;
+
+    // World and normal matrices as of the last call to update()
+    const glm::mat4& getWorldMatrix(TransformID id) const;
+    const glm::mat4& getNormalMatrix(TransformID id) const;
+
+    // Recompute world matrices of dirty transforms and their
+    // descendants. Does nothing at all when no transform has changed
+    void update();
+
+    std::size_t size() const { return mParents.size(); }
+
+private:
+    void markDirty(TransformID id);
+    void sortByDepth();
+    void updateRange(std::size_t begin, std::size_t end);
+
+    // Per-slot data, sorted by depth
+    std::vector<glm::vec3> mPositions;
+    std::vector<glm::quat> mRotations;
+    std::vector<glm::vec3> mScales;
+    std::vector<std::uint32_t> mParents; // parent slot, or NO_TRANSFORM
+    std::vector<std::uint32_t> mDepths;
+    std::vector<std::uint8_t> mDirty;
+    std::vector<glm::mat4> mWorldMatrices;
+    std::vector<glm::mat4> mNormalMatrices;
+
+    // Mapping between stable IDs and slots
+    std::vector<std::uint32_t> mSlotOfID;
+    std::vector<TransformID> mIDOfSlot;
+
+    // First slot of each depth level, plus one past the last slot
+    std::vector<std::size_t> mLevelStarts;
+
+    bool mNeedsSort {false};
+    bool mAnyDirty {false};
+};
+
+#endif
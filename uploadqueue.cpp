@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <utility>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "profiler.hpp"
+#include "uploadqueue.hpp"
+
+UploadQueue::UploadQueue(Context context):
+    mContext {std::move(context)}
+{
+    mThread = std::thread {&UploadQueue::run, this};
+    std::unique_lock<std::mutex> lock {mMutex};
+    mStarted.wait(lock, [this]{ return !mStarting; });
+}
+
+UploadQueue::~UploadQueue() {
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mQuit = true;
+    }
+    mJobReady.notify_all();
+    mThread.join();
+
+    // Jobs not yet run are dropped; their fences can go from here
+    for(Finished& finished: mFinished) glDeleteSync(finished.mFence);
+}
+
+std::uint64_t UploadQueue::submit(Job job) {
+    std::uint64_t ticket { ++mSubmitted };
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mJobs.push_back(Pending { .mTicket {ticket}, .mJob {std::move(job)} });
+    }
+    mJobReady.notify_one();
+    return ticket;
+}
+
+void UploadQueue::update() {
+    PROFILE_ZONE("UploadQueue::update");
+    std::lock_guard<std::mutex> lock {mMutex};
+    // Jobs finish in order, so once one's fence isn't signalled none
+    // after it are either
+    while(!mFinished.empty()) {
+        Finished& finished { mFinished.front() };
+        GLenum status { glClientWaitSync(finished.mFence, 0, 0) };
+        if(status == GL_TIMEOUT_EXPIRED) break;
+        if(status == GL_WAIT_FAILED) std::cout << "ERROR::UPLOADQUEUE::FENCE_WAIT_FAILED" << std::endl;
+        glDeleteSync(finished.mFence);
+        mDone = finished.mTicket;
+        mFinished.pop_front();
+    }
+}
+
+void UploadQueue::run() {
+    PROFILE_THREAD_NAME("GL upload");
+    bool running { mContext.mMakeCurrent() };
+    if(!running) std::cout << "ERROR::UPLOADQUEUE::CONTEXT_NOT_CURRENT" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mRunning = running;
+        mStarting = false;
+    }
+    mStarted.notify_all();
+    if(!running) return;
+
+    for(;;) {
+        Pending pending {};
+        {
+            std::unique_lock<std::mutex> lock {mMutex};
+            mJobReady.wait(lock, [this]{ return mQuit || !mJobs.empty(); });
+            if(mQuit) break;
+            pending = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+
+        {
+            PROFILE_ZONE("Upload");
+            pending.mJob();
+        }
+        // Flushed, so the fence is certain to signal without anyone
+        // waiting on it
+        GLsync fence { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) };
+        glFlush();
+
+        std::lock_guard<std::mutex> lock {mMutex};
+        mFinished.push_back(Finished { .mTicket {pending.mTicket}, .mFence {fence} });
+    }
+    mContext.mRelease();
+}
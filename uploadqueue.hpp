@@ -0,0 +1,96 @@
+#ifndef ZOUPLOADQUEUE_H
+#define ZOUPLOADQUEUE_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+/*
+A thread of its own for putting data on the GPU: creating and filling
+buffers and textures through a second GL context that shares objects
+with the GL thread's, so big glBufferData and glTexImage2D calls never
+hold up a frame.
+
+Jobs run in the order they're submitted, each followed by a fence.
+The GL thread checks the fences without waiting, once a frame in
+update(), and a job's objects are only theirs to use once isDone()
+says so. Per GL's rules for sharing, they must be bound again on the
+GL thread after that before their new contents are certain to show,
+which happens anyway as they're drawn with.
+
+Container objects (vertex arrays, framebuffers) aren't shared between
+contexts, so those are still made on the GL thread, around buffers
+made here
+*/
+class UploadQueue {
+public:
+    using Job = std::function<void()>;
+
+    // How the thread gets at its context: made current on it as the
+    // thread starts, released as it stops
+    struct Context {
+        std::function<bool()> mMakeCurrent;
+        std::function<void()> mRelease;
+    };
+
+    // Start the thread, returning once it has its context current
+    // (or failed to)
+    explicit UploadQueue(Context context);
+    ~UploadQueue();
+
+    UploadQueue(const UploadQueue& other) = delete;
+    UploadQueue& operator=(const UploadQueue& other) = delete;
+
+    // False if the thread couldn't make its context current, in which
+    // case nothing submitted will ever run
+    bool isRunning() const { return mRunning; }
+
+    // Run job on the upload thread, with its context current. Returns
+    // a ticket to check on it with; tickets count up from 1. Anything
+    // job uses must stay alive until it's done, even if whoever
+    // submitted it is gone by then
+    std::uint64_t submit(Job job);
+
+    // Find out, without waiting, which jobs the GPU has finished. Call
+    // once a frame on the GL thread
+    void update();
+
+    // Job ticket, and every one before it, is finished, as of the
+    // last update()
+    bool isDone(std::uint64_t ticket) const { return ticket <= mDone; }
+
+private:
+    struct Pending {
+        std::uint64_t mTicket;
+        Job mJob;
+    };
+
+    struct Finished {
+        std::uint64_t mTicket;
+        GLsync mFence;
+    };
+
+    void run();
+
+    Context mContext;
+    bool mRunning {false};
+    std::uint64_t mSubmitted {0};
+    std::uint64_t mDone {0}; // GL thread only
+
+    // Shared with the upload thread
+    std::mutex mMutex;
+    std::condition_variable mJobReady;
+    std::condition_variable mStarted;
+    bool mStarting {true};
+    bool mQuit {false};
+    std::deque<Pending> mJobs;
+    std::deque<Finished> mFinished; // oldest first
+    std::thread mThread;
+};
+
+#endif
@@ -1,3 +1,6 @@
+#include <SDL2/SDL.h>
+
+#include "shared_globals.hpp"
 #include "utility.hpp"
 
 int nearestPowerOfTwo_32bit(int n) {
@@ -10,3 +13,13 @@ int nearestPowerOfTwo_32bit(int n) {
     n += 1;
     return n;
 }
+
+void getDrawableSize(int& width, int& height) {
+    width = gWindowWidth;
+    height = gWindowHeight;
+    if(gWindow) SDL_GL_GetDrawableSize(gWindow, &width, &height);
+    if(width <= 0 || height <= 0) {
+        width = gWindowWidth;
+        height = gWindowHeight;
+    }
+}
@@ -3,4 +3,9 @@
 
 int nearestPowerOfTwo_32bit(int n);
 
+// Size of what's actually drawn to, in pixels: the window's drawable
+// area, which can differ from its size in screen coordinates (high DPI)
+// and follows resizes, or the configured size without a window
+void getDrawableSize(int& width, int& height);
+
 #endif
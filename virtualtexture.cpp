@@ -0,0 +1,521 @@
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <SDL2/SDL.h>
+#include <glm/glm.hpp>
+
+#include "texture.hpp"
+#include "profiler.hpp"
+#include "glcallcounts.hpp"
+#include "virtualtexture.hpp"
+
+namespace {
+    // Tile stores are this header, then every tile of every level,
+    // finest level first and each level row by row from the bottom,
+    // PAGE_SIZE^2 RGBA texels apiece, borders included
+    struct TileStoreHeader {
+        char mMagic[4];
+        std::uint32_t mVersion;
+        std::uint32_t mSize;   // of level 0, along each side
+        std::uint32_t mLevels;
+    };
+    constexpr char TILE_STORE_MAGIC[4] {'Z', 'O', 'V', 'T'};
+    constexpr std::uint32_t TILE_STORE_VERSION {1};
+
+    // Feedback can name tiles, levels and textures up to 255
+    constexpr int MAX_TILES {256};
+    constexpr std::size_t MAX_TEXTURES {255};
+
+    constexpr std::size_t TILE_BYTES { static_cast<std::size_t>(VirtualTextureCache::PAGE_SIZE) * VirtualTextureCache::PAGE_SIZE * 4 };
+    // Enough to keep the loader busy without chasing views the
+    // camera has long since left
+    constexpr std::size_t MAX_PENDING {64};
+    constexpr std::size_t MAX_UPLOADS_PER_FRAME {8};
+    constexpr std::size_t FEEDBACK_READBACKS {3};
+}
+
+// Texel (x, y) of a size x size RGBA image that repeats
+static const std::uint8_t* wrappedTexel(const std::vector<std::uint8_t>& image, int size, int x, int y) {
+    x = ((x % size) + size) % size;
+    y = ((y % size) + size) % size;
+    return &image[(static_cast<std::size_t>(y) * size + x) * 4];
+}
+
+bool VirtualTextureCache::buildTileStore(const char* imagePath, const std::string& storePath) {
+    PROFILE_ZONE("VirtualTextureCache::buildTileStore");
+    SDL_Surface* image { Texture::decodeImageFile(imagePath) };
+    if(!image) return false;
+
+    int size {TILE_SIZE};
+    while(size < std::max(image->w, image->h) && size < TILE_SIZE * MAX_TILES) size *= 2;
+
+    // Level 0, bilinearly resampled to size x size where it isn't
+    // already
+    std::vector<std::uint8_t> level(static_cast<std::size_t>(size) * size * 4);
+    const std::uint8_t* pixels { static_cast<const std::uint8_t*>(image->pixels) };
+    auto sourceTexel = [&](int x, int y) {
+        x = ((x % image->w) + image->w) % image->w;
+        y = ((y % image->h) + image->h) % image->h;
+        return pixels + static_cast<std::size_t>(y) * image->pitch + x * 4;
+    };
+    for(int y {0}; y < size; ++y) {
+        float v { (y + .5f) * image->h / size - .5f };
+        int y0 { static_cast<int>(std::floor(v)) };
+        float fy { v - y0 };
+        for(int x {0}; x < size; ++x) {
+            float u { (x + .5f) * image->w / size - .5f };
+            int x0 { static_cast<int>(std::floor(u)) };
+            float fx { u - x0 };
+            for(int c {0}; c < 4; ++c) {
+                float top { sourceTexel(x0, y0 + 1)[c] * (1.f - fx) + sourceTexel(x0 + 1, y0 + 1)[c] * fx };
+                float bottom { sourceTexel(x0, y0)[c] * (1.f - fx) + sourceTexel(x0 + 1, y0)[c] * fx };
+                level[(static_cast<std::size_t>(y) * size + x) * 4 + c] = static_cast<std::uint8_t>(bottom * (1.f - fy) + top * fy + .5f);
+            }
+        }
+    }
+    SDL_FreeSurface(image);
+
+    std::ofstream store {storePath, std::ios::binary};
+    if(!store) {
+        std::cout << "ERROR::VIRTUALTEXTURE::STORE_NOT_WRITTEN " << storePath << std::endl;
+        return false;
+    }
+    TileStoreHeader header {};
+    std::memcpy(header.mMagic, TILE_STORE_MAGIC, sizeof(TILE_STORE_MAGIC));
+    header.mVersion = TILE_STORE_VERSION;
+    header.mSize = static_cast<std::uint32_t>(size);
+    for(int tiles {size / TILE_SIZE}; tiles > 0; tiles /= 2) ++header.mLevels;
+    store.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<std::uint8_t> page(TILE_BYTES);
+    for(int levelSize {size}; levelSize >= TILE_SIZE; levelSize /= 2) {
+        int tiles { levelSize / TILE_SIZE };
+        for(int tileY {0}; tileY < tiles; ++tileY) {
+            for(int tileX {0}; tileX < tiles; ++tileX) {
+                for(int y {0}; y < PAGE_SIZE; ++y) {
+                    for(int x {0}; x < PAGE_SIZE; ++x) {
+                        const std::uint8_t* texel {
+                            wrappedTexel(level, levelSize, tileX * TILE_SIZE + x - TILE_BORDER, tileY * TILE_SIZE + y - TILE_BORDER)
+                        };
+                        std::memcpy(&page[(static_cast<std::size_t>(y) * PAGE_SIZE + x) * 4], texel, 4);
+                    }
+                }
+                store.write(reinterpret_cast<const char*>(page.data()), page.size());
+            }
+        }
+
+        // Box filter down to the next level
+        int half { levelSize / 2 };
+        for(int y {0}; y < half; ++y) {
+            for(int x {0}; x < half; ++x) {
+                for(int c {0}; c < 4; ++c) {
+                    int sum {
+                        wrappedTexel(level, levelSize, 2 * x, 2 * y)[c] + wrappedTexel(level, levelSize, 2 * x + 1, 2 * y)[c]
+                        + wrappedTexel(level, levelSize, 2 * x, 2 * y + 1)[c] + wrappedTexel(level, levelSize, 2 * x + 1, 2 * y + 1)[c]
+                    };
+                    // Written behind where it's read from, so in place
+                    level[(static_cast<std::size_t>(y) * half + x) * 4 + c] = static_cast<std::uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+    if(!store) {
+        std::cout << "ERROR::VIRTUALTEXTURE::STORE_NOT_WRITTEN " << storePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+VirtualTextureCache::VirtualTextureCache(int pagesPerSide, int feedbackDivisor):
+    mFeedbackShader {"shaders/vertex.vs", "shaders/vt_feedback.fs"},
+    mFeedbackDivisor {std::max(1, feedbackDivisor)},
+    mPagesPerSide {std::clamp(pagesPerSide, 2, MAX_TILES)},
+    mReadbacks(FEEDBACK_READBACKS),
+    mPages(static_cast<std::size_t>(mPagesPerSide) * mPagesPerSide)
+{
+    // The atlas is never mipmapped; mip levels are separate tiles
+    int atlasSize { mPagesPerSide * PAGE_SIZE };
+    glGenTextures(1, &mAtlas);
+    counted::bindTexture(GL_TEXTURE_2D, mAtlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &mFeedbackFBO);
+    glGenTextures(1, &mFeedbackColor);
+    glGenRenderbuffers(1, &mFeedbackDepth);
+    for(Readback& readback: mReadbacks) glGenBuffers(1, &readback.mPBO);
+
+    mLoader = std::thread {&VirtualTextureCache::loaderLoop, this};
+}
+
+VirtualTextureCache::~VirtualTextureCache() {
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        mQuit = true;
+    }
+    mLoadReady.notify_all();
+    mLoader.join();
+
+    for(Readback& readback: mReadbacks) {
+        glDeleteSync(readback.mFence);
+        glDeleteBuffers(1, &readback.mPBO);
+    }
+    for(std::unique_ptr<VirtualTexture>& texture: mTextures) glDeleteTextures(1, &texture->mIndirection);
+    glDeleteRenderbuffers(1, &mFeedbackDepth);
+    glDeleteTextures(1, &mFeedbackColor);
+    glDeleteFramebuffers(1, &mFeedbackFBO);
+    glDeleteTextures(1, &mAtlas);
+}
+
+bool VirtualTextureCache::getBuildSuccess() {
+    return mFeedbackShader.getBuildSuccess();
+}
+
+VirtualTextureCache::TileKey VirtualTextureCache::makeKey(std::size_t texture, int level, int x, int y) {
+    return (static_cast<TileKey>(texture) << 32) | (static_cast<TileKey>(level) << 16)
+        | (static_cast<TileKey>(y) << 8) | static_cast<TileKey>(x);
+}
+
+bool VirtualTextureCache::readTile(std::ifstream& store, const VirtualTexture& texture, int level, int x, int y, std::vector<std::uint8_t>& pixels) {
+    std::size_t tile { texture.mLevelStarts[level] + static_cast<std::size_t>(y) * (texture.mTiles >> level) + x };
+    pixels.resize(TILE_BYTES);
+    store.clear();
+    store.seekg(static_cast<std::streamoff>(sizeof(TileStoreHeader) + tile * TILE_BYTES));
+    return static_cast<bool>(store.read(reinterpret_cast<char*>(pixels.data()), pixels.size()));
+}
+
+GLuint VirtualTextureCache::addTexture(const std::string& storePath) {
+    if(mTextures.size() >= MAX_TEXTURES) {
+        std::cout << "ERROR::VIRTUALTEXTURE::TOO_MANY_TEXTURES" << std::endl;
+        return 0;
+    }
+    std::ifstream store {storePath, std::ios::binary};
+    TileStoreHeader header {};
+    store.read(reinterpret_cast<char*>(&header), sizeof(header));
+    int tiles { static_cast<int>(header.mSize / TILE_SIZE) };
+    if(
+        !store || std::memcmp(header.mMagic, TILE_STORE_MAGIC, sizeof(TILE_STORE_MAGIC)) != 0
+        || header.mVersion != TILE_STORE_VERSION || tiles < 1 || tiles > MAX_TILES
+        || header.mSize != static_cast<std::uint32_t>(tiles * TILE_SIZE) || (tiles & (tiles - 1))
+        || (tiles >> (header.mLevels - 1)) != 1
+    ) {
+        std::cout << "ERROR::VIRTUALTEXTURE::INVALID_STORE " << storePath << std::endl;
+        return 0;
+    }
+
+    std::unique_ptr<VirtualTexture> texture { std::make_unique<VirtualTexture>() };
+    texture->mStorePath = storePath;
+    texture->mTiles = tiles;
+    texture->mLevels = static_cast<int>(header.mLevels);
+    std::size_t levelStart {0};
+    for(int level {0}; level < texture->mLevels; ++level) {
+        int levelTiles { tiles >> level };
+        texture->mLevelStarts.push_back(levelStart);
+        texture->mEntries.emplace_back(static_cast<std::size_t>(levelTiles) * levelTiles);
+        levelStart += static_cast<std::size_t>(levelTiles) * levelTiles;
+    }
+
+    // One texel per tile, a mip level per tile level, all read as is
+    glGenTextures(1, &texture->mIndirection);
+    counted::bindTexture(GL_TEXTURE_2D, texture->mIndirection);
+    for(int level {0}; level < texture->mLevels; ++level)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, tiles >> level, tiles >> level, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture->mLevels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+
+    // The coarsest tile stays, so every texel always has something
+    std::vector<std::uint8_t> pixels {};
+    if(!readTile(store, *texture, texture->mLevels - 1, 0, 0, pixels)) {
+        std::cout << "ERROR::VIRTUALTEXTURE::INVALID_STORE " << storePath << std::endl;
+        glDeleteTextures(1, &texture->mIndirection);
+        return 0;
+    }
+    GLuint indirection { texture->mIndirection };
+    std::size_t index { mTextures.size() };
+    mTextures.push_back(std::move(texture));
+    uploadTile(makeKey(index, mTextures[index]->mLevels - 1, 0, 0), pixels, true);
+    updateIndirection(*mTextures[index], index);
+    return indirection;
+}
+
+void VirtualTextureCache::resizeFeedback(int width, int height) {
+    mFeedbackWidth = width;
+    mFeedbackHeight = height;
+
+    counted::bindTexture(GL_TEXTURE_2D, mFeedbackColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, mFeedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mFeedbackFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mFeedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mFeedbackDepth);
+}
+
+void VirtualTextureCache::renderFeedback(const CommandQueue& commands, const glm::mat4& view, const glm::mat4& projection, int width, int height) {
+    PROFILE_ZONE("VirtualTextureCache::renderFeedback");
+    if(commands.getCommandCount() == 0 || mTextures.empty()) return;
+
+    // Skip a frame rather than wait if every readback's in flight
+    Readback& readback { mReadbacks[mNextReadback] };
+    if(readback.mFence) return;
+    PROFILE_GPU_ZONE("Virtual texture feedback");
+
+    GLint viewport[4] {};
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLint sceneFramebuffer {0};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &sceneFramebuffer);
+    GLboolean blend { glIsEnabled(GL_BLEND) };
+
+    int feedbackWidth { std::max(1, width / mFeedbackDivisor) };
+    int feedbackHeight { std::max(1, height / mFeedbackDivisor) };
+    if(feedbackWidth != mFeedbackWidth || feedbackHeight != mFeedbackHeight)
+        resizeFeedback(feedbackWidth, feedbackHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFeedbackFBO);
+    glViewport(0, 0, mFeedbackWidth, mFeedbackHeight);
+    const GLfloat none[4] {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, none);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    // Blending would mix tile numbers together
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+
+    mFeedbackShader.use();
+    mFeedbackShader.setMat4("view", view);
+    mFeedbackShader.setMat4("projection", projection);
+    mFeedbackShader.setInt("material.texture_diffuse1", 0);
+    // Derivatives are this much larger at the feedback's resolution
+    mFeedbackShader.setFloat("lodBias", -std::log2(static_cast<float>(mFeedbackDivisor)));
+    commands.submit(mFeedbackShader);
+
+    // Read it back into a pixel buffer, to be looked at once the GPU
+    // has got there
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.mPBO);
+    if(readback.mWidth != mFeedbackWidth || readback.mHeight != mFeedbackHeight) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(mFeedbackWidth) * mFeedbackHeight * 4, nullptr, GL_STREAM_READ);
+        readback.mWidth = mFeedbackWidth;
+        readback.mHeight = mFeedbackHeight;
+    }
+    glReadPixels(0, 0, mFeedbackWidth, mFeedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.mFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mNextReadback = (mNextReadback + 1) % mReadbacks.size();
+
+    if(blend) glEnable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void VirtualTextureCache::touch(std::size_t texture, int level, int x, int y) {
+    // Whatever stands in for a tile is as needed as the tile itself,
+    // so its ancestors are kept fresh too
+    const VirtualTexture& virtualTexture { *mTextures[texture] };
+    for(; level < virtualTexture.mLevels; ++level, x /= 2, y /= 2) {
+        TileKey tile { makeKey(texture, level, x, y) };
+        auto resident { mResident.find(tile) };
+        if(resident != mResident.end()) {
+            mPages[resident->second].mLastUsed = mFrame;
+        } else if(mPending.insert(tile).second) mWanted.push_back(tile);
+    }
+}
+
+void VirtualTextureCache::processFeedback(const std::uint8_t* pixels, int width, int height) {
+    PROFILE_ZONE("VirtualTextureCache::processFeedback");
+    std::uint32_t previous {0};
+    for(std::size_t i {0}; i < static_cast<std::size_t>(width) * height; ++i) {
+        std::uint32_t texel {};
+        std::memcpy(&texel, pixels + i * 4, 4);
+        // Neighbouring pixels mostly want the same tile
+        if(texel == previous) continue;
+        previous = texel;
+
+        const std::uint8_t* request { pixels + i * 4 };
+        if(request[3] == 0 || request[3] > mTextures.size()) continue;
+        std::size_t texture { request[3] - 1u };
+        int level { request[2] };
+        int x { request[0] };
+        int y { request[1] };
+        const VirtualTexture& virtualTexture { *mTextures[texture] };
+        if(level >= virtualTexture.mLevels || x >= (virtualTexture.mTiles >> level) || y >= (virtualTexture.mTiles >> level))
+            continue;
+        touch(texture, level, x, y);
+    }
+}
+
+int VirtualTextureCache::allocatePage() {
+    // A free page, or else the one unused for longest that wasn't
+    // needed this frame
+    int oldest {-1};
+    for(std::size_t i {0}; i < mPages.size(); ++i) {
+        const Page& page { mPages[i] };
+        if(!page.mUsed) return static_cast<int>(i);
+        if(page.mPinned || page.mLastUsed >= mFrame) continue;
+        if(oldest < 0 || page.mLastUsed < mPages[oldest].mLastUsed) oldest = static_cast<int>(i);
+    }
+    if(oldest >= 0) {
+        TileKey evicted { mPages[oldest].mTile };
+        mResident.erase(evicted);
+        mTextures[evicted >> 32]->mDirty = true;
+    }
+    return oldest;
+}
+
+void VirtualTextureCache::uploadTile(TileKey tile, const std::vector<std::uint8_t>& pixels, bool pinned) {
+    mPending.erase(tile);
+    if(pixels.size() != TILE_BYTES) return;
+    int index { allocatePage() };
+    if(index < 0) return; // the view needs more than fits; asked for again later
+
+    Page& page { mPages[index] };
+    page = Page { .mTile {tile}, .mUsed {true}, .mPinned {pinned}, .mLastUsed {mFrame} };
+    mResident[tile] = index;
+    mTextures[tile >> 32]->mDirty = true;
+
+    counted::bindTexture(GL_TEXTURE_2D, mAtlas);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, (index % mPagesPerSide) * PAGE_SIZE, (index / mPagesPerSide) * PAGE_SIZE,
+        PAGE_SIZE, PAGE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data()
+    );
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTextureCache::updateIndirection(VirtualTexture& texture, std::size_t index) {
+    PROFILE_ZONE("VirtualTextureCache::updateIndirection");
+    // Coarsest first, so every tile that isn't resident can take its
+    // parent's entry
+    counted::bindTexture(GL_TEXTURE_2D, texture.mIndirection);
+    for(int level { texture.mLevels - 1 }; level >= 0; --level) {
+        int tiles { texture.mTiles >> level };
+        std::vector<std::uint32_t>& entries { texture.mEntries[level] };
+        for(int y {0}; y < tiles; ++y) {
+            for(int x {0}; x < tiles; ++x) {
+                auto resident { mResident.find(makeKey(index, level, x, y)) };
+                std::uint32_t& entry { entries[static_cast<std::size_t>(y) * tiles + x] };
+                if(resident != mResident.end()) {
+                    std::uint32_t page { static_cast<std::uint32_t>(resident->second) };
+                    entry = (page % mPagesPerSide) | (page / mPagesPerSide) << 8
+                        | static_cast<std::uint32_t>(level) << 16 | static_cast<std::uint32_t>(index + 1) << 24;
+                } else if(level + 1 < texture.mLevels) {
+                    entry = texture.mEntries[level + 1][static_cast<std::size_t>(y / 2) * (tiles / 2) + x / 2];
+                } else entry = 0;
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tiles, tiles, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+    }
+    counted::bindTexture(GL_TEXTURE_2D, 0);
+    texture.mDirty = false;
+}
+
+void VirtualTextureCache::update() {
+    PROFILE_ZONE("VirtualTextureCache::update");
+    ++mFrame;
+
+    // Feedback the GPU has finished with
+    for(Readback& readback: mReadbacks) {
+        if(!readback.mFence) continue;
+        GLenum status { glClientWaitSync(readback.mFence, 0, 0) };
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+        glDeleteSync(readback.mFence);
+        readback.mFence = nullptr;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.mPBO);
+        const void* pixels {
+            glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(readback.mWidth) * readback.mHeight * 4, GL_MAP_READ_BIT)
+        };
+        if(pixels) {
+            processFeedback(static_cast<const std::uint8_t*>(pixels), readback.mWidth, readback.mHeight);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Ask for what's missing, coarse levels first since they stand
+    // in for the most. What doesn't fit is asked for again later
+    if(!mWanted.empty()) {
+        std::stable_sort(mWanted.begin(), mWanted.end(), [](TileKey a, TileKey b) {
+            return ((a >> 16) & 0xFF) > ((b >> 16) & 0xFF);
+        });
+        std::size_t inFlight { mPending.size() - mWanted.size() };
+        std::size_t accepted { inFlight < MAX_PENDING? std::min(mWanted.size(), MAX_PENDING - inFlight): 0 };
+        for(std::size_t i {accepted}; i < mWanted.size(); ++i) mPending.erase(mWanted[i]);
+        {
+            std::lock_guard<std::mutex> lock {mMutex};
+            for(std::size_t i {0}; i < accepted; ++i) {
+                TileKey tile { mWanted[i] };
+                mRequests.push_back(Request { .mTile {tile}, .mTexture {mTextures[tile >> 32].get()} });
+            }
+        }
+        mWanted.clear();
+        if(accepted > 0) mLoadReady.notify_one();
+    }
+
+    // A few finished loads a frame, so uploads don't spike
+    {
+        std::lock_guard<std::mutex> lock {mMutex};
+        for(Load& load: mLoads) mUploading.push_back(std::move(load));
+        mLoads.clear();
+    }
+    std::size_t uploads { std::min(mUploading.size(), MAX_UPLOADS_PER_FRAME) };
+    for(std::size_t i {0}; i < uploads; ++i) uploadTile(mUploading[i].mTile, mUploading[i].mPixels, false);
+    mUploading.erase(mUploading.begin(), mUploading.begin() + uploads);
+
+    for(std::size_t i {0}; i < mTextures.size(); ++i) {
+        if(mTextures[i]->mDirty) updateIndirection(*mTextures[i], i);
+    }
+}
+
+void VirtualTextureCache::bind(const Shader& shader) const {
+    glActiveTexture(GL_TEXTURE0 + VIRTUAL_TEXTURE_ATLAS_UNIT);
+    counted::bindTexture(GL_TEXTURE_2D, mAtlas);
+    glActiveTexture(GL_TEXTURE0);
+    shader.setInt("vtAtlas", VIRTUAL_TEXTURE_ATLAS_UNIT);
+    shader.setFloat("vtPagesPerSide", static_cast<float>(mPagesPerSide));
+}
+
+void VirtualTextureCache::loaderLoop() {
+    PROFILE_THREAD_NAME("Tile loader");
+    // Stores stay open for as long as the cache does
+    std::unordered_map<const VirtualTexture*, std::ifstream> stores {};
+    for(;;) {
+        Request request {};
+        {
+            std::unique_lock<std::mutex> lock {mMutex};
+            mLoadReady.wait(lock, [this]{ return mQuit || !mRequests.empty(); });
+            if(mQuit) return;
+            request = mRequests.front();
+            mRequests.pop_front();
+        }
+
+        std::ifstream& store { stores[request.mTexture] };
+        if(!store.is_open()) store.open(request.mTexture->mStorePath, std::ios::binary);
+        Load load { .mTile {request.mTile}, .mPixels {} };
+        int level { static_cast<int>((request.mTile >> 16) & 0xFF) };
+        int y { static_cast<int>((request.mTile >> 8) & 0xFF) };
+        int x { static_cast<int>(request.mTile & 0xFF) };
+        if(!readTile(store, *request.mTexture, level, x, y, load.mPixels)) load.mPixels.clear();
+
+        {
+            std::lock_guard<std::mutex> lock {mMutex};
+            mLoads.push_back(std::move(load));
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef ZOVIRTUALTEXTURE_H
+#define ZOVIRTUALTEXTURE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "commandbuffer.hpp"
+
+// Texture unit the page atlas is bound to
+const GLint VIRTUAL_TEXTURE_ATLAS_UNIT {9};
+
+/*
+Software virtual texturing. A virtual texture is split, mip level by
+mip level, into 128x128 tiles kept in a tile store on disk; only the
+tiles the view actually needs are loaded, into pages of a fixed-size
+atlas, so texture memory stays the same however much texture detail
+the scene has.
+
+Each frame the virtual-textured draws are rendered again into a small
+feedback buffer, recording the tile and mip level every pixel wants.
+That's read back a few frames later without stalling; missing tiles
+are loaded on a background thread and uploaded a few per frame,
+evicting whichever pages have gone unused longest. A texture's
+coarsest tile is always resident, so there's always something to
+draw while finer ones arrive.
+
+Shaders find texels through an indirection texture per virtual
+texture, one texel per tile with a mip level per tile level, which
+names the atlas page holding that tile or its nearest resident
+ancestor. Draws record the indirection texture as their diffuse map
+and are shaded with a shader built with VIRTUAL_TEXTURING defined
+(see bind()). Virtual textures are square and a power of two in size
+*/
+class VirtualTextureCache {
+public:
+    static constexpr int TILE_SIZE {128};
+    // Texels each tile repeats from its neighbours, so bilinear
+    // filtering never reads from the wrong page
+    static constexpr int TILE_BORDER {4};
+    static constexpr int PAGE_SIZE {TILE_SIZE + 2 * TILE_BORDER};
+
+    // Split the image at imagePath into a tile store at storePath,
+    // resampled to a power of two square if it isn't one. Textures
+    // repeat, and tile borders wrap accordingly
+    static bool buildTileStore(const char* imagePath, const std::string& storePath);
+
+    // An atlas of pagesPerSide^2 pages; feedback is rendered at
+    // 1/feedbackDivisor of the window's resolution
+    explicit VirtualTextureCache(int pagesPerSide=16, int feedbackDivisor=8);
+    ~VirtualTextureCache();
+
+    VirtualTextureCache(const VirtualTextureCache& other) = delete;
+    VirtualTextureCache& operator=(const VirtualTextureCache& other) = delete;
+
+    bool getBuildSuccess();
+
+    // Open the tile store at storePath. Returns its indirection
+    // texture, to record as draws' diffuse map, or 0 if it couldn't
+    // be opened
+    GLuint addTexture(const std::string& storePath);
+
+    // Render the tiles commands' draws need into the feedback
+    // buffer. commands must hold virtual-textured draws only
+    void renderFeedback(const CommandQueue& commands, const glm::mat4& view, const glm::mat4& projection, int width, int height);
+
+    // Act on feedback that's finished reading back, and upload tiles
+    // that have finished loading. Once a frame, on the GL thread
+    void update();
+
+    // Bind the atlas for a shader built with VIRTUAL_TEXTURING
+    void bind(const Shader& shader) const;
+
+    std::size_t getPageCount() const { return mPages.size(); }
+    std::size_t getResidentCount() const { return mResident.size(); }
+    std::size_t getPendingCount() const { return mPending.size(); }
+
+private:
+    // Texture, mip level, and tile position packed into one number
+    using TileKey = std::uint64_t;
+    static TileKey makeKey(std::size_t texture, int level, int x, int y);
+
+    struct VirtualTexture {
+        std::string mStorePath;
+        int mTiles;  // along each side, at level 0
+        int mLevels;
+        std::vector<std::size_t> mLevelStarts; // first tile of each level in the store
+        GLuint mIndirection {0};
+        // One texel per tile: atlas page x and y, level mapped, and
+        // this texture's index + 1 (see shaders/vt_feedback.fs)
+        std::vector<std::vector<std::uint32_t>> mEntries;
+        bool mDirty {true};
+    };
+
+    struct Page {
+        TileKey mTile {0};
+        bool mUsed {false};
+        bool mPinned {false};  // a texture's coarsest tile
+        std::uint64_t mLastUsed {0};
+    };
+
+    struct Request {
+        TileKey mTile;
+        const VirtualTexture* mTexture; // never moves once added
+    };
+
+    struct Load {
+        TileKey mTile;
+        std::vector<std::uint8_t> mPixels; // empty if it couldn't be read
+    };
+
+    struct Readback {
+        GLuint mPBO {0};
+        GLsync mFence {nullptr};
+        int mWidth {0};
+        int mHeight {0};
+    };
+
+    static bool readTile(std::ifstream& store, const VirtualTexture& texture, int level, int x, int y, std::vector<std::uint8_t>& pixels);
+
+    void resizeFeedback(int width, int height);
+    void processFeedback(const std::uint8_t* pixels, int width, int height);
+    void touch(std::size_t texture, int level, int x, int y);
+    int allocatePage();
+    void uploadTile(TileKey tile, const std::vector<std::uint8_t>& pixels, bool pinned);
+    void updateIndirection(VirtualTexture& texture, std::size_t index);
+    void loaderLoop();
+
+    Shader mFeedbackShader;
+    int mFeedbackDivisor;
+    int mPagesPerSide;
+    GLuint mAtlas {0};
+    GLuint mFeedbackFBO {0};
+    GLuint mFeedbackColor {0};
+    GLuint mFeedbackDepth {0};
+    int mFeedbackWidth {0};
+    int mFeedbackHeight {0};
+    std::vector<Readback> mReadbacks;
+    std::size_t mNextReadback {0};
+
+    std::vector<std::unique_ptr<VirtualTexture>> mTextures;
+    std::vector<Page> mPages;
+    std::unordered_map<TileKey, int> mResident; // tile -> page
+    std::unordered_set<TileKey> mPending;       // requested, not uploaded
+    std::vector<TileKey> mWanted;               // this feedback's misses
+    std::uint64_t mFrame {0};
+
+    // Shared with the loader thread
+    std::mutex mMutex;
+    std::condition_variable mLoadReady;
+    std::deque<Request> mRequests;
+    std::vector<Load> mLoads;
+    bool mQuit {false};
+    std::thread mLoader;
+
+    std::vector<Load> mUploading; // taken from mLoads, storage kept
+};
+
+#endif